@@ -0,0 +1,17 @@
+<html>
+<head>
+    <title><%= title %></title>
+</head>
+<body>
+    <h1><%= title %></h1>
+    <table>
+    % for _, item in ipairs(items) do
+        <tr>
+            <td><%= item.id %></td>
+            <td><%= item.name %></td>
+            <td><%= item.price %></td>
+        </tr>
+    % end
+    </table>
+</body>
+</html>
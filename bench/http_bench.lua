@@ -0,0 +1,235 @@
+#!/usr/bin/env tarantool
+-- End-to-end benchmark of http.server.
+--
+-- Starts bench/server.lua in a child process (over plain TCP and TLS), loads
+-- each of its routes with bench/loadgen.lua over loopback and prints a JSON
+-- report with RPS, latency percentiles and allocations per request.
+--
+-- Usage: tarantool bench/http_bench.lua [options]
+--
+--   --duration <sec>      measured interval per scenario (default 10)
+--   --warmup <sec>        unmeasured interval per scenario (default 2)
+--   --connections <n>     number of keep-alive connections (default 32)
+--   --scenario <name>     run only the given scenario, may be repeated
+--   --port <port>         port of the benchmarked server (default 18080)
+--   --no-tls              skip the TLS runs
+--   --output <file>       also write the report to the file
+
+local fio = require('fio')
+local fiber = require('fiber')
+local json = require('json')
+local popen = require('popen')
+local socket = require('socket')
+
+local bench_dir = fio.dirname(fio.abspath(arg[0]))
+package.path = fio.pathjoin(bench_dir, '?.lua') .. ';' .. package.path
+
+local loadgen = require('loadgen')
+local version = require('http.version')
+
+local SCENARIOS = {
+    { name = 'hello', path = '/hello' },
+    { name = 'json', path = '/json' },
+    { name = 'template', path = '/template' },
+    { name = 'static', path = '/static.html' },
+    { name = 'chunked', path = '/chunked' },
+}
+
+local function usage(err)
+    io.stderr:write(string.format('%s\nSee the header of %s for usage.\n',
+                                  err, arg[0]))
+    os.exit(1)
+end
+
+local function parse_args()
+    local opts = {
+        duration = 10,
+        warmup = 2,
+        connections = 32,
+        port = 18080,
+        tls = true,
+        scenarios = nil,
+    }
+    local i = 1
+    local function value(name)
+        i = i + 1
+        if arg[i] == nil then
+            usage('Missing value of ' .. name)
+        end
+        return arg[i]
+    end
+    local function number(name)
+        local v = tonumber(value(name))
+        if v == nil or v <= 0 then
+            usage(name .. ' must be a positive number')
+        end
+        return v
+    end
+    while arg[i] ~= nil do
+        local name = arg[i]
+        if name == '--duration' then
+            opts.duration = number(name)
+        elseif name == '--warmup' then
+            opts.warmup = tonumber(value(name)) or usage('Invalid --warmup')
+        elseif name == '--connections' then
+            opts.connections = math.floor(number(name))
+        elseif name == '--port' then
+            opts.port = math.floor(number(name))
+        elseif name == '--scenario' then
+            opts.scenarios = opts.scenarios or {}
+            opts.scenarios[value(name)] = true
+        elseif name == '--no-tls' then
+            opts.tls = false
+        elseif name == '--output' then
+            opts.output = value(name)
+        else
+            usage('Unknown option ' .. name)
+        end
+        i = i + 1
+    end
+    return opts
+end
+
+-- popen does not search PATH, so resolve the interpreter explicitly.
+local function tarantool_executable()
+    local exe = arg[-1]
+    if string.find(exe, '/', 1, true) then
+        return fio.abspath(exe)
+    end
+    for dir in string.gmatch(os.getenv('PATH') or '', '[^:]+') do
+        local path = fio.pathjoin(dir, exe)
+        if fio.path.exists(path) then
+            return path
+        end
+    end
+    return exe
+end
+
+local function start_server(port, tls)
+    local argv = {
+        tarantool_executable(),
+        fio.pathjoin(bench_dir, 'server.lua'),
+        tostring(port),
+    }
+    if tls then
+        table.insert(argv, 'tls')
+    end
+    local ph, err = popen.new(argv, {
+        stdin = popen.opts.DEVNULL,
+        stdout = popen.opts.DEVNULL,
+        stderr = popen.opts.INHERIT,
+        group_signal = true,
+    })
+    if ph == nil then
+        error('Failed to start the server: ' .. tostring(err))
+    end
+
+    for _ = 1, 500 do
+        local sock = socket.tcp_connect('127.0.0.1', port, 0.1)
+        if sock ~= nil then
+            sock:close()
+            return ph
+        end
+        if ph:info().status.state ~= popen.state.ALIVE then
+            break
+        end
+        fiber.sleep(0.01)
+    end
+    ph:close()
+    error('The server did not start listening on port ' .. port)
+end
+
+local function stop_server(ph)
+    pcall(ph.kill, ph)
+    pcall(ph.wait, ph)
+    ph:close()
+end
+
+local function server_stats(target)
+    local status, body = loadgen.fetch(target, '/__bench/stats')
+    if status ~= 200 then
+        return nil
+    end
+    return json.decode(body)
+end
+
+local function run_scenario(target, scenario, opts)
+    local before, after
+    local result = loadgen.run(target, scenario.path, opts, function(what)
+        if what == 'start' then
+            before = server_stats(target)
+        else
+            after = server_stats(target)
+        end
+    end)
+
+    result.scenario = scenario.name
+    result.tls = target.tls_ctx ~= nil
+    result.connections = opts.connections
+    -- The stats requests themselves are not excluded, they are negligible
+    -- compared to the number of measured requests.
+    if result.requests > 0 and before ~= nil and after ~= nil and
+       before.gc_allocated ~= nil and after.gc_allocated ~= nil then
+        result.alloc_bytes_per_request =
+            (after.gc_allocated - before.gc_allocated) / result.requests
+    else
+        result.alloc_bytes_per_request = json.NULL
+    end
+    return result
+end
+
+local function run_transport(tls, opts, results)
+    local target = { host = '127.0.0.1', port = opts.port }
+    if tls then
+        local ctx, err = loadgen.new_tls_ctx()
+        if ctx == nil then
+            io.stderr:write('Skipping TLS runs: ' .. tostring(err) .. '\n')
+            return
+        end
+        target.tls_ctx = ctx
+    end
+
+    local ph = start_server(opts.port, tls)
+    local ok, err = pcall(function()
+        for _, scenario in ipairs(SCENARIOS) do
+            if opts.scenarios == nil or opts.scenarios[scenario.name] then
+                local result = run_scenario(target, scenario, opts)
+                io.stderr:write(string.format(
+                    '%-8s %-4s %10.0f rps  p50 %.3f ms  p99 %.3f ms\n',
+                    scenario.name, tls and 'tls' or 'tcp', result.rps,
+                    result.latency_ms.p50 or 0, result.latency_ms.p99 or 0))
+                table.insert(results, result)
+            end
+        end
+    end)
+    stop_server(ph)
+    if not ok then
+        error(err, 0)
+    end
+end
+
+local opts = parse_args()
+local results = {}
+
+run_transport(false, opts, results)
+if opts.tls then
+    run_transport(true, opts, results)
+end
+
+local report = json.encode({
+    tarantool = _TARANTOOL,
+    http = version,
+    duration = opts.duration,
+    warmup = opts.warmup,
+    results = results,
+})
+print(report)
+
+if opts.output ~= nil then
+    local fh = assert(fio.open(opts.output, { 'O_WRONLY', 'O_CREAT', 'O_TRUNC' },
+                               tonumber('644', 8)))
+    fh:write(report .. '\n')
+    fh:close()
+end
+
+os.exit(0)
@@ -0,0 +1,239 @@
+-- Keep-alive HTTP/1.1 load generator for bench/http_bench.lua.
+--
+-- Every connection is served by its own fiber that sends a request, reads
+-- the whole response and immediately sends the next one, so the number of
+-- connections is the concurrency level.
+
+local clock = require('clock')
+local fiber = require('fiber')
+local socket = require('socket')
+local lib = require('http.lib')
+
+local sslsocket_supported, sslsocket = pcall(require, 'http.sslsocket')
+
+local IO_TIMEOUT = 10
+
+local function new_tls_ctx()
+    if not sslsocket_supported then
+        return nil, 'ssl socket is not supported'
+    end
+    local ok, ctx = pcall(sslsocket.ctx, sslsocket.tls_client_method())
+    if not ok then
+        return nil, ctx
+    end
+    return ctx
+end
+
+local function connect(target)
+    local sock, err = socket.tcp_connect(target.host, target.port, IO_TIMEOUT)
+    if sock == nil then
+        return nil, err
+    end
+    pcall(sock.setsockopt, sock, 'SOL_TCP', 'TCP_NODELAY', true)
+    if target.tls_ctx ~= nil then
+        return sslsocket.wrap_connected_socket(sock, target.tls_ctx)
+    end
+    return sock
+end
+
+-- Reads a response with a Content-Length or chunked body. Returns the status,
+-- the response headers and, if `keep_body` is set, the body.
+local function read_response(conn, keep_body)
+    local head = conn:read({ delimiter = '\r\n\r\n' }, IO_TIMEOUT)
+    if head == nil or head == '' then
+        return nil, 'connection closed'
+    end
+    local resp = lib.parse_response(head)
+    if resp.error ~= nil then
+        return nil, resp.error
+    end
+
+    local body = {}
+    local len = tonumber(resp.headers['content-length'])
+    if len ~= nil then
+        if len > 0 then
+            local data = conn:read(len, IO_TIMEOUT)
+            if data == nil or #data < len then
+                return nil, 'unexpected end of body'
+            end
+            table.insert(body, data)
+        end
+    elseif resp.headers['transfer-encoding'] == 'chunked' then
+        while true do
+            local line = conn:read({ delimiter = '\r\n' }, IO_TIMEOUT)
+            local size = line and tonumber(string.match(line, '^%x+'), 16)
+            if size == nil then
+                return nil, 'invalid chunk'
+            end
+            local data = conn:read(size + 2, IO_TIMEOUT)
+            if data == nil or #data < size + 2 then
+                return nil, 'unexpected end of chunk'
+            end
+            if size == 0 then
+                break
+            end
+            table.insert(body, string.sub(data, 1, size))
+        end
+    end
+
+    if keep_body then
+        return resp.status, resp.headers, table.concat(body)
+    end
+    return resp.status, resp.headers
+end
+
+local function request_string(target, path)
+    return string.format('GET %s HTTP/1.1\r\nHost: %s:%d\r\n' ..
+                         'Connection: keep-alive\r\n\r\n',
+                         path, target.host, target.port)
+end
+
+-- Performs a single request over a new connection, used to query the server
+-- between measurements.
+local function fetch(target, path)
+    local conn, err = connect(target)
+    if conn == nil then
+        return nil, err
+    end
+    local ok = conn:write(request_string(target, path))
+    if not ok then
+        conn:close()
+        return nil, 'write failed'
+    end
+    local status, headers, body = read_response(conn, true)
+    conn:close()
+    if status == nil then
+        return nil, headers
+    end
+    return status, body
+end
+
+local function worker(target, request, state)
+    local conn
+    while not state.stopped do
+        if conn == nil then
+            local err
+            conn, err = connect(target)
+            if conn == nil then
+                state.errors = state.errors + 1
+                state.last_error = tostring(err)
+                fiber.sleep(0.01)
+            else
+                state.connects = state.connects + 1
+            end
+        end
+
+        if conn ~= nil then
+            local started = clock.monotonic()
+            local status, headers
+            if conn:write(request) then
+                status, headers = read_response(conn, false)
+            else
+                headers = 'write failed'
+            end
+            local latency = clock.monotonic() - started
+
+            if status == nil then
+                state.errors = state.errors + 1
+                state.last_error = tostring(headers)
+                conn:close()
+                conn = nil
+            else
+                if state.measuring then
+                    if status == 200 then
+                        state.requests = state.requests + 1
+                        state.latencies[state.requests] = latency
+                    else
+                        state.errors = state.errors + 1
+                        state.last_error = 'status ' .. status
+                    end
+                end
+                if headers.connection == 'close' then
+                    conn:close()
+                    conn = nil
+                end
+            end
+        end
+    end
+    if conn ~= nil then
+        conn:close()
+    end
+    state.finished = state.finished + 1
+end
+
+local function percentile(sorted, q)
+    local n = #sorted
+    if n == 0 then
+        return nil
+    end
+    return sorted[math.max(1, math.ceil(q * n))]
+end
+
+-- Runs `connections` keep-alive clients requesting `path` for `warmup`
+-- seconds without measuring and then for `duration` seconds with measuring.
+-- `on_measure` is called right before and right after the measured interval.
+local function run(target, path, opts, on_measure)
+    local state = {
+        stopped = false,
+        measuring = false,
+        requests = 0,
+        errors = 0,
+        connects = 0,
+        finished = 0,
+        latencies = {},
+    }
+    local request = request_string(target, path)
+
+    for _ = 1, opts.connections do
+        fiber.create(worker, target, request, state)
+    end
+
+    fiber.sleep(opts.warmup)
+    state.errors = 0
+    on_measure('start')
+    local started = clock.monotonic()
+    state.measuring = true
+    fiber.sleep(opts.duration)
+    state.measuring = false
+    local elapsed = clock.monotonic() - started
+    local errors = state.errors
+    on_measure('stop')
+
+    state.stopped = true
+    while state.finished < opts.connections do
+        fiber.sleep(0.01)
+    end
+
+    local latencies = state.latencies
+    table.sort(latencies)
+    local sum = 0
+    for _, v in ipairs(latencies) do
+        sum = sum + v
+    end
+
+    local function ms(v)
+        return v and v * 1000
+    end
+
+    return {
+        requests = state.requests,
+        errors = errors,
+        last_error = state.last_error,
+        connects = state.connects,
+        elapsed = elapsed,
+        rps = state.requests / elapsed,
+        latency_ms = {
+            mean = state.requests > 0 and ms(sum / state.requests) or nil,
+            p50 = ms(percentile(latencies, 0.5)),
+            p99 = ms(percentile(latencies, 0.99)),
+            p999 = ms(percentile(latencies, 0.999)),
+            max = ms(latencies[#latencies]),
+        },
+    }
+end
+
+return {
+    new_tls_ctx = new_tls_ctx,
+    fetch = fetch,
+    run = run,
+}
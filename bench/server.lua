@@ -0,0 +1,73 @@
+#!/usr/bin/env tarantool
+-- HTTP server used by bench/http_bench.lua. It is started in a separate
+-- process so the load generator does not share the TX thread with it.
+--
+-- Usage: tarantool bench/server.lua <port> [tls]
+
+local fio = require('fio')
+local fiber = require('fiber')
+local http_server = require('http.server')
+
+local port = tonumber(arg[1])
+local use_tls = arg[2] == 'tls'
+
+local bench_dir = fio.dirname(fio.abspath(arg[0]))
+local ssl_data_dir = fio.pathjoin(fio.dirname(bench_dir), 'test', 'ssl_data')
+
+local misc_supported, misc = pcall(require, 'misc')
+
+local options = {
+    app_dir = fio.pathjoin(bench_dir, 'app'),
+    log_requests = false,
+    log_errors = true,
+}
+if use_tls then
+    options.ssl_cert_file = fio.pathjoin(ssl_data_dir, 'server.crt')
+    options.ssl_key_file = fio.pathjoin(ssl_data_dir, 'server.key')
+end
+
+local ITEMS = {}
+for i = 1, 20 do
+    ITEMS[i] = { id = i, name = 'item #' .. i, price = i * 1.5, tags = { 'a', 'b' } }
+end
+
+local CHUNKS = {}
+for i = 1, 16 do
+    CHUNKS[i] = string.rep(string.char(string.byte('a') + i % 26), 256)
+end
+
+local httpd = http_server.new('127.0.0.1', port, options)
+
+httpd:route({ path = '/hello', method = 'GET' }, function(req)
+    return req:render({ text = 'Hello, world!' })
+end)
+
+httpd:route({ path = '/json', method = 'GET' }, function(req)
+    return req:render({ json = { items = ITEMS, total = #ITEMS } })
+end)
+
+httpd:route({ path = '/template', method = 'GET', file = 'page.html.el' }, function(req)
+    return req:render({ title = 'Benchmark', items = ITEMS })
+end)
+
+httpd:route({ path = '/chunked', method = 'GET' }, function(req)
+    return req:iterate(ipairs(CHUNKS))
+end)
+
+-- Allocation counters of this process, requested by the load generator
+-- before and after each measurement.
+httpd:route({ path = '/__bench/stats', method = 'GET' }, function(req)
+    local stats = { gc_count_kb = collectgarbage('count') }
+    if misc_supported then
+        local metrics = misc.getmetrics()
+        stats.gc_allocated = metrics.gc_allocated
+        stats.gc_freed = metrics.gc_freed
+    end
+    return req:render({ json = stats })
+end)
+
+httpd:start()
+
+while true do
+    fiber.sleep(3600)
+end
@@ -23,6 +23,11 @@ if(TARANTOOL_INCLUDE_DIR)
     unset(_config)
 endif()
 
+find_program(TARANTOOL_EXECUTABLE tarantool
+  HINTS ${TARANTOOL_DIR} ENV TARANTOOL_DIR
+  PATH_SUFFIXES bin
+)
+
 include(FindPackageHandleStandardArgs)
 find_package_handle_standard_args(Tarantool
     REQUIRED_VARS TARANTOOL_INCLUDE_DIR VERSION_VAR TARANTOOL_VERSION)
@@ -42,4 +47,4 @@ if(TARANTOOL_FOUND)
     endif ()
 endif()
 mark_as_advanced(TARANTOOL_INCLUDE_DIRS TARANTOOL_INSTALL_LIBDIR
-    TARANTOOL_INSTALL_LUADIR)
+    TARANTOOL_INSTALL_LUADIR TARANTOOL_EXECUTABLE)
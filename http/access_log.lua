@@ -0,0 +1,357 @@
+-- http.access_log
+--
+-- Asynchronous access log. Served requests are recorded into a fixed-size
+-- ring of structured records without formatting; a background fiber takes
+-- them in batches, formats them and appends the batch to a file with one
+-- write or inserts it into a space in one transaction. When the ring is
+-- full, new records are dropped and counted instead of slowing down
+-- requests.
+
+local fiber = require('fiber')
+local fio = require('fio')
+local json = require('json')
+local log = require('log')
+local table_new = require('table.new')
+
+local DEFAULT_OPTIONS = {
+    buffer_size = 16384,
+    flush_interval = 1,
+    sample = 1,
+}
+
+local FORMATS = {
+    common = true,
+    json = true,
+}
+
+-- Fields of the ring, one array per field.
+local FIELDS = {
+    'time', 'method', 'path', 'query', 'proto', 'status', 'bytes_in',
+    'bytes_out', 'duration', 'peer', 'timing',
+}
+
+local function errorf(fmt, ...)
+    error(string.format(fmt, ...))
+end
+
+-- Checks the `access_log` server option and returns a normalized table or
+-- nil if the access log is disabled.
+local function parse_options(opts)
+    if opts == nil or opts == false then
+        return nil
+    end
+    if type(opts) ~= 'table' then
+        error('Option access_log must be a table.')
+    end
+    for k in pairs(opts) do
+        if k ~= 'file' and k ~= 'space' and k ~= 'format' and
+           DEFAULT_OPTIONS[k] == nil then
+            errorf("Unknown access_log option '%s'", k)
+        end
+    end
+    if (opts.file == nil) == (opts.space == nil) then
+        error('access_log must have either a file or a space')
+    end
+    if opts.file ~= nil and type(opts.file) ~= 'string' then
+        error('access_log.file must be a string')
+    end
+    if opts.space ~= nil and type(opts.space) ~= 'string' and
+       type(opts.space) ~= 'table' then
+        error('access_log.space must be a space or its name')
+    end
+    local format = opts.format
+    if opts.file ~= nil then
+        format = format or 'common'
+        if type(format) ~= 'function' and not FORMATS[format] then
+            error("access_log.format must be 'common', 'json' or a function")
+        end
+    elseif format ~= nil and type(format) ~= 'function' then
+        error('access_log.format must be a function')
+    end
+    if opts.buffer_size ~= nil and
+       (type(opts.buffer_size) ~= 'number' or opts.buffer_size < 1 or
+        opts.buffer_size ~= math.floor(opts.buffer_size)) then
+        error('access_log.buffer_size must be a positive integer')
+    end
+    if opts.flush_interval ~= nil and
+       (type(opts.flush_interval) ~= 'number' or opts.flush_interval <= 0) then
+        error('access_log.flush_interval must be a positive number')
+    end
+    if opts.sample ~= nil and
+       (type(opts.sample) ~= 'number' or opts.sample < 0 or opts.sample > 1) then
+        error('access_log.sample must be a number between 0 and 1')
+    end
+    return {
+        file = opts.file,
+        space = opts.space,
+        format = format,
+        buffer_size = opts.buffer_size or DEFAULT_OPTIONS.buffer_size,
+        flush_interval = opts.flush_interval or DEFAULT_OPTIONS.flush_interval,
+        sample = opts.sample or DEFAULT_OPTIONS.sample,
+    }
+end
+
+local clf_time = { second = nil, str = nil }
+
+-- Formats a time as in the Common Log Format, once per second.
+local function format_clf_time(time)
+    local second = math.floor(time)
+    if clf_time.second ~= second then
+        clf_time.second = second
+        clf_time.str = os.date('!%d/%b/%Y:%H:%M:%S +0000', second)
+    end
+    return clf_time.str
+end
+
+local function format_common(r)
+    return string.format('%s - - [%s] "%s %s%s HTTP/%d.%d" %d %d %.6f\n',
+        r.peer or '-', format_clf_time(r.time), r.method, r.path,
+        r.query ~= '' and '?' .. r.query or '', r.proto[1], r.proto[2],
+        r.status, r.bytes_out, r.duration)
+end
+
+local function format_json(r)
+    return json.encode(r) .. '\n'
+end
+
+-- The default tuple of a record in a space: the record number, which is
+-- the primary key, followed by the fields of the record.
+local function record_tuple(r)
+    return {
+        r.id, r.time, r.method, r.path, r.query, r.status, r.bytes_in,
+        r.bytes_out, r.duration, r.peer,
+    }
+end
+
+local log_methods = {}
+
+-- Records a served request. Runs in the request fiber and does not yield.
+function log_methods.record(self, p, status, bytes_in, bytes_out, duration,
+                            timing)
+    local sample = self.opts.sample
+    if sample < 1 and status < 500 and math.random() >= sample then
+        self.sampled_out = self.sampled_out + 1
+        return
+    end
+    if self.count == self.size then
+        self.dropped = self.dropped + 1
+        return
+    end
+    local i = self.tail
+    local ring = self.ring
+    ring.time[i] = fiber.time()
+    ring.method[i] = p.method
+    ring.path[i] = p.path
+    ring.query[i] = p.query
+    ring.proto[i] = p.proto
+    ring.status[i] = status
+    ring.bytes_in[i] = bytes_in
+    ring.bytes_out[i] = bytes_out
+    ring.duration[i] = duration
+    ring.peer[i] = p.peer ~= nil and p.peer.host or nil
+    ring.timing[i] = timing
+    self.tail = i % self.size + 1
+    self.count = self.count + 1
+    -- Do not wait for the interval when the ring is half full.
+    if self.count * 2 == self.size then
+        self.cond:signal()
+    end
+end
+
+-- Moves the recorded requests out of the ring and formats them. Returns
+-- an array of lines or tuples and its length.
+local function take_batch(self)
+    local ring = self.ring
+    local batch = self.batch
+    local r = self.current
+    local n = 0
+    local i = self.head
+    for _ = 1, self.count do
+        for _, field in ipairs(FIELDS) do
+            r[field] = ring[field][i]
+            ring[field][i] = nil
+        end
+        if self.opts.space ~= nil then
+            self.id = self.id + 1
+            r.id = self.id
+        end
+        local ok, res = pcall(self.format, r)
+        if ok then
+            n = n + 1
+            batch[n] = res
+        else
+            self.failed = self.failed + 1
+            log.error('access_log: failed to format a record: %s', res)
+        end
+        i = i % self.size + 1
+    end
+    for k = n + 1, #batch do
+        batch[k] = nil
+    end
+    self.head = i
+    self.count = 0
+    return batch, n
+end
+
+local function open_file(self)
+    local fh, err = fio.open(self.opts.file, { 'O_WRONLY', 'O_CREAT', 'O_APPEND' },
+        tonumber('644', 8))
+    if fh == nil then
+        return nil, err
+    end
+    self.fh = fh
+    return fh
+end
+
+local function write_file(self, batch, n)
+    local fh = self.fh
+    if fh == nil then
+        local err
+        fh, err = open_file(self)
+        if fh == nil then
+            return nil, err
+        end
+    end
+    return fh:write(table.concat(batch, '', 1, n))
+end
+
+local function resolve_space(self)
+    local space = self.opts.space
+    if type(space) == 'string' then
+        space = box.space[space]
+        if space == nil then
+            return nil, string.format("space '%s' does not exist", self.opts.space)
+        end
+    end
+    return space
+end
+
+local function insert_space(self, batch, n)
+    local space, err = resolve_space(self)
+    if space == nil then
+        return nil, err
+    end
+    return pcall(box.atomic, function()
+        for k = 1, n do
+            space:insert(batch[k])
+        end
+    end)
+end
+
+-- Writes the recorded requests. Returns the number of written records.
+function log_methods.flush(self)
+    if self.count == 0 then
+        return 0
+    end
+    local batch, n = take_batch(self)
+    if n == 0 then
+        return 0
+    end
+    local ok, err
+    if self.opts.file ~= nil then
+        ok, err = write_file(self, batch, n)
+    else
+        ok, err = insert_space(self, batch, n)
+    end
+    if not ok then
+        self.failed = self.failed + n
+        log.error('access_log: failed to write %d records: %s', n, tostring(err))
+        return 0
+    end
+    self.written = self.written + n
+    return n
+end
+
+-- Makes the next flush reopen the file, e.g. after it was rotated.
+function log_methods.reopen(self)
+    if self.fh ~= nil then
+        self.fh:close()
+        self.fh = nil
+    end
+end
+
+-- Flushes the log every interval until `worker` is stopped.
+local function flush_loop(self, worker)
+    while not worker.stopped do
+        self.cond:wait(self.opts.flush_interval)
+        self:flush()
+    end
+end
+
+function log_methods.start(self)
+    if self.worker ~= nil then
+        return
+    end
+    if self.opts.space ~= nil and self.id == 0 then
+        -- Continue the numbering of the records already in the space.
+        local space = resolve_space(self)
+        local last = space ~= nil and space.index[0]:max() or nil
+        self.id = last ~= nil and last[1] or 0
+    end
+    self.worker = { stopped = false }
+    local f = fiber.new(flush_loop, self, self.worker)
+    f:name('http.access_log', { truncate = true })
+end
+
+-- Stops the background fiber and writes the remaining records.
+function log_methods.stop(self)
+    if self.worker == nil then
+        return
+    end
+    self.worker.stopped = true
+    self.worker = nil
+    self.cond:signal()
+    self:flush()
+    self:reopen()
+end
+
+function log_methods.stats(self)
+    return {
+        buffered = self.count,
+        written = self.written,
+        dropped = self.dropped,
+        failed = self.failed,
+        sampled_out = self.sampled_out,
+    }
+end
+
+local log_mt = { __index = log_methods }
+
+-- Returns an access log given the options normalized by parse_options().
+local function new(opts)
+    local format = opts.format
+    if format == 'common' then
+        format = format_common
+    elseif format == 'json' then
+        format = format_json
+    elseif format == nil then
+        format = record_tuple
+    end
+    local ring = {}
+    for _, field in ipairs(FIELDS) do
+        ring[field] = table_new(opts.buffer_size, 0)
+    end
+    return setmetatable({
+        opts = opts,
+        format = format,
+        size = opts.buffer_size,
+        ring = ring,
+        head = 1,
+        tail = 1,
+        count = 0,
+        id = 0,
+        batch = {},
+        current = {},
+        cond = fiber.cond(),
+        written = 0,
+        dropped = 0,
+        failed = 0,
+        sampled_out = 0,
+    }, log_mt)
+end
+
+return {
+    new = new,
+    parse_options = parse_options,
+    DEFAULT_OPTIONS = DEFAULT_OPTIONS,
+}
@@ -0,0 +1,140 @@
+-- http.buffer_pool
+--
+-- Read buffers of the connections. A connection takes a buffer when data
+-- arrives and gives it back when it becomes idle, so idle keep-alive
+-- connections hold no buffer memory. Free buffers are kept in size classes
+-- by their capacity. A buffer grown above the largest class, e.g. by
+-- a large upload, or one that does not fit in the byte budget of the pool
+-- has its memory freed when it is given back.
+
+local buffer = require('buffer')
+
+local DEFAULT_OPTIONS = {
+    -- Capacities of the size classes, the last one is the high-water mark.
+    classes = { 16384, 65536, 262144 },
+    -- Memory of the free buffers.
+    max_bytes = 16 * 1024 * 1024,
+    -- Free buffers, including the ones without memory.
+    max_buffers = 4096,
+}
+
+local pool_methods = {}
+
+-- Returns the index of the smallest class a buffer of `capacity` bytes
+-- fits in or nil if it is above the high-water mark.
+local function class_of(self, capacity)
+    for i, size in ipairs(self.classes) do
+        if capacity <= size then
+            return i
+        end
+    end
+    return nil
+end
+
+-- Returns a free buffer, the smallest one with memory if there is any.
+function pool_methods.take(self)
+    for i = 1, #self.free do
+        local list = self.free[i]
+        local n = #list
+        if n > 0 then
+            local buf = list[n]
+            list[n] = nil
+            self.free_count = self.free_count - 1
+            self.free_bytes = self.free_bytes - buf:capacity()
+            self.taken = self.taken + 1
+            return buf
+        end
+    end
+    self.created = self.created + 1
+    self.taken = self.taken + 1
+    return buffer.ibuf()
+end
+
+-- Gives back an empty buffer.
+function pool_methods.put(self, buf)
+    self.returned = self.returned + 1
+    buf:reset()
+    local capacity = buf:capacity()
+    local class = capacity > 0 and class_of(self, capacity) or nil
+    if capacity > 0 and
+       (class == nil or self.free_bytes + capacity > self.max_bytes) then
+        buf:recycle()
+        self.shrunk = self.shrunk + 1
+        capacity = 0
+    end
+    if self.free_count >= self.max_buffers then
+        return
+    end
+    -- Buffers without memory are kept in the last list and taken last.
+    local list = self.free[capacity > 0 and class or #self.free]
+    list[#list + 1] = buf
+    self.free_count = self.free_count + 1
+    self.free_bytes = self.free_bytes + capacity
+end
+
+-- Gives a buffer to a socket which has none. Works with the sockets that
+-- keep the read-ahead data in `rbuf`, like the sockets of Tarantool and
+-- http.sslsocket.
+function pool_methods.attach(self, s)
+    if s.rbuf == nil then
+        s.rbuf = self:take()
+    end
+end
+
+-- Takes the buffer of an idle socket back if it has no unread data.
+function pool_methods.detach(self, s)
+    local rbuf = s.rbuf
+    if rbuf ~= nil and rbuf:size() == 0 then
+        s.rbuf = nil
+        self:put(rbuf)
+    end
+end
+
+function pool_methods.stats(self)
+    local classes = {}
+    for i, size in ipairs(self.classes) do
+        classes[i] = { size = size, free = #self.free[i] }
+    end
+    return {
+        taken = self.taken,
+        returned = self.returned,
+        free = self.free_count,
+        free_bytes = self.free_bytes,
+        created = self.created,
+        shrunk = self.shrunk,
+        classes = classes,
+        -- Buffers without memory.
+        empty = #self.free[#self.free],
+    }
+end
+
+local pool_mt = { __index = pool_methods }
+
+local function new(opts)
+    opts = opts or {}
+    local classes = opts.classes or DEFAULT_OPTIONS.classes
+    local free = {}
+    -- One more list for the buffers without memory.
+    for i = 1, #classes + 1 do
+        free[i] = {}
+    end
+    return setmetatable({
+        classes = classes,
+        max_bytes = opts.max_bytes or DEFAULT_OPTIONS.max_bytes,
+        max_buffers = opts.max_buffers or DEFAULT_OPTIONS.max_buffers,
+        free = free,
+        free_count = 0,
+        free_bytes = 0,
+        taken = 0,
+        returned = 0,
+        created = 0,
+        shrunk = 0,
+    }, pool_mt)
+end
+
+return {
+    new = new,
+    -- The pool of the connections of all the servers.
+    shared = new(),
+    DEFAULT_OPTIONS = DEFAULT_OPTIONS,
+}
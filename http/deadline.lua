@@ -0,0 +1,147 @@
+-- http.deadline
+--
+-- Request deadlines. A request with a deadline has its handler called in
+-- a fiber of its own, while the fiber of the connection waits for it.
+-- The handler fiber is cancelled when the deadline passes, the client
+-- gets `504 Gateway Timeout`, or when the client closes the connection.
+-- A cancelled fiber stops at its next yield, e.g. a socket or a box call.
+-- The timeout is set for the server or a route and may be shortened by
+-- the client with a request header.
+
+local clock = require('clock')
+local fiber = require('fiber')
+
+local DEFAULT_OPTIONS = {
+    -- Seconds between the checks that the client is still connected.
+    check_interval = 1,
+}
+
+local function errorf(fmt, ...)
+    error(string.format(fmt, ...))
+end
+
+-- Checks the `deadline` option of the server or, if `is_route` is set,
+-- of a route and returns a normalized table or nil if there is no
+-- deadline.
+local function parse_options(opts, is_route)
+    if opts == nil or opts == false then
+        return nil
+    end
+    if type(opts) ~= 'table' then
+        if is_route then
+            error("'deadline' option should be a table")
+        end
+        error('Option deadline must be a table.')
+    end
+    for k in pairs(opts) do
+        if k ~= 'timeout' and (is_route or
+                               (k ~= 'header' and DEFAULT_OPTIONS[k] == nil)) then
+            errorf("Unknown deadline option '%s'", k)
+        end
+    end
+    if opts.timeout ~= nil and
+       (type(opts.timeout) ~= 'number' or not (opts.timeout > 0)) then
+        error('deadline.timeout must be a positive number')
+    end
+    if is_route then
+        if opts.timeout == nil then
+            error('deadline.timeout must be a positive number')
+        end
+        return { timeout = opts.timeout }
+    end
+    if opts.header ~= nil and
+       (type(opts.header) ~= 'string' or opts.header == '') then
+        error('deadline.header must be a non-empty string')
+    end
+    if opts.timeout == nil and opts.header == nil then
+        error('deadline.timeout or deadline.header must be set')
+    end
+    if opts.check_interval ~= nil and
+       (type(opts.check_interval) ~= 'number' or
+        not (opts.check_interval > 0)) then
+        error('deadline.check_interval must be a positive number')
+    end
+    return {
+        timeout = opts.timeout,
+        header = opts.header ~= nil and string.lower(opts.header) or nil,
+        check_interval = opts.check_interval or DEFAULT_OPTIONS.check_interval,
+    }
+end
+
+-- Returns the timeout of a request in seconds or nil. The server options
+-- `opts` and the route options `route_opts` are normalized by
+-- parse_options(), `route_opts` is false if the route has no deadline.
+-- The header may only shorten the timeout.
+local function request_timeout(opts, route_opts, headers)
+    if route_opts == false then
+        return nil
+    end
+    local timeout = route_opts and route_opts.timeout or opts and opts.timeout
+    if opts ~= nil and opts.header ~= nil then
+        local requested = tonumber(headers[opts.header])
+        if requested ~= nil and requested > 0 and
+           (timeout == nil or requested < timeout) then
+            timeout = requested
+        end
+    end
+    return timeout
+end
+
+-- Returns true if the peer has closed the connection of socket `s`. Only
+-- the sockets which can peek the received data are checked.
+local function peer_closed(s)
+    if s.recv == nil or s.readable == nil or not s:readable(0) then
+        return false
+    end
+    return s:recv(1, { 'MSG_PEEK', 'MSG_DONTWAIT' }) == ''
+end
+
+local function finish(state, ...)
+    state.n = select('#', ...)
+    state.results = { ... }
+    state.done = true
+    state.cond:signal()
+end
+
+local function run(state, f, ...)
+    finish(state, pcall(f, ...))
+end
+
+-- Calls `f(...)` in a new fiber and waits for it until `deadline`,
+-- a clock.monotonic() time, checking every `interval` seconds that
+-- the peer of socket `s` is connected. Returns true and the results of
+-- `f` or, after cancelling the fiber, false and 'timeout' or 'disconnect'.
+local function call(deadline, interval, s, f, ...)
+    local state = { done = false, cond = fiber.cond() }
+    local worker = fiber.new(run, state, f, ...)
+    worker:name('http.handler', { truncate = true })
+    local reason
+    while not state.done do
+        local left = deadline - clock.monotonic()
+        if left <= 0 then
+            reason = 'timeout'
+            break
+        end
+        state.cond:wait(math.min(left, interval))
+        if not state.done and peer_closed(s) then
+            reason = 'disconnect'
+            break
+        end
+    end
+    if reason ~= nil then
+        worker:cancel()
+        return false, reason
+    end
+    local results = state.results
+    if not results[1] then
+        error(results[2], 0)
+    end
+    return true, unpack(results, 2, state.n)
+end
+
+return {
+    parse_options = parse_options,
+    request_timeout = request_timeout,
+    call = call,
+    DEFAULT_OPTIONS = DEFAULT_OPTIONS,
+}
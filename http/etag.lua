@@ -0,0 +1,81 @@
+-- http.etag
+--
+-- Conditional GET for routes with the `etag` option. A successful response
+-- gets a weak ETag, the hash of its body computed in C or the hash of
+-- the value returned by the route validator, and a request whose
+-- If-None-Match lists it is answered with 304 Not Modified and no body.
+-- The validator is called before the handler, so a matching request does
+-- not generate the body at all.
+
+local lib = require('http.lib')
+local log = require('log')
+
+local function errorf(fmt, ...)
+    error(string.format(fmt, ...))
+end
+
+-- Checks the `etag` option of a route and returns a normalized table.
+local function parse_route_options(opts)
+    if opts == true then
+        opts = {}
+    end
+    if type(opts) ~= 'table' then
+        error("'etag' option should be a boolean or a table")
+    end
+    for k in pairs(opts) do
+        if k ~= 'validator' then
+            errorf("Unknown etag option '%s'", k)
+        end
+    end
+    if opts.validator ~= nil and type(opts.validator) ~= 'function' then
+        error('etag.validator must be a function')
+    end
+    return {
+        validator = opts.validator,
+    }
+end
+
+-- Returns the ETag of a request given by the route validator or nil.
+local function validate(opts, req)
+    if opts.validator == nil then
+        return nil
+    end
+    local ok, value = pcall(opts.validator, req)
+    if not ok then
+        log.error('etag: validator failed: %s', value)
+        return nil
+    end
+    if value == nil then
+        return nil
+    end
+    return lib.etag(tostring(value))
+end
+
+-- Returns true if the If-None-Match header `header` lists `tag`. The tags
+-- are compared weakly, ignoring the W/ prefix.
+local function none_match(header, tag)
+    if header == nil then
+        return false
+    end
+    if string.sub(tag, 1, 2) == 'W/' then
+        tag = string.sub(tag, 3)
+    end
+    -- Most clients send back exactly the tag they have got.
+    if header == tag or header == 'W/' .. tag then
+        return true
+    end
+    for item in string.gmatch(header, '[^,]+') do
+        item = string.match(item, '^%s*(.-)%s*$')
+        if item == '*' or item == tag or item == 'W/' .. tag then
+            return true
+        end
+    end
+    return false
+end
+
+return {
+    parse_route_options = parse_route_options,
+    validate = validate,
+    none_match = none_match,
+    of = lib.etag,
+}
@@ -0,0 +1,164 @@
+-- http.fast_route
+--
+-- Routes with a constant response, like health checks. The complete
+-- response is serialized once when the route is added, and a request
+-- whose method and target match the route exactly is answered with these
+-- bytes right after its head is read: lib.fast_route_key() scans the head
+-- in C and the request is never parsed into tables. Requests the scan
+-- does not accept, e.g. ones with a body, are served by the route as
+-- usual.
+
+local lib = require('http.lib')
+local codes = require('http.codes')
+
+local function errorf(fmt, ...)
+    error(string.format(fmt, ...))
+end
+
+local function copy_headers(headers)
+    local res = {}
+    for k, v in pairs(headers) do
+        res[k] = v
+    end
+    return res
+end
+
+-- Checks the `response` option of a route and returns a normalized table.
+local function parse_route_options(opts)
+    if type(opts) ~= 'table' then
+        error("'response' option should be a table")
+    end
+    for k in pairs(opts) do
+        if k ~= 'status' and k ~= 'headers' and k ~= 'body' then
+            errorf("Unknown response option '%s'", k)
+        end
+    end
+    local status = opts.status or 200
+    if type(status) ~= 'number' or status ~= math.floor(status) or
+       status < 200 or status > 599 then
+        error('response.status must be an integer between 200 and 599')
+    end
+    local headers = {}
+    if opts.headers ~= nil then
+        if type(opts.headers) ~= 'table' then
+            error('response.headers must be a table')
+        end
+        for k, v in pairs(opts.headers) do
+            if type(k) ~= 'string' or
+               (type(v) ~= 'string' and type(v) ~= 'number') then
+                error('response.headers must map names to strings')
+            end
+            headers[string.lower(k)] = v
+        end
+    end
+    local body = opts.body or ''
+    if type(body) ~= 'string' then
+        error('response.body must be a string')
+    end
+    return {
+        status = status,
+        headers = headers,
+        body = body,
+    }
+end
+
+-- Returns the handler serving the response when the request does not
+-- take the fast path.
+local function handler(response)
+    return function()
+        return {
+            status = response.status,
+            headers = copy_headers(response.headers),
+            body = response.body,
+        }
+    end
+end
+
+local function serialize(response, connection, with_body)
+    local status = response.status
+    local parts = {
+        string.format('HTTP/1.1 %d %s\r\n', status,
+                      codes[status] or 'Unknown code ' .. status),
+    }
+    for k, v in pairs(response.headers) do
+        if k ~= 'connection' then
+            parts[#parts + 1] = string.gsub(k, '^%l', string.upper, 1) ..
+                                ': ' .. v .. '\r\n'
+        end
+    end
+    parts[#parts + 1] = 'Connection: ' .. connection .. '\r\n\r\n'
+    if with_body then
+        parts[#parts + 1] = response.body
+    end
+    return table.concat(parts)
+end
+
+local routes_methods = {}
+
+-- Registers a route with the `response` option normalized by
+-- parse_route_options(). Its headers must already have the ones every
+-- response gets, like Content-Length. A route added earlier for the same
+-- method and path keeps it.
+function routes_methods.add(self, route)
+    local path = route.path
+    if string.sub(path, 1, 1) ~= '/' then
+        path = '/' .. path
+    end
+    local methods = { route.method }
+    if route.method == 'ANY' then
+        methods = { 'GET', 'HEAD' }
+    end
+    for _, method in ipairs(methods) do
+        local key = method .. ' ' .. path
+        if self.entries[key] == nil then
+            -- A response to HEAD has the headers of the response to GET.
+            local with_body = method ~= 'HEAD'
+            self.entries[key] = {
+                route = { endpoint = route },
+                method = method,
+                status = route.response.status,
+                keepalive = serialize(route.response, 'keep-alive', with_body),
+                close = serialize(route.response, 'close', with_body),
+            }
+            self.size = self.size + 1
+        end
+    end
+end
+
+function routes_methods.remove(self, route)
+    for key, entry in pairs(self.entries) do
+        if entry.route.endpoint == route then
+            self.entries[key] = nil
+            self.size = self.size - 1
+        end
+    end
+end
+
+-- Returns the entry of the route answering the request with the head
+-- `head` and whether to keep the connection alive, or nil.
+function routes_methods.lookup(self, head)
+    local key, keepalive = lib.fast_route_key(head)
+    if key == nil then
+        return nil
+    end
+    local entry = self.entries[key]
+    if entry == nil then
+        return nil
+    end
+    return entry, keepalive
+end
+
+local routes_mt = { __index = routes_methods }
+
+local function new()
+    return setmetatable({
+        entries = {},
+        size = 0,
+    }, routes_mt)
+end
+
+return {
+    new = new,
+    parse_route_options = parse_route_options,
+    handler = handler,
+}
@@ -0,0 +1,594 @@
+-- http.hpack
+--
+-- HPACK header compression for HTTP/2 (RFC 7541). The decoder supports
+-- Huffman coded strings, the encoder emits plain strings and relies on the
+-- dynamic table for compression.
+
+local bit = require('bit')
+
+local band, bor, rshift, lshift = bit.band, bit.bor, bit.rshift, bit.lshift
+local byte, char, sub = string.byte, string.char, string.sub
+
+local DEFAULT_TABLE_SIZE = 4096
+
+-- Per-entry overhead counted by the table size, RFC 7541 4.1.
+local ENTRY_OVERHEAD = 32
+
+local STATIC_TABLE = {
+    { ':authority', '' },
+    { ':method', 'GET' },
+    { ':method', 'POST' },
+    { ':path', '/' },
+    { ':path', '/index.html' },
+    { ':scheme', 'http' },
+    { ':scheme', 'https' },
+    { ':status', '200' },
+    { ':status', '204' },
+    { ':status', '206' },
+    { ':status', '304' },
+    { ':status', '400' },
+    { ':status', '404' },
+    { ':status', '500' },
+    { 'accept-charset', '' },
+    { 'accept-encoding', 'gzip, deflate' },
+    { 'accept-language', '' },
+    { 'accept-ranges', '' },
+    { 'accept', '' },
+    { 'access-control-allow-origin', '' },
+    { 'age', '' },
+    { 'allow', '' },
+    { 'authorization', '' },
+    { 'cache-control', '' },
+    { 'content-disposition', '' },
+    { 'content-encoding', '' },
+    { 'content-language', '' },
+    { 'content-length', '' },
+    { 'content-location', '' },
+    { 'content-range', '' },
+    { 'content-type', '' },
+    { 'cookie', '' },
+    { 'date', '' },
+    { 'etag', '' },
+    { 'expect', '' },
+    { 'expires', '' },
+    { 'from', '' },
+    { 'host', '' },
+    { 'if-match', '' },
+    { 'if-modified-since', '' },
+    { 'if-none-match', '' },
+    { 'if-range', '' },
+    { 'if-unmodified-since', '' },
+    { 'last-modified', '' },
+    { 'link', '' },
+    { 'location', '' },
+    { 'max-forwards', '' },
+    { 'proxy-authenticate', '' },
+    { 'proxy-authorization', '' },
+    { 'range', '' },
+    { 'referer', '' },
+    { 'refresh', '' },
+    { 'retry-after', '' },
+    { 'server', '' },
+    { 'set-cookie', '' },
+    { 'strict-transport-security', '' },
+    { 'transfer-encoding', '' },
+    { 'user-agent', '' },
+    { 'vary', '' },
+    { 'via', '' },
+    { 'www-authenticate', '' },
+}
+local STATIC_TABLE_LEN = #STATIC_TABLE
+
+-- Indexes of static entries by name and by name and value.
+local STATIC_NAME_INDEX = {}
+local STATIC_FIELD_INDEX = {}
+for i, field in ipairs(STATIC_TABLE) do
+    if STATIC_NAME_INDEX[field[1]] == nil then
+        STATIC_NAME_INDEX[field[1]] = i
+    end
+    STATIC_FIELD_INDEX[field[1] .. '\0' .. field[2]] = i
+end
+
+-- Huffman code of every octet, RFC 7541 Appendix B. The EOS symbol is
+-- handled separately.
+local HUFFMAN_CODES = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5,
+    0xfffffe6, 0xfffffe7, 0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9,
+    0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec, 0xfffffed, 0xfffffee,
+    0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9,
+    0xffffffa, 0xffffffb, 0x14, 0x3f8, 0x3f9, 0xffa,
+    0x1ff9, 0x15, 0xf8, 0x7fa, 0x3fa, 0x3fb,
+    0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b,
+    0x1c, 0x1d, 0x1e, 0x1f, 0x5c, 0xfb,
+    0x7ffc, 0x20, 0xffb, 0x3fc, 0x1ffa, 0x21,
+    0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e,
+    0x6f, 0x70, 0x71, 0x72, 0xfc, 0x73,
+    0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5,
+    0x25, 0x26, 0x27, 0x6, 0x74, 0x75,
+    0x28, 0x29, 0x2a, 0x7, 0x2b, 0x76,
+    0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd,
+    0x1ffd, 0xffffffc, 0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8,
+    0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9, 0x3fffd6, 0x7fffda,
+    0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1,
+    0x7fffe2, 0x7fffe3, 0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5,
+    0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef, 0x3fffda, 0x1fffdd,
+    0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf,
+    0x7fffeb, 0x7fffec, 0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2,
+    0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef, 0xfffea, 0x3fffe2,
+    0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2,
+    0x3fffe8, 0x1ffffec, 0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde,
+    0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed, 0x7fff2, 0x1fffe3,
+    0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3,
+    0x7ffffe4, 0x7ffffe5, 0xfffec, 0xfffff3, 0xfffed, 0x1fffe6,
+    0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3, 0x3fffea, 0x3fffeb,
+    0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8,
+    0x7ffffe9, 0x7ffffea, 0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed,
+    0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+}
+
+local HUFFMAN_LENGTHS = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+}
+
+local EOS = 256
+
+-- The Huffman decoder walks a binary tree of codes four bits at a time.
+-- HUFFMAN_STATES[node * 16 + nibble + 1] holds the next node, the decoded
+-- octet (or -1) and whether the input may end in the next node.
+local HUFFMAN_STATES = {}
+
+do
+    -- Tree nodes are numbered from 0 (the root), leaves keep the symbol.
+    local children = { [0] = {} }
+    local symbols = {}
+    local nnodes = 1
+    local function add(code, len, sym)
+        local node = 0
+        for i = len - 1, 0, -1 do
+            local b = band(rshift(code, i), 1)
+            local next = children[node][b]
+            if next == nil then
+                next = nnodes
+                nnodes = nnodes + 1
+                children[next] = {}
+                children[node][b] = next
+            end
+            node = next
+        end
+        symbols[node] = sym
+    end
+    for sym = 0, 255 do
+        add(HUFFMAN_CODES[sym + 1], HUFFMAN_LENGTHS[sym + 1], sym)
+    end
+    add(0x3fffffff, 30, EOS)
+
+    -- A node may end the input if it is reached from the root by at most
+    -- seven 1 bits, i.e. the padding is a prefix of EOS.
+    local accepting = { [0] = true }
+    local node = 0
+    for _ = 1, 7 do
+        node = children[node][1]
+        accepting[node] = true
+    end
+
+    for state = 0, nnodes - 1 do
+        if symbols[state] == nil then
+            for nibble = 0, 15 do
+                local cur = state
+                local sym = -1
+                local failed = false
+                for i = 3, 0, -1 do
+                    cur = children[cur][band(rshift(nibble, i), 1)]
+                    if symbols[cur] ~= nil then
+                        if symbols[cur] == EOS or sym ~= -1 then
+                            failed = true
+                            break
+                        end
+                        sym = symbols[cur]
+                        cur = 0
+                    end
+                end
+                local idx = state * 16 + nibble + 1
+                if failed then
+                    HUFFMAN_STATES[idx] = false
+                else
+                    HUFFMAN_STATES[idx] = { cur, sym, accepting[cur] == true }
+                end
+            end
+        end
+    end
+end
+
+local function huffman_decode(data, pos, last)
+    local out = {}
+    local n = 0
+    local state = 0
+    local accepting = true
+    for i = (pos - 1) * 2, last * 2 - 1 do
+        local b = byte(data, rshift(i, 1) + 1)
+        local nibble = band(i, 1) == 0 and rshift(b, 4) or band(b, 0x0f)
+        local t = HUFFMAN_STATES[state * 16 + nibble + 1]
+        if not t then
+            return nil, 'invalid Huffman code'
+        end
+        state, accepting = t[1], t[3]
+        if t[2] >= 0 then
+            n = n + 1
+            out[n] = t[2]
+        end
+    end
+    if not accepting then
+        return nil, 'invalid Huffman padding'
+    end
+    local res = {}
+    for i = 1, n, 4096 do
+        table.insert(res, char(unpack(out, i, math.min(n, i + 4095))))
+    end
+    return table.concat(res)
+end
+
+-- Decodes an integer with an N-bit prefix (RFC 7541 5.1) starting at `pos`.
+-- Returns the value and the position of the next octet.
+local function decode_integer(data, pos, prefix_bits)
+    local b = byte(data, pos)
+    if b == nil then
+        return nil, 'truncated integer'
+    end
+    local max_prefix = lshift(1, prefix_bits) - 1
+    local value = band(b, max_prefix)
+    pos = pos + 1
+    if value < max_prefix then
+        return value, pos
+    end
+    local m = 0
+    repeat
+        b = byte(data, pos)
+        if b == nil then
+            return nil, 'truncated integer'
+        end
+        value = value + band(b, 0x7f) * 2 ^ m
+        m = m + 7
+        pos = pos + 1
+        if m > 28 then
+            return nil, 'integer overflow'
+        end
+    until b < 0x80
+    return value, pos
+end
+
+-- Encodes an integer with an N-bit prefix, `flags` are the high bits of the
+-- first octet.
+local function encode_integer(value, prefix_bits, flags)
+    local max_prefix = lshift(1, prefix_bits) - 1
+    if value < max_prefix then
+        return char(bor(flags, value))
+    end
+    local res = { bor(flags, max_prefix) }
+    value = value - max_prefix
+    while value >= 128 do
+        table.insert(res, bor(band(value, 0x7f), 0x80))
+        value = math.floor(value / 128)
+    end
+    table.insert(res, value)
+    return char(unpack(res))
+end
+
+local function decode_string(data, pos)
+    local b = byte(data, pos)
+    if b == nil then
+        return nil, 'truncated string'
+    end
+    local len, next = decode_integer(data, pos, 7)
+    if len == nil then
+        return nil, next
+    end
+    local last = next + len - 1
+    if last > #data then
+        return nil, 'truncated string'
+    end
+    if band(b, 0x80) ~= 0 then
+        local str, err = huffman_decode(data, next, last)
+        if str == nil then
+            return nil, err
+        end
+        return str, last + 1
+    end
+    return sub(data, next, last), last + 1
+end
+
+local function encode_string(str)
+    return encode_integer(#str, 7, 0) .. str
+end
+
+-- Dynamic table shared by the decoder and the encoder. Entries are stored
+-- newest first, as they are addressed by index.
+local function table_new(max_size)
+    return { entries = {}, size = 0, max_size = max_size }
+end
+
+local function table_evict(tbl, on_evict)
+    while tbl.size > tbl.max_size do
+        local entry = table.remove(tbl.entries)
+        tbl.size = tbl.size - #entry[1] - #entry[2] - ENTRY_OVERHEAD
+        if on_evict ~= nil then
+            on_evict(entry)
+        end
+    end
+end
+
+local function table_add(tbl, name, value, on_evict)
+    local size = #name + #value + ENTRY_OVERHEAD
+    if size > tbl.max_size then
+        -- An entry larger than the table empties it, RFC 7541 4.4.
+        while #tbl.entries > 0 do
+            local entry = table.remove(tbl.entries)
+            if on_evict ~= nil then
+                on_evict(entry)
+            end
+        end
+        tbl.size = 0
+        return nil
+    end
+    local entry = { name, value }
+    table.insert(tbl.entries, 1, entry)
+    tbl.size = tbl.size + size
+    table_evict(tbl, on_evict)
+    return entry
+end
+
+local decoder_methods = {}
+
+local function lookup(self, index)
+    if index == 0 then
+        return nil
+    end
+    if index <= STATIC_TABLE_LEN then
+        return STATIC_TABLE[index]
+    end
+    return self.table.entries[index - STATIC_TABLE_LEN]
+end
+
+-- Decodes a complete header block. Returns an array of `{ name, value }`
+-- pairs in the order of appearance or nil and an error message. An error
+-- is a connection error, the decoder state can not be used after it.
+function decoder_methods.decode(self, block)
+    local headers = {}
+    local pos = 1
+    local len = #block
+    local allow_size_update = true
+    while pos <= len do
+        local b = byte(block, pos)
+        local name, value
+        if b >= 0x80 then
+            -- Indexed header field.
+            local index
+            index, pos = decode_integer(block, pos, 7)
+            if index == nil then
+                return nil, pos
+            end
+            local field = lookup(self, index)
+            if field == nil then
+                return nil, 'invalid header index ' .. index
+            end
+            name, value = field[1], field[2]
+            allow_size_update = false
+        elseif b >= 0x20 and b < 0x40 then
+            -- Dynamic table size update, only at the beginning of a block.
+            if not allow_size_update then
+                return nil, 'unexpected dynamic table size update'
+            end
+            local size
+            size, pos = decode_integer(block, pos, 5)
+            if size == nil then
+                return nil, pos
+            end
+            if size > self.max_table_size then
+                return nil, 'dynamic table size update exceeds the limit'
+            end
+            self.table.max_size = size
+            table_evict(self.table)
+        else
+            -- Literal header field with incremental indexing (6-bit prefix),
+            -- without indexing or never indexed (4-bit prefix).
+            local indexing = b >= 0x40
+            local index
+            index, pos = decode_integer(block, pos, indexing and 6 or 4)
+            if index == nil then
+                return nil, pos
+            end
+            if index == 0 then
+                name, pos = decode_string(block, pos)
+                if name == nil then
+                    return nil, pos
+                end
+            else
+                local field = lookup(self, index)
+                if field == nil then
+                    return nil, 'invalid header index ' .. index
+                end
+                name = field[1]
+            end
+            value, pos = decode_string(block, pos)
+            if value == nil then
+                return nil, pos
+            end
+            if indexing then
+                table_add(self.table, name, value)
+            end
+            allow_size_update = false
+        end
+        if name ~= nil then
+            table.insert(headers, { name, value })
+        end
+    end
+    return headers
+end
+
+-- Sets the limit of the dynamic table size the peer may use, that is the
+-- value of SETTINGS_HEADER_TABLE_SIZE sent to it.
+function decoder_methods.set_max_table_size(self, size)
+    self.max_table_size = size
+end
+
+local decoder_mt = { __index = decoder_methods }
+
+local function new_decoder(max_table_size)
+    max_table_size = max_table_size or DEFAULT_TABLE_SIZE
+    return setmetatable({
+        table = table_new(max_table_size),
+        max_table_size = max_table_size,
+    }, decoder_mt)
+end
+
+-- Values of these headers are either sensitive or unique for a response,
+-- so they are not added to the dynamic table.
+local NEVER_INDEXED = {
+    ['set-cookie'] = true,
+    ['authorization'] = true,
+    ['cookie'] = true,
+}
+local NOT_INDEXED = {
+    [':path'] = true,
+    ['content-length'] = true,
+    ['date'] = true,
+    ['etag'] = true,
+    ['last-modified'] = true,
+    ['location'] = true,
+    ['server-timing'] = true,
+}
+
+local encoder_methods = {}
+
+-- Returns the index of the field in the encoder dynamic table and whether
+-- the value matches too.
+local function encoder_search(self, name, value)
+    local seq = self.fields[name .. '\0' .. value]
+    if seq ~= nil then
+        return self.inserted - seq + 1 + STATIC_TABLE_LEN, true
+    end
+    seq = self.names[name]
+    if seq ~= nil then
+        return self.inserted - seq + 1 + STATIC_TABLE_LEN, false
+    end
+    return nil
+end
+
+-- Encodes an array of `{ name, value }` pairs into a header block. Names
+-- must be in lower case.
+function encoder_methods.encode(self, headers)
+    local out = {}
+    if self.pending_size_update ~= nil then
+        table.insert(out, encode_integer(self.pending_size_update, 5, 0x20))
+        self.pending_size_update = nil
+    end
+    for _, field in ipairs(headers) do
+        local name, value = field[1], tostring(field[2])
+        local key = name .. '\0' .. value
+        local index = STATIC_FIELD_INDEX[key]
+        local full = index ~= nil
+        if not full then
+            local dyn_index, dyn_full = encoder_search(self, name, value)
+            if dyn_full then
+                index, full = dyn_index, true
+            else
+                index = STATIC_NAME_INDEX[name] or dyn_index
+            end
+        end
+
+        if full then
+            table.insert(out, encode_integer(index, 7, 0x80))
+        else
+            local flags, prefix
+            if NEVER_INDEXED[name] then
+                flags, prefix = 0x10, 4
+            elseif NOT_INDEXED[name] then
+                flags, prefix = 0x00, 4
+            else
+                flags, prefix = 0x40, 6
+            end
+            table.insert(out, encode_integer(index or 0, prefix, flags))
+            if index == nil then
+                table.insert(out, encode_string(name))
+            end
+            table.insert(out, encode_string(value))
+            if flags == 0x40 then
+                self.inserted = self.inserted + 1
+                local entry = table_add(self.table, name, value, self.on_evict)
+                if entry ~= nil then
+                    entry.seq = self.inserted
+                    self.fields[key] = self.inserted
+                    self.names[name] = self.inserted
+                end
+            end
+        end
+    end
+    return table.concat(out)
+end
+
+-- Applies SETTINGS_HEADER_TABLE_SIZE received from the peer.
+function encoder_methods.set_max_table_size(self, size)
+    size = math.min(size, DEFAULT_TABLE_SIZE)
+    if size == self.table.max_size then
+        return
+    end
+    self.table.max_size = size
+    table_evict(self.table, self.on_evict)
+    self.pending_size_update = size
+end
+
+local encoder_mt = { __index = encoder_methods }
+
+local function new_encoder()
+    local self = setmetatable({
+        table = table_new(DEFAULT_TABLE_SIZE),
+        -- Sequence numbers of the newest entries by field and by name.
+        fields = {},
+        names = {},
+        inserted = 0,
+    }, encoder_mt)
+    self.on_evict = function(entry)
+        local key = entry[1] .. '\0' .. entry[2]
+        if self.fields[key] == entry.seq then
+            self.fields[key] = nil
+        end
+        if self.names[entry[1]] == entry.seq then
+            self.names[entry[1]] = nil
+        end
+    end
+    return self
+end
+
+return {
+    new_decoder = new_decoder,
+    new_encoder = new_encoder,
+    encode_integer = encode_integer,
+    decode_integer = decode_integer,
+    huffman_decode = huffman_decode,
+    DEFAULT_TABLE_SIZE = DEFAULT_TABLE_SIZE,
+}
@@ -0,0 +1,1255 @@
+-- http.http2
+--
+-- HTTP/2 connection handling (RFC 9113): framing, stream multiplexing, flow
+-- control and prioritization of responses (RFC 9218). Every request stream
+-- is passed to the server callback in its own fiber, frames are written by
+-- a single writer fiber of the connection.
+
+local bit = require('bit')
+local errno = require('errno')
+local fiber = require('fiber')
+local log = require('log')
+local hpack = require('http.hpack')
+
+local band, bor, rshift = bit.band, bit.bor, bit.rshift
+local byte, char, sub = string.byte, string.char, string.sub
+
+local PREFACE = 'PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n'
+
+local FRAME_HEADER_SIZE = 9
+
+local DATA = 0x0
+local HEADERS = 0x1
+local PRIORITY = 0x2
+local RST_STREAM = 0x3
+local SETTINGS = 0x4
+local PUSH_PROMISE = 0x5
+local PING = 0x6
+local GOAWAY = 0x7
+local WINDOW_UPDATE = 0x8
+local CONTINUATION = 0x9
+local PRIORITY_UPDATE = 0x10
+
+local FLAG_END_STREAM = 0x1
+local FLAG_ACK = 0x1
+local FLAG_END_HEADERS = 0x4
+local FLAG_PADDED = 0x8
+local FLAG_PRIORITY = 0x20
+
+local NO_ERROR = 0x0
+local PROTOCOL_ERROR = 0x1
+local INTERNAL_ERROR = 0x2
+local FLOW_CONTROL_ERROR = 0x3
+local STREAM_CLOSED = 0x5
+local FRAME_SIZE_ERROR = 0x6
+local REFUSED_STREAM = 0x7
+local CANCEL = 0x8
+local COMPRESSION_ERROR = 0x9
+local ENHANCE_YOUR_CALM = 0xb
+
+local SETTINGS_HEADER_TABLE_SIZE = 0x1
+local SETTINGS_ENABLE_PUSH = 0x2
+local SETTINGS_MAX_CONCURRENT_STREAMS = 0x3
+local SETTINGS_INITIAL_WINDOW_SIZE = 0x4
+local SETTINGS_MAX_FRAME_SIZE = 0x5
+local SETTINGS_MAX_HEADER_LIST_SIZE = 0x6
+
+local DEFAULT_WINDOW_SIZE = 65535
+local MAX_WINDOW_SIZE = 2147483647
+local MIN_FRAME_SIZE = 16384
+local MAX_FRAME_SIZE = 16777215
+
+-- Bytes written to the socket at once, frames of different streams are
+-- interleaved within this amount.
+local WRITE_BATCH_SIZE = 65536
+-- A streamed response body is buffered up to this size before the handler
+-- is paused.
+local STREAM_BUFFER_SIZE = 65536
+-- Control frames (SETTINGS and PING acknowledgements, RST_STREAM and so on)
+-- waiting to be written. A peer that makes the server queue more does not
+-- read its socket and is disconnected.
+local MAX_QUEUED_CONTROL_FRAMES = 1000
+-- Seconds the GOAWAY of such a peer is waited to be written for.
+local FLOOD_WRITE_TIMEOUT = 1
+
+local DEFAULT_URGENCY = 3
+
+local DEFAULT_OPTIONS = {
+    max_concurrent_streams = 100,
+    initial_window_size = 1048576,
+    max_frame_size = MIN_FRAME_SIZE,
+    header_table_size = hpack.DEFAULT_TABLE_SIZE,
+    max_header_list_size = 65536,
+    -- Seconds a TLS client has to complete the handshake.
+    handshake_timeout = 10,
+}
+
+-- Headers that are specific to an HTTP/1 connection and must not be sent
+-- over HTTP/2, RFC 9113 8.2.2.
+local CONNECTION_HEADERS = {
+    ['connection'] = true,
+    ['keep-alive'] = true,
+    ['proxy-connection'] = true,
+    ['transfer-encoding'] = true,
+    ['upgrade'] = true,
+}
+
+local REQUEST_PSEUDO_HEADERS = {
+    [':method'] = true,
+    [':scheme'] = true,
+    [':authority'] = true,
+    [':path'] = true,
+}
+
+local function errorf(fmt, ...)
+    error(string.format(fmt, ...))
+end
+
+-- Checks the `http2` server option and returns a normalized table or nil
+-- if HTTP/2 is disabled.
+local function parse_options(opts)
+    if opts == nil or opts == false then
+        return nil
+    end
+    if opts == true then
+        opts = {}
+    end
+    if type(opts) ~= 'table' then
+        error('Option http2 must be a boolean or a table.')
+    end
+    for k in pairs(opts) do
+        if DEFAULT_OPTIONS[k] == nil then
+            errorf("Unknown http2 option '%s'", k)
+        end
+    end
+    local function check_range(name, min, max)
+        local value = opts[name]
+        if value ~= nil and (type(value) ~= 'number' or value < min or
+                             value > max or value % 1 ~= 0) then
+            errorf('http2.%s must be an integer from %d to %d', name, min, max)
+        end
+    end
+    check_range('max_concurrent_streams', 1, MAX_WINDOW_SIZE)
+    check_range('initial_window_size', DEFAULT_WINDOW_SIZE, MAX_WINDOW_SIZE)
+    check_range('max_frame_size', MIN_FRAME_SIZE, MAX_FRAME_SIZE)
+    check_range('header_table_size', 0, MAX_WINDOW_SIZE)
+    check_range('max_header_list_size', 1024, MAX_WINDOW_SIZE)
+    if opts.handshake_timeout ~= nil and
+       (type(opts.handshake_timeout) ~= 'number' or
+        not (opts.handshake_timeout > 0)) then
+        error('http2.handshake_timeout must be a positive number')
+    end
+    local res = {}
+    for k, v in pairs(DEFAULT_OPTIONS) do
+        if opts[k] ~= nil then
+            res[k] = opts[k]
+        else
+            res[k] = v
+        end
+    end
+    return res
+end
+
+local function uint32(n)
+    return char(band(rshift(n, 24), 0xff), band(rshift(n, 16), 0xff),
+                band(rshift(n, 8), 0xff), band(n, 0xff))
+end
+
+local function read_uint32(data, pos)
+    local b1, b2, b3, b4 = byte(data, pos, pos + 3)
+    return ((b1 * 256 + b2) * 256 + b3) * 256 + b4
+end
+
+local function frame_header(length, type, flags, stream_id)
+    return char(band(rshift(length, 16), 0xff), band(rshift(length, 8), 0xff),
+                band(length, 0xff), type, flags) .. uint32(stream_id)
+end
+
+local function frame(type, flags, stream_id, payload)
+    return frame_header(#payload, type, flags, stream_id) .. payload
+end
+
+-- Parses the `priority` header (RFC 9218 4), unknown parameters are ignored.
+local function parse_priority(value, urgency, incremental)
+    if type(value) ~= 'string' then
+        return urgency, incremental
+    end
+    for item in string.gmatch(value, '[^,]+') do
+        local key, val = string.match(item, '^%s*([%w%-%*]+)%s*=?%s*(%S*)%s*$')
+        if key == 'u' then
+            local u = tonumber(val)
+            if u ~= nil and u >= 0 and u <= 7 and u % 1 == 0 then
+                urgency = u
+            end
+        elseif key == 'i' then
+            if val == '' or val == '?1' then
+                incremental = true
+            elseif val == '?0' then
+                incremental = false
+            end
+        end
+    end
+    return urgency, incremental
+end
+
+local conn_methods = {}
+local stream_methods = {}
+local stream_mt = { __index = stream_methods }
+
+local function wakeup_writer(conn)
+    conn.writer_cond:signal()
+end
+
+local function queue_control(conn, data)
+    if #conn.control >= MAX_QUEUED_CONTROL_FRAMES then
+        -- The read loop closes the connection.
+        conn.flooded = true
+        return
+    end
+    table.insert(conn.control, data)
+    wakeup_writer(conn)
+end
+
+local function queue_window_update(conn, stream_id, increment)
+    queue_control(conn, frame(WINDOW_UPDATE, 0, stream_id, uint32(increment)))
+end
+
+-- Removes a stream from the connection once both sides are closed.
+local function close_stream(conn, stream)
+    if conn.streams[stream.id] == stream then
+        conn.streams[stream.id] = nil
+        conn.nstreams = conn.nstreams - 1
+    end
+    stream.out = {}
+    stream.out_bytes = 0
+    stream.cond:broadcast()
+    conn.done_cond:broadcast()
+end
+
+local function reset_stream(conn, stream, code)
+    if stream.reset then
+        return
+    end
+    stream.reset = true
+    queue_control(conn, frame(RST_STREAM, 0, stream.id, uint32(code)))
+    close_stream(conn, stream)
+end
+
+-- Resets a stream that is not known to the connection (already closed).
+local function reset_stream_id(conn, stream_id, code)
+    queue_control(conn, frame(RST_STREAM, 0, stream_id, uint32(code)))
+end
+
+-- Returns true if a frame of the stream can be written now.
+local function is_sendable(conn, stream)
+    if not stream.headers_sent or stream.end_sent or stream.reset then
+        return false
+    end
+    if stream.out_bytes > 0 then
+        return stream.send_window > 0 and conn.send_window > 0
+    end
+    return stream.out_end
+end
+
+-- Picks the stream to write the next DATA frame of: the most urgent one,
+-- non-incremental responses are sent one after another in the order of
+-- streams, incremental ones are interleaved frame by frame.
+local function pick_stream(conn)
+    local best
+    for _, stream in pairs(conn.streams) do
+        if is_sendable(conn, stream) then
+            if best == nil or stream.urgency < best.urgency then
+                best = stream
+            elseif stream.urgency == best.urgency then
+                if best.incremental ~= stream.incremental then
+                    if not stream.incremental then
+                        best = stream
+                    end
+                elseif stream.incremental then
+                    if stream.served < best.served then
+                        best = stream
+                    end
+                elseif stream.id < best.id then
+                    best = stream
+                end
+            end
+        end
+    end
+    return best
+end
+
+-- Appends a DATA frame of the stream to `out`, returns its size.
+local function write_data_frame(conn, stream, out)
+    local size = math.min(stream.out_bytes, stream.send_window,
+                          conn.send_window, conn.peer_max_frame_size)
+    local flags = 0
+    local header_pos = #out + 1
+    out[header_pos] = false
+    local left = size
+    while left > 0 do
+        local chunk = stream.out[1]
+        local avail = #chunk - stream.out_pos + 1
+        if avail <= left then
+            table.insert(out, stream.out_pos == 1 and chunk or
+                              sub(chunk, stream.out_pos))
+            table.remove(stream.out, 1)
+            stream.out_pos = 1
+            left = left - avail
+        else
+            table.insert(out, sub(chunk, stream.out_pos, stream.out_pos + left - 1))
+            stream.out_pos = stream.out_pos + left
+            left = 0
+        end
+    end
+    stream.out_bytes = stream.out_bytes - size
+    stream.send_window = stream.send_window - size
+    conn.send_window = conn.send_window - size
+    if stream.out_bytes == 0 and stream.out_end then
+        flags = FLAG_END_STREAM
+        stream.end_sent = true
+    end
+    out[header_pos] = frame_header(size, DATA, flags, stream.id)
+    conn.serial = conn.serial + 1
+    stream.served = conn.serial
+    stream.bytes_out = stream.bytes_out + FRAME_HEADER_SIZE + size
+    return FRAME_HEADER_SIZE + size
+end
+
+local function write_headers(conn, item, out)
+    local stream = item.stream
+    if stream.reset then
+        return 0
+    end
+    local block = conn.encoder:encode(item.fields)
+    local max = conn.peer_max_frame_size
+    local flags = item.end_stream and FLAG_END_STREAM or 0
+    local size = 0
+    local pos = 1
+    local type = HEADERS
+    repeat
+        local part = sub(block, pos, pos + max - 1)
+        pos = pos + #part
+        local f = flags
+        if pos > #block then
+            f = bor(f, FLAG_END_HEADERS)
+        end
+        table.insert(out, frame(type, f, stream.id, part))
+        size = size + FRAME_HEADER_SIZE + #part
+        type, flags = CONTINUATION, 0
+    until pos > #block
+    stream.headers_sent = true
+    stream.bytes_out = stream.bytes_out + size
+    if item.end_stream then
+        stream.end_sent = true
+    end
+    return size
+end
+
+local function writer_loop(conn)
+    while true do
+        local out = {}
+        local size = 0
+        for _, data in ipairs(conn.control) do
+            table.insert(out, data)
+            size = size + #data
+        end
+        conn.control = {}
+        for _, item in ipairs(conn.header_queue) do
+            size = size + write_headers(conn, item, out)
+        end
+        conn.header_queue = {}
+        if not conn.closed then
+            while size < WRITE_BATCH_SIZE do
+                local stream = pick_stream(conn)
+                if stream == nil then
+                    break
+                end
+                size = size + write_data_frame(conn, stream, out)
+            end
+        end
+
+        if #out == 0 then
+            if conn.closed then
+                break
+            end
+            conn.writer_cond:wait()
+        else
+            local ok = conn.s:write(table.concat(out))
+            -- Wake up the streams waiting for their output to be flushed or
+            -- for the buffer space.
+            for _, stream in pairs(conn.streams) do
+                if ok and stream.end_sent then
+                    stream.flushed = true
+                end
+                if stream.end_sent or stream.out_bytes < STREAM_BUFFER_SIZE then
+                    stream.cond:broadcast()
+                end
+                if not ok then
+                    break
+                elseif stream.end_sent and stream.remote_closed then
+                    close_stream(conn, stream)
+                elseif stream.end_sent then
+                    -- The response is complete, the rest of the request
+                    -- body is not needed.
+                    reset_stream(conn, stream, NO_ERROR)
+                end
+            end
+            if not ok then
+                conn.write_failed = true
+                conn.closed = true
+                for _, stream in pairs(conn.streams) do
+                    stream.cond:broadcast()
+                end
+                conn.done_cond:broadcast()
+                break
+            end
+        end
+    end
+    conn.writer_done = true
+    conn.done_cond:broadcast()
+end
+
+-- Reads exactly `size` bytes. Returns nil on EOF or an error, nil and true
+-- on a timeout.
+local function read_exact(conn, size, timeout)
+    if size == 0 then
+        return ''
+    end
+    local data = conn.s:read(size, timeout)
+    if data == nil then
+        return nil, conn.s:errno() == errno.ETIMEDOUT
+    end
+    if #data < size then
+        return nil
+    end
+    return data
+end
+
+local function send_goaway(conn, code, msg)
+    local payload = uint32(conn.last_stream_id) .. uint32(code)
+    if msg ~= nil then
+        payload = payload .. msg
+    end
+    queue_control(conn, frame(GOAWAY, 0, 0, payload))
+    conn.goaway_sent = true
+end
+
+-- Removes padding of DATA and HEADERS frames.
+local function strip_padding(flags, payload)
+    if band(flags, FLAG_PADDED) == 0 then
+        return payload
+    end
+    local pad = byte(payload, 1)
+    if pad == nil or pad >= #payload then
+        return nil
+    end
+    return sub(payload, 2, #payload - pad)
+end
+
+-- Builds a request from a decoded header list. Returns nil and an error
+-- message for a malformed request, RFC 9113 8.3.
+local function make_request(fields)
+    local headers = {}
+    local pseudo = {}
+    local regular = false
+    for _, field in ipairs(fields) do
+        local name, value = field[1], field[2]
+        if string.find(name, '[A-Z]') then
+            return nil, 'uppercase header name'
+        end
+        if sub(name, 1, 1) == ':' then
+            if regular or not REQUEST_PSEUDO_HEADERS[name] or pseudo[name] then
+                return nil, 'invalid pseudo-header ' .. name
+            end
+            pseudo[name] = value
+        else
+            regular = true
+            if CONNECTION_HEADERS[name] or (name == 'te' and value ~= 'trailers') then
+                return nil, 'connection-specific header ' .. name
+            end
+            local old = headers[name]
+            if old == nil then
+                headers[name] = value
+            elseif name == 'cookie' then
+                headers[name] = old .. '; ' .. value
+            else
+                headers[name] = old .. ', ' .. value
+            end
+        end
+    end
+    if pseudo[':method'] == nil or pseudo[':scheme'] == nil or
+       pseudo[':path'] == nil or pseudo[':path'] == '' then
+        return nil, 'missing pseudo-header'
+    end
+    if headers.host == nil and pseudo[':authority'] ~= nil then
+        headers.host = pseudo[':authority']
+    end
+    local target = pseudo[':path']
+    local qpos = string.find(target, '?', 1, true)
+    return {
+        method = pseudo[':method'],
+        path = qpos and sub(target, 1, qpos - 1) or target,
+        query = qpos and sub(target, qpos + 1) or '',
+        proto = { 2, 0 },
+        headers = headers,
+        body = '',
+    }
+end
+
+local function run_stream(conn, stream, on_stream)
+    local ok, err = pcall(on_stream, stream)
+    if not ok then
+        log.error('http2: failed to process stream %d: %s', stream.id, tostring(err))
+    end
+    if not stream.end_sent then
+        reset_stream(conn, stream, INTERNAL_ERROR)
+    end
+    conn.running = conn.running - 1
+    conn.done_cond:broadcast()
+end
+
+-- Returns false if the request body received so far does not match the
+-- content-length of the request, such a request is malformed, RFC 9113
+-- 8.1.1.
+local function body_length_valid(stream)
+    local length = stream.content_length
+    if length == nil then
+        return true
+    end
+    if stream.remote_closed then
+        return stream.body_bytes == length
+    end
+    return stream.body_bytes <= length
+end
+
+local function open_stream(conn, stream_id, fields, end_stream, header_bytes, on_stream)
+    local request, err = make_request(fields)
+    if request == nil then
+        log.verbose('http2: malformed request on stream %d: %s', stream_id, err)
+        reset_stream_id(conn, stream_id, PROTOCOL_ERROR)
+        return
+    end
+    if conn.goaway_sent or conn.running >= conn.opts.max_concurrent_streams then
+        -- Handler fibers of reset streams are counted too, so a client
+        -- can not run more handlers by resetting its streams.
+        reset_stream_id(conn, stream_id, REFUSED_STREAM)
+        return
+    end
+
+    local urgency, incremental = parse_priority(request.headers['priority'],
+        DEFAULT_URGENCY, false)
+    local pending = conn.pending_priority[stream_id]
+    if pending ~= nil then
+        conn.pending_priority[stream_id] = nil
+        urgency, incremental = parse_priority(pending, urgency, incremental)
+    end
+
+    local stream = setmetatable({
+        id = stream_id,
+        conn = conn,
+        request = request,
+        header_bytes = header_bytes,
+        body_bytes = 0,
+        content_length = tonumber(request.headers['content-length']),
+        chunks = {},
+        buffered = 0,
+        credited = 0,
+        remote_closed = end_stream,
+        recv_window = conn.opts.initial_window_size,
+        recv_unacked = 0,
+        send_window = conn.peer_initial_window_size,
+        out = {},
+        out_pos = 1,
+        out_bytes = 0,
+        out_end = false,
+        headers_sent = false,
+        end_sent = false,
+        flushed = false,
+        reset = false,
+        urgency = urgency,
+        incremental = incremental,
+        served = 0,
+        bytes_out = 0,
+        cond = fiber.cond(),
+    }, stream_mt)
+    if not body_length_valid(stream) then
+        reset_stream_id(conn, stream_id, PROTOCOL_ERROR)
+        return
+    end
+    if not end_stream and request.headers['content-length'] == nil then
+        -- The body length is known only at the end of the stream.
+        request._remaining = math.huge
+    end
+
+    conn.streams[stream_id] = stream
+    conn.nstreams = conn.nstreams + 1
+    conn.nrequests = conn.nrequests + 1
+    stream.reused = conn.nrequests > 1
+    conn.running = conn.running + 1
+    fiber.new(run_stream, conn, stream, on_stream)
+end
+
+-- Frame handlers return nil or an error code and a message of a connection
+-- error.
+local handlers = {}
+
+local function end_of_headers(conn, on_stream)
+    local hdr = conn.header_block
+    conn.header_block = nil
+    local block = table.concat(hdr.parts)
+    local fields, err = conn.decoder:decode(block)
+    if fields == nil then
+        return COMPRESSION_ERROR, err
+    end
+    local list_size = 0
+    for _, field in ipairs(fields) do
+        list_size = list_size + #field[1] + #field[2] + 32
+    end
+
+    local stream = conn.streams[hdr.stream_id]
+    if stream ~= nil then
+        -- Trailers, they are not passed to the handler.
+        if stream.remote_closed then
+            reset_stream(conn, stream, STREAM_CLOSED)
+        elseif not hdr.end_stream then
+            reset_stream(conn, stream, PROTOCOL_ERROR)
+        else
+            stream.remote_closed = true
+            if not body_length_valid(stream) then
+                reset_stream(conn, stream, PROTOCOL_ERROR)
+            end
+            stream.cond:broadcast()
+        end
+        return nil
+    end
+    if hdr.stream_id <= conn.last_stream_id then
+        return STREAM_CLOSED, 'HEADERS on a closed stream'
+    end
+    conn.last_stream_id = hdr.stream_id
+    if list_size > conn.opts.max_header_list_size then
+        reset_stream_id(conn, hdr.stream_id, PROTOCOL_ERROR)
+        return nil
+    end
+    open_stream(conn, hdr.stream_id, fields, hdr.end_stream, #block, on_stream)
+    return nil
+end
+
+handlers[HEADERS] = function(conn, flags, stream_id, payload, on_stream)
+    if stream_id == 0 or stream_id % 2 == 0 then
+        return PROTOCOL_ERROR, 'invalid stream id'
+    end
+    payload = strip_padding(flags, payload)
+    if payload == nil then
+        return PROTOCOL_ERROR, 'invalid padding'
+    end
+    if band(flags, FLAG_PRIORITY) ~= 0 then
+        -- RFC 7540 priorities are deprecated by RFC 9113 and ignored.
+        if #payload < 5 then
+            return FRAME_SIZE_ERROR, 'invalid priority'
+        end
+        payload = sub(payload, 6)
+    end
+    conn.header_block = {
+        stream_id = stream_id,
+        end_stream = band(flags, FLAG_END_STREAM) ~= 0,
+        parts = { payload },
+        size = #payload,
+    }
+    if band(flags, FLAG_END_HEADERS) ~= 0 then
+        return end_of_headers(conn, on_stream)
+    end
+    return nil
+end
+
+handlers[CONTINUATION] = function(conn, flags, stream_id, payload, on_stream)
+    local hdr = conn.header_block
+    if hdr == nil or hdr.stream_id ~= stream_id then
+        return PROTOCOL_ERROR, 'unexpected CONTINUATION'
+    end
+    hdr.size = hdr.size + #payload
+    if hdr.size > conn.opts.max_header_list_size then
+        return PROTOCOL_ERROR, 'header block is too large'
+    end
+    table.insert(hdr.parts, payload)
+    if band(flags, FLAG_END_HEADERS) ~= 0 then
+        return end_of_headers(conn, on_stream)
+    end
+    return nil
+end
+
+handlers[DATA] = function(conn, flags, stream_id, payload)
+    if stream_id == 0 then
+        return PROTOCOL_ERROR, 'DATA on stream 0'
+    end
+    -- The connection window is replenished as soon as data is received,
+    -- so a stream which body is not read does not block other streams.
+    local length = #payload
+    conn.recv_window = conn.recv_window - length
+    if conn.recv_window < 0 then
+        return FLOW_CONTROL_ERROR, 'connection window exceeded'
+    end
+    conn.recv_unacked = conn.recv_unacked + length
+    if conn.recv_unacked >= conn.opts.initial_window_size / 2 then
+        queue_window_update(conn, 0, conn.recv_unacked)
+        conn.recv_window = conn.recv_window + conn.recv_unacked
+        conn.recv_unacked = 0
+    end
+
+    local stream = conn.streams[stream_id]
+    if stream == nil then
+        if stream_id > conn.last_stream_id then
+            return PROTOCOL_ERROR, 'DATA on an idle stream'
+        end
+        reset_stream_id(conn, stream_id, STREAM_CLOSED)
+        return nil
+    end
+    if stream.remote_closed then
+        reset_stream(conn, stream, STREAM_CLOSED)
+        return nil
+    end
+    local data = strip_padding(flags, payload)
+    if data == nil then
+        return PROTOCOL_ERROR, 'invalid padding'
+    end
+    stream.recv_window = stream.recv_window - length
+    if stream.recv_window < 0 then
+        reset_stream(conn, stream, FLOW_CONTROL_ERROR)
+        return nil
+    end
+    -- Padding is not passed to the handler, credit it right away.
+    stream.recv_unacked = stream.recv_unacked + length - #data
+    if #data > 0 then
+        table.insert(stream.chunks, data)
+        stream.buffered = stream.buffered + #data
+        stream.body_bytes = stream.body_bytes + #data
+    end
+    if band(flags, FLAG_END_STREAM) ~= 0 then
+        stream.remote_closed = true
+    end
+    if not body_length_valid(stream) then
+        reset_stream(conn, stream, PROTOCOL_ERROR)
+        return nil
+    end
+    stream.cond:broadcast()
+    return nil
+end
+
+handlers[PRIORITY] = function(_, _, stream_id, payload)
+    if stream_id == 0 then
+        return PROTOCOL_ERROR, 'PRIORITY on stream 0'
+    end
+    if #payload ~= 5 then
+        return FRAME_SIZE_ERROR, 'invalid PRIORITY frame'
+    end
+    return nil
+end
+
+handlers[PRIORITY_UPDATE] = function(conn, _, stream_id, payload)
+    if stream_id ~= 0 then
+        return PROTOCOL_ERROR, 'PRIORITY_UPDATE on a stream'
+    end
+    if #payload < 4 then
+        return FRAME_SIZE_ERROR, 'invalid PRIORITY_UPDATE frame'
+    end
+    local id = band(read_uint32(payload, 1), 0x7fffffff)
+    local value = sub(payload, 5)
+    local stream = conn.streams[id]
+    if stream ~= nil then
+        stream.urgency, stream.incremental =
+            parse_priority(value, stream.urgency, stream.incremental)
+        wakeup_writer(conn)
+    elseif id > conn.last_stream_id and
+           conn.npending_priority < conn.opts.max_concurrent_streams then
+        -- The frame may arrive before the stream is opened.
+        if conn.pending_priority[id] == nil then
+            conn.npending_priority = conn.npending_priority + 1
+        end
+        conn.pending_priority[id] = value
+    end
+    return nil
+end
+
+handlers[RST_STREAM] = function(conn, _, stream_id, payload)
+    if stream_id == 0 then
+        return PROTOCOL_ERROR, 'RST_STREAM on stream 0'
+    end
+    if #payload ~= 4 then
+        return FRAME_SIZE_ERROR, 'invalid RST_STREAM frame'
+    end
+    if stream_id > conn.last_stream_id then
+        return PROTOCOL_ERROR, 'RST_STREAM on an idle stream'
+    end
+    local stream = conn.streams[stream_id]
+    if stream ~= nil then
+        stream.reset = true
+        close_stream(conn, stream)
+    end
+    return nil
+end
+
+local function apply_settings(conn, payload)
+    for pos = 1, #payload, 6 do
+        local id = byte(payload, pos) * 256 + byte(payload, pos + 1)
+        local value = read_uint32(payload, pos + 2)
+        if id == SETTINGS_HEADER_TABLE_SIZE then
+            conn.encoder:set_max_table_size(value)
+        elseif id == SETTINGS_ENABLE_PUSH then
+            if value > 1 then
+                return PROTOCOL_ERROR, 'invalid SETTINGS_ENABLE_PUSH'
+            end
+        elseif id == SETTINGS_INITIAL_WINDOW_SIZE then
+            if value > MAX_WINDOW_SIZE then
+                return FLOW_CONTROL_ERROR, 'invalid SETTINGS_INITIAL_WINDOW_SIZE'
+            end
+            local delta = value - conn.peer_initial_window_size
+            conn.peer_initial_window_size = value
+            for _, stream in pairs(conn.streams) do
+                stream.send_window = stream.send_window + delta
+                if stream.send_window > MAX_WINDOW_SIZE then
+                    return FLOW_CONTROL_ERROR, 'stream window overflow'
+                end
+            end
+        elseif id == SETTINGS_MAX_FRAME_SIZE then
+            if value < MIN_FRAME_SIZE or value > MAX_FRAME_SIZE then
+                return PROTOCOL_ERROR, 'invalid SETTINGS_MAX_FRAME_SIZE'
+            end
+            conn.peer_max_frame_size = value
+        end
+    end
+    return nil
+end
+
+handlers[SETTINGS] = function(conn, flags, stream_id, payload)
+    if stream_id ~= 0 then
+        return PROTOCOL_ERROR, 'SETTINGS on a stream'
+    end
+    if band(flags, FLAG_ACK) ~= 0 then
+        if #payload ~= 0 then
+            return FRAME_SIZE_ERROR, 'SETTINGS ack with payload'
+        end
+        return nil
+    end
+    if #payload % 6 ~= 0 then
+        return FRAME_SIZE_ERROR, 'invalid SETTINGS frame'
+    end
+    local code, msg = apply_settings(conn, payload)
+    if code ~= nil then
+        return code, msg
+    end
+    queue_control(conn, frame(SETTINGS, FLAG_ACK, 0, ''))
+    return nil
+end
+
+handlers[PUSH_PROMISE] = function()
+    return PROTOCOL_ERROR, 'PUSH_PROMISE from a client'
+end
+
+handlers[PING] = function(conn, flags, stream_id, payload)
+    if stream_id ~= 0 then
+        return PROTOCOL_ERROR, 'PING on a stream'
+    end
+    if #payload ~= 8 then
+        return FRAME_SIZE_ERROR, 'invalid PING frame'
+    end
+    if band(flags, FLAG_ACK) == 0 then
+        queue_control(conn, frame(PING, FLAG_ACK, 0, payload))
+    end
+    return nil
+end
+
+handlers[GOAWAY] = function(conn, _, stream_id, payload)
+    if stream_id ~= 0 then
+        return PROTOCOL_ERROR, 'GOAWAY on a stream'
+    end
+    if #payload < 8 then
+        return FRAME_SIZE_ERROR, 'invalid GOAWAY frame'
+    end
+    conn.goaway_received = true
+    return nil
+end
+
+handlers[WINDOW_UPDATE] = function(conn, _, stream_id, payload)
+    if #payload ~= 4 then
+        return FRAME_SIZE_ERROR, 'invalid WINDOW_UPDATE frame'
+    end
+    local increment = band(read_uint32(payload, 1), 0x7fffffff)
+    if stream_id == 0 then
+        if increment == 0 then
+            return PROTOCOL_ERROR, 'zero window increment'
+        end
+        conn.send_window = conn.send_window + increment
+        if conn.send_window > MAX_WINDOW_SIZE then
+            return FLOW_CONTROL_ERROR, 'connection window overflow'
+        end
+    else
+        local stream = conn.streams[stream_id]
+        if stream == nil then
+            if stream_id > conn.last_stream_id then
+                return PROTOCOL_ERROR, 'WINDOW_UPDATE on an idle stream'
+            end
+            return nil
+        end
+        if increment == 0 then
+            reset_stream(conn, stream, PROTOCOL_ERROR)
+            return nil
+        end
+        stream.send_window = stream.send_window + increment
+        if stream.send_window > MAX_WINDOW_SIZE then
+            reset_stream(conn, stream, FLOW_CONTROL_ERROR)
+            return nil
+        end
+    end
+    wakeup_writer(conn)
+    return nil
+end
+
+local function handle_frame(self, header, on_stream)
+    local b1, b2, b3, type, flags = byte(header, 1, 5)
+    local length = (b1 * 256 + b2) * 256 + b3
+    local stream_id = band(read_uint32(header, 6), 0x7fffffff)
+    if length > self.opts.max_frame_size then
+        return FRAME_SIZE_ERROR, 'frame is too large'
+    end
+    local payload = read_exact(self, length, self.idle_timeout)
+    if payload == nil then
+        return nil, nil, true
+    end
+    if self.nframes == 0 and type ~= SETTINGS then
+        return PROTOCOL_ERROR, 'the first frame must be SETTINGS'
+    end
+    self.nframes = self.nframes + 1
+    if self.header_block ~= nil and type ~= CONTINUATION then
+        return PROTOCOL_ERROR, 'expected CONTINUATION'
+    end
+    local handler = handlers[type]
+    if handler == nil then
+        -- Frames of unknown types are ignored, RFC 9113 4.1.
+        return nil
+    end
+    return handler(self, flags, stream_id, payload, on_stream)
+end
+
+-- Reads and handles frames until the connection is closed. Returns nil or
+-- an error code and a message of a connection error.
+function conn_methods.read_loop(self, on_stream)
+    while not self.goaway_received or self.nstreams > 0 or self.running > 0 do
+        local header, timed_out = read_exact(self, FRAME_HEADER_SIZE, self.idle_timeout)
+        if header ~= nil then
+            local code, msg, eof = handle_frame(self, header, on_stream)
+            if code ~= nil then
+                return code, msg
+            end
+            if self.flooded then
+                return ENHANCE_YOUR_CALM, 'too many queued control frames'
+            end
+            if eof then
+                return nil
+            end
+        elseif not timed_out or (self.nstreams == 0 and self.running == 0) then
+            -- EOF, an error or the idle timeout without requests in progress.
+            return nil
+        end
+    end
+    return nil
+end
+
+-- Returns the number of bytes of a body read that satisfies `opts`, like
+-- socket:read() does, or nil.
+local function check_body(data, limit, delimiters)
+    if delimiters == nil then
+        if #data >= limit then
+            return limit
+        end
+        return nil
+    end
+    local shortest
+    for _, delimiter in ipairs(delimiters) do
+        local _, last = string.find(data, delimiter, 1, true)
+        if last ~= nil and (shortest == nil or last < shortest) then
+            shortest = last
+        end
+    end
+    if shortest ~= nil and shortest <= limit then
+        return shortest
+    elseif limit <= #data then
+        return limit
+    end
+    return nil
+end
+
+-- Reads the request body, accepts the same arguments as socket:read().
+-- Returns '' at the end of the body and nil on a timeout.
+function stream_methods.read(self, opts, timeout)
+    local limit, delimiters = math.huge, nil
+    if type(opts) == 'number' then
+        limit = opts
+    elseif type(opts) == 'string' then
+        delimiters = { opts }
+    elseif type(opts) == 'table' then
+        limit = opts.chunk or opts.size or math.huge
+        local delimiter = opts.delimiter or opts.line
+        if type(delimiter) == 'string' then
+            delimiters = { delimiter }
+        else
+            delimiters = delimiter
+        end
+    end
+
+    local deadline = timeout and fiber.clock() + timeout
+    local data, len
+    while true do
+        if #self.chunks > 1 then
+            self.chunks = { table.concat(self.chunks) }
+        end
+        data = self.chunks[1] or ''
+        len = check_body(data, limit, delimiters)
+        if len ~= nil then
+            break
+        end
+        if self.remote_closed or self.reset or self.conn.closed then
+            len = math.min(#data, limit)
+            break
+        end
+        local left = deadline and deadline - fiber.clock()
+        if left ~= nil and left <= 0 then
+            return nil
+        end
+        -- The read needs more data than the window allows to buffer, let
+        -- the peer send more before the buffered data is consumed.
+        local credit = self.recv_unacked + self.buffered - self.credited
+        if credit > 0 and not self.remote_closed and not self.reset and
+           self.recv_window <= self.conn.opts.initial_window_size / 2 then
+            queue_window_update(self.conn, self.id, credit)
+            self.recv_window = self.recv_window + credit
+            self.recv_unacked = 0
+            self.credited = self.buffered
+        end
+        self.cond:wait(left)
+    end
+
+    if len == #data then
+        self.chunks = {}
+    else
+        self.chunks[1] = sub(data, len + 1)
+        data = sub(data, 1, len)
+    end
+    self.buffered = self.buffered - len
+
+    -- The peer may send more once the handler has consumed the data.
+    local credited = math.min(self.credited, len)
+    self.credited = self.credited - credited
+    self.recv_unacked = self.recv_unacked + len - credited
+    if not self.remote_closed and not self.reset and
+       self.recv_unacked >= self.conn.opts.initial_window_size / 2 then
+        queue_window_update(self.conn, self.id, self.recv_unacked)
+        self.recv_window = self.recv_window + self.recv_unacked
+        self.recv_unacked = 0
+    end
+    return data
+end
+
+function stream_methods.peer(self)
+    return self.conn.s:peer()
+end
+
+local function queue_data(self, data)
+    table.insert(self.out, data)
+    self.out_bytes = self.out_bytes + #data
+    wakeup_writer(self.conn)
+end
+
+-- Waits until the stream output is shorter than `limit` or, without
+-- a limit, until the whole response is written. Returns false if the
+-- stream or the connection is closed.
+local function wait_output(self, limit)
+    while true do
+        if limit == nil and self.flushed then
+            return true
+        end
+        if self.reset or self.conn.closed then
+            return false
+        end
+        if limit ~= nil and self.out_bytes < limit then
+            return true
+        end
+        self.cond:wait()
+    end
+end
+
+-- Sends a response. `headers` is a table of lowercase names and values,
+-- values may be arrays. The body is a string or an iterator `gen, param,
+-- state` yielding chunks. Returns true if the whole response has been
+-- written and the number of bytes written.
+function stream_methods.respond(self, status, headers, body, gen, param, state)
+    if self.reset or self.conn.closed then
+        return false, 0
+    end
+    local fields = { { ':status', tostring(status) } }
+    for k, v in pairs(headers) do
+        if not CONNECTION_HEADERS[k] then
+            if type(v) == 'table' then
+                for _, sv in pairs(v) do
+                    table.insert(fields, { k, tostring(sv) })
+                end
+            else
+                table.insert(fields, { k, tostring(v) })
+            end
+        end
+    end
+    -- The server may change the priority of a response, RFC 9218 5.
+    self.urgency, self.incremental = parse_priority(headers['priority'],
+        self.urgency, self.incremental)
+
+    if self.request.method == 'HEAD' then
+        body, gen = nil, nil
+    end
+    local has_body = gen ~= nil or (body ~= nil and #body > 0)
+    table.insert(self.conn.header_queue, {
+        stream = self,
+        fields = fields,
+        end_stream = not has_body,
+    })
+    wakeup_writer(self.conn)
+
+    if type(body) == 'string' and #body > 0 then
+        queue_data(self, body)
+    elseif gen ~= nil then
+        for _, part in gen, param, state do
+            part = tostring(part)
+            if #part > 0 then
+                queue_data(self, part)
+            end
+            if not wait_output(self, STREAM_BUFFER_SIZE) then
+                break
+            end
+        end
+    end
+    if has_body then
+        self.out_end = true
+        wakeup_writer(self.conn)
+    end
+    return wait_output(self), self.bytes_out
+end
+
+-- Resets the stream, e.g. when a response can not be sent.
+function stream_methods.cancel(self)
+    reset_stream(self.conn, self, CANCEL)
+end
+
+local conn_mt = { __index = conn_methods }
+
+local function new_conn(s, opts, idle_timeout)
+    return setmetatable({
+        s = s,
+        opts = opts,
+        idle_timeout = idle_timeout,
+        encoder = hpack.new_encoder(),
+        decoder = hpack.new_decoder(opts.header_table_size),
+        streams = {},
+        nstreams = 0,
+        nrequests = 0,
+        running = 0,
+        last_stream_id = 0,
+        pending_priority = {},
+        npending_priority = 0,
+        control = {},
+        header_queue = {},
+        serial = 0,
+        send_window = DEFAULT_WINDOW_SIZE,
+        recv_window = opts.initial_window_size,
+        recv_unacked = 0,
+        peer_initial_window_size = DEFAULT_WINDOW_SIZE,
+        peer_max_frame_size = MIN_FRAME_SIZE,
+        nframes = 0,
+        closed = false,
+        writer_cond = fiber.cond(),
+        done_cond = fiber.cond(),
+    }, conn_mt)
+end
+
+local function settings_frame(opts)
+    local payload = {
+        char(0, SETTINGS_MAX_CONCURRENT_STREAMS), uint32(opts.max_concurrent_streams),
+        char(0, SETTINGS_INITIAL_WINDOW_SIZE), uint32(opts.initial_window_size),
+        char(0, SETTINGS_MAX_FRAME_SIZE), uint32(opts.max_frame_size),
+        char(0, SETTINGS_MAX_HEADER_LIST_SIZE), uint32(opts.max_header_list_size),
+        char(0, SETTINGS_ENABLE_PUSH), uint32(0),
+    }
+    if opts.header_table_size ~= hpack.DEFAULT_TABLE_SIZE then
+        table.insert(payload, char(0, SETTINGS_HEADER_TABLE_SIZE))
+        table.insert(payload, uint32(opts.header_table_size))
+    end
+    return frame(SETTINGS, 0, 0, table.concat(payload))
+end
+
+-- Serves an HTTP/2 connection after the client preface has been read.
+-- `on_stream(stream)` is called in a new fiber for every request, the
+-- request is in `stream.request`, the handler reads its body with
+-- `stream:read()` and sends the response with `stream:respond()`. Returns
+-- when the connection is closed and all handlers have finished.
+local function serve(s, opts, idle_timeout, on_stream)
+    local conn = new_conn(s, opts, idle_timeout)
+    queue_control(conn, settings_frame(opts))
+    if opts.initial_window_size > DEFAULT_WINDOW_SIZE then
+        queue_window_update(conn, 0, opts.initial_window_size - DEFAULT_WINDOW_SIZE)
+    end
+    local writer = fiber.new(writer_loop, conn)
+    writer:set_joinable(true)
+
+    local ok, code, msg = pcall(conn.read_loop, conn, on_stream)
+    if not ok then
+        log.error('http2: %s', tostring(code))
+        code, msg = INTERNAL_ERROR, nil
+    end
+    if code == ENHANCE_YOUR_CALM then
+        log.verbose('http2: connection error %d: %s', code, msg)
+        -- The queued frames are dropped and the GOAWAY is written if the
+        -- socket takes it in time. Then the socket is shut down, so that
+        -- neither the writer nor the handlers wait for the peer.
+        conn.control = {}
+        send_goaway(conn, code, msg)
+        conn.closed = true
+        local deadline = fiber.clock() + FLOOD_WRITE_TIMEOUT
+        while not conn.writer_done and fiber.clock() < deadline do
+            conn.done_cond:wait(deadline - fiber.clock())
+        end
+        if not conn.writer_done then
+            conn.s:shutdown()
+        end
+    elseif code ~= nil then
+        log.verbose('http2: connection error %d: %s', code, tostring(msg))
+        send_goaway(conn, code, msg)
+    elseif not conn.goaway_received then
+        send_goaway(conn, NO_ERROR)
+    end
+
+    -- Let the handlers in progress finish, their responses are still
+    -- written if the connection is alive. Request bodies will not be
+    -- received anymore.
+    for _, stream in pairs(conn.streams) do
+        if code ~= nil or not stream.remote_closed then
+            stream.reset = true
+            close_stream(conn, stream)
+        end
+    end
+    while conn.running > 0 and not conn.write_failed do
+        conn.done_cond:wait()
+    end
+    conn.closed = true
+    for _, stream in pairs(conn.streams) do
+        stream.cond:broadcast()
+    end
+    wakeup_writer(conn)
+    writer:join()
+    while conn.running > 0 do
+        conn.done_cond:wait()
+    end
+end
+
+return {
+    PREFACE = PREFACE,
+    parse_options = parse_options,
+    parse_priority = parse_priority,
+    serve = serve,
+    DEFAULT_OPTIONS = DEFAULT_OPTIONS,
+}
@@ -0,0 +1,212 @@
+-- http.idle_watcher
+--
+-- Idle keep-alive connections parked without a fiber each. The fiber of
+-- a parked connection ends, its socket is registered in an epoll instance
+-- watched by a single fiber, and a worker fiber takes the connection over
+-- when it becomes readable. Idle timeouts are kept in a timer wheel.
+-- Workers are reused, so their number follows the number of requests
+-- being served rather than the number of open connections.
+--
+-- Works on Linux with the sockets of the socket module.
+
+local bit = require('bit')
+local ffi = require('ffi')
+local fiber = require('fiber')
+local log = require('log')
+local socket = require('socket')
+
+local supported = ffi.os == 'Linux'
+
+if supported then
+    -- The event is packed on x86_64 only, see <sys/epoll.h>.
+    local event = ffi.arch == 'x64' and
+        'struct http_epoll_event { uint32_t events; uint64_t data; } ' ..
+        '__attribute__((packed));' or
+        'struct http_epoll_event { uint32_t events; uint64_t data; };'
+    ffi.cdef(event)
+    -- The functions may be declared by another module.
+    pcall(ffi.cdef, [[
+        int epoll_create1(int flags);
+        int epoll_ctl(int epfd, int op, int fd, void *event);
+        int epoll_wait(int epfd, void *events, int maxevents, int timeout);
+    ]])
+end
+
+local EPOLL_CLOEXEC = 0x80000
+local EPOLL_CTL_ADD = 1
+local EPOLL_CTL_DEL = 2
+local EPOLLIN = 0x001
+local EPOLLRDHUP = 0x2000
+
+-- Events taken by one epoll_wait().
+local MAX_EVENTS = 256
+-- Seconds a worker waits for the next connection before it ends.
+local WORKER_IDLE_TIMEOUT = 10
+
+local DEFAULT_OPTIONS = {
+    -- Resolution of the idle timeouts in seconds.
+    tick = 0.1,
+    -- Slots of the timer wheel, a timeout longer than `tick * slots`
+    -- stays in its slot for several turns.
+    slots = 1024,
+}
+
+-- Replaces close() and shutdown() of a parked socket: the server which
+-- accepted it closes the socket when the handler returns.
+local function keep_open()
+    return true
+end
+
+local watcher_methods = {}
+
+local function wheel_slot(self, deadline)
+    return math.ceil(deadline / self.tick) % self.nslots + 1
+end
+
+local function unpark(self, entry)
+    local s = entry.s
+    ffi.C.epoll_ctl(self.epfd, EPOLL_CTL_DEL, entry.fd, nil)
+    self.entries[entry.fd] = nil
+    self.parked = self.parked - 1
+    if entry.deadline ~= nil then
+        self.wheel[entry.slot][entry] = nil
+    end
+    rawset(s, 'close', nil)
+    rawset(s, 'shutdown', nil)
+end
+
+local function run(entry, f)
+    local ok, err = pcall(f, entry.s)
+    if not ok then
+        log.error('idle_watcher: %s', err)
+        entry.s:close()
+    end
+end
+
+-- Serves the woken connections until there are none for a while.
+local function worker_loop(self, entry)
+    self.workers = self.workers + 1
+    while entry ~= nil do
+        run(entry, entry.resume)
+        entry = self.jobs:get(WORKER_IDLE_TIMEOUT)
+    end
+    self.workers = self.workers - 1
+end
+
+-- Passes a woken connection to a waiting worker or starts a new one.
+local function wake(self, entry)
+    self.woken = self.woken + 1
+    if not self.jobs:put(entry, 0) then
+        local f = fiber.new(worker_loop, self, entry)
+        f:name('http.idle_worker', { truncate = true })
+    end
+end
+
+local function expire(self, now)
+    local current = math.floor(now / self.tick)
+    local first = math.max(self.last_tick + 1, current - self.nslots + 1)
+    for tick = first, current do
+        for entry in pairs(self.wheel[tick % self.nslots + 1]) do
+            if entry.deadline <= now then
+                unpark(self, entry)
+                self.expired = self.expired + 1
+                run(entry, entry.expire)
+            end
+        end
+    end
+    self.last_tick = current
+end
+
+local function watch_loop(self)
+    local events = ffi.new('struct http_epoll_event[?]', MAX_EVENTS)
+    while self.parked > 0 do
+        socket.iowait(self.epfd, 'R', self.tick)
+        local n = ffi.C.epoll_wait(self.epfd, events, MAX_EVENTS, 0)
+        for i = 0, n - 1 do
+            local entry = self.entries[tonumber(events[i].data)]
+            if entry ~= nil then
+                unpark(self, entry)
+                wake(self, entry)
+            end
+        end
+        expire(self, fiber.clock())
+    end
+    self.watcher = nil
+end
+
+-- Parks an idle socket with no buffered data. `resume(s)` is called in
+-- a worker fiber when the socket becomes readable, `expire(s)` when it has
+-- been idle for `timeout` seconds. Both must close the socket unless they
+-- park it again. Returns false if the socket can not be parked.
+function watcher_methods.park(self, s, timeout, resume, expire_f)
+    if self.epfd == nil then
+        local epfd = ffi.C.epoll_create1(EPOLL_CLOEXEC)
+        if epfd < 0 then
+            return false
+        end
+        self.epfd = epfd
+    end
+    local fd = s:fd()
+    self.event.events = bit.bor(EPOLLIN, EPOLLRDHUP)
+    self.event.data = fd
+    if ffi.C.epoll_ctl(self.epfd, EPOLL_CTL_ADD, fd, self.event) ~= 0 then
+        return false
+    end
+    local entry = { s = s, fd = fd, resume = resume, expire = expire_f }
+    if timeout ~= nil and timeout > 0 then
+        entry.deadline = fiber.clock() + timeout
+        entry.slot = wheel_slot(self, entry.deadline)
+        self.wheel[entry.slot][entry] = true
+    end
+    self.entries[fd] = entry
+    self.parked = self.parked + 1
+    rawset(s, 'close', keep_open)
+    rawset(s, 'shutdown', keep_open)
+    if self.watcher == nil then
+        self.last_tick = math.floor(fiber.clock() / self.tick)
+        self.watcher = fiber.new(watch_loop, self)
+        self.watcher:name('http.idle_watcher', { truncate = true })
+    end
+    return true
+end
+
+function watcher_methods.stats(self)
+    return {
+        parked = self.parked,
+        workers = self.workers,
+        woken = self.woken,
+        expired = self.expired,
+    }
+end
+
+local watcher_mt = { __index = watcher_methods }
+
+local function new(opts)
+    opts = opts or {}
+    local nslots = opts.slots or DEFAULT_OPTIONS.slots
+    local wheel = {}
+    for i = 1, nslots do
+        wheel[i] = {}
+    end
+    return setmetatable({
+        tick = opts.tick or DEFAULT_OPTIONS.tick,
+        nslots = nslots,
+        wheel = wheel,
+        last_tick = 0,
+        entries = {},
+        event = supported and ffi.new('struct http_epoll_event') or nil,
+        jobs = fiber.channel(0),
+        parked = 0,
+        workers = 0,
+        woken = 0,
+        expired = 0,
+    }, watcher_mt)
+end
+
+return {
+    new = new,
+    supported = supported,
+    -- The watcher of the connections of all the servers.
+    shared = new(),
+    DEFAULT_OPTIONS = DEFAULT_OPTIONS,
+}
@@ -35,24 +35,55 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
 
 #include "tpleval.h"
 #include "httpfast.h"
+#include "websocket.h"
+#include "mpjson.h"
+#include "ratelimit.h"
+#include "xxhash.h"
+
+/* State of the code generator of a template. */
+struct tpl_codegen {
+	luaL_Buffer *b;
+	/* A text constant is open, the next text is appended to it. */
+	int in_text;
+};
+
+static void
+tpl_text_end(struct tpl_codegen *gen)
+{
+	if (gen->in_text) {
+		luaL_addstring(gen->b, "\") ");
+		gen->in_text = 0;
+	}
+}
 
 static void
 tpl_term(int type, const char *str, size_t len, void *data)
 {
-	luaL_Buffer *b = (luaL_Buffer *)data;
+	struct tpl_codegen *gen = (struct tpl_codegen *)data;
+	luaL_Buffer *b = gen->b;
 	size_t i;
 
 	switch(type) {
 		case TPE_TEXT:
-			luaL_addstring(b, "_i(\"");
+			/*
+			 * Adjacent text runs, e.g. lines, are merged into
+			 * one constant and one _i() call. A newline is
+			 * escaped with a line break, so the lines of the
+			 * code match the lines of the template.
+			 */
+			if (!gen->in_text) {
+				luaL_addstring(b, "_i(\"");
+				gen->in_text = 1;
+			}
 			for(i = 0; i < len; i++) {
 				switch(str[i]) {
 					case '\n':
-						luaL_addstring(b,
-								"\\n\" ..\n\"");
+						luaL_addstring(b, "\\\n");
 						break;
 					case '\r':
 						luaL_addstring(b,
@@ -65,10 +96,10 @@ tpl_term(int type, const char *str, size_t len, void *data)
 						break;
 				}
 			}
-			luaL_addstring(b, "\") ");
 			break;
 		case TPE_LINECODE:
 		case TPE_MULTILINE_CODE:
+			tpl_text_end(gen);
 			/* _i one line */
 			if (len > 1 && str[0] == '=' && str[1] == '=') {
 				luaL_addstring(b, "_i(");
@@ -91,6 +122,71 @@ tpl_term(int type, const char *str, size_t len, void *data)
 	}
 }
 
+static void
+tpl_codegen(luaL_Buffer *b, const char *str, size_t len)
+{
+	struct tpl_codegen gen = { b, 0 };
+	tpe_parse(str, len, tpl_term, &gen);
+	tpl_text_end(&gen);
+}
+
+#define TEMPLATE_OUT_MT "http.template.out"
+
+/*
+ * Output of a render. _i() and _q() append to it, the result is
+ * pushed once at the end, so rendering is linear in its size.
+ */
+struct tpl_out {
+	char *data;
+	size_t size;
+	size_t capacity;
+};
+
+static char *
+tpl_out_reserve(struct lua_State *L, struct tpl_out *out, size_t len)
+{
+	if (out->capacity - out->size < len) {
+		size_t capacity = out->capacity > 0 ? out->capacity * 2 : 4096;
+		while (capacity - out->size < len)
+			capacity *= 2;
+		char *data = realloc(out->data, capacity);
+		if (data == NULL)
+			luaL_error(L, "box.httpd.template: not enough memory");
+		out->data = data;
+		out->capacity = capacity;
+	}
+	return out->data + out->size;
+}
+
+static void
+tpl_out_add(struct lua_State *L, struct tpl_out *out, const char *str,
+	    size_t len)
+{
+	memcpy(tpl_out_reserve(L, out, len), str, len);
+	out->size += len;
+}
+
+static struct tpl_out *
+tpl_out_new(struct lua_State *L)
+{
+	struct tpl_out *out = lua_newuserdata(L, sizeof(*out));
+	out->data = NULL;
+	out->size = 0;
+	out->capacity = 0;
+	luaL_getmetatable(L, TEMPLATE_OUT_MT);
+	lua_setmetatable(L, -2);
+	return out;
+}
+
+static int
+lbox_httpd_template_out_gc(struct lua_State *L)
+{
+	struct tpl_out *out = luaL_checkudata(L, 1, TEMPLATE_OUT_MT);
+	free(out->data);
+	out->data = NULL;
+	return 0;
+}
+
 /**
  * This function exists because lua_tostring does not use
  * __tostring metamethod, and this metamethod has to be used
@@ -125,84 +221,168 @@ luaT_tolstring(lua_State *L, int idx, size_t *len)
 static int
 lbox_httpd_escape_html(struct lua_State *L)
 {
-	int idx  = lua_upvalueindex(1);
-
+	struct tpl_out *out = lua_touserdata(L, lua_upvalueindex(1));
 	int i, top = lua_gettop(L);
-	lua_rawgeti(L, idx, 1);
-
-	luaL_Buffer b;
-	luaL_buffinit(L, &b);
-
-	if (lua_isnil(L, -1)) {
-		luaL_addstring(&b, "");
-	} else {
-		luaL_addvalue(&b);
-	}
 
 	for (i = 1; i <= top; i++) {
-		const char *s = luaT_tolstring(L, i, NULL);
-		int str_idx = lua_gettop(L);
-		for (; *s; s++) {
+		size_t len;
+		const char *s = luaT_tolstring(L, i, &len);
+		const char *end = s + len;
+		const char *run = s;
+		for (; s < end; s++) {
+			const char *entity;
+			size_t entity_len;
 			switch(*s) {
 				case '&':
-					luaL_addstring(&b, "&amp;");
+					entity = "&amp;";
+					entity_len = 5;
 					break;
 				case '<':
-					luaL_addstring(&b, "&lt;");
+					entity = "&lt;";
+					entity_len = 4;
 					break;
 				case '>':
-					luaL_addstring(&b, "&gt;");
+					entity = "&gt;";
+					entity_len = 4;
 					break;
 				case '"':
-					luaL_addstring(&b, "&quot;");
+					entity = "&quot;";
+					entity_len = 6;
 					break;
 				case '\'':
-					luaL_addstring(&b, "&#39;");
+					entity = "&#39;";
+					entity_len = 5;
 					break;
 				default:
-					luaL_addchar(&b, *s);
-					break;
+					continue;
 			}
+			tpl_out_add(L, out, run, s - run);
+			tpl_out_add(L, out, entity, entity_len);
+			run = s + 1;
 		}
-		lua_remove(L, str_idx);
+		tpl_out_add(L, out, run, end - run);
+		lua_pop(L, 1);
 	}
-
-	luaL_pushresult(&b);
-	lua_rawseti(L, idx, 1);
 	return 0;
 }
 
 static int
 lbox_httpd_immediate_html(struct lua_State *L)
 {
-	int idx  = lua_upvalueindex(1);
-
-	int k = 0;
+	struct tpl_out *out = lua_touserdata(L, lua_upvalueindex(1));
 	int i, top = lua_gettop(L);
 
-	lua_rawgeti(L, idx, 1);
-	if (lua_isnil(L, -1)) {
-		lua_pop(L, 1);
-	} else {
-		++k;
-	}
-
-	lua_checkstack(L, top - 1);
 	for (i = 1; i <= top; i++) {
-		if (lua_isnil(L, i)) {
-			lua_pushliteral(L, "nil");
-			++k;
-			continue;
+		size_t len;
+		const char *s;
+		switch (lua_type(L, i)) {
+			case LUA_TNIL:
+				tpl_out_add(L, out, "nil", 3);
+				break;
+			case LUA_TSTRING:
+			case LUA_TNUMBER:
+				s = lua_tolstring(L, i, &len);
+				tpl_out_add(L, out, s, len);
+				break;
+			default:
+				return luaL_error(L, "attempt to concatenate a %s value",
+						  luaL_typename(L, i));
 		}
-		lua_pushvalue(L, i);
-		++k;
 	}
-
-	lua_concat(L, k);
-	lua_rawseti(L, idx, 1);
 	return 0;
 }
 
+/**
+ * Raises the error of a template function, which is on the top
+ * of the stack, prefixed with the line of the template.
+ */
+static int
+tpl_error(struct lua_State *L)
+{
+	lua_getfield(L, -1, "match");
+
+	lua_pushvalue(L, -2);
+	lua_pushliteral(L, ":(%d+):(.*)");
+	lua_call(L, 2, 2);
+
+	lua_getfield(L, -1, "format");
+	lua_pushliteral(L, "box.httpd.template: users template:%s: %s");
+	lua_pushvalue(L, -4);
+	lua_pushvalue(L, -4);
+	lua_call(L, 3, 1);
+
+	return lua_error(L);
+}
+
+/**
+ * Compiles a template to a chunk which returns the template
+ * function `function(_q, _i) ... end`. The variables of a render
+ * are looked up in the environment of the function, so the chunk
+ * does not depend on them: it is compiled once and can be dumped
+ * with string.dump().
+ */
+static int
+lbox_httpd_template_compile(struct lua_State *L)
+{
+	size_t len;
+	const char *str = luaL_checklstring(L, 1, &len);
+	const char *name = luaL_optstring(L, 2, "=template");
+
+	luaL_Buffer b;
+	luaL_buffinit(L, &b);
+	luaL_addstring(&b, "return function(_q, _i) ");
+	tpl_codegen(&b, str, len);
+	luaL_addstring(&b, " end");
+	luaL_pushresult(&b);
+
+	size_t src_len;
+	const char *src = lua_tolstring(L, -1, &src_len);
+	if (luaL_loadbuffer(L, src, src_len, name) != 0)
+		lua_error(L);
+	return 1;
+}
+
+/**
+ * Renders a template compiled by template_compile(). The variables
+ * are copied to the environment of the template function, globals
+ * are available through its metatable.
+ */
+static int
+tpl_render_compiled(struct lua_State *L)
+{
+	struct tpl_out *out = tpl_out_new(L);	/* 3. output */
+
+	lua_pushvalue(L, 1);
+	lua_call(L, 0, 1);		/* 4. template function */
+	if (!lua_isfunction(L, 4))
+		luaL_error(L, "box.httpd.template: not a compiled template");
+
+	lua_newtable(L);		/* environment */
+	lua_pushnil(L);
+	while (lua_next(L, 2) != 0) {
+		lua_pushvalue(L, -2);
+		lua_insert(L, -2);
+		lua_rawset(L, -4);
+	}
+	if (luaL_newmetatable(L, "http.template.env")) {
+		lua_pushvalue(L, LUA_GLOBALSINDEX);
+		lua_setfield(L, -2, "__index");
+	}
+	lua_setmetatable(L, -2);
+	lua_setfenv(L, 4);
+
+	lua_pushvalue(L, 3);		/* _q */
+	lua_pushcclosure(L, lbox_httpd_escape_html, 1);
+	lua_pushvalue(L, 3);		/* _i */
+	lua_pushcclosure(L, lbox_httpd_immediate_html, 1);
+
+	if (lua_pcall(L, 2, 0, 0) != 0)
+		return tpl_error(L);
+
+	lua_pushlstring(L, out->data, out->size);
+	return 1;
+}
+
 static int
 lbox_httpd_template(struct lua_State *L)
 {
@@ -214,8 +394,11 @@ lbox_httpd_template(struct lua_State *L)
 	if (!lua_istable(L, 2))
 		luaL_error(L, "usage: box.httpd.template(tpl, { var = val })");
 
+	if (lua_isfunction(L, 1))
+		return tpl_render_compiled(L);
 
-	lua_newtable(L);	/* 3. results (closure table) */
+
+	struct tpl_out *out = tpl_out_new(L);	/* 3. output */
 
 	lua_pushnil(L);		/* 4. place for prepared html */
 
@@ -251,7 +434,7 @@ lbox_httpd_template(struct lua_State *L)
 
 	luaL_addstring(&b, ") ");
 
-	tpe_parse(str, len, tpl_term, &b);
+	tpl_codegen(&b, str, len);
 
 	luaL_addstring(&b, " end");
 
@@ -270,30 +453,16 @@ lbox_httpd_template(struct lua_State *L)
 	/* stack:
 	   1 - user's template,
 	   2 - user's arglist
-	   3 - closure table
+	   3 - output
 	   4 - prepared html
 	   5 - compiled function
 	   ... function arguments
 	   */
 
-	if (lua_pcall(L, lua_gettop(L) - 5, 0, 0) != 0) {
-		lua_getfield(L, -1, "match");
+	if (lua_pcall(L, lua_gettop(L) - 5, 0, 0) != 0)
+		return tpl_error(L);
 
-		lua_pushvalue(L, -2);
-		lua_pushliteral(L, ":(%d+):(.*)");
-		lua_call(L, 2, 2);
-
-		lua_getfield(L, -1, "format");
-		lua_pushliteral(L, "box.httpd.template: users template:%s: %s");
-		lua_pushvalue(L, -4);
-		lua_pushvalue(L, -4);
-		lua_call(L, 3, 1);
-
-		lua_error(L);
-	}
-
-	lua_pushnumber(L, 1);
-	lua_rawget(L, 3);
+	lua_pushlstring(L, out->data, out->size);
 	lua_replace(L, 3);
 
 	return 2;
@@ -398,7 +567,7 @@ http_parser_on_request_line(void *uobj, const char *method, size_t method_len,
 	lua_rawset(L, -4);
 
 	lua_pushliteral(L, "proto");
-	lua_newtable(L);
+	lua_createtable(L, 2, 0);
 
 	lua_pushnumber(L, 1);
 	lua_pushnumber(L, http_major);
@@ -421,7 +590,7 @@ http_parser_on_response_line(void *uobj, unsigned code,
 	struct lua_State *L = (struct lua_State *)uobj;
 
 	lua_pushliteral(L, "proto");
-	lua_newtable(L);
+	lua_createtable(L, 2, 0);
 
 	lua_pushnumber(L, 1);
 	lua_pushnumber(L, http_major);
@@ -506,6 +675,104 @@ lbox_httpd_parse_request(struct lua_State *L)
 	return 1;
 }
 
+/*
+ * Returns the trimmed value of the header line `line` if the header is
+ * named `name`, compared case-insensitively, or NULL.
+ */
+static inline const char *
+fast_route_header(const char *line, size_t len, const char *name,
+		  size_t name_len, size_t *value_len)
+{
+	if (len <= name_len || line[name_len] != ':' ||
+	    strncasecmp(line, name, name_len) != 0)
+		return NULL;
+	const char *value = line + name_len + 1;
+	const char *end = line + len;
+	while (value < end && (*value == ' ' || *value == '\t'))
+		value++;
+	while (end > value && (end[-1] == ' ' || end[-1] == '\t'))
+		end--;
+	*value_len = end - value;
+	return value;
+}
+
+#define FAST_ROUTE_HEADER(line, len, name, value_len) \
+	fast_route_header(line, len, name, sizeof(name) - 1, value_len)
+
+/*
+ * fast_route_key(head) scans the head of a request without parsing it
+ * into tables. Returns the method and the target of the request separated
+ * by a space, which is the key of a fast route, and whether the connection
+ * is kept alive after the response, or nothing if the request can not be
+ * answered by a fast route: it is not HTTP/1.x or it has a body.
+ */
+static int
+lbox_httpd_fast_route_key(struct lua_State *L)
+{
+	size_t len;
+	const char *head = luaL_checklstring(L, 1, &len);
+	const char *end = head + len;
+
+	const char *target = memchr(head, ' ', len);
+	if (target == NULL || target == head)
+		return 0;
+	target++;
+	const char *proto = memchr(target, ' ', end - target);
+	if (proto == NULL || proto == target)
+		return 0;
+	const char *eol = memchr(proto, '\n', end - proto);
+	if (eol == NULL)
+		return 0;
+	size_t proto_len = eol - proto - 1;
+	if (proto_len > 0 && eol[-1] == '\r')
+		proto_len--;
+	if (proto_len != 8 || memcmp(proto + 1, "HTTP/1.", 7) != 0)
+		return 0;
+	int keepalive;
+	if (proto[8] == '1')
+		keepalive = 1;
+	else if (proto[8] == '0')
+		keepalive = 0;
+	else
+		return 0;
+
+	const char *line = eol + 1;
+	while (line < end) {
+		eol = memchr(line, '\n', end - line);
+		if (eol == NULL)
+			break;
+		size_t line_len = eol - line;
+		if (line_len > 0 && line[line_len - 1] == '\r')
+			line_len--;
+		if (line_len == 0)
+			break;
+		const char *value;
+		size_t value_len;
+		if ((value = FAST_ROUTE_HEADER(line, line_len, "connection",
+					       &value_len)) != NULL) {
+			if (value_len == 10 &&
+			    strncasecmp(value, "keep-alive", 10) == 0)
+				keepalive = 1;
+			else
+				keepalive = 0;
+		} else if ((value = FAST_ROUTE_HEADER(line, line_len,
+						      "content-length",
+						      &value_len)) != NULL) {
+			if (value_len != 1 || value[0] != '0')
+				return 0;
+		} else if (FAST_ROUTE_HEADER(line, line_len, "transfer-encoding",
+					     &value_len) != NULL) {
+			return 0;
+		}
+		line = eol + 1;
+	}
+
+	/* The key is a part of the head, no copying is needed. */
+	lua_pushlstring(L, head, proto - head);
+	lua_pushboolean(L, keepalive);
+	return 2;
+}
+
 static inline int
 httpd_on_param(void *uobj, const char *name, size_t name_len,
 	       const char *value, size_t value_len)
@@ -554,17 +821,313 @@ lbox_httpd_params(struct lua_State *L)
 	return 1;
 }
 
+/*
+ * Payloads up to this size are prepared on the C stack, larger ones in
+ * a userdata collected along with the rest of the garbage.
+ */
+#define WS_STACK_BUFFER_SIZE 4096
+
+static uint32_t
+ws_mask_to_number(const unsigned char mask[4])
+{
+	return ((uint32_t)mask[0] << 24) | ((uint32_t)mask[1] << 16) |
+	       ((uint32_t)mask[2] << 8) | (uint32_t)mask[3];
+}
+
+static void
+ws_mask_from_number(unsigned char mask[4], uint32_t number)
+{
+	mask[0] = (unsigned char)(number >> 24);
+	mask[1] = (unsigned char)(number >> 16);
+	mask[2] = (unsigned char)(number >> 8);
+	mask[3] = (unsigned char)number;
+}
+
+/*
+ * ws_parse_header(data) returns header_len, fin, opcode, payload_len and
+ * the masking key as a number (nil for an unmasked frame). If `data` is
+ * too short, returns 0 and the header length known so far; on a protocol
+ * error returns nil and an error message.
+ */
+static int
+lbox_httpd_ws_parse_header(struct lua_State *L)
+{
+	size_t len;
+	const char *data = luaL_checklstring(L, 1, &len);
+
+	struct ws_frame frame;
+	const char *error = NULL;
+	int rc = ws_parse_header(data, len, &frame, &error);
+	if (rc < 0) {
+		lua_pushnil(L);
+		lua_pushstring(L, error);
+		return 2;
+	}
+	if (rc == 0) {
+		lua_pushinteger(L, 0);
+		lua_pushinteger(L, frame.header_len);
+		return 2;
+	}
+	lua_pushinteger(L, frame.header_len);
+	lua_pushboolean(L, frame.fin);
+	lua_pushinteger(L, frame.opcode);
+	lua_pushnumber(L, (lua_Number)frame.payload_len);
+	if (frame.masked)
+		lua_pushnumber(L, ws_mask_to_number(frame.mask));
+	else
+		lua_pushnil(L);
+	return 5;
+}
+
+/* ws_unmask(data, mask[, offset]) returns `data` XORed with the key. */
+static int
+lbox_httpd_ws_unmask(struct lua_State *L)
+{
+	size_t len;
+	const char *data = luaL_checklstring(L, 1, &len);
+	unsigned char mask[4];
+	ws_mask_from_number(mask, (uint32_t)luaL_checknumber(L, 2));
+	size_t offset = (size_t)luaL_optinteger(L, 3, 0);
+
+	char stack_buf[WS_STACK_BUFFER_SIZE];
+	char *buf = stack_buf;
+	if (len > sizeof(stack_buf))
+		buf = (char *)lua_newuserdata(L, len);
+	ws_mask(buf, data, len, mask, offset);
+	lua_pushlstring(L, buf, len);
+	return 1;
+}
+
+/*
+ * ws_encode_frame(opcode, payload[, fin[, mask]]) returns a frame with
+ * the header and the payload in one string. `fin` is true by default,
+ * the payload is masked if `mask` is set.
+ */
+static int
+lbox_httpd_ws_encode_frame(struct lua_State *L)
+{
+	int opcode = luaL_checkint(L, 1);
+	size_t len;
+	const char *payload = luaL_optlstring(L, 2, "", &len);
+	int fin = lua_isnoneornil(L, 3) ? 1 : lua_toboolean(L, 3);
+	unsigned char mask_buf[4];
+	const unsigned char *mask = NULL;
+	if (!lua_isnoneornil(L, 4)) {
+		ws_mask_from_number(mask_buf, (uint32_t)luaL_checknumber(L, 4));
+		mask = mask_buf;
+	}
+
+	char stack_buf[WS_STACK_BUFFER_SIZE];
+	char *buf = stack_buf;
+	if (len + WS_MAX_HEADER_SIZE > sizeof(stack_buf))
+		buf = (char *)lua_newuserdata(L, len + WS_MAX_HEADER_SIZE);
+	size_t header_len = ws_encode_header(buf, fin, opcode, len, mask);
+	if (mask != NULL)
+		ws_mask(buf + header_len, payload, len, mask, 0);
+	else
+		memcpy(buf + header_len, payload, len);
+	lua_pushlstring(L, buf, header_len + len);
+	return 1;
+}
+
+static int
+lbox_httpd_ws_utf8_valid(struct lua_State *L)
+{
+	size_t len;
+	const char *data = luaL_checklstring(L, 1, &len);
+	lua_pushboolean(L, ws_utf8_valid(data, len));
+	return 1;
+}
+
+/* The buffer is kept between calls unless it has grown too big. */
+#define MPJSON_KEEP_BUFFER_SIZE (1024 * 1024)
+
+static struct mpjson_buf mpjson_buffer;
+
+/*
+ * msgpack_to_json(data[, names[, bare]]) encodes a MessagePack string as
+ * JSON. `names` is an array of field names, the elements of a top-level
+ * array are encoded as objects with these keys. If `bare` is true,
+ * the elements of a top-level array are returned without the brackets.
+ */
+static int
+lbox_httpd_msgpack_to_json(struct lua_State *L)
+{
+	size_t len;
+	const char *data = luaL_checklstring(L, 1, &len);
+	int bare = lua_toboolean(L, 3);
+
+	struct mpjson_names names_buf;
+	struct mpjson_names *names = NULL;
+	if (!lua_isnoneornil(L, 2)) {
+		luaL_checktype(L, 2, LUA_TTABLE);
+		size_t count = lua_objlen(L, 2);
+		names_buf.count = count;
+		names_buf.name = (const char **)lua_newuserdata(L,
+			count * (sizeof(*names_buf.name) +
+				 sizeof(*names_buf.len)) + 1);
+		names_buf.len = (size_t *)(names_buf.name + count);
+		for (size_t i = 0; i < count; i++) {
+			lua_rawgeti(L, 2, i + 1);
+			if (lua_type(L, -1) != LUA_TSTRING)
+				return luaL_error(L, "field name %d is not "
+						  "a string", (int)i + 1);
+			/* The string is referenced by the table. */
+			names_buf.name[i] = lua_tolstring(L, -1,
+							  &names_buf.len[i]);
+			lua_pop(L, 1);
+		}
+		names = &names_buf;
+	}
+
+	struct mpjson ctx;
+	mpjson_buffer.size = 0;
+	int rc = mpjson_encode(&ctx, &mpjson_buffer, data, len, names, bare);
+	if (rc == 0)
+		lua_pushlstring(L, mpjson_buffer.data, mpjson_buffer.size);
+	if (mpjson_buffer.capacity > MPJSON_KEEP_BUFFER_SIZE) {
+		free(mpjson_buffer.data);
+		memset(&mpjson_buffer, 0, sizeof(mpjson_buffer));
+	}
+	if (rc != 0)
+		return luaL_error(L, "msgpack_to_json: %s", ctx.error);
+	return 1;
+}
+
+/*
+ * etag(data) returns a weak entity tag of a response body, the XXH64 hash
+ * of the data in hex: W/"0123456789abcdef".
+ */
+static int
+lbox_httpd_etag(struct lua_State *L)
+{
+	static const char hex[] = "0123456789abcdef";
+	size_t len;
+	const char *data = luaL_checklstring(L, 1, &len);
+	uint64_t h = xxh64(data, len, 0);
+	char tag[] = "W/\"0123456789abcdef\"";
+	for (int i = 15; i >= 0; i--) {
+		tag[3 + i] = hex[h & 0xf];
+		h >>= 4;
+	}
+	lua_pushlstring(L, tag, sizeof(tag) - 1);
+	return 1;
+}
+
+#define RATE_LIMITER_MT "http.rate_limiter"
+
+/*
+ * rate_limiter(max_keys, rate, burst) returns a limiter allowing each key
+ * `rate` requests per second with bursts of `burst` requests and keeping
+ * the state of up to `max_keys` keys.
+ */
+static int
+lbox_httpd_rate_limiter(struct lua_State *L)
+{
+	lua_Integer max_keys = luaL_checkinteger(L, 1);
+	lua_Number rate = luaL_checknumber(L, 2);
+	lua_Integer burst = luaL_checkinteger(L, 3);
+	if (max_keys < 1 || max_keys > RL_MAX_KEYS)
+		return luaL_error(L, "rate_limiter: invalid max_keys");
+	if (!(rate > 0))
+		return luaL_error(L, "rate_limiter: rate must be positive");
+	if (burst < 1)
+		return luaL_error(L, "rate_limiter: burst must be positive");
+
+	struct rl_store *store = (struct rl_store *)
+		lua_newuserdata(L, sizeof(*store));
+	/* Make __gc safe if the allocation below fails. */
+	store->entries = NULL;
+	luaL_getmetatable(L, RATE_LIMITER_MT);
+	lua_setmetatable(L, -2);
+	if (rl_store_create(store, (uint32_t)max_keys, rate,
+			    (uint32_t)burst) != 0)
+		return luaL_error(L, "rate_limiter: out of memory");
+	return 1;
+}
+
+/*
+ * limiter:check(key[, now]) accounts a request of `key` and returns 0 if
+ * it is allowed or the number of seconds to wait. `now` is the time in
+ * seconds, the monotonic clock by default.
+ */
+static int
+lbox_httpd_rate_limiter_check(struct lua_State *L)
+{
+	struct rl_store *store = (struct rl_store *)
+		luaL_checkudata(L, 1, RATE_LIMITER_MT);
+	size_t len;
+	const char *key = luaL_checklstring(L, 2, &len);
+	double now;
+	if (lua_isnoneornil(L, 3)) {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		now = ts.tv_sec + ts.tv_nsec / 1e9;
+	} else {
+		now = luaL_checknumber(L, 3);
+	}
+	double wait = rl_check(store, key, len, now);
+	if (wait < 0)
+		return luaL_error(L, "rate_limiter: out of memory");
+	lua_pushnumber(L, wait);
+	return 1;
+}
+
+static int
+lbox_httpd_rate_limiter_size(struct lua_State *L)
+{
+	struct rl_store *store = (struct rl_store *)
+		luaL_checkudata(L, 1, RATE_LIMITER_MT);
+	lua_pushinteger(L, store->size);
+	return 1;
+}
+
+static int
+lbox_httpd_rate_limiter_gc(struct lua_State *L)
+{
+	struct rl_store *store = (struct rl_store *)
+		luaL_checkudata(L, 1, RATE_LIMITER_MT);
+	rl_store_destroy(store);
+	return 0;
+}
+
 LUA_API int
 luaopen_http_lib(lua_State *L)
 {
+	static const struct luaL_Reg rate_limiter_methods[] = {
+		{"check", lbox_httpd_rate_limiter_check},
+		{"size", lbox_httpd_rate_limiter_size},
+		{"__gc", lbox_httpd_rate_limiter_gc},
+		{NULL, NULL}
+	};
 	static const struct luaL_Reg reg[] = {
 		{"parse_response", lbox_http_parse_response},
 		{"template", lbox_httpd_template},
+		{"template_compile", lbox_httpd_template_compile},
 		{"_parse_request", lbox_httpd_parse_request},
 		{"params", lbox_httpd_params},
+		{"ws_parse_header", lbox_httpd_ws_parse_header},
+		{"ws_unmask", lbox_httpd_ws_unmask},
+		{"ws_encode_frame", lbox_httpd_ws_encode_frame},
+		{"ws_utf8_valid", lbox_httpd_ws_utf8_valid},
+		{"msgpack_to_json", lbox_httpd_msgpack_to_json},
+		{"rate_limiter", lbox_httpd_rate_limiter},
+		{"etag", lbox_httpd_etag},
+		{"fast_route_key", lbox_httpd_fast_route_key},
 		{NULL, NULL}
 	};
 
+	luaL_newmetatable(L, TEMPLATE_OUT_MT);
+	lua_pushcfunction(L, lbox_httpd_template_out_gc);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
+
+	luaL_newmetatable(L, RATE_LIMITER_MT);
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+	luaL_register(L, NULL, rate_limiter_methods);
+	lua_pop(L, 1);
+
 	luaL_register(L, "box._lib", reg);
 	return 1;
 }
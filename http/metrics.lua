@@ -0,0 +1,314 @@
+-- http.metrics
+--
+-- Built-in request instrumentation for http.server. Counters live in plain
+-- Lua tables keyed by route, method and status, so recording a request does
+-- not allocate once a combination has been seen.
+
+local DEFAULT_BUCKETS = {
+    0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05,
+    0.1, 0.25, 0.5, 1, 2.5, 5, 10,
+}
+
+local UNMATCHED_ROUTE = 'unmatched'
+
+local function errorf(fmt, ...)
+    error(string.format(fmt, ...))
+end
+
+local function validate_buckets(buckets)
+    if type(buckets) ~= 'table' or #buckets == 0 then
+        error('metrics.buckets must be a non-empty array of numbers')
+    end
+    for i, b in ipairs(buckets) do
+        if type(b) ~= 'number' then
+            errorf('metrics.buckets[%d] must be a number', i)
+        end
+        if i > 1 and b <= buckets[i - 1] then
+            error('metrics.buckets must be sorted in increasing order')
+        end
+    end
+end
+
+-- Checks the `metrics` option of http.server.new() and returns a normalized
+-- table or nil if metrics are disabled.
+local function parse_options(opts)
+    if opts == nil or opts == false then
+        return nil
+    end
+    if opts == true then
+        opts = {}
+    end
+    if type(opts) ~= 'table' then
+        error('Option metrics must be a boolean or a table.')
+    end
+    for k in pairs(opts) do
+        if k ~= 'path' and k ~= 'buckets' then
+            errorf("Unknown metrics option '%s'", k)
+        end
+    end
+    if opts.path ~= nil then
+        if type(opts.path) ~= 'string' or string.sub(opts.path, 1, 1) ~= '/' then
+            error("metrics.path must be a string starting with '/'")
+        end
+    end
+    if opts.buckets ~= nil then
+        validate_buckets(opts.buckets)
+    end
+    return {
+        path = opts.path,
+        buckets = opts.buckets or DEFAULT_BUCKETS,
+    }
+end
+
+local function new_route_stats(nbuckets)
+    local hist = {}
+    for i = 1, nbuckets + 1 do
+        hist[i] = 0
+    end
+    return {
+        requests = {},
+        hist = hist,
+        duration_sum = 0,
+        duration_count = 0,
+        bytes_in = 0,
+        bytes_out = 0,
+        cache_hits = 0,
+        cache_misses = 0,
+    }
+end
+
+local function route_label(route)
+    if route == nil then
+        return UNMATCHED_ROUTE
+    end
+    return route.endpoint.name or route.endpoint.path
+end
+
+local collector_methods = {}
+
+local function route_stats(self, route)
+    local label = route_label(route)
+    local stats = self.routes[label]
+    if stats == nil then
+        stats = new_route_stats(#self.buckets)
+        self.routes[label] = stats
+    end
+    return stats
+end
+
+function collector_methods.connection_opened(self)
+    self.active_connections = self.active_connections + 1
+    self.connections_total = self.connections_total + 1
+end
+
+function collector_methods.connection_closed(self)
+    self.active_connections = self.active_connections - 1
+end
+
+-- Accounts a single served request. `reused` is true when the request was
+-- received over a keep-alive connection that already served another one.
+function collector_methods.observe(self, route, method, status, duration,
+                                   bytes_in, bytes_out, reused)
+    local stats = route_stats(self, route)
+
+    local by_method = stats.requests[method]
+    if by_method == nil then
+        by_method = {}
+        stats.requests[method] = by_method
+    end
+    by_method[status] = (by_method[status] or 0) + 1
+
+    local buckets = self.buckets
+    local nbuckets = #buckets
+    local i = 1
+    while i <= nbuckets and duration > buckets[i] do
+        i = i + 1
+    end
+    stats.hist[i] = stats.hist[i] + 1
+    stats.duration_sum = stats.duration_sum + duration
+    stats.duration_count = stats.duration_count + 1
+
+    stats.bytes_in = stats.bytes_in + bytes_in
+    stats.bytes_out = stats.bytes_out + bytes_out
+
+    if reused then
+        self.keepalive_requests_total = self.keepalive_requests_total + 1
+    end
+end
+
+-- Accounts a lookup in the response cache of a route.
+function collector_methods.cache_lookup(self, route, hit)
+    local stats = route_stats(self, route)
+    if hit then
+        stats.cache_hits = stats.cache_hits + 1
+    else
+        stats.cache_misses = stats.cache_misses + 1
+    end
+end
+
+local function sorted_keys(tbl)
+    local keys = {}
+    for k in pairs(tbl) do
+        table.insert(keys, k)
+    end
+    table.sort(keys, function(a, b) return tostring(a) < tostring(b) end)
+    return keys
+end
+
+-- Returns a snapshot of all counters as a Lua table. Histogram buckets are
+-- cumulative, the last one is `+Inf`.
+function collector_methods.collect(self)
+    local routes = {}
+    for label, stats in pairs(self.routes) do
+        local requests = {}
+        for method, by_status in pairs(stats.requests) do
+            requests[method] = table.copy(by_status)
+        end
+        local buckets = {}
+        local acc = 0
+        for i = 1, #self.buckets + 1 do
+            acc = acc + stats.hist[i]
+            buckets[i] = { le = self.buckets[i] or math.huge, count = acc }
+        end
+        routes[label] = {
+            requests = requests,
+            duration = {
+                buckets = buckets,
+                sum = stats.duration_sum,
+                count = stats.duration_count,
+            },
+            bytes_in = stats.bytes_in,
+            bytes_out = stats.bytes_out,
+            cache_hits = stats.cache_hits,
+            cache_misses = stats.cache_misses,
+        }
+    end
+    return {
+        routes = routes,
+        active_connections = self.active_connections,
+        connections_total = self.connections_total,
+        keepalive_requests_total = self.keepalive_requests_total,
+    }
+end
+
+local function escape_label(value)
+    return (string.gsub(tostring(value), '[\\"\n]', {
+        ['\\'] = '\\\\',
+        ['"'] = '\\"',
+        ['\n'] = '\\n',
+    }))
+end
+
+local function format_number(v)
+    if v == math.huge then
+        return '+Inf'
+    end
+    return string.format('%.16g', v)
+end
+
+-- Renders all counters in the Prometheus text exposition format.
+function collector_methods.render(self)
+    local out = {}
+    local function add(...)
+        table.insert(out, table.concat({ ... }))
+    end
+
+    local snapshot = self:collect()
+    local labels = sorted_keys(snapshot.routes)
+
+    add('# HELP http_server_requests_total Total number of served requests.')
+    add('# TYPE http_server_requests_total counter')
+    for _, label in ipairs(labels) do
+        local requests = snapshot.routes[label].requests
+        for _, method in ipairs(sorted_keys(requests)) do
+            for _, status in ipairs(sorted_keys(requests[method])) do
+                add('http_server_requests_total{route="', escape_label(label),
+                    '",method="', escape_label(method),
+                    '",status="', status, '"} ',
+                    format_number(requests[method][status]))
+            end
+        end
+    end
+
+    add('# HELP http_server_request_duration_seconds Request processing time.')
+    add('# TYPE http_server_request_duration_seconds histogram')
+    for _, label in ipairs(labels) do
+        local duration = snapshot.routes[label].duration
+        local route = escape_label(label)
+        for _, b in ipairs(duration.buckets) do
+            add('http_server_request_duration_seconds_bucket{route="', route,
+                '",le="', format_number(b.le), '"} ', format_number(b.count))
+        end
+        add('http_server_request_duration_seconds_sum{route="', route, '"} ',
+            format_number(duration.sum))
+        add('http_server_request_duration_seconds_count{route="', route, '"} ',
+            format_number(duration.count))
+    end
+
+    add('# HELP http_server_request_bytes_total Bytes received from clients.')
+    add('# TYPE http_server_request_bytes_total counter')
+    for _, label in ipairs(labels) do
+        add('http_server_request_bytes_total{route="', escape_label(label), '"} ',
+            format_number(snapshot.routes[label].bytes_in))
+    end
+
+    add('# HELP http_server_response_bytes_total Bytes sent to clients.')
+    add('# TYPE http_server_response_bytes_total counter')
+    for _, label in ipairs(labels) do
+        add('http_server_response_bytes_total{route="', escape_label(label), '"} ',
+            format_number(snapshot.routes[label].bytes_out))
+    end
+
+    add('# HELP http_server_cache_requests_total Response cache lookups.')
+    add('# TYPE http_server_cache_requests_total counter')
+    for _, label in ipairs(labels) do
+        local route = snapshot.routes[label]
+        if route.cache_hits + route.cache_misses > 0 then
+            add('http_server_cache_requests_total{route="', escape_label(label),
+                '",result="hit"} ', format_number(route.cache_hits))
+            add('http_server_cache_requests_total{route="', escape_label(label),
+                '",result="miss"} ', format_number(route.cache_misses))
+        end
+    end
+
+    add('# HELP http_server_active_connections Currently open client connections.')
+    add('# TYPE http_server_active_connections gauge')
+    add('http_server_active_connections ', format_number(snapshot.active_connections))
+
+    add('# HELP http_server_connections_total Total number of accepted connections.')
+    add('# TYPE http_server_connections_total counter')
+    add('http_server_connections_total ', format_number(snapshot.connections_total))
+
+    add('# HELP http_server_keepalive_requests_total Requests served over a reused connection.')
+    add('# TYPE http_server_keepalive_requests_total counter')
+    add('http_server_keepalive_requests_total ',
+        format_number(snapshot.keepalive_requests_total))
+
+    return table.concat(out, '\n') .. '\n'
+end
+
+function collector_methods.reset(self)
+    self.routes = {}
+    self.connections_total = 0
+    self.keepalive_requests_total = 0
+end
+
+local collector_mt = { __index = collector_methods }
+
+local function new(opts)
+    opts = opts or {}
+    return setmetatable({
+        buckets = opts.buckets or DEFAULT_BUCKETS,
+        routes = {},
+        active_connections = 0,
+        connections_total = 0,
+        keepalive_requests_total = 0,
+    }, collector_mt)
+end
+
+return {
+    new = new,
+    parse_options = parse_options,
+    DEFAULT_BUCKETS = DEFAULT_BUCKETS,
+    UNMATCHED_ROUTE = UNMATCHED_ROUTE,
+}
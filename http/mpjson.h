@@ -0,0 +1,642 @@
+/*
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef MPJSON_H_INCLUDED
+#define MPJSON_H_INCLUDED
+
+/*
+ * Encoding of MessagePack data, e.g. box tuples, as JSON without
+ * decoding it into Lua values.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MPJSON_MAX_DEPTH 128
+
+/* Tarantool MessagePack extension types. */
+enum {
+	MPJSON_EXT_DECIMAL = 1,
+	MPJSON_EXT_UUID = 2,
+	MPJSON_EXT_DATETIME = 4
+};
+
+struct mpjson_buf {
+	char *data;
+	size_t size;
+	size_t capacity;
+};
+
+/* Field names of tuples, tuples are encoded as JSON objects. */
+struct mpjson_names {
+	const char **name;
+	size_t *len;
+	size_t count;
+};
+
+struct mpjson {
+	struct mpjson_buf *buf;
+	const unsigned char *pos;
+	const unsigned char *end;
+	const char *error;
+	char error_buf[64];
+};
+
+/* 0 - as is, 'u' - \u00XX, otherwise the character after a backslash. */
+static const char mpjson_escape[256] = {
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+	'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+	['"'] = '"', ['\\'] = '\\',
+};
+
+static inline int
+mpjson_reserve(struct mpjson *ctx, size_t len)
+{
+	struct mpjson_buf *buf = ctx->buf;
+	if (buf->size + len <= buf->capacity)
+		return 0;
+	size_t capacity = buf->capacity > 0 ? buf->capacity : 4096;
+	while (capacity < buf->size + len)
+		capacity *= 2;
+	char *data = (char *)realloc(buf->data, capacity);
+	if (data == NULL) {
+		ctx->error = "not enough memory";
+		return -1;
+	}
+	buf->data = data;
+	buf->capacity = capacity;
+	return 0;
+}
+
+static inline int
+mpjson_append(struct mpjson *ctx, const char *data, size_t len)
+{
+	if (mpjson_reserve(ctx, len) != 0)
+		return -1;
+	memcpy(ctx->buf->data + ctx->buf->size, data, len);
+	ctx->buf->size += len;
+	return 0;
+}
+
+static inline int
+mpjson_putc(struct mpjson *ctx, char c)
+{
+	if (mpjson_reserve(ctx, 1) != 0)
+		return -1;
+	ctx->buf->data[ctx->buf->size++] = c;
+	return 0;
+}
+
+static inline int
+mpjson_string(struct mpjson *ctx, const char *str, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	/* The worst case is \u00XX for every byte. */
+	if (mpjson_reserve(ctx, len * 6 + 2) != 0)
+		return -1;
+	char *out = ctx->buf->data + ctx->buf->size;
+	*out++ = '"';
+	const unsigned char *p = (const unsigned char *)str;
+	const unsigned char *end = p + len;
+	while (p < end) {
+		const unsigned char *run = p;
+		while (p < end && mpjson_escape[*p] == 0)
+			p++;
+		memcpy(out, run, p - run);
+		out += p - run;
+		if (p == end)
+			break;
+		char e = mpjson_escape[*p];
+		*out++ = '\\';
+		*out++ = e;
+		if (e == 'u') {
+			*out++ = '0';
+			*out++ = '0';
+			*out++ = hex[*p >> 4];
+			*out++ = hex[*p & 0xf];
+		}
+		p++;
+	}
+	*out++ = '"';
+	ctx->buf->size = out - ctx->buf->data;
+	return 0;
+}
+
+static inline int
+mpjson_uint(struct mpjson *ctx, uint64_t value)
+{
+	char tmp[20];
+	char *p = tmp + sizeof(tmp);
+	do {
+		*--p = '0' + value % 10;
+		value /= 10;
+	} while (value != 0);
+	return mpjson_append(ctx, p, tmp + sizeof(tmp) - p);
+}
+
+static inline int
+mpjson_int(struct mpjson *ctx, int64_t value)
+{
+	if (value >= 0)
+		return mpjson_uint(ctx, (uint64_t)value);
+	if (mpjson_putc(ctx, '-') != 0)
+		return -1;
+	return mpjson_uint(ctx, -(uint64_t)value);
+}
+
+/* The same precision as the default of the json module. */
+static inline int
+mpjson_double(struct mpjson *ctx, double value)
+{
+	if (value != value || value - value != 0)
+		return mpjson_append(ctx, "null", 4);
+	char tmp[32];
+	int len = snprintf(tmp, sizeof(tmp), "%.14g", value);
+	return mpjson_append(ctx, tmp, len);
+}
+
+static inline int
+mpjson_error(struct mpjson *ctx, const char *error)
+{
+	ctx->error = error;
+	return -1;
+}
+
+static inline int
+mpjson_truncated(struct mpjson *ctx)
+{
+	return mpjson_error(ctx, "truncated MessagePack data");
+}
+
+static inline uint64_t
+mpjson_load_be(const unsigned char *p, int len)
+{
+	uint64_t value = 0;
+	for (int i = 0; i < len; i++)
+		value = (value << 8) | p[i];
+	return value;
+}
+
+static inline uint64_t
+mpjson_load_le(const unsigned char *p, int len)
+{
+	uint64_t value = 0;
+	for (int i = len - 1; i >= 0; i--)
+		value = (value << 8) | p[i];
+	return value;
+}
+
+/* Reads a big-endian unsigned integer of `len` bytes. */
+static inline int
+mpjson_read_uint(struct mpjson *ctx, int len, uint64_t *value)
+{
+	if (ctx->end - ctx->pos < len)
+		return mpjson_truncated(ctx);
+	*value = mpjson_load_be(ctx->pos, len);
+	ctx->pos += len;
+	return 0;
+}
+
+static inline int
+mpjson_read_int(const unsigned char **pos, const unsigned char *end,
+		int64_t *value)
+{
+	const unsigned char *p = *pos;
+	if (p >= end)
+		return -1;
+	unsigned char c = *p++;
+	int len = 0;
+	int is_signed = 0;
+	if (c <= 0x7f) {
+		*value = c;
+	} else if (c >= 0xe0) {
+		*value = (int8_t)c;
+	} else if (c >= 0xcc && c <= 0xd3) {
+		len = 1 << ((c - 0xcc) & 3);
+		is_signed = c >= 0xd0;
+	} else {
+		return -1;
+	}
+	if (len > 0) {
+		if (end - p < len)
+			return -1;
+		uint64_t u = mpjson_load_be(p, len);
+		if (is_signed && len < 8 && (u >> (len * 8 - 1)))
+			u |= ~(uint64_t)0 << (len * 8);
+		*value = (int64_t)u;
+		p += len;
+	}
+	*pos = p;
+	return 0;
+}
+
+/*
+ * Decimal: the scale as a MessagePack integer and packed BCD digits with
+ * the sign in the last nibble. Encoded as a string, like the json module
+ * does.
+ */
+static inline int
+mpjson_decimal(struct mpjson *ctx, const unsigned char *p, size_t len)
+{
+	const unsigned char *end = p + len;
+	int64_t scale;
+	if (mpjson_read_int(&p, end, &scale) != 0 || p >= end ||
+	    scale > 1000 || scale < -1000)
+		return mpjson_error(ctx, "invalid decimal");
+	char digits[2 * 64];
+	size_t n = 0;
+	size_t nibbles = (end - p) * 2;
+	if (nibbles > sizeof(digits))
+		return mpjson_error(ctx, "invalid decimal");
+	for (size_t i = 0; i + 1 < nibbles; i++) {
+		unsigned d = i % 2 == 0 ? p[i / 2] >> 4 : p[i / 2] & 0xf;
+		if (d > 9)
+			return mpjson_error(ctx, "invalid decimal");
+		if (n > 0 || d != 0)
+			digits[n++] = '0' + d;
+	}
+	unsigned sign = end[-1] & 0xf;
+	if (mpjson_reserve(ctx, n + (scale > 0 ? scale : -scale) + 5) != 0)
+		return -1;
+	char *out = ctx->buf->data + ctx->buf->size;
+	*out++ = '"';
+	if ((sign == 0x0b || sign == 0x0d) && n > 0)
+		*out++ = '-';
+	if (n == 0) {
+		*out++ = '0';
+	} else if (scale <= 0) {
+		memcpy(out, digits, n);
+		out += n;
+		for (int64_t i = 0; i < -scale; i++)
+			*out++ = '0';
+	} else if ((int64_t)n > scale) {
+		memcpy(out, digits, n - scale);
+		out += n - scale;
+		*out++ = '.';
+		memcpy(out, digits + n - scale, scale);
+		out += scale;
+	} else {
+		*out++ = '0';
+		*out++ = '.';
+		for (int64_t i = n; i < scale; i++)
+			*out++ = '0';
+		memcpy(out, digits, n);
+		out += n;
+	}
+	*out++ = '"';
+	ctx->buf->size = out - ctx->buf->data;
+	return 0;
+}
+
+static inline int
+mpjson_uuid(struct mpjson *ctx, const unsigned char *p, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	if (len != 16)
+		return mpjson_error(ctx, "invalid uuid");
+	char tmp[38];
+	char *out = tmp;
+	*out++ = '"';
+	for (int i = 0; i < 16; i++) {
+		if (i == 4 || i == 6 || i == 8 || i == 10)
+			*out++ = '-';
+		*out++ = hex[p[i] >> 4];
+		*out++ = hex[p[i] & 0xf];
+	}
+	*out++ = '"';
+	return mpjson_append(ctx, tmp, out - tmp);
+}
+
+/*
+ * Datetime: little-endian seconds since the epoch, optionally followed by
+ * nanoseconds, the offset of the timezone in minutes and the timezone
+ * index. Encoded as an ISO 8601 string.
+ */
+static inline int
+mpjson_datetime(struct mpjson *ctx, const unsigned char *p, size_t len)
+{
+	if (len != 8 && len != 16)
+		return mpjson_error(ctx, "invalid datetime");
+	int64_t secs = (int64_t)mpjson_load_le(p, 8);
+	int32_t nsec = 0;
+	int16_t tzoffset = 0;
+	if (len == 16) {
+		nsec = (int32_t)mpjson_load_le(p + 8, 4);
+		tzoffset = (int16_t)mpjson_load_le(p + 12, 2);
+	}
+	time_t local = (time_t)(secs + tzoffset * 60);
+	struct tm tm;
+	if (gmtime_r(&local, &tm) == NULL)
+		return mpjson_error(ctx, "invalid datetime");
+	char tmp[64];
+	int n = snprintf(tmp, sizeof(tmp), "\"%04d-%02d-%02dT%02d:%02d:%02d",
+			 tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+			 tm.tm_hour, tm.tm_min, tm.tm_sec);
+	if (nsec > 0 && nsec < 1000000000) {
+		if (nsec % 1000000 == 0)
+			n += snprintf(tmp + n, sizeof(tmp) - n, ".%03d",
+				      nsec / 1000000);
+		else if (nsec % 1000 == 0)
+			n += snprintf(tmp + n, sizeof(tmp) - n, ".%06d",
+				      nsec / 1000);
+		else
+			n += snprintf(tmp + n, sizeof(tmp) - n, ".%09d", nsec);
+	}
+	if (tzoffset == 0) {
+		n += snprintf(tmp + n, sizeof(tmp) - n, "Z\"");
+	} else {
+		int offset = tzoffset < 0 ? -tzoffset : tzoffset;
+		n += snprintf(tmp + n, sizeof(tmp) - n, "%c%02d%02d\"",
+			      tzoffset < 0 ? '-' : '+', offset / 60,
+			      offset % 60);
+	}
+	return mpjson_append(ctx, tmp, n);
+}
+
+static inline int
+mpjson_ext(struct mpjson *ctx, int8_t type, const unsigned char *p,
+	   size_t len)
+{
+	switch (type) {
+	case MPJSON_EXT_DECIMAL:
+		return mpjson_decimal(ctx, p, len);
+	case MPJSON_EXT_UUID:
+		return mpjson_uuid(ctx, p, len);
+	case MPJSON_EXT_DATETIME:
+		return mpjson_datetime(ctx, p, len);
+	default:
+		snprintf(ctx->error_buf, sizeof(ctx->error_buf),
+			 "unsupported MessagePack extension type %d", type);
+		return mpjson_error(ctx, ctx->error_buf);
+	}
+}
+
+static inline int
+mpjson_value(struct mpjson *ctx, int depth,
+	     const struct mpjson_names *names);
+
+/* Reads the header of a string, a binary or an extension value. */
+static inline int
+mpjson_read_len(struct mpjson *ctx, int len_bytes, uint64_t *len)
+{
+	if (mpjson_read_uint(ctx, len_bytes, len) != 0)
+		return -1;
+	if ((uint64_t)(ctx->end - ctx->pos) < *len)
+		return mpjson_truncated(ctx);
+	return 0;
+}
+
+static inline int
+mpjson_str(struct mpjson *ctx, uint64_t len)
+{
+	const char *str = (const char *)ctx->pos;
+	ctx->pos += len;
+	return mpjson_string(ctx, str, len);
+}
+
+/* JSON object keys are strings, numeric keys are quoted. */
+static inline int
+mpjson_key(struct mpjson *ctx, int depth)
+{
+	if (ctx->pos >= ctx->end)
+		return mpjson_truncated(ctx);
+	unsigned char c = *ctx->pos;
+	if ((c >= 0xa0 && c <= 0xbf) || (c >= 0xd9 && c <= 0xdb))
+		return mpjson_value(ctx, depth, NULL);
+	if (c <= 0x7f || c >= 0xe0 || (c >= 0xca && c <= 0xd3)) {
+		if (mpjson_putc(ctx, '"') != 0 ||
+		    mpjson_value(ctx, depth, NULL) != 0)
+			return -1;
+		return mpjson_putc(ctx, '"');
+	}
+	return mpjson_error(ctx, "map key must be a string or a number");
+}
+
+static inline int
+mpjson_array(struct mpjson *ctx, uint64_t count, int depth,
+	     const struct mpjson_names *names)
+{
+	if (names != NULL) {
+		if (mpjson_putc(ctx, '{') != 0)
+			return -1;
+		for (uint64_t i = 0; i < count; i++) {
+			if (i > 0 && mpjson_putc(ctx, ',') != 0)
+				return -1;
+			if (i < names->count) {
+				if (mpjson_string(ctx, names->name[i],
+						  names->len[i]) != 0)
+					return -1;
+			} else if (mpjson_putc(ctx, '"') != 0 ||
+				   mpjson_uint(ctx, i + 1) != 0 ||
+				   mpjson_putc(ctx, '"') != 0) {
+				return -1;
+			}
+			if (mpjson_putc(ctx, ':') != 0 ||
+			    mpjson_value(ctx, depth + 1, NULL) != 0)
+				return -1;
+		}
+		return mpjson_putc(ctx, '}');
+	}
+	if (mpjson_putc(ctx, '[') != 0)
+		return -1;
+	for (uint64_t i = 0; i < count; i++) {
+		if (i > 0 && mpjson_putc(ctx, ',') != 0)
+			return -1;
+		if (mpjson_value(ctx, depth + 1, NULL) != 0)
+			return -1;
+	}
+	return mpjson_putc(ctx, ']');
+}
+
+static inline int
+mpjson_map(struct mpjson *ctx, uint64_t count, int depth)
+{
+	if (mpjson_putc(ctx, '{') != 0)
+		return -1;
+	for (uint64_t i = 0; i < count; i++) {
+		if (i > 0 && mpjson_putc(ctx, ',') != 0)
+			return -1;
+		if (mpjson_key(ctx, depth + 1) != 0 ||
+		    mpjson_putc(ctx, ':') != 0 ||
+		    mpjson_value(ctx, depth + 1, NULL) != 0)
+			return -1;
+	}
+	return mpjson_putc(ctx, '}');
+}
+
+/*
+ * Encodes the value at ctx->pos. An array is encoded as an object with
+ * `names` as keys if they are set.
+ */
+static inline int
+mpjson_value(struct mpjson *ctx, int depth, const struct mpjson_names *names)
+{
+	if (depth > MPJSON_MAX_DEPTH)
+		return mpjson_error(ctx, "too deep nesting");
+	if (ctx->pos >= ctx->end)
+		return mpjson_truncated(ctx);
+	unsigned char c = *ctx->pos++;
+	uint64_t u;
+	int64_t i;
+	if (c <= 0x7f)
+		return mpjson_uint(ctx, c);
+	if (c >= 0xe0)
+		return mpjson_int(ctx, (int8_t)c);
+	if (c <= 0x8f)
+		return mpjson_map(ctx, c & 0x0f, depth);
+	if (c <= 0x9f)
+		return mpjson_array(ctx, c & 0x0f, depth, names);
+	if (c <= 0xbf) {
+		u = c & 0x1f;
+		if ((uint64_t)(ctx->end - ctx->pos) < u)
+			return mpjson_truncated(ctx);
+		return mpjson_str(ctx, u);
+	}
+	switch (c) {
+	case 0xc0:
+		return mpjson_append(ctx, "null", 4);
+	case 0xc2:
+		return mpjson_append(ctx, "false", 5);
+	case 0xc3:
+		return mpjson_append(ctx, "true", 4);
+	case 0xc4: case 0xc5: case 0xc6:
+		/* Binary strings are encoded as strings. */
+		if (mpjson_read_len(ctx, 1 << (c - 0xc4), &u) != 0)
+			return -1;
+		return mpjson_str(ctx, u);
+	case 0xd9: case 0xda: case 0xdb:
+		if (mpjson_read_len(ctx, 1 << (c - 0xd9), &u) != 0)
+			return -1;
+		return mpjson_str(ctx, u);
+	case 0xca: {
+		if (mpjson_read_uint(ctx, 4, &u) != 0)
+			return -1;
+		uint32_t bits = (uint32_t)u;
+		float f;
+		memcpy(&f, &bits, sizeof(f));
+		return mpjson_double(ctx, f);
+	}
+	case 0xcb: {
+		if (mpjson_read_uint(ctx, 8, &u) != 0)
+			return -1;
+		double d;
+		memcpy(&d, &u, sizeof(d));
+		return mpjson_double(ctx, d);
+	}
+	case 0xcc: case 0xcd: case 0xce: case 0xcf:
+		if (mpjson_read_uint(ctx, 1 << (c - 0xcc), &u) != 0)
+			return -1;
+		return mpjson_uint(ctx, u);
+	case 0xd0: case 0xd1: case 0xd2: case 0xd3:
+		ctx->pos--;
+		if (mpjson_read_int(&ctx->pos, ctx->end, &i) != 0)
+			return mpjson_truncated(ctx);
+		return mpjson_int(ctx, i);
+	case 0xdc: case 0xdd:
+		if (mpjson_read_uint(ctx, c == 0xdc ? 2 : 4, &u) != 0)
+			return -1;
+		return mpjson_array(ctx, u, depth, names);
+	case 0xde: case 0xdf:
+		if (mpjson_read_uint(ctx, c == 0xde ? 2 : 4, &u) != 0)
+			return -1;
+		return mpjson_map(ctx, u, depth);
+	case 0xd4: case 0xd5: case 0xd6: case 0xd7: case 0xd8:
+	case 0xc7: case 0xc8: case 0xc9: {
+		if (c >= 0xd4) {
+			u = 1 << (c - 0xd4);
+		} else if (mpjson_read_uint(ctx, 1 << (c - 0xc7), &u) != 0) {
+			return -1;
+		}
+		if ((uint64_t)(ctx->end - ctx->pos) < u + 1)
+			return mpjson_truncated(ctx);
+		int8_t type = (int8_t)*ctx->pos;
+		const unsigned char *data = ctx->pos + 1;
+		ctx->pos += u + 1;
+		return mpjson_ext(ctx, type, data, u);
+	}
+	default:
+		return mpjson_error(ctx, "invalid MessagePack data");
+	}
+}
+
+/*
+ * Encodes a MessagePack value as JSON and appends it to `buf`. If `bare`
+ * is set, the value must be an array and its elements are encoded without
+ * the brackets, so that batches can be joined into one JSON array.
+ * `names`, if not NULL, apply to the elements of the top-level array.
+ *
+ * Returns 0 on success, -1 and sets *error otherwise. The error string is
+ * valid while `ctx` is.
+ */
+static inline int
+mpjson_encode(struct mpjson *ctx, struct mpjson_buf *buf, const char *data,
+	      size_t len, const struct mpjson_names *names, int bare)
+{
+	ctx->buf = buf;
+	ctx->pos = (const unsigned char *)data;
+	ctx->end = ctx->pos + len;
+	ctx->error = NULL;
+	if (!bare && names == NULL) {
+		if (mpjson_value(ctx, 1, NULL) != 0)
+			return -1;
+	} else {
+		if (ctx->pos >= ctx->end)
+			return mpjson_truncated(ctx);
+		unsigned char c = *ctx->pos++;
+		uint64_t count;
+		if (c >= 0x90 && c <= 0x9f) {
+			count = c & 0x0f;
+		} else if (c == 0xdc || c == 0xdd) {
+			if (mpjson_read_uint(ctx, c == 0xdc ? 2 : 4, &count) != 0)
+				return -1;
+		} else {
+			return mpjson_error(ctx, "an array is expected");
+		}
+		if (!bare && mpjson_putc(ctx, '[') != 0)
+			return -1;
+		for (uint64_t i = 0; i < count; i++) {
+			if (i > 0 && mpjson_putc(ctx, ',') != 0)
+				return -1;
+			if (mpjson_value(ctx, 2, names) != 0)
+				return -1;
+		}
+		if (!bare && mpjson_putc(ctx, ']') != 0)
+			return -1;
+	}
+	if (ctx->pos != ctx->end)
+		return mpjson_error(ctx, "trailing data after a MessagePack value");
+	return 0;
+}
+
+#endif /* MPJSON_H_INCLUDED */
@@ -0,0 +1,315 @@
+-- http.profiler
+--
+-- On-demand sampling profiler. LuaJIT's jit.profile, the engine of jit.p,
+-- samples the running Lua stack for a bounded window. Every sample is
+-- tagged with the route whose handler was running in the sampled fiber and
+-- counted by its collapsed stack, `route;outer;...;inner`, the input of
+-- flamegraph.pl and similar tools. The profiler is process-wide: there is
+-- one profile at a time for all the servers.
+
+local fiber = require('fiber')
+local json = require('json')
+local log = require('log')
+
+local has_profile, profile = pcall(require, 'jit.profile')
+
+local DEFAULT_OPTIONS = {
+    -- Seconds the profiler runs unless stopped earlier.
+    duration = 10,
+    -- Milliseconds between samples.
+    interval = 10,
+    -- Frames of a stack.
+    depth = 64,
+    -- Distinct stacks, the samples of other stacks are dropped.
+    max_stacks = 10000,
+}
+
+local MAX_DURATION = 600
+
+-- The tag of samples taken outside of the route handlers.
+local NO_ROUTE = '(no route)'
+
+local VMSTATE_FRAMES = {
+    G = ';[gc]',
+    J = ';[jit]',
+}
+
+local function errorf(fmt, ...)
+    error(string.format(fmt, ...))
+end
+
+-- The profile being collected or the last one.
+local state = {
+    running = false,
+    -- Incremented by every start, stops the timer of a stopped profile.
+    generation = 0,
+    opts = nil,
+    started = 0,
+    stopped = 0,
+    samples = 0,
+    dropped = 0,
+    stacks = {},
+    nstacks = 0,
+    routes = {},
+}
+
+-- Routes running in the fibers, by the coroutine of the fiber.
+local fiber_routes = setmetatable({}, { __mode = 'k' })
+
+local function check_integer(opts, name, max)
+    local value = opts[name]
+    if value ~= nil and (type(value) ~= 'number' or value < 1 or
+                         value ~= math.floor(value) or
+                         (max ~= nil and value > max)) then
+        if max ~= nil then
+            errorf('profiler.%s must be an integer between 1 and %d', name, max)
+        end
+        errorf('profiler.%s must be a positive integer', name)
+    end
+end
+
+-- Checks the options of start() and returns a normalized table.
+local function parse_start_options(opts)
+    opts = opts or {}
+    if type(opts) ~= 'table' then
+        error('profiler options must be a table')
+    end
+    for k in pairs(opts) do
+        if DEFAULT_OPTIONS[k] == nil then
+            errorf("Unknown profiler option '%s'", k)
+        end
+    end
+    if opts.duration ~= nil and
+       (type(opts.duration) ~= 'number' or not (opts.duration > 0) or
+        opts.duration > MAX_DURATION) then
+        errorf('profiler.duration must be a positive number of at most %d seconds',
+               MAX_DURATION)
+    end
+    check_integer(opts, 'interval', 1000)
+    check_integer(opts, 'depth', 1000)
+    check_integer(opts, 'max_stacks')
+    local res = {}
+    for k, v in pairs(DEFAULT_OPTIONS) do
+        res[k] = opts[k] or v
+    end
+    return res
+end
+
+-- Checks the `profiler` option of http.server.new() and returns
+-- a normalized table or nil if the profiler route is disabled.
+local function parse_options(opts)
+    if opts == nil or opts == false then
+        return nil
+    end
+    if type(opts) ~= 'table' then
+        error('Option profiler must be a table.')
+    end
+    for k in pairs(opts) do
+        if k ~= 'path' and k ~= 'token' then
+            errorf("Unknown profiler option '%s'", k)
+        end
+    end
+    if type(opts.path) ~= 'string' or string.sub(opts.path, 1, 1) ~= '/' then
+        error("profiler.path must be a string starting with '/'")
+    end
+    if type(opts.token) ~= 'string' or opts.token == '' then
+        error('profiler.token must be a non-empty string')
+    end
+    return {
+        path = opts.path,
+        token = opts.token,
+    }
+end
+
+local function on_sample(thread, samples, vmstate)
+    local route = fiber_routes[thread] or NO_ROUTE
+    local stack = route .. ';' ..
+                  profile.dumpstack(thread, 'FZ;', -state.opts.depth) ..
+                  (VMSTATE_FRAMES[vmstate] or '')
+    local stacks = state.stacks
+    local count = stacks[stack]
+    if count == nil then
+        if state.nstacks >= state.opts.max_stacks then
+            state.dropped = state.dropped + samples
+            return
+        end
+        state.nstacks = state.nstacks + 1
+        count = 0
+    end
+    stacks[stack] = count + samples
+    state.routes[route] = (state.routes[route] or 0) + samples
+    state.samples = state.samples + samples
+end
+
+local function is_running()
+    return state.running
+end
+
+-- Returns the summary of the running or the last profile.
+local function report()
+    local finished = state.running and fiber.time() or state.stopped
+    return {
+        running = state.running,
+        started = state.started,
+        duration = state.started > 0 and finished - state.started or 0,
+        interval = state.opts and state.opts.interval or nil,
+        samples = state.samples,
+        dropped = state.dropped,
+        stacks = state.nstacks,
+        routes = table.copy(state.routes),
+    }
+end
+
+-- Stops the profiler. Returns the report of the profile or nil if it is
+-- not running.
+local function stop()
+    if not state.running then
+        return nil
+    end
+    profile.stop()
+    state.running = false
+    state.stopped = fiber.time()
+    log.info('profiler: stopped after %.1f seconds, %d samples',
+             state.stopped - state.started, state.samples)
+    return report()
+end
+
+local function stop_after(generation, duration)
+    fiber.sleep(duration)
+    if state.running and state.generation == generation then
+        stop()
+    end
+end
+
+-- Starts a new profile, dropping the previous one. Returns true or nil and
+-- an error if the profiler is running or not available.
+local function start(opts)
+    opts = parse_start_options(opts)
+    if not has_profile then
+        return nil, 'jit.profile is not available'
+    end
+    if state.running then
+        return nil, 'profiler is already running'
+    end
+    state.generation = state.generation + 1
+    state.opts = opts
+    state.started = fiber.time()
+    state.stopped = 0
+    state.samples = 0
+    state.dropped = 0
+    state.stacks = {}
+    state.nstacks = 0
+    state.routes = {}
+    state.running = true
+    profile.start('i' .. opts.interval, on_sample)
+    local f = fiber.new(stop_after, state.generation, opts.duration)
+    f:name('http.profiler', { truncate = true })
+    log.info('profiler: started for %s seconds', opts.duration)
+    return true
+end
+
+-- Returns the collapsed stacks of the running or the last profile, one
+-- `stack count` line per stack, the most sampled first.
+local function collapsed()
+    local lines = {}
+    for stack, count in pairs(state.stacks) do
+        lines[#lines + 1] = { stack, count }
+    end
+    table.sort(lines, function(a, b)
+        if a[2] ~= b[2] then
+            return a[2] > b[2]
+        end
+        return a[1] < b[1]
+    end)
+    for i, line in ipairs(lines) do
+        lines[i] = line[1] .. ' ' .. line[2] .. '\n'
+    end
+    return table.concat(lines)
+end
+
+local function call_tail(thread, previous, ok, ...)
+    fiber_routes[thread] = previous
+    if not ok then
+        error((...), 0)
+    end
+    return ...
+end
+
+-- Calls `func` with the arguments, tagging the samples of the current
+-- fiber with `route`. The main coroutine can not be tagged.
+local function call(route, func, ...)
+    local thread = coroutine.running()
+    if thread == nil then
+        return func(...)
+    end
+    local previous = fiber_routes[thread]
+    fiber_routes[thread] = route
+    return call_tail(thread, previous, pcall(func, ...))
+end
+
+local function text_response(status, body)
+    return {
+        status = status,
+        headers = { ['content-type'] = 'text/plain; charset=utf-8' },
+        body = body,
+    }
+end
+
+local function json_response(status, data)
+    return {
+        status = status,
+        headers = { ['content-type'] = 'application/json; charset=utf-8' },
+        body = json.encode(data),
+    }
+end
+
+-- Returns the handler of the profiler route given the options normalized
+-- by parse_options(). A request must have the header
+-- `Authorization: Bearer <token>`. POST starts the profiler with the
+-- options given in the query string, DELETE stops it and GET returns
+-- the collapsed stacks or, with `?format=json`, the summary.
+local function handler(opts)
+    local authorization = 'Bearer ' .. opts.token
+    return function(req)
+        if req.headers.authorization ~= authorization then
+            local resp = text_response(401, 'Unauthorized')
+            resp.headers['www-authenticate'] = 'Bearer'
+            return resp
+        end
+        if req.method == 'POST' then
+            local start_opts = {}
+            for k in pairs(DEFAULT_OPTIONS) do
+                start_opts[k] = tonumber(req:query_param(k))
+            end
+            local ok, res, err = pcall(start, start_opts)
+            if not ok then
+                return text_response(400, tostring(res))
+            end
+            if res == nil then
+                return text_response(409, err)
+            end
+            return json_response(202, report())
+        elseif req.method == 'DELETE' then
+            stop()
+            return text_response(200, collapsed())
+        elseif req.method == 'GET' then
+            if req:query_param('format') == 'json' then
+                return json_response(200, report())
+            end
+            return text_response(200, collapsed())
+        end
+        return text_response(405, 'Method Not Allowed')
+    end
+end
+
+return {
+    start = start,
+    stop = stop,
+    is_running = is_running,
+    report = report,
+    collapsed = collapsed,
+    call = call,
+    handler = handler,
+    parse_options = parse_options,
+    DEFAULT_OPTIONS = DEFAULT_OPTIONS,
+}
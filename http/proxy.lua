@@ -0,0 +1,565 @@
+-- http.proxy
+--
+-- Reverse proxy routes. Requests are forwarded to upstream HTTP/1.1
+-- servers over pooled keep-alive connections; request and response bodies
+-- larger than a buffer are streamed. An upstream failing several times in
+-- a row is taken out of the balancing for a while.
+
+local lib = require('http.lib')
+local buffer_pool = require('http.buffer_pool')
+local clock = require('clock')
+local log = require('log')
+local socket = require('socket')
+
+local DEFAULT_OPTIONS = {
+    connect_timeout = 1,
+    timeout = 60,
+    retries = 1,
+    pool_size = 16,
+    idle_timeout = 30,
+    max_fails = 3,
+    fail_timeout = 10,
+    buffer_size = 65536,
+}
+
+local MAX_HEADER_SIZE = 65536
+
+-- Headers of a single connection, RFC 9110 7.6.1.
+local HOP_BY_HOP = {
+    ['connection'] = true,
+    ['keep-alive'] = true,
+    ['proxy-connection'] = true,
+    ['te'] = true,
+    ['trailer'] = true,
+    ['transfer-encoding'] = true,
+    ['upgrade'] = true,
+}
+
+-- Requests which may be sent again after a failure, RFC 9110 9.2.2.
+local IDEMPOTENT = {
+    GET = true, HEAD = true, OPTIONS = true, PUT = true, DELETE = true,
+}
+
+local function errorf(fmt, ...)
+    error(string.format(fmt, ...))
+end
+
+local function parse_upstream(value, i)
+    if type(value) ~= 'string' then
+        errorf('proxy.upstreams[%d] must be a string', i)
+    end
+    local host, port = string.match(value, '^([^:/]+):(%d+)$')
+    if host == nil then
+        errorf("proxy.upstreams[%d] must be 'host:port', got '%s'", i, value)
+    end
+    return {
+        name = value,
+        host = host,
+        port = tonumber(port),
+        idle = {},
+        active = 0,
+        fails = 0,
+        down_until = 0,
+        requests = 0,
+    }
+end
+
+-- Checks the `proxy` route option and returns a normalized table.
+local function parse_route_options(opts)
+    if type(opts) == 'string' then
+        opts = { upstreams = { opts } }
+    end
+    if type(opts) ~= 'table' then
+        error("'proxy' option should be a string or a table")
+    end
+    for k in pairs(opts) do
+        if DEFAULT_OPTIONS[k] == nil and k ~= 'upstreams' and k ~= 'strip_prefix' and
+           k ~= 'preserve_host' and k ~= 'headers' then
+            errorf("Unknown proxy option '%s'", k)
+        end
+    end
+    local upstreams = opts.upstreams
+    if type(upstreams) == 'string' then
+        upstreams = { upstreams }
+    end
+    if type(upstreams) ~= 'table' or #upstreams == 0 then
+        error('proxy.upstreams must be a non-empty array')
+    end
+    local res = {
+        upstreams = {},
+        strip_prefix = opts.strip_prefix,
+        preserve_host = opts.preserve_host == true,
+        headers = {},
+    }
+    for i, value in ipairs(upstreams) do
+        res.upstreams[i] = parse_upstream(value, i)
+    end
+    if opts.strip_prefix ~= nil and type(opts.strip_prefix) ~= 'string' then
+        error('proxy.strip_prefix must be a string')
+    end
+    if opts.preserve_host ~= nil and type(opts.preserve_host) ~= 'boolean' then
+        error('proxy.preserve_host must be a boolean')
+    end
+    if opts.headers ~= nil then
+        if type(opts.headers) ~= 'table' then
+            error('proxy.headers must be a table')
+        end
+        for k, v in pairs(opts.headers) do
+            res.headers[string.lower(k)] = v
+        end
+    end
+    for name, default in pairs(DEFAULT_OPTIONS) do
+        local value = opts[name]
+        if value == nil then
+            value = default
+        elseif type(value) ~= 'number' or value < 0 then
+            errorf('proxy.%s must be a non-negative number', name)
+        end
+        res[name] = value
+    end
+    for _, name in ipairs({ 'retries', 'pool_size', 'max_fails', 'buffer_size' }) do
+        if res[name] ~= math.floor(res[name]) then
+            errorf('proxy.%s must be an integer', name)
+        end
+    end
+    if res.buffer_size == 0 then
+        error('proxy.buffer_size must be positive')
+    end
+    return res
+end
+
+local function is_available(upstream, now)
+    return upstream.down_until <= now
+end
+
+-- Picks the available upstream with the fewest requests in progress,
+-- skipping the already tried ones. If all upstreams are down, the one
+-- which will be back first is tried anyway.
+local function pick_upstream(self, tried)
+    local now = clock.monotonic()
+    local best, fallback
+    local n = #self.upstreams
+    self.next = self.next % n + 1
+    for i = 0, n - 1 do
+        local upstream = self.upstreams[(self.next + i - 1) % n + 1]
+        if not tried[upstream] then
+            if is_available(upstream, now) then
+                if best == nil or upstream.active < best.active then
+                    best = upstream
+                end
+            elseif fallback == nil or upstream.down_until < fallback.down_until then
+                fallback = upstream
+            end
+        end
+    end
+    return best or fallback
+end
+
+local function mark_failure(self, upstream, err)
+    upstream.fails = upstream.fails + 1
+    log.warn('proxy: upstream %s failed: %s', upstream.name, err)
+    if upstream.fails >= self.max_fails and is_available(upstream, clock.monotonic()) then
+        upstream.down_until = clock.monotonic() + self.fail_timeout
+        log.warn('proxy: upstream %s is marked down for %s seconds',
+                 upstream.name, self.fail_timeout)
+    end
+end
+
+local function mark_success(upstream)
+    upstream.fails = 0
+    upstream.down_until = 0
+end
+
+-- Returns a pooled connection to the upstream or a new one. The second
+-- value tells whether the connection has been used before.
+local function acquire(self, upstream)
+    local now = clock.monotonic()
+    while #upstream.idle > 0 do
+        local conn = table.remove(upstream.idle)
+        -- A readable idle connection is closed by the upstream or broken.
+        if now - conn.since < self.idle_timeout and not conn.s:readable(0) then
+            buffer_pool.shared:attach(conn.s)
+            return conn.s, true
+        end
+        conn.s:close()
+    end
+    local s = socket.tcp_connect(upstream.host, upstream.port, self.connect_timeout)
+    if s == nil then
+        return nil
+    end
+    buffer_pool.shared:attach(s)
+    return s, false
+end
+
+local function release(self, upstream, s)
+    if #upstream.idle < self.pool_size then
+        -- An idle connection holds no read buffer.
+        buffer_pool.shared:detach(s)
+        table.insert(upstream.idle, { s = s, since = clock.monotonic() })
+    else
+        s:close()
+    end
+end
+
+local function build_request(self, req, upstream, content_length)
+    local path = req.path_raw or req.path
+    local prefix = self.strip_prefix
+    if prefix ~= nil and string.sub(path, 1, #prefix) == prefix then
+        path = string.sub(path, #prefix + 1)
+        if string.sub(path, 1, 1) ~= '/' then
+            path = '/' .. path
+        end
+    end
+    if req.query ~= nil and req.query ~= '' then
+        path = path .. '?' .. req.query
+    end
+
+    local skip = {}
+    if req.headers['connection'] ~= nil then
+        for token in string.gmatch(req.headers['connection'], '[^,%s]+') do
+            skip[string.lower(token)] = true
+        end
+    end
+    -- The upstream is given the time left before the deadline of
+    -- the request in the header the server takes it from.
+    local deadline = rawget(req, '_deadline')
+    local deadline_opts = req.httpd ~= nil and req.httpd.deadline or nil
+    local timeout_header = deadline ~= nil and deadline_opts ~= nil and
+                           deadline_opts.header or nil
+    if timeout_header ~= nil then
+        skip[timeout_header] = true
+    end
+    local lines = { string.format('%s %s HTTP/1.1\r\n', req.method, path) }
+    for k, v in pairs(req.headers) do
+        if not HOP_BY_HOP[k] and not skip[k] and self.headers[k] == nil and
+           k ~= 'host' and k ~= 'content-length' and k ~= 'expect' and
+           k ~= 'x-forwarded-for' then
+            table.insert(lines, k .. ': ' .. v .. '\r\n')
+        end
+    end
+    for k, v in pairs(self.headers) do
+        table.insert(lines, k .. ': ' .. v .. '\r\n')
+    end
+    local host = upstream.name
+    if self.preserve_host and req.headers['host'] ~= nil then
+        host = req.headers['host']
+    end
+    table.insert(lines, 'host: ' .. host .. '\r\n')
+    local peer = req.peer and req.peer.host
+    if peer ~= nil then
+        local forwarded = req.headers['x-forwarded-for']
+        table.insert(lines, 'x-forwarded-for: ' ..
+            (forwarded and forwarded .. ', ' .. peer or peer) .. '\r\n')
+    end
+    if req.headers['x-forwarded-proto'] == nil then
+        table.insert(lines, 'x-forwarded-proto: ' ..
+            (req.httpd ~= nil and req.httpd.use_tls and 'https' or 'http') .. '\r\n')
+    end
+    if timeout_header ~= nil then
+        table.insert(lines, string.format('%s: %.3f\r\n', timeout_header,
+            math.max(0, deadline - clock.monotonic())))
+    end
+    if content_length ~= nil then
+        table.insert(lines, 'content-length: ' .. content_length .. '\r\n')
+    end
+    table.insert(lines, '\r\n')
+    return table.concat(lines)
+end
+
+-- Set-Cookie values can not be joined into one header.
+local function split_set_cookie(head)
+    local cookies = {}
+    for name, value in string.gmatch(head, '\n([^:\r\n]+):[ \t]*([^\r\n]*)') do
+        if string.lower(name) == 'set-cookie' then
+            table.insert(cookies, value)
+        end
+    end
+    return cookies
+end
+
+-- Reads the response head, skipping interim responses. Returns the parsed
+-- response or nil and an error.
+local function read_response_head(self, s)
+    local start = clock.monotonic()
+    while true do
+        local head = s:read({ delimiter = { '\r\n\r\n', '\n\n' }, chunk = MAX_HEADER_SIZE },
+                            self.timeout)
+        if head == nil or head == '' then
+            if clock.monotonic() - start >= self.timeout then
+                return nil, 'timeout'
+            end
+            return nil, 'no response'
+        end
+        local resp = lib.parse_response(head)
+        if resp.error ~= nil or resp.status == nil then
+            return nil, 'invalid response: ' .. tostring(resp.error)
+        end
+        if resp.status >= 200 then
+            if resp.headers['set-cookie'] ~= nil then
+                resp.headers['set-cookie'] = split_set_cookie(head)
+            end
+            return resp
+        end
+    end
+end
+
+-- Returns the iterator of a streamed response body and a function closing
+-- the upstream connection if the body is not read to the end.
+local function response_body_iterator(self, upstream, s, framing, remaining, keepalive)
+    local done = false
+    local function finish(reusable)
+        done = true
+        upstream.active = upstream.active - 1
+        if reusable and keepalive then
+            release(self, upstream, s)
+        else
+            s:close()
+        end
+    end
+    local function close()
+        if not done then
+            finish(false)
+        end
+    end
+    local function gen()
+        if done then
+            return nil
+        end
+        if framing == 'chunked' then
+            local line = s:read('\r\n', self.timeout)
+            local size = line and tonumber(string.match(line, '^%s*(%x+)'), 16)
+            if size == nil then
+                return finish(false)
+            end
+            if size == 0 then
+                -- Trailers are dropped.
+                repeat
+                    line = s:read('\r\n', self.timeout)
+                until line == nil or line == '' or line == '\r\n'
+                return finish(line == '\r\n')
+            end
+            local data = s:read(size + 2, self.timeout)
+            if data == nil or #data < size + 2 then
+                return finish(false)
+            end
+            return true, string.sub(data, 1, size)
+        end
+        if remaining == 0 then
+            return finish(true)
+        end
+        local data = s:read(math.min(remaining, self.buffer_size), self.timeout)
+        if data == nil or data == '' then
+            -- The end of a response delimited by closing the connection.
+            return finish(false)
+        end
+        if remaining ~= math.huge then
+            remaining = remaining - #data
+        end
+        return true, data
+    end
+    return gen, close
+end
+
+-- Sends the request body to the upstream. Returns true or false and
+-- the side which failed: 'client' if the rest of the body can not be read
+-- from the client, 'upstream' if it can not be written.
+local function send_body(self, req, s, body, content_length)
+    if body ~= nil then
+        if body == '' or s:write(body, self.timeout) then
+            return true
+        end
+        return false, 'upstream'
+    end
+    local remaining = content_length
+    while remaining > 0 do
+        local chunk = req:read(math.min(remaining, self.buffer_size))
+        if chunk == nil or chunk == '' then
+            return false, 'client'
+        end
+        remaining = remaining - #chunk
+        if not s:write(chunk, self.timeout) then
+            return false, 'upstream'
+        end
+    end
+    return true
+end
+
+local proxy_methods = {}
+
+-- Forwards `req` to an upstream and returns a response table for
+-- the server.
+function proxy_methods.forward(self, req)
+    local content_length = tonumber(req.headers['content-length'])
+    -- Small bodies are read before connecting, so the request can be
+    -- retried even if the body is sent.
+    local body
+    if content_length == nil or content_length <= self.buffer_size then
+        body = req:read()
+    end
+    local retriable = IDEMPOTENT[req.method] and body ~= nil
+
+    local tried = {}
+    local attempts = 1 + self.retries
+    local last_err = 'no upstream available'
+    local attempt = 0
+    while attempt < attempts do
+        attempt = attempt + 1
+        local upstream = pick_upstream(self, tried)
+        if upstream == nil then
+            break
+        end
+        tried[upstream] = true
+        upstream.requests = upstream.requests + 1
+
+        local s, reused = acquire(self, upstream)
+        local resp, err, sent, failed_side
+        -- Whether a part of a streamed body is read from the client.
+        local consumed = false
+        if s == nil then
+            err = 'connection failed'
+        else
+            upstream.active = upstream.active + 1
+            local head = build_request(self, req, upstream, content_length)
+            if s:write(head, self.timeout) then
+                consumed = body == nil
+                sent, failed_side = send_body(self, req, s, body, content_length)
+            end
+            if sent then
+                resp, err = read_response_head(self, s)
+            else
+                err = 'write failed'
+            end
+            -- A response keeps the upstream active until its body is read.
+            if resp == nil then
+                upstream.active = upstream.active - 1
+            end
+        end
+
+        if resp ~= nil then
+            mark_success(upstream)
+            return self:respond(req, upstream, s, resp)
+        end
+
+        if s ~= nil then
+            s:close()
+        end
+        if failed_side == 'client' then
+            -- The client has not sent the whole body, the upstream is fine.
+            rawset(req, 'broken', true)
+            return { status = 400, body = 'Incomplete request body' }
+        end
+        if reused and not consumed and (not sent or retriable) then
+            -- The upstream has closed a pooled connection, it is not
+            -- a failure of the upstream itself.
+            tried[upstream] = nil
+            attempt = attempt - 1
+            reused = nil
+        else
+            mark_failure(self, upstream, err)
+            last_err = err
+            -- Only connection failures are safe to retry for other requests.
+            if not retriable and s ~= nil then
+                break
+            end
+        end
+    end
+    return {
+        status = last_err == 'timeout' and 504 or 502,
+        body = 'Upstream error: ' .. last_err,
+    }
+end
+
+function proxy_methods.respond(self, req, upstream, s, resp)
+    local headers = resp.headers
+    local skip = {}
+    if headers['connection'] ~= nil then
+        for token in string.gmatch(headers['connection'], '[^,%s]+') do
+            skip[string.lower(token)] = true
+        end
+    end
+    local keepalive = resp.proto[1] == 1 and resp.proto[2] >= 1 and
+                      not skip['close'] or skip['keep-alive']
+
+    local framing, length
+    if req.method == 'HEAD' or resp.status == 204 or resp.status == 304 then
+        length = 0
+    elseif headers['transfer-encoding'] ~= nil then
+        framing = 'chunked'
+    elseif headers['content-length'] ~= nil then
+        length = tonumber(headers['content-length'])
+        if length == nil or length < 0 or length ~= math.floor(length) then
+            upstream.active = upstream.active - 1
+            s:close()
+            return { status = 502, body = 'Upstream error: invalid content-length' }
+        end
+    else
+        length = math.huge
+        keepalive = false
+    end
+
+    local res_headers = {}
+    for k, v in pairs(headers) do
+        if not HOP_BY_HOP[k] and not skip[k] and k ~= 'content-length' then
+            res_headers[k] = v
+        end
+    end
+
+    if length ~= nil and length <= self.buffer_size then
+        upstream.active = upstream.active - 1
+        local body = ''
+        if length > 0 then
+            body = s:read(length, self.timeout)
+            if body == nil or #body < length then
+                s:close()
+                return { status = 502, body = 'Upstream error: incomplete response' }
+            end
+        end
+        if keepalive then
+            release(self, upstream, s)
+        else
+            s:close()
+        end
+        if req.method == 'HEAD' then
+            -- The length of the body the response would have.
+            res_headers['content-length'] = headers['content-length']
+            body = nil
+        end
+        return { status = resp.status, headers = res_headers, body = body }
+    end
+
+    local gen, close = response_body_iterator(self, upstream, s, framing, length,
+                                              keepalive)
+    return {
+        status = resp.status,
+        headers = res_headers,
+        body = { gen = gen, close = close },
+    }
+end
+
+function proxy_methods.stats(self)
+    local res = {}
+    local now = clock.monotonic()
+    for _, upstream in ipairs(self.upstreams) do
+        res[upstream.name] = {
+            requests = upstream.requests,
+            active = upstream.active,
+            idle = #upstream.idle,
+            fails = upstream.fails,
+            available = is_available(upstream, now),
+        }
+    end
+    return res
+end
+
+local proxy_mt = { __index = proxy_methods }
+
+local function new(opts)
+    opts.next = 0
+    return setmetatable(opts, proxy_mt)
+end
+
+return {
+    new = new,
+    parse_route_options = parse_route_options,
+    DEFAULT_OPTIONS = DEFAULT_OPTIONS,
+}
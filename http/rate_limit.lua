@@ -0,0 +1,144 @@
+-- http.rate_limit
+--
+-- Request rate limiting. Requests are grouped by a key, the client
+-- address by default, and each key is allowed `rate` requests per second
+-- with bursts of up to `burst` requests. The state of the keys is kept by
+-- lib.rate_limiter() in a fixed-size table, so a flood of new clients
+-- evicts the least recently seen ones instead of growing the memory.
+
+local lib = require('http.lib')
+local log = require('log')
+
+local DEFAULT_OPTIONS = {
+    key = 'peer',
+    max_keys = 65536,
+}
+
+-- The limit of lib.rate_limiter().
+local MAX_KEYS = 2^24
+
+local function errorf(fmt, ...)
+    error(string.format(fmt, ...))
+end
+
+-- Checks the `rate_limit` option of the server or, if `is_route` is set,
+-- of a route and returns a normalized table or nil if there is no limit.
+local function parse_options(opts, is_route)
+    if opts == nil or opts == false then
+        return nil
+    end
+    if type(opts) ~= 'table' then
+        if is_route then
+            error("'rate_limit' option should be a table")
+        end
+        error('Option rate_limit must be a table.')
+    end
+    for k in pairs(opts) do
+        if k ~= 'rate' and k ~= 'burst' and DEFAULT_OPTIONS[k] == nil then
+            errorf("Unknown rate_limit option '%s'", k)
+        end
+    end
+    if type(opts.rate) ~= 'number' or not (opts.rate > 0) then
+        error('rate_limit.rate must be a positive number')
+    end
+    if opts.burst ~= nil and
+       (type(opts.burst) ~= 'number' or opts.burst < 1 or
+        opts.burst ~= math.floor(opts.burst)) then
+        error('rate_limit.burst must be a positive integer')
+    end
+    if opts.max_keys ~= nil and
+       (type(opts.max_keys) ~= 'number' or opts.max_keys < 1 or
+        opts.max_keys ~= math.floor(opts.max_keys)) then
+        error('rate_limit.max_keys must be a positive integer')
+    end
+    if opts.max_keys ~= nil and opts.max_keys > MAX_KEYS then
+        errorf('rate_limit.max_keys must not exceed %d', MAX_KEYS)
+    end
+    local key = opts.key or DEFAULT_OPTIONS.key
+    local header
+    if type(key) == 'string' then
+        header = string.match(key, '^header:(.+)$')
+        if key ~= 'peer' and header == nil and
+           not (key == 'route' and is_route) then
+            if is_route then
+                error("rate_limit.key must be 'peer', 'route', " ..
+                      "'header:<name>' or a function")
+            end
+            error("rate_limit.key must be 'peer', 'header:<name>' or a function")
+        end
+    elseif type(key) ~= 'function' then
+        error('rate_limit.key must be a string or a function')
+    end
+    return {
+        rate = opts.rate,
+        burst = opts.burst or math.max(1, math.ceil(opts.rate)),
+        key = key,
+        header = header ~= nil and string.lower(header) or nil,
+        max_keys = opts.max_keys or DEFAULT_OPTIONS.max_keys,
+    }
+end
+
+local function peer_key(p)
+    local peer = p.peer
+    return peer ~= nil and peer.host or '-'
+end
+
+local limiter_methods = {}
+
+-- Returns the key of a request or nil if it is not limited.
+function limiter_methods.request_key(self, p)
+    local opts = self.opts
+    if opts.header ~= nil then
+        -- Requests without the header are limited by the address.
+        return p.headers[opts.header] or peer_key(p)
+    elseif opts.key == 'peer' then
+        return peer_key(p)
+    elseif opts.key == 'route' then
+        return ''
+    end
+    local ok, key = pcall(opts.key, p)
+    if not ok then
+        log.error('rate_limit: key function failed: %s', key)
+        return nil
+    end
+    return key ~= nil and tostring(key) or nil
+end
+
+-- Accounts a request. Returns nil if it is allowed or the number of
+-- seconds after which it would be allowed.
+function limiter_methods.check(self, p)
+    local key = self:request_key(p)
+    if key == nil then
+        return nil
+    end
+    local wait = self.store:check(key)
+    if wait == 0 then
+        return nil
+    end
+    self.rejected = self.rejected + 1
+    return wait
+end
+
+function limiter_methods.stats(self)
+    return {
+        keys = self.store:size(),
+        rejected = self.rejected,
+    }
+end
+
+local limiter_mt = { __index = limiter_methods }
+
+-- Returns a limiter given the options normalized by parse_options().
+local function new(opts)
+    return setmetatable({
+        opts = opts,
+        store = lib.rate_limiter(opts.max_keys, opts.rate, opts.burst),
+        rejected = 0,
+    }, limiter_mt)
+end
+
+return {
+    new = new,
+    parse_options = parse_options,
+    DEFAULT_OPTIONS = DEFAULT_OPTIONS,
+}
@@ -0,0 +1,250 @@
+/*
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef RATELIMIT_H_INCLUDED
+#define RATELIMIT_H_INCLUDED
+
+/*
+ * Rate limiting by the generic cell rate algorithm (GCRA). A key is
+ * allowed a request every `interval` seconds with bursts of up to
+ * `burst` requests. The state of a key is the theoretical arrival time
+ * of its next request, so a key takes one small fixed-size entry. The
+ * number of keys is bounded: when the store is full, the least recently
+ * used key is evicted, which can only make the limit less strict.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RL_NIL UINT32_MAX
+
+/* The maximal number of keys of a store. */
+#define RL_MAX_KEYS (1U << 24)
+
+/* Keys up to this size are stored in the entry itself. */
+#define RL_INLINE_KEY 40
+
+struct rl_entry {
+	uint64_t hash;
+	/* Theoretical arrival time. */
+	double tat;
+	/* Next entry in the bucket chain. */
+	uint32_t next;
+	/* Neighbours in the LRU list, the head is the most recent. */
+	uint32_t lru_prev;
+	uint32_t lru_next;
+	uint32_t key_len;
+	union {
+		char inline_key[RL_INLINE_KEY];
+		char *key;
+	};
+};
+
+struct rl_store {
+	double interval;
+	double tolerance;
+	uint32_t capacity;
+	uint32_t size;
+	uint32_t mask;
+	uint32_t *buckets;
+	struct rl_entry *entries;
+	uint32_t lru_head;
+	uint32_t lru_tail;
+};
+
+static inline uint64_t
+rl_hash(const char *key, size_t len)
+{
+	/* FNV-1a. */
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < len; i++) {
+		h ^= (unsigned char)key[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static inline const char *
+rl_entry_key(const struct rl_entry *e)
+{
+	return e->key_len <= RL_INLINE_KEY ? e->inline_key : e->key;
+}
+
+/*
+ * Initializes a store of up to `capacity` keys allowing `rate` requests
+ * per second with bursts of `burst` requests. Returns -1 if the capacity
+ * is out of range or there is not enough memory.
+ */
+static inline int
+rl_store_create(struct rl_store *store, uint32_t capacity, double rate,
+		uint32_t burst)
+{
+	memset(store, 0, sizeof(*store));
+	/* The limit keeps the allocation sizes below within size_t. */
+	if (capacity < 1 || capacity > RL_MAX_KEYS)
+		return -1;
+	uint32_t nbuckets = 1;
+	while (nbuckets < capacity)
+		nbuckets <<= 1;
+	store->interval = 1.0 / rate;
+	store->tolerance = store->interval * (burst - 1);
+	store->capacity = capacity;
+	store->mask = nbuckets - 1;
+	store->buckets = (uint32_t *)malloc((size_t)nbuckets * sizeof(uint32_t));
+	store->entries = (struct rl_entry *)malloc((size_t)capacity *
+						   sizeof(struct rl_entry));
+	if (store->buckets == NULL || store->entries == NULL) {
+		free(store->buckets);
+		free(store->entries);
+		return -1;
+	}
+	memset(store->buckets, 0xff, (size_t)nbuckets * sizeof(uint32_t));
+	store->lru_head = RL_NIL;
+	store->lru_tail = RL_NIL;
+	return 0;
+}
+
+static inline void
+rl_store_destroy(struct rl_store *store)
+{
+	if (store->entries == NULL)
+		return;
+	for (uint32_t i = 0; i < store->size; i++) {
+		if (store->entries[i].key_len > RL_INLINE_KEY)
+			free(store->entries[i].key);
+	}
+	free(store->buckets);
+	free(store->entries);
+	store->buckets = NULL;
+	store->entries = NULL;
+}
+
+static inline void
+rl_lru_unlink(struct rl_store *store, uint32_t i)
+{
+	struct rl_entry *e = &store->entries[i];
+	if (e->lru_prev != RL_NIL)
+		store->entries[e->lru_prev].lru_next = e->lru_next;
+	else
+		store->lru_head = e->lru_next;
+	if (e->lru_next != RL_NIL)
+		store->entries[e->lru_next].lru_prev = e->lru_prev;
+	else
+		store->lru_tail = e->lru_prev;
+}
+
+static inline void
+rl_lru_push(struct rl_store *store, uint32_t i)
+{
+	struct rl_entry *e = &store->entries[i];
+	e->lru_prev = RL_NIL;
+	e->lru_next = store->lru_head;
+	if (store->lru_head != RL_NIL)
+		store->entries[store->lru_head].lru_prev = i;
+	else
+		store->lru_tail = i;
+	store->lru_head = i;
+}
+
+/* Removes the least recently used entry and returns its index. */
+static inline uint32_t
+rl_evict(struct rl_store *store)
+{
+	uint32_t i = store->lru_tail;
+	struct rl_entry *e = &store->entries[i];
+	uint32_t *link = &store->buckets[e->hash & store->mask];
+	while (*link != i)
+		link = &store->entries[*link].next;
+	*link = e->next;
+	rl_lru_unlink(store, i);
+	if (e->key_len > RL_INLINE_KEY)
+		free(e->key);
+	return i;
+}
+
+/*
+ * Accounts a request of `key` at `now` seconds. Returns 0 if it is
+ * allowed, the number of seconds after which it would be allowed if it
+ * is not, or -1 if there is not enough memory.
+ */
+static inline double
+rl_check(struct rl_store *store, const char *key, size_t len, double now)
+{
+	uint64_t hash = rl_hash(key, len);
+	uint32_t *bucket = &store->buckets[hash & store->mask];
+	uint32_t i = *bucket;
+	while (i != RL_NIL) {
+		struct rl_entry *e = &store->entries[i];
+		if (e->hash == hash && e->key_len == len &&
+		    memcmp(rl_entry_key(e), key, len) == 0)
+			break;
+		i = e->next;
+	}
+
+	if (i == RL_NIL) {
+		char *copy = NULL;
+		if (len > RL_INLINE_KEY) {
+			copy = (char *)malloc(len);
+			if (copy == NULL)
+				return -1;
+			memcpy(copy, key, len);
+		}
+		if (store->size < store->capacity) {
+			i = store->size++;
+		} else {
+			i = rl_evict(store);
+			/* The eviction may have changed the chain. */
+			bucket = &store->buckets[hash & store->mask];
+		}
+		struct rl_entry *e = &store->entries[i];
+		e->hash = hash;
+		e->key_len = (uint32_t)len;
+		if (copy != NULL)
+			e->key = copy;
+		else
+			memcpy(e->inline_key, key, len);
+		e->tat = now;
+		e->next = *bucket;
+		*bucket = i;
+		rl_lru_push(store, i);
+	} else if (i != store->lru_head) {
+		rl_lru_unlink(store, i);
+		rl_lru_push(store, i);
+	}
+
+	struct rl_entry *e = &store->entries[i];
+	double tat = e->tat > now ? e->tat : now;
+	if (tat - now > store->tolerance)
+		return tat - now - store->tolerance;
+	e->tat = tat + store->interval;
+	return 0;
+}
+
+#endif /* RATELIMIT_H_INCLUDED */
@@ -0,0 +1,337 @@
+-- http.response_cache
+--
+-- In-memory cache of responses of routes declared with the `cache` option.
+-- Entries are kept in two LRU lists: a global one bounded by the server
+-- budget and a per-route one bounded by the route `max_bytes`.
+
+local clock = require('clock')
+
+local DEFAULT_MAX_BYTES = 64 * 1024 * 1024
+
+-- Approximate overhead of an entry in addition to its strings.
+local ENTRY_OVERHEAD = 256
+
+local function errorf(fmt, ...)
+    error(string.format(fmt, ...))
+end
+
+-- Checks the `cache` option of a route and returns a normalized table.
+local function parse_route_options(opts)
+    if type(opts) ~= 'table' then
+        error("'cache' option should be a table")
+    end
+    for k in pairs(opts) do
+        if k ~= 'ttl' and k ~= 'vary' and k ~= 'max_bytes' then
+            errorf("Unknown cache option '%s'", k)
+        end
+    end
+    if type(opts.ttl) ~= 'number' or opts.ttl <= 0 then
+        error('cache.ttl must be a positive number')
+    end
+    local vary = {}
+    if opts.vary ~= nil then
+        if type(opts.vary) ~= 'table' then
+            error('cache.vary must be an array of header names')
+        end
+        for i, name in ipairs(opts.vary) do
+            if type(name) ~= 'string' then
+                errorf('cache.vary[%d] must be a string', i)
+            end
+            vary[i] = string.lower(name)
+        end
+    end
+    if opts.max_bytes ~= nil and
+       (type(opts.max_bytes) ~= 'number' or opts.max_bytes <= 0) then
+        error('cache.max_bytes must be a positive number')
+    end
+    return {
+        ttl = opts.ttl,
+        vary = vary,
+        max_bytes = opts.max_bytes,
+    }
+end
+
+-- Collapses repeated slashes and drops the trailing one, so the paths
+-- matching the same route share an entry.
+local function normalize_path(path)
+    path = string.gsub(path, '//+', '/')
+    if #path > 1 and string.sub(path, -1) == '/' then
+        path = string.sub(path, 1, -2)
+    end
+    return path
+end
+
+local function normalize_query(query)
+    if query == nil or query == '' then
+        return ''
+    end
+    if string.find(query, '&', 1, true) == nil then
+        return query
+    end
+    local params = string.split(query, '&')
+    table.sort(params)
+    return table.concat(params, '&')
+end
+
+-- Returns the cache key of a request and its normalized path.
+local function request_key(route_opts, req)
+    local path = normalize_path(req.path)
+    local key = { req.method, ' ', path, '?', normalize_query(req.query) }
+    for _, name in ipairs(route_opts.vary) do
+        local value = req.headers[name]
+        if type(value) == 'table' then
+            value = table.concat(value, ', ')
+        end
+        table.insert(key, '\n')
+        table.insert(key, name)
+        table.insert(key, ':')
+        table.insert(key, value or '')
+    end
+    return table.concat(key), path
+end
+
+-- Adds the `vary` headers of the route to the Vary header of a response,
+-- so that downstream caches keep the variants apart. Returns `headers`.
+local function add_vary(route_opts, headers)
+    if #route_opts.vary == 0 then
+        return headers
+    end
+    local names = {}
+    local present = {}
+    local vary = headers['vary']
+    if type(vary) == 'string' and vary ~= '' then
+        table.insert(names, vary)
+        for name in string.gmatch(string.lower(vary), '[^,%s]+') do
+            present[name] = true
+        end
+    end
+    for _, name in ipairs(route_opts.vary) do
+        if not present[name] then
+            table.insert(names, name)
+        end
+    end
+    headers['vary'] = table.concat(names, ', ')
+    return headers
+end
+
+-- Only complete successful responses that are not private to a client
+-- are stored.
+local function is_cacheable(status, headers, body)
+    if status ~= 200 or type(body) ~= 'string' then
+        return false
+    end
+    if headers['set-cookie'] ~= nil then
+        return false
+    end
+    local cache_control = headers['cache-control']
+    if type(cache_control) == 'string' then
+        cache_control = string.lower(cache_control)
+        if string.find(cache_control, 'no-store', 1, true) or
+           string.find(cache_control, 'private', 1, true) then
+            return false
+        end
+    end
+    return true
+end
+
+local function entry_size(key, headers, body)
+    local size = ENTRY_OVERHEAD + #key + #body
+    for k, v in pairs(headers) do
+        size = size + #k + #tostring(v)
+    end
+    return size
+end
+
+-- Intrusive doubly-linked lists, `prev` and `next` are the names of the
+-- link fields so the same entry can be a member of several lists.
+local function list_new()
+    return { head = nil, tail = nil }
+end
+
+local function list_push_front(list, entry, prev, next)
+    entry[prev] = nil
+    entry[next] = list.head
+    if list.head ~= nil then
+        list.head[prev] = entry
+    else
+        list.tail = entry
+    end
+    list.head = entry
+end
+
+local function list_remove(list, entry, prev, next)
+    if entry[prev] ~= nil then
+        entry[prev][next] = entry[next]
+    else
+        list.head = entry[next]
+    end
+    if entry[next] ~= nil then
+        entry[next][prev] = entry[prev]
+    else
+        list.tail = entry[prev]
+    end
+    entry[prev] = nil
+    entry[next] = nil
+end
+
+local cache_methods = {}
+
+local function route_state(self, endpoint)
+    local state = self.by_route[endpoint]
+    if state == nil then
+        state = { lru = list_new(), bytes = 0 }
+        self.by_route[endpoint] = state
+    end
+    return state
+end
+
+local function remove_entry(self, entry)
+    local state = self.by_route[entry.endpoint]
+    list_remove(self.lru, entry, 'prev', 'next')
+    list_remove(state.lru, entry, 'route_prev', 'route_next')
+    self.entries[entry.key] = nil
+    self.bytes = self.bytes - entry.size
+    self.count = self.count - 1
+    state.bytes = state.bytes - entry.size
+end
+
+-- Returns a fresh entry for `key` or nil.
+function cache_methods.get(self, endpoint, key)
+    local entry = self.entries[key]
+    if entry == nil or entry.endpoint ~= endpoint then
+        self.misses = self.misses + 1
+        return nil
+    end
+    if entry.expires <= clock.monotonic() then
+        remove_entry(self, entry)
+        self.misses = self.misses + 1
+        return nil
+    end
+    local state = self.by_route[endpoint]
+    list_remove(self.lru, entry, 'prev', 'next')
+    list_push_front(self.lru, entry, 'prev', 'next')
+    list_remove(state.lru, entry, 'route_prev', 'route_next')
+    list_push_front(state.lru, entry, 'route_prev', 'route_next')
+    self.hits = self.hits + 1
+    return entry
+end
+
+-- Stores a response of the route `endpoint`, evicting least recently used
+-- entries to fit into the route and the global budgets. Returns true if
+-- the response has been stored.
+function cache_methods.put(self, endpoint, key, path, status, headers, body)
+    if not is_cacheable(status, headers, body) then
+        return false
+    end
+
+    local size = entry_size(key, headers, body)
+    local route_max = endpoint.cache.max_bytes
+    if size > self.max_bytes or (route_max ~= nil and size > route_max) then
+        return false
+    end
+
+    local old = self.entries[key]
+    if old ~= nil then
+        remove_entry(self, old)
+    end
+
+    local state = route_state(self, endpoint)
+    if route_max ~= nil then
+        while state.bytes + size > route_max do
+            remove_entry(self, state.lru.tail)
+            self.evictions = self.evictions + 1
+        end
+    end
+    while self.bytes + size > self.max_bytes do
+        remove_entry(self, self.lru.tail)
+        self.evictions = self.evictions + 1
+    end
+
+    local entry = {
+        key = key,
+        path = path,
+        endpoint = endpoint,
+        status = status,
+        headers = headers,
+        body = body,
+        size = size,
+        expires = clock.monotonic() + endpoint.cache.ttl,
+    }
+    list_push_front(self.lru, entry, 'prev', 'next')
+    list_push_front(state.lru, entry, 'route_prev', 'route_next')
+    self.entries[key] = entry
+    self.bytes = self.bytes + size
+    self.count = self.count + 1
+    state.bytes = state.bytes + size
+    return true
+end
+
+-- Removes entries matching all given conditions:
+--   * `endpoint` - entries of the route;
+--   * `prefix` - entries whose normalized path starts with the prefix.
+-- Without conditions the whole cache is dropped. Returns the number of
+-- removed entries.
+function cache_methods.invalidate(self, endpoint, prefix)
+    local removed = 0
+    local entry = self.lru.head
+    while entry ~= nil do
+        local next = entry.next
+        if (endpoint == nil or entry.endpoint == endpoint) and
+           (prefix == nil or string.sub(entry.path, 1, #prefix) == prefix) then
+            remove_entry(self, entry)
+            removed = removed + 1
+        end
+        entry = next
+    end
+    if endpoint ~= nil and prefix == nil then
+        self.by_route[endpoint] = nil
+    end
+    return removed
+end
+
+-- Changes the global budget, evicting least recently used entries when it
+-- shrinks.
+function cache_methods.set_max_bytes(self, max_bytes)
+    self.max_bytes = max_bytes
+    while self.bytes > max_bytes do
+        remove_entry(self, self.lru.tail)
+        self.evictions = self.evictions + 1
+    end
+end
+
+function cache_methods.stats(self)
+    return {
+        entries = self.count,
+        bytes = self.bytes,
+        max_bytes = self.max_bytes,
+        hits = self.hits,
+        misses = self.misses,
+        evictions = self.evictions,
+    }
+end
+
+local cache_mt = { __index = cache_methods }
+
+local function new(opts)
+    opts = opts or {}
+    return setmetatable({
+        max_bytes = opts.max_bytes or DEFAULT_MAX_BYTES,
+        entries = {},
+        by_route = setmetatable({}, { __mode = 'k' }),
+        lru = list_new(),
+        bytes = 0,
+        count = 0,
+        hits = 0,
+        misses = 0,
+        evictions = 0,
+    }, cache_mt)
+end
+
+return {
+    new = new,
+    parse_route_options = parse_route_options,
+    request_key = request_key,
+    add_vary = add_vary,
+    normalize_path = normalize_path,
+    DEFAULT_MAX_BYTES = DEFAULT_MAX_BYTES,
+}
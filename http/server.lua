@@ -8,11 +8,34 @@ local require = require
 local package = package
 local mime_types = require('http.mime_types')
 local codes = require('http.codes')
+local metrics = require('http.metrics')
+local response_cache = require('http.response_cache')
+local single_flight = require('http.single_flight')
+local http2 = require('http.http2')
+local websocket = require('http.websocket')
+local sse = require('http.sse')
+local proxy = require('http.proxy')
+local tuple_json = require('http.tuple_json')
+local template = require('http.template')
+local access_log = require('http.access_log')
+local rate_limit = require('http.rate_limit')
+local etag = require('http.etag')
+local buffer_pool = require('http.buffer_pool')
+local fast_route = require('http.fast_route')
+local profiler = require('http.profiler')
+local idle_watcher = require('http.idle_watcher')
+local deadline = require('http.deadline')
 
 local log = require('log')
 local socket = require('socket')
+local ffi = require('ffi')
 local json = require('json')
+local msgpack = require('msgpack')
 local errno = require 'errno'
+local clock = require('clock')
+local fiber = require('fiber')
+local table_new = require('table.new')
+local table_clear = require('table.clear')
 
 local DETACHED = 101
 
@@ -90,19 +113,20 @@ local function uri_escape(str)
 end
 
 local function uri_unescape(str, unescape_plus_sign)
-    local res = {}
     if type(str) == 'table' then
+        local res = {}
         for _, v in pairs(str) do
             table.insert(res, uri_unescape(v))
         end
-    else
-        if unescape_plus_sign ~= nil then
-            str = string.gsub(str, '+', ' ')
-        end
-
-        res = string.gsub(str, '%%([0-9a-fA-F][0-9a-fA-F])', unescape_char)
+        return res
     end
-    return res
+    if unescape_plus_sign ~= nil then
+        str = string.gsub(str, '+', ' ')
+    end
+    if not string.find(str, '%', 1, true) then
+        return str
+    end
+    return (string.gsub(str, '%%([0-9a-fA-F][0-9a-fA-F])', unescape_char))
 end
 
 local function extend(tbl, tblu, raise)
@@ -147,6 +171,36 @@ local function ucfirst(str)
     return str:gsub("^%l", string.upper, 1)
 end
 
+-- Header names and status lines of responses are formatted once.
+local MAX_HEADER_NAMES = 1024
+local header_names = {}
+local header_names_count = 0
+
+local function header_name(name)
+    local res = header_names[name]
+    if res == nil then
+        res = ucfirst(name)
+        if header_names_count < MAX_HEADER_NAMES then
+            header_names[name] = res
+            header_names_count = header_names_count + 1
+        end
+    end
+    return res
+end
+
+local status_lines = {}
+
+local function status_line(status)
+    local res = status_lines[status]
+    if res == nil then
+        res = sprintf("HTTP/1.1 %s %s\r\n", status, reason_by_code(status))
+        if codes[status] ~= nil then
+            status_lines[status] = res
+        end
+    end
+    return res
+end
+
 local function cached_query_param(self, name)
     if name == nil then
         return self.query_params
@@ -208,7 +262,23 @@ local function request_content_type(self)
                      '^(.*);.*')
 end
 
+-- Media types of MessagePack bodies.
+local MSGPACK_TYPES = {
+    ['application/msgpack'] = true,
+    ['application/x-msgpack'] = true,
+}
+
 local function post_param(self, name)
+    if MSGPACK_TYPES[self:content_type()] then
+        local params = self:msgpack()
+        if type(params) ~= 'table' then
+            params = {}
+        end
+        rawset(self, 'post_params', params)
+        rawset(self, 'post_param', cached_post_param)
+        return self:post_param(name)
+    end
+
     local body = self:read_cached()
 
     if body == '' then
@@ -383,6 +453,10 @@ local function url_for_helper(tx, name, args, query)
     return tx:url_for(name, args, query)
 end
 
+-- Cached templates are checked for changes at most once per this number
+-- of seconds.
+local TEMPLATE_CHECK_INTERVAL = 1
+
 local function load_template(self, r, format)
     if r.template ~= nil then
         return
@@ -404,30 +478,72 @@ local function load_template(self, r, format)
     end
 
     if self.options.cache_templates then
-        if self.cache.tpl[ file ] ~= nil then
-            return self.cache.tpl[ file ]
+        local chunk, err = self.cache.tpl:get(file)
+        if chunk == nil then
+            errorf("Can not load template for '%s': '%s'", r.path, err)
         end
+        return chunk
     end
 
-
     local tpl = catfile(self.options.app_dir, 'templates', file)
     local fh, err = fio.open(tpl)
     if err ~= nil then
         errorf("Can not load template for '%s': '%s'", r.path, err)
     end
 
-    local template
-    template, err = fh:read()
+    local source
+    source, err = fh:read()
     if err ~= nil then
         errorf("Can not load template for '%s': '%s'", r.path, err)
     end
 
     fh:close()
 
-    if self.options.cache_templates then
-        self.cache.tpl[ file ] = template
+    return template.compile(source, file)
+end
+
+-- Helpers bound to the request being rendered. They are created once per
+-- connection (or HTTP/2 stream) instead of on every render: requests of
+-- a connection are rendered one at a time.
+local bound_helpers = setmetatable({}, { __mode = 'k' })
+local helpers_generation = 0
+
+local function bind_helpers(tx)
+    local httpd = tx.httpd
+    local bound = bound_helpers[tx.s]
+    if bound ~= nil and bound.httpd == httpd and
+       bound.generation == helpers_generation then
+        return bound
+    end
+    bound = { httpd = httpd, generation = helpers_generation, helpers = {} }
+    for hname in pairs(httpd.helpers) do
+        bound.helpers[hname] = function(...)
+            return httpd.helpers[hname](bound.tx, ...)
+        end
+    end
+    if tx.s ~= nil then
+        bound_helpers[tx.s] = bound
     end
-    return template
+    return bound
+end
+
+-- Returns true if the Accept header lists a MessagePack media type with
+-- a quality not lower than the one of JSON.
+local function prefers_msgpack(accept)
+    if accept == nil or not string.find(accept, 'msgpack', 1, true) then
+        return false
+    end
+    local msgpack_q, json_q = 0, 0
+    for range in string.gmatch(accept, '[^,]+') do
+        local media = string.lower(string.match(range, '^%s*([^;%s]+)') or '')
+        local q = tonumber(string.match(range, ';%s*q=([%d.]+)')) or 1
+        if MSGPACK_TYPES[media] then
+            msgpack_q = math.max(msgpack_q, q)
+        elseif media == 'application/json' then
+            json_q = math.max(json_q, q)
+        end
+    end
+    return msgpack_q > 0 and msgpack_q >= json_q
 end
 
 local function render(tx, opts)
@@ -451,7 +567,23 @@ local function render(tx, opts)
             return resp
         end
 
-        if opts.json ~= nil then
+        local value = opts.negotiate
+        if value ~= nil then
+            resp.headers['vary'] = 'Accept'
+            if prefers_msgpack(tx.headers.accept) then
+                opts = { msgpack = value }
+            else
+                opts = { json = value }
+            end
+        end
+
+        if opts.msgpack ~= nil then
+            resp.headers['content-type'] = 'application/msgpack'
+            resp.body = msgpack.encode(opts.msgpack)
+            return resp
+        end
+
+        if opts.json ~= nil or opts.tuple ~= nil or opts.tuples ~= nil then
             if tx.httpd.options.charset ~= nil then
                 resp.headers['content-type'] =
                     sprintf('application/json; charset=%s',
@@ -460,7 +592,13 @@ local function render(tx, opts)
             else
                 resp.headers['content-type'] = 'application/json'
             end
-            resp.body = json.encode(opts.json)
+            if opts.json ~= nil then
+                resp.body = json.encode(opts.json)
+            else
+                -- Box data is encoded from MessagePack, without
+                -- converting it to Lua tables.
+                resp.body = tuple_json.render(opts)
+            end
             return resp
         end
 
@@ -481,6 +619,10 @@ local function render(tx, opts)
 
     if tx.endpoint.template ~= nil then
         tpl = tx.endpoint.template
+        if type(tpl) == 'function' then
+            tpl = tpl()
+        end
+        tpl = template.compile_cached(tpl)
     else
         tpl = load_template(tx.httpd, tx.endpoint, format)
         if tpl == nil then
@@ -488,18 +630,19 @@ local function render(tx, opts)
         end
     end
 
-    if type(tpl) == 'function' then
-        tpl = tpl()
-    end
-
-    for hname, sub in pairs(tx.httpd.helpers) do
-        vars[hname] = function(...) return sub(tx, ...) end
+    local bound = bind_helpers(tx)
+    for hname, sub in pairs(bound.helpers) do
+        vars[hname] = sub
     end
     vars.action = tx.endpoint.action
     vars.controller = tx.endpoint.controller
     vars.format = format
 
+    -- A helper may render another template.
+    local outer = bound.tx
+    bound.tx = tx
     resp.body = lib.template(tpl, vars)
+    bound.tx = outer
     resp.headers['content-type'] = type_by_format(format)
 
     if tx.httpd.options.charset ~= nil then
@@ -588,6 +731,192 @@ local function request_read(req, opts, timeout)
     return buf
 end
 
+-- Reads up to `size` bytes of a request body into `ptr`. The bytes read
+-- ahead by the socket are taken first, then the socket is read directly
+-- into `ptr`. Returns the number of bytes, 0 at EOF or nil on an error or
+-- a timeout.
+local function body_read_into(s, ptr, size, timeout)
+    local rbuf = s.rbuf
+    if rbuf ~= nil and rbuf:size() > 0 then
+        local n = math.min(rbuf:size(), size)
+        ffi.copy(ptr, rbuf.rpos, n)
+        rbuf.rpos = rbuf.rpos + n
+        return n
+    end
+    if s.read_into ~= nil then
+        return s:read_into(ptr, size, timeout)
+    elseif s.sysread == nil then
+        -- An HTTP/2 stream, its data is received in strings anyway.
+        local data = s:read(size, timeout)
+        if data == nil then
+            return nil
+        end
+        ffi.copy(ptr, data, #data)
+        return #data
+    end
+    local deadline = timeout ~= nil and clock.monotonic() + timeout or nil
+    while true do
+        local n = s:sysread(ptr, size)
+        if n ~= nil then
+            return n
+        end
+        local err = s:errno()
+        if err ~= errno.EAGAIN and err ~= errno.EINTR then
+            return nil
+        end
+        local left = deadline ~= nil and deadline - clock.monotonic() or nil
+        if left ~= nil and left <= 0 or not s:readable(left) then
+            return nil
+        end
+    end
+end
+
+local function body_remaining(req)
+    return req._remaining or tonumber(req.headers['content-length']) or 0
+end
+
+-- Appends up to `size` bytes of the request body, the rest of it by
+-- default, to the buffer.ibuf `buf`. Returns the number of bytes, 0 at
+-- the end of the body, or nil if the connection failed or timed out.
+local function request_read_into(req, buf, size, timeout)
+    local remaining = body_remaining(req)
+    if size == nil or size > remaining then
+        size = remaining
+    end
+    local deadline = timeout ~= nil and clock.monotonic() + timeout or nil
+    local total = 0
+    while total < size do
+        local ptr = buf:reserve(size - total)
+        local n = body_read_into(req.s, ptr, size - total,
+                                 deadline and deadline - clock.monotonic())
+        if n == nil or n == 0 then
+            -- The rest of the body is lost, the connection can not be reused.
+            req._remaining = 0
+            rawset(req, 'broken', true)
+            return nil
+        end
+        buf.wpos = buf.wpos + n
+        total = total + n
+    end
+    req._remaining = remaining - total
+    return total
+end
+
+-- Calls `decode(ptr, size)` on the rest of the request body, read into
+-- a buffer of the pool instead of a Lua string. Returns nil if the body
+-- is empty.
+local function decode_body(req, decode)
+    local data = req.cached_data
+    if data ~= nil then
+        -- The body is already read by read_cached().
+        if data == '' then
+            return nil
+        end
+        local ok, res = pcall(decode, ffi.cast('const char *', data), #data)
+        if not ok then
+            errorf("Can't decode msgpack in request: %s", tostring(res))
+        end
+        return res
+    end
+
+    local buf = buffer_pool.shared:take()
+    local n = req:read_into(buf)
+    local ok, res = true, nil
+    if n ~= nil and n > 0 then
+        ok, res = pcall(decode, buf.rpos, n)
+    end
+    buffer_pool.shared:put(buf)
+    if n == nil then
+        error("Can't read the request body")
+    end
+    if not ok then
+        errorf("Can't decode msgpack in request: %s", tostring(res))
+    end
+    return res
+end
+
+-- Decodes the MessagePack request body.
+local function request_msgpack(req)
+    local cached = req._msgpack
+    if cached == nil then
+        cached = { value = decode_body(req, msgpack.decode) }
+        rawset(req, '_msgpack', cached)
+    elseif cached.value == nil and cached.object ~= nil then
+        cached.value = cached.object:decode()
+    end
+    return cached.value
+end
+
+-- Returns the MessagePack request body as a msgpack object, which box
+-- functions take as a tuple without encoding it again.
+local function request_msgpack_object(req)
+    if msgpack.object_from_raw == nil then
+        error('msgpack objects are not supported by this version of Tarantool')
+    end
+    local cached = req._msgpack
+    if cached == nil then
+        cached = { object = decode_body(req, msgpack.object_from_raw) }
+        rawset(req, '_msgpack', cached)
+    elseif cached.object == nil and cached.value ~= nil then
+        cached.object = msgpack.object(cached.value)
+    end
+    return cached.object
+end
+
+-- Returns the deadline of the request, a clock.monotonic() time, or nil.
+local function request_deadline(req)
+    return req._deadline
+end
+
+-- Returns the seconds left before the deadline of the request or nil.
+local function request_remaining(req)
+    local at = req._deadline
+    if at == nil then
+        return nil
+    end
+    return math.max(0, at - clock.monotonic())
+end
+
+-- The unread bodies are drained into this buffer. The data is thrown
+-- away, so the buffer is shared by all the connections.
+local DISCARD_CHUNK_SIZE = 65536
+local discard_buf = ffi.new('char[?]', DISCARD_CHUNK_SIZE)
+
+-- Skips the rest of the request body without making strings of it.
+local function request_discard(req, timeout)
+    local remaining = body_remaining(req)
+    local deadline = timeout ~= nil and clock.monotonic() + timeout or nil
+    while remaining > 0 do
+        local n = body_read_into(req.s, discard_buf,
+                                 math.min(remaining, DISCARD_CHUNK_SIZE),
+                                 deadline and deadline - clock.monotonic())
+        if n == nil or n == 0 then
+            rawset(req, 'broken', true)
+            break
+        end
+        remaining = remaining - n
+    end
+    req._remaining = 0
+end
+
+local function request_websocket(req, opts)
+    return websocket.upgrade(req, opts)
+end
+
+local function request_sse(req, channels, opts)
+    if type(channels) == 'string' then
+        channels = { channels }
+    end
+    if type(channels) ~= 'table' then
+        error('Usage: req:sse(channels, opts)')
+    end
+    local list = {}
+    for i, name in ipairs(channels) do
+        list[i] = req.httpd:sse_channel(name)
+    end
+    return sse.subscribe(req, list, opts)
+end
+
 local function request_read_cached(self)
     if self.cached_data == nil then
         local data = self:read()
@@ -652,7 +981,15 @@ request_mt = {
         post_param  = post_param,
         param       = param,
         read        = request_read,
-        json        = request_json
+        read_into   = request_read_into,
+        discard     = request_discard,
+        json        = request_json,
+        msgpack     = request_msgpack,
+        msgpack_object = request_msgpack_object,
+        deadline    = request_deadline,
+        remaining   = request_remaining,
+        websocket   = request_websocket,
+        sse         = request_sse,
     },
     __tostring = request_tostring;
 }
@@ -707,9 +1044,16 @@ local function get_error_logger(server_opts, route_opts)
     return log.debug
 end
 
+-- Routes matched by the server before calling the handler, false if no
+-- route matches.
+local matched_routes = setmetatable({}, { __mode = 'k' })
+
 local function handler(self, request)
+    local r = matched_routes[request]
     if self.hooks.before_dispatch ~= nil then
         self.hooks.before_dispatch(self, request)
+        -- The hook may change the request.
+        r = nil
     end
 
     local format = 'html'
@@ -719,61 +1063,608 @@ local function handler(self, request)
         format = pformat
     end
 
-    local r = self:match(request.method, request.path)
     if r == nil then
+        r = self:match(request.method, request.path)
+    end
+    if not r then
         return static_file(self, request, format)
     end
 
-    local stash = extend(r.stash, { format = format })
+    -- The stash is a new table of the match.
+    local stash = r.stash
+    stash.format = format
 
     request.endpoint = r.endpoint
     request.tstash   = stash
 
-    local resp = r.endpoint.sub(request)
+    local resp
+    if profiler.is_running() then
+        resp = profiler.call(r.endpoint.name or r.endpoint.path,
+                             r.endpoint.sub, request)
+    else
+        resp = r.endpoint.sub(request)
+    end
     if self.hooks.after_dispatch ~= nil then
         self.hooks.after_dispatch(request, resp)
     end
     return resp
 end
 
-local function normalize_headers(hdrs)
-    local res = {}
+-- fiber_object:csw() appeared in Tarantool 2.11. Older versions expose the
+-- counter via fiber.info() only, which walks all the fibers, so there the
+-- switches are not counted and nil is returned.
+local has_fiber_csw = fiber.self().csw ~= nil
+
+local function fiber_csw()
+    if has_fiber_csw then
+        return fiber.self():csw()
+    end
+    return nil
+end
+
+local TIMING_PHASES = { 'read', 'parse', 'route', 'handler', 'serialize', 'write' }
+
+-- Stores the time elapsed since the previous mark as a duration of `phase`.
+local function timing_mark(timing, phase)
+    local now = clock.monotonic()
+    timing[phase] = now - timing.mark
+    timing.mark = now
+end
+
+local function format_timing(timing)
+    local res = { sprintf('total=%.3fms', timing.total * 1000) }
+    for _, phase in ipairs(TIMING_PHASES) do
+        table.insert(res, sprintf('%s=%.3fms', phase, timing[phase] * 1000))
+    end
+    table.insert(res, sprintf('cpu=%.3fms', timing.cpu * 1000))
+    if timing.csw ~= nil then
+        table.insert(res, sprintf('csw=%d', timing.csw))
+    end
+    return table.concat(res, ' ')
+end
+
+-- Only phases that are finished before the response headers are sent can be
+-- reported in the Server-Timing header.
+local function server_timing_header(timing)
+    return sprintf('parse;dur=%.3f, route;dur=%.3f, handler;dur=%.3f',
+                   timing.parse * 1000, timing.route * 1000,
+                   timing.handler * 1000)
+end
+
+-- Converts a handler result to a form that can be sent to several clients.
+-- Streamed responses can not be shared.
+local function share_response(ok, resp)
+    if not ok then
+        return { ok = false, err = resp }
+    end
+    if resp == nil then
+        return { ok = true }
+    end
+    if type(resp) ~= 'table' then
+        return nil
+    end
+    if resp.body ~= nil and type(resp.body) ~= 'string' then
+        return nil
+    end
+    return {
+        ok = true,
+        status = resp.status,
+        headers = type(resp.headers) == 'table' and table.copy(resp.headers) or resp.headers,
+        body = resp.body,
+    }
+end
+
+-- Calls the server handler. Concurrent GET requests to a route with
+-- the `single_flight` option that have the same key wait for the running
+-- handler and get a copy of its response.
+local function call_handler(self, p, route)
+    local endpoint = route and route.endpoint
+    if endpoint == nil or endpoint.single_flight == nil or p.method ~= 'GET' or
+       not single_flight.is_shareable(endpoint.single_flight, p.headers) then
+        return pcall(self.options.handler, self, p)
+    end
+
+    local opts = endpoint.single_flight
+    local key = response_cache.request_key(opts, p)
+    local is_leader, ok, resp = self.single_flight:execute(key, opts.timeout,
+        share_response, self.options.handler, self, p)
+    if is_leader then
+        return ok, resp
+    end
+
+    local shared, err = ok, resp
+    if err == 'timeout' then
+        return true, {
+            status = 504,
+            body = 'Timed out waiting for an identical request',
+        }
+    end
+    if shared == nil then
+        return pcall(self.options.handler, self, p)
+    end
+    if not shared.ok then
+        return false, shared.err
+    end
+    return true, {
+        status = shared.status,
+        headers = type(shared.headers) == 'table' and table.copy(shared.headers) or shared.headers,
+        body = shared.body,
+    }
+end
+
+-- Calls the handler in the fiber of deadline.call() and stores the
+-- context switches of that fiber in `counter.csw`.
+local function call_handler_counted(counter, self, p, route)
+    local csw_start = fiber_csw()
+    local res, reason = call_handler(self, p, route)
+    if csw_start ~= nil then
+        counter.csw = fiber_csw() - csw_start
+    end
+    return res, reason
+end
+
+-- Calls the server handler with a deadline `timeout` seconds from now.
+-- Returns the results of call_handler(), nil and the context switches of
+-- the handler fiber, or true, nil and the reason the handler is
+-- abandoned: 'timeout' or 'disconnect'.
+local function call_handler_until(self, p, route, timeout)
+    local at = clock.monotonic() + timeout
+    rawset(p, '_deadline', at)
+    local interval = self.deadline ~= nil and self.deadline.check_interval or
+                     deadline.DEFAULT_OPTIONS.check_interval
+    local counter = {}
+    local completed, res, reason = deadline.call(at, interval, p.s,
+                                                 call_handler_counted, counter,
+                                                 self, p, route)
+    if completed then
+        return res, reason, nil, counter.csw
+    end
+    -- The cancelled handler may still be reading the connection.
+    rawset(p, '_remaining', 0)
+    rawset(p, 'broken', true)
+    return true, nil, res
+end
+
+-- Copies response headers with lowercase names to `res`.
+local function normalize_headers(hdrs, res)
     for h, v in pairs(hdrs) do
         res[ string.lower(h) ] = v
     end
     return res
 end
 
-local function parse_request(req)
-    local p = lib._parse_request(req)
-    if p.error then
-        return p
+-- Calls the `close` function of an iterator body, which is called once
+-- the body is sent or dropped.
+local function close_body(body)
+    if type(body) == 'table' and body.close ~= nil then
+        body.close()
     end
+end
+
+-- Unescapes the path of a request and rejects paths leading outside of
+-- the root.
+local function check_request_path(p)
     p.path_raw = p.path
     p.path = uri_unescape(p.path)
     if p.path:sub(1, 1) ~= "/" then
         p.error = "invalid uri"
         return p
     end
-    for _, path_segment in ipairs(p.path:split('/')) do
-        if path_segment == "." or path_segment == ".." then
-            p.error = "invalid uri"
-            return p
-        end
+    -- "." and ".." segments.
+    if string.find(p.path, '/%.%.?/') or string.find(p.path, '/%.%.?$') then
+        p.error = "invalid uri"
+        return p
     end
 
     return p
 end
 
-local function process_client(self, s, peer)
+local function parse_request(req)
+    local p = lib._parse_request(req)
+    if p.error then
+        return p
+    end
+    return check_request_path(p)
+end
+
+-- Routes a parsed request and calls its handler. Returns the matched route,
+-- the request logger and the response status, headers and body. The status
+-- is nil if the handler has detached the connection. Response headers are
+-- put to `hdrs`, an empty table reused by the connection, if it is set.
+local function dispatch(self, p, timing, hdrs)
+    -- The limit of the server is checked before routing, the one of
+    -- a route before the handler.
+    local route
+    local retry_after = self.rate_limit ~= nil and self.rate_limit:check(p) or nil
+    if retry_after == nil then
+        route = self:match(p.method, p.path)
+        if route ~= nil and route.endpoint.rate_limit ~= nil then
+            retry_after = route.endpoint.rate_limit:check(p)
+        end
+    end
+    local logreq = get_request_logger(self.options, route)
+    if timing == nil then
+        logreq("%s %s%s", p.method, p.path,
+               p.query ~= "" and "?"..p.query or "")
+    end
+
+    if retry_after ~= nil then
+        p:discard()
+        hdrs = hdrs or {}
+        hdrs['retry-after'] = math.max(1, math.ceil(retry_after))
+        hdrs['content-type'] = 'text/plain; charset=utf-8'
+        return route, logreq, 429, hdrs, 'Too Many Requests'
+    end
+
+    local cpu_start, csw_start
+    if timing ~= nil then
+        timing_mark(timing, 'route')
+        cpu_start = clock.thread()
+        csw_start = fiber_csw()
+    end
+
+    -- A conditional request matching the route validator is answered
+    -- without calling the handler.
+    local etag_opts, tag
+    if route ~= nil and route.endpoint.etag ~= nil and
+       (p.method == 'GET' or p.method == 'HEAD') then
+        etag_opts = route.endpoint.etag
+        tag = etag.validate(etag_opts, p)
+        if tag ~= nil and etag.none_match(p.headers['if-none-match'], tag) then
+            p:discard()
+            hdrs = hdrs or {}
+            hdrs.etag = tag
+            return route, logreq, 304, hdrs, nil
+        end
+    end
+
+    -- Responses of cached routes are served without calling the handler.
+    local cache_key, cache_path, cached
+    if route ~= nil and route.endpoint.cache ~= nil and p.method == 'GET' then
+        cache_key, cache_path = response_cache.request_key(route.endpoint.cache, p)
+        cached = self.response_cache:get(route.endpoint, cache_key)
+        if self.metrics ~= nil then
+            self.metrics:cache_lookup(route, cached ~= nil)
+        end
+    end
+
+    local res, reason, abandoned, timeout, handler_csw
+    if cached ~= nil then
+        res, reason = true, {
+            status = cached.status,
+            headers = cached.headers,
+            body = cached.body,
+        }
+    else
+        matched_routes[p] = route or false
+        if self.deadline ~= nil or route ~= nil and route.endpoint.deadline ~= nil then
+            timeout = deadline.request_timeout(self.deadline,
+                                               route and route.endpoint.deadline,
+                                               p.headers)
+        end
+        if timeout ~= nil then
+            res, reason, abandoned, handler_csw =
+                call_handler_until(self, p, route, timeout)
+        else
+            res, reason = call_handler(self, p, route)
+        end
+        matched_routes[p] = nil
+    end
+    p:discard() -- skip remaining bytes of request body
+
+    if timing ~= nil then
+        timing_mark(timing, 'handler')
+        timing.cpu = clock.thread() - cpu_start
+        -- The handler of a request with a deadline runs in a fiber of its
+        -- own, the switches are unknown if it is cancelled.
+        if timeout ~= nil then
+            timing.csw = handler_csw
+        elseif csw_start ~= nil then
+            timing.csw = fiber_csw() - csw_start
+        end
+    end
+
+    if abandoned == 'disconnect' then
+        log.info('%s %s is cancelled: the client has closed the connection',
+                 p.method, p.path)
+        return route, logreq, nil
+    elseif abandoned ~= nil then
+        get_error_logger(self.options, route)(
+            '%s %s is cancelled: the deadline has passed', p.method, p.path)
+        hdrs = hdrs or {}
+        hdrs['content-type'] = 'text/plain; charset=utf-8'
+        return route, logreq, 504, hdrs, 'Gateway Timeout'
+    end
+
+    local status, body
+    hdrs = hdrs or {}
+
+    if not res then
+        status = 500
+        local trace = debug.traceback()
+        local logerror = get_error_logger(self.options, route)
+        logerror('unhandled error: %s\n%s\nrequest:\n%s',
+                 tostring(reason), trace, tostring(p))
+        if self.options.display_errors then
+        body =
+              "Unhandled error: " .. tostring(reason) .. "\n"
+            .. trace .. "\n\n"
+            .. "\n\nRequest:\n"
+            .. tostring(p)
+        else
+            body = "Internal Error"
+        end
+   elseif type(reason) == 'table' then
+        if reason.status == nil then
+            status = 200
+        elseif type(reason.status) == 'number' then
+            status = reason.status
+        else
+            error('response.status must be a number')
+        end
+        if type(reason.headers) == 'table' then
+            normalize_headers(reason.headers, hdrs)
+        elseif reason.headers ~= nil then
+            error('response.headers must be a table')
+        end
+        body = reason.body
+    elseif reason == nil then
+        status = 200
+    elseif type(reason) == 'number' then
+        if reason == DETACHED then
+            return route, logreq, nil
+        end
+    else
+        error('invalid response')
+    end
+
+    -- The connection of an upgraded request belongs to the WebSocket.
+    local ws = rawget(p, 'websocket_conn')
+    if ws ~= nil then
+        websocket.finish(ws)
+        return route, logreq, nil
+    end
+    local stream = rawget(p, 'sse_stream')
+    if stream ~= nil then
+        sse.serve(stream)
+        return route, logreq, nil
+    end
+
+    if etag_opts ~= nil and status == 200 then
+        tag = tag or hdrs.etag
+        if tag == nil and type(body) == 'string' then
+            tag = etag.of(body)
+        end
+        hdrs.etag = tag
+    end
+
+    if cache_key ~= nil and cached == nil and res then
+        local stored = response_cache.add_vary(route.endpoint.cache, table.copy(hdrs))
+        if self.response_cache:put(route.endpoint, cache_key, cache_path,
+                                   status, stored, body) then
+            hdrs['vary'] = stored['vary']
+        end
+    end
+
+    if hdrs.etag ~= nil and etag_opts ~= nil and status == 200 and
+       etag.none_match(p.headers['if-none-match'], hdrs.etag) then
+        close_body(body)
+        return route, logreq, 304, hdrs, nil
+    end
+
+    return route, logreq, status, hdrs, body
+end
+
+local SERVER_HEADER = sprintf('Tarantool http (tarantool v%s)', _TARANTOOL)
+
+-- Sets the body related and the default headers of a response to
+-- a request with `method`. Returns the body and the iterator of a streamed
+-- body.
+local function prepare_response(self, status, hdrs, body, timing, method)
+    local gen, param, state
+    if status == 304 then
+        -- Not Modified has no body, its headers describe the cached one.
+        hdrs['content-type'] = nil
+        hdrs['content-length'] = nil
+        close_body(body)
+        body = nil
+    elseif type(body) == 'string' then
+        -- Plain string
+        hdrs['content-length'] = #body
+    elseif type(body) == 'function' then
+        -- Generating function
+        gen = body
+        hdrs['transfer-encoding'] = 'chunked'
+    elseif type(body) == 'table' and body.gen then
+        -- Iterator
+        gen, param, state = body.gen, body.param, body.state
+        hdrs['transfer-encoding'] = 'chunked'
+    elseif body == nil then
+        -- Empty body, a response to HEAD may keep the length of the body
+        -- it describes.
+        if method ~= 'HEAD' or hdrs['content-length'] == nil then
+            hdrs['content-length'] = 0
+        end
+    else
+        body = tostring(body)
+        hdrs['content-length'] = #body
+    end
+
+    if hdrs['content-type'] == nil and status ~= 304 then
+        hdrs['content-type'] = 'text/plain; charset=utf-8'
+    end
+
+    if hdrs.server == nil then
+        hdrs.server = SERVER_HEADER
+    end
+
+    if timing ~= nil and self.options.server_timing then
+        hdrs['server-timing'] = server_timing_header(timing)
+    end
+
+    return body, gen, param, state
+end
+
+-- Accounts a written response in metrics and logs the request timings.
+local function finish_request(self, p, route, logreq, status, timing, start,
+                              bytes_in, bytes_out, reused)
+    local duration = clock.monotonic() - start
+    if self.metrics ~= nil then
+        self.metrics:observe(route, p.method, status, duration,
+                             bytes_in, bytes_out, reused)
+    end
+
+    local access = self.access_log
+    if access ~= nil and (route == nil or route.endpoint.log_requests ~= false) then
+        access:record(p, status, bytes_in, bytes_out, duration, timing)
+    end
+
+    if timing ~= nil then
+        timing_mark(timing, 'write')
+        timing.total = timing.mark - start
+        timing.mark = nil
+
+        -- The request is logged after the response when timings are
+        -- collected, so a custom logger receives them as the last
+        -- argument.
+        local query = p.query ~= "" and "?"..p.query or ""
+        logreq("%s %s%s", p.method, p.path, query, timing)
+
+        local threshold = self.options.slow_request_threshold
+        if threshold ~= nil and timing.total >= threshold then
+            log.warn("slow request %s %s%s: %s", p.method, p.path, query,
+                     format_timing(timing))
+        end
+    end
+end
+
+local function is_timing_enabled(self)
+    return self.options.request_timing or self.options.server_timing or
+        self.options.slow_request_threshold ~= nil
+end
+
+-- Handles a request stream of an HTTP/2 connection.
+local function process_http2_stream(self, stream, peer)
+    local start = clock.monotonic()
+    local p = check_request_path(stream.request)
+    local bytes_in = stream.header_bytes + (tonumber(p.headers['content-length']) or 0)
+    if p.error ~= nil then
+        log.error('failed to parse request: %s', p.error)
+        local _, bytes_out = stream:respond(400, {
+            ['content-type'] = 'text/plain; charset=utf-8',
+        }, p.error)
+        if self.metrics ~= nil then
+            self.metrics:observe(nil, p.method, 400, clock.monotonic() - start,
+                                 bytes_in, bytes_out, stream.reused)
+        end
+        return
+    end
+    p.httpd = self
+    p.s = stream
+    p.peer = peer
+    setmetatable(p, request_mt)
+
+    local timing
+    if is_timing_enabled(self) then
+        timing = { started = start, read = 0, mark = start }
+        timing_mark(timing, 'parse')
+        p.timing = timing
+    end
+
+    local route, logreq, status, hdrs, body = dispatch(self, p, timing)
+    if status == nil then
+        log.error('handler of %s %s has detached an HTTP/2 stream', p.method, p.path)
+        stream:cancel()
+        return
+    end
+    local gen, param, state
+    body, gen, param, state = prepare_response(self, status, hdrs, body, timing,
+                                               p.method)
+
+    if timing ~= nil then
+        timing_mark(timing, 'serialize')
+    end
+
+    local _, bytes_out = stream:respond(status, hdrs, body, gen, param, state)
+    close_body(body)
+    finish_request(self, p, route, logreq, status, timing, start,
+                   stream.header_bytes + stream.body_bytes, bytes_out, stream.reused)
+end
+
+local READ_REQUEST_HEAD = { delimiter = { "\n\n", "\r\n\r\n" } }
+
+local serve_client
+
+local function can_park(self, listener)
+    return listener.plain and self.options.park_idle and
+           idle_watcher.supported and not listener.draining
+end
+
+-- Parks an idle connection in the idle watcher: the fiber serving it ends
+-- and a worker fiber serves the next request. Returns false if the
+-- connection can not be parked.
+local function park_client(self, listener, s, peer, nrequests, collector)
+    local function resume(sock)
+        if not serve_client(self, listener, sock, peer, collector,
+                            nrequests, true) then
+            sock:shutdown()
+            sock:close()
+        end
+    end
+    local function expire(sock)
+        log.error('failed to read request: %s', errno.strerror(errno.ETIMEDOUT))
+        sock:shutdown()
+        sock:close()
+        if collector ~= nil then
+            collector:connection_closed()
+        end
+        self.internal.postprocess_client_handler()
+    end
+    return idle_watcher.shared:park(s, self.idle_timeout, resume, expire)
+end
+
+-- Serves the requests of a connection. Returns true if the connection is
+-- parked in the idle watcher, see park_client(). A parked connection is
+-- resumed with the number of requests served and `ready` set: its next
+-- request has arrived.
+local function process_client(self, listener, s, peer, conn_collector,
+                              nrequests, ready)
+    local collector = self.metrics
+    nrequests = nrequests or 0
+    local timing_enabled = is_timing_enabled(self)
+    -- Reused by the requests of the connection.
+    local response_headers = table_new(0, 8)
+    local response = table_new(32, 0)
+    -- Special sockets may not be able to wait for data.
+    local pool = s.readable ~= nil and buffer_pool.shared or nil
+
     while true do
         local hdrs = ''
+        local read_start = timing_enabled and clock.monotonic()
+
+        -- An idle connection gives its read buffer back to the pool and
+        -- takes one when the next request arrives.
+        if pool ~= nil then
+            pool:detach(s)
+            if s.rbuf == nil then
+                if ready then
+                    ready = false
+                elseif nrequests > 0 and can_park(self, listener) and
+                       park_client(self, listener, s, peer, nrequests,
+                                   conn_collector) then
+                    return true
+                elseif not s:readable(self.idle_timeout) then
+                    log.error('failed to read request: %s',
+                              errno.strerror(errno.ETIMEDOUT))
+                    return
+                end
+                pool:attach(s)
+            end
+        end
 
         local is_eof = false
         while true do
-            local chunk = s:read({
-                delimiter = { "\n\n", "\r\n\r\n" },
-            }, self.idle_timeout)
+            local chunk = s:read(READ_REQUEST_HEAD, self.idle_timeout)
 
             if chunk == '' then
                 is_eof = true
@@ -783,7 +1674,11 @@ local function process_client(self, s, peer)
                 return
             end
 
-            hdrs = hdrs .. chunk
+            if hdrs == '' then
+                hdrs = chunk
+            else
+                hdrs = hdrs .. chunk
+            end
 
             if string.endswith(hdrs, "\n\n") or string.endswith(hdrs, "\r\n\r\n") then
                 break
@@ -794,11 +1689,67 @@ local function process_client(self, s, peer)
             break
         end
 
+        -- An HTTP/2 client starts the connection with the preface, either
+        -- right away (prior knowledge) or after the TLS handshake.
+        if nrequests == 0 and self.http2 ~= nil and
+           hdrs == string.sub(http2.PREFACE, 1, #hdrs) then
+            local rest = string.sub(http2.PREFACE, #hdrs + 1)
+            if s:read(#rest, self.idle_timeout) == rest then
+                http2.serve(s, self.http2, self.idle_timeout, function(stream)
+                    process_http2_stream(self, stream, peer)
+                end)
+            end
+            break
+        end
+
+        local start = clock.monotonic()
+        local header_size = #hdrs
+        nrequests = nrequests + 1
+
+        -- A route with a constant response is served without parsing
+        -- the request. User agents with keep-alive disabled take the
+        -- usual path, which checks the User-Agent header, and so do all
+        -- requests if the server has hooks, a rate limit or an access log.
+        local fast, keepalive
+        if self.fast_routes.size > 0 and next(self.disable_keepalive) == nil and
+           self.rate_limit == nil and self.access_log == nil and
+           self.hooks.before_dispatch == nil and
+           self.hooks.after_dispatch == nil then
+            fast, keepalive = self.fast_routes:lookup(hdrs)
+        end
+        if fast ~= nil then
+            if listener.draining then
+                keepalive = false
+            end
+            local data = keepalive and fast.keepalive or fast.close
+            local write_ok = s:write(data)
+            if collector ~= nil then
+                collector:observe(fast.route, fast.method, fast.status,
+                                  clock.monotonic() - start, header_size, #data,
+                                  nrequests > 1)
+            end
+            if not write_ok or not keepalive then
+                break
+            end
+            goto continue
+        end
+
+        local timing
+        if timing_enabled then
+            timing = { started = start, read = start - read_start, mark = start }
+        end
+
         log.debug("request:\n%s", hdrs)
         local p = parse_request(hdrs)
         if p.error ~= nil then
             log.error('failed to parse request: %s', p.error)
-            s:write(sprintf("HTTP/1.0 400 Bad request\r\n\r\n%s", p.error))
+            local response = sprintf("HTTP/1.0 400 Bad request\r\n\r\n%s", p.error)
+            s:write(response)
+            if collector ~= nil then
+                collector:observe(nil, p.method or 'UNKNOWN', 400,
+                                  clock.monotonic() - start, header_size, #response,
+                                  nrequests > 1)
+            end
             break
         end
         p.httpd = self
@@ -806,89 +1757,26 @@ local function process_client(self, s, peer)
         p.peer = peer
         setmetatable(p, request_mt)
 
+        if timing ~= nil then
+            timing_mark(timing, 'parse')
+            p.timing = timing
+        end
+
         if p.headers['expect'] == '100-continue' then
             s:write('HTTP/1.0 100 Continue\r\n\r\n')
         end
 
-        local route = self:match(p.method, p.path)
-        local logreq = get_request_logger(self.options, route)
-        logreq("%s %s%s", p.method, p.path,
-               p.query ~= "" and "?"..p.query or "")
-
-        local res, reason = pcall(self.options.handler, self, p)
-        p:read() -- skip remaining bytes of request body
-        local status, hdrs, body
-
-        if not res then
-            status = 500
-            hdrs = {}
-            local trace = debug.traceback()
-            local logerror = get_error_logger(self.options, route)
-            logerror('unhandled error: %s\n%s\nrequest:\n%s',
-                     tostring(reason), trace, tostring(p))
-            if self.options.display_errors then
-            body =
-                  "Unhandled error: " .. tostring(reason) .. "\n"
-                .. trace .. "\n\n"
-                .. "\n\nRequest:\n"
-                .. tostring(p)
-            else
-                body = "Internal Error"
-            end
-       elseif type(reason) == 'table' then
-            if reason.status == nil then
-                status = 200
-            elseif type(reason.status) == 'number' then
-                status = reason.status
-            else
-                error('response.status must be a number')
-            end
-            if reason.headers == nil then
-                hdrs = {}
-            elseif type(reason.headers) == 'table' then
-                hdrs = normalize_headers(reason.headers)
-            else
-                error('response.headers must be a table')
-            end
-            body = reason.body
-        elseif reason == nil then
-            status = 200
-            hdrs = {}
-        elseif type(reason) == 'number' then
-            if reason == DETACHED then
-                break
-            end
-        else
-            error('invalid response')
+        table_clear(response_headers)
+        local route, logreq, status, hdrs, body = dispatch(self, p, timing,
+                                                           response_headers)
+        if status == nil then
+            -- The socket may still be read by the handler.
+            return
         end
 
         local gen, param, state
-        if type(body) == 'string' then
-            -- Plain string
-            hdrs['content-length'] = #body
-        elseif type(body) == 'function' then
-            -- Generating function
-            gen = body
-            hdrs['transfer-encoding'] = 'chunked'
-        elseif type(body) == 'table' and body.gen then
-            -- Iterator
-            gen, param, state = body.gen, body.param, body.state
-            hdrs['transfer-encoding'] = 'chunked'
-        elseif body == nil then
-            -- Empty body
-            hdrs['content-length'] = 0
-        else
-            body = tostring(body)
-            hdrs['content-length'] = #body
-        end
-
-        if hdrs['content-type'] == nil then
-            hdrs['content-type'] = 'text/plain; charset=utf-8'
-        end
-
-        if hdrs.server == nil then
-            hdrs.server = sprintf('Tarantool http (tarantool v%s)', _TARANTOOL)
-        end
+        body, gen, param, state = prepare_response(self, status, hdrs, body, timing,
+                                                   p.method)
 
         if p.proto[1] ~= 1 then
             hdrs.connection = 'close'
@@ -918,52 +1806,76 @@ local function process_client(self, s, peer)
         if self.disable_keepalive[useragent] == true then
             hdrs.connection = 'close'
         end
+        -- The listener is closed, let the client reconnect.
+        if listener.draining then
+            hdrs.connection = 'close'
+        end
 
-        local response = {
-            "HTTP/1.1 ";
-            status;
-            " ";
-            reason_by_code(status);
-            "\r\n";
-        };
+        -- The response head is built from parts without formatting
+        -- the header lines.
+        local n = 1
+        response[1] = status_line(status)
         for k, v in pairs(hdrs) do
+            local name = header_name(k)
             if type(v) == 'table' then
                 for _, sv in pairs(v) do
-                    table.insert(response, sprintf("%s: %s\r\n", ucfirst(k), sv))
+                    if type(sv) ~= 'string' and type(sv) ~= 'number' then
+                        sv = tostring(sv)
+                    end
+                    response[n + 1], response[n + 2] = name, ': '
+                    response[n + 3], response[n + 4] = sv, '\r\n'
+                    n = n + 4
                 end
             else
-                table.insert(response, sprintf("%s: %s\r\n", ucfirst(k), v))
+                if type(v) ~= 'string' and type(v) ~= 'number' then
+                    v = tostring(v)
+                end
+                response[n + 1], response[n + 2] = name, ': '
+                response[n + 3], response[n + 4] = v, '\r\n'
+                n = n + 4
             end
         end
-        table.insert(response, "\r\n")
+        n = n + 1
+        response[n] = '\r\n'
+
+        if timing ~= nil then
+            timing_mark(timing, 'serialize')
+        end
 
+        local write_ok
+        local bytes_out
         if type(body) == 'string' then
-            table.insert(response, body)
-            response = table.concat(response)
-            if not s:write(response) then
-                break
-            end
-        elseif gen then
-            response = table.concat(response)
-            if not s:write(response) then
-                break
-            end
-            response = nil -- luacheck: no unused
-            -- Transfer-Encoding: chunked
-            for _, part in gen, param, state do
-                part = tostring(part)
-                if not s:write(sprintf("%x\r\n%s\r\n", #part, part)) then
-                    break
+            n = n + 1
+            response[n] = body
+        end
+        local data = table.concat(response, '', 1, n)
+        table_clear(response)
+        write_ok = s:write(data)
+        bytes_out = #data
+        data = nil -- luacheck: no unused
+        if gen then
+            if write_ok then
+                -- Transfer-Encoding: chunked
+                for _, part in gen, param, state do
+                    part = tostring(part)
+                    local chunk = sprintf("%x\r\n%s\r\n", #part, part)
+                    if not s:write(chunk) then
+                        break
+                    end
+                    bytes_out = bytes_out + #chunk
                 end
+                write_ok = s:write("0\r\n\r\n")
+                bytes_out = bytes_out + 5
             end
-            if not s:write("0\r\n\r\n") then
-                break
-            end
-        else
-            response = table.concat(response)
-            if not s:write(response) then
-                break
-            end
+            close_body(body)
+        end
+
+        local bytes_in = header_size + (tonumber(p.headers['content-length']) or 0)
+        finish_request(self, p, route, logreq, status, timing, start,
+                       bytes_in, bytes_out, nrequests > 1)
+
+        if not write_ok then
+            break
         end
 
         if p.proto[1] ~= 1 then
@@ -973,7 +1885,29 @@ local function process_client(self, s, peer)
         if hdrs.connection ~= 'keep-alive' then
             break
         end
+        ::continue::
+    end
+    if pool ~= nil then
+        pool:detach(s)
+    end
+end
+
+-- Serves a connection counted by `collector`, if any, until it is closed
+-- or parked. Returns true if it is parked.
+serve_client = function(self, listener, s, peer, collector, nrequests, ready)
+    local ok, parked = pcall(process_client, self, listener, s, peer,
+                             collector, nrequests, ready)
+    if parked == true then
+        return true
+    end
+    if collector ~= nil then
+        collector:connection_closed()
     end
+    if not ok then
+        error(parked, 0)
+    end
+    self.internal.postprocess_client_handler()
+    return false
 end
 
 local function httpd_stop(self)
@@ -989,31 +1923,53 @@ local function httpd_stop(self)
     if self.tcp_server ~= nil then
         self.tcp_server:close()
         self.tcp_server = nil
+        self.listener.draining = true
+    end
+    -- The context is created again with the current options on start.
+    self.ssl_ctx = nil
+    if self.access_log ~= nil then
+        self.access_log:stop()
     end
     return self
 end
 
+-- Returns the number of captures of a successful match, 0 otherwise.
+local function count_captures(first, ...)
+    if first == nil then
+        return 0
+    end
+    return select('#', ...) + 1
+end
+
+local function fill_stash(stash, names, ...)
+    for i = 1, #names do
+        stash[ names[ i ] ] = (select(i, ...))
+    end
+    return stash
+end
+
 local function match_route(self, method, route)
     -- route must have '/' at the begin and end
-    if string.match(route, '.$') ~= '/' then
+    if string.byte(route, -1) ~= 47 then
         route = route .. '/'
     end
-    if string.match(route, '^.') ~= '/' then
+    if string.byte(route, 1) ~= 47 then
         route = '/' .. route
     end
 
     method = string.upper(method)
 
+    -- Captures are only counted here, the stash is filled for the best
+    -- route only.
     local fit
-    local stash = {}
 
     for _, r in pairs(self.routes) do
         if r.method == method or r.method == 'ANY' then
-            local m = { string.match(route, r.match)  }
+            local ncaptures = count_captures(string.match(route, r.match))
             local nfit
-            if #m > 0 then
+            if ncaptures > 0 then
                 if #r.stash > 0 then
-                    if #r.stash == #m then
+                    if #r.stash == ncaptures then
                         nfit = r
                     end
                 else
@@ -1023,15 +1979,12 @@ local function match_route(self, method, route)
                 if nfit ~= nil then
                     if fit == nil then
                         fit = nfit
-                        stash = m
                     else
                         if #fit.stash > #nfit.stash then
                             fit = nfit
-                            stash = m
                         elseif r.method ~= fit.method then
                             if fit.method == 'ANY' then
                                 fit = nfit
-                                stash = m
                             end
                         end
                     end
@@ -1043,16 +1996,14 @@ local function match_route(self, method, route)
     if fit == nil then
         return fit
     end
-    local resstash = {}
-    for i = 1, #fit.stash do
-        resstash[ fit.stash[ i ] ] = stash[ i ]
-    end
+    local resstash = fill_stash({}, fit.stash, string.match(route, fit.match))
     return  { endpoint = fit, stash = resstash }
 end
 
 local function set_helper(self, name, sub)
     if sub == nil or type(sub) == 'function' then
         self.helpers[ name ] = sub
+        helpers_generation = helpers_generation + 1
         return self
     end
     errorf("Wrong type for helper function: %s", type(sub))
@@ -1162,6 +2113,27 @@ local function add_route(self, opts, sub)
     local ctx
     local action
 
+    if opts.proxy ~= nil then
+        if sub ~= nil then
+            error("Route with the 'proxy' option can not have a handler")
+        end
+        local upstream = proxy.new(proxy.parse_route_options(opts.proxy))
+        opts.proxy = upstream
+        sub = function(req)
+            return upstream:forward(req)
+        end
+    end
+
+    if opts.response ~= nil then
+        if sub ~= nil or opts.proxy ~= nil then
+            error("Route with the 'response' option can not have a handler")
+        end
+        local response = fast_route.parse_route_options(opts.response)
+        prepare_response(self, response.status, response.headers, response.body)
+        opts.response = response
+        sub = fast_route.handler(response)
+    end
+
     if sub == nil then
         sub = render
     elseif type(sub) == 'string' then
@@ -1230,6 +2202,19 @@ local function add_route(self, opts, sub)
 
     estash = nil -- luacheck: no unused
 
+    if opts.response ~= nil and #stash > 0 then
+        error("Route with the 'response' option can not have stashes")
+    end
+    if opts.response ~= nil then
+        -- The response is sent before the route options are looked at.
+        for _, name in ipairs({ 'rate_limit', 'etag', 'cache' }) do
+            if opts[name] ~= nil then
+                errorf("Route with the 'response' option can not have the '%s' option",
+                       name)
+            end
+        end
+    end
+
     opts.stash = stash
     opts.sub = sub
     opts.url_for = url_for_route
@@ -1246,6 +2231,31 @@ local function add_route(self, opts, sub)
         end
     end
 
+    if opts.cache ~= nil then
+        opts.cache = response_cache.parse_route_options(opts.cache)
+    end
+
+    if opts.single_flight == false then
+        opts.single_flight = nil
+    elseif opts.single_flight ~= nil then
+        opts.single_flight = single_flight.parse_route_options(opts.single_flight)
+    end
+
+    if opts.etag == false then
+        opts.etag = nil
+    elseif opts.etag ~= nil then
+        opts.etag = etag.parse_route_options(opts.etag)
+    end
+
+    if opts.deadline ~= nil and opts.deadline ~= false then
+        opts.deadline = deadline.parse_options(opts.deadline, true)
+    end
+
+    if opts.rate_limit ~= nil then
+        local rate_limit_opts = rate_limit.parse_options(opts.rate_limit, true)
+        opts.rate_limit = rate_limit_opts and rate_limit.new(rate_limit_opts)
+    end
+
     if opts.name ~= nil then
         if opts.name == 'current' then
             error("Route can not have name 'current'")
@@ -1258,6 +2268,9 @@ local function add_route(self, opts, sub)
     else
         table.insert(self.routes, opts)
     end
+    if opts.response ~= nil then
+        self.fast_routes:add(opts)
+    end
     return self
 end
 
@@ -1268,7 +2281,13 @@ local function delete_route(self, name)
     end
 
     self.iroutes[name] = nil
-    table.remove(self.routes, route)
+    local endpoint = table.remove(self.routes, route)
+    if endpoint.cache ~= nil then
+        self.response_cache:invalidate(endpoint)
+    end
+    if endpoint.response ~= nil then
+        self.fast_routes:remove(endpoint)
+    end
 
     -- Update iroutes numeration.
     for n, r in ipairs(self.routes) do
@@ -1278,6 +2297,45 @@ local function delete_route(self, name)
     end
 end
 
+-- Drops cached responses of the route with the given name and/or with paths
+-- starting with the given prefix, or all cached responses if no options are
+-- passed. Returns the number of removed entries.
+local function invalidate_cache(self, opts)
+    if opts == nil then
+        opts = {}
+    end
+    if type(opts) ~= 'table' then
+        error("Usage: httpd:invalidate_cache({ route = ..., prefix = ... })")
+    end
+    if opts.prefix ~= nil and type(opts.prefix) ~= 'string' then
+        error("'prefix' option should be a string")
+    end
+
+    local endpoint
+    if opts.route ~= nil then
+        local idx = self.iroutes[opts.route]
+        if idx == nil then
+            errorf("Route with name '%s' does not exist", opts.route)
+        end
+        endpoint = self.routes[idx]
+    end
+    return self.response_cache:invalidate(endpoint, opts.prefix)
+end
+
+-- Returns the Server-Sent Events channel with the given name, creates it
+-- on the first use.
+local function sse_channel(self, name)
+    if type(name) ~= 'string' then
+        error('Usage: httpd:sse_channel(name)')
+    end
+    local channel = self.sse_channels[name]
+    if channel == nil then
+        channel = sse.new_channel(name)
+        self.sse_channels[name] = channel
+    end
+    return channel
+end
+
 local function url_for_httpd(httpd, name, args, query)
 
     local idx = httpd.iroutes[ name ]
@@ -1331,6 +2389,10 @@ local function create_ssl_ctx(host, port, opts)
         sslsocket.ctx_set_verify(ctx, opts.ssl_verify_client)
     end
 
+    if opts.alpn_h2 then
+        sslsocket.ctx_set_alpn_h2(ctx)
+    end
+
     if opts.ssl_ciphers ~= nil then
         rc = sslsocket.ctx_set_cipher_list(ctx, opts.ssl_ciphers)
         if rc == false then
@@ -1344,32 +2406,282 @@ local function create_ssl_ctx(host, port, opts)
     return ctx
 end
 
-local function httpd_start(self)
-    if type(self) ~= 'table' then
-        error("httpd: usage: httpd:start()")
+local function metrics_handler(req)
+    return {
+        status = 200,
+        headers = {
+            ['content-type'] = 'text/plain; version=0.0.4; charset=utf-8',
+        },
+        body = req.httpd.metrics:render(),
+    }
+end
+
+local function add_metrics_route(self, metrics_opts)
+    if metrics_opts.path ~= nil then
+        self:route({
+            path = metrics_opts.path,
+            method = 'GET',
+            log_requests = false,
+        }, metrics_handler)
+    end
+end
+
+local function add_profiler_route(self, profiler_opts)
+    self.profiler_handler = profiler.handler(profiler_opts)
+    self:route({
+        path = profiler_opts.path,
+        log_requests = false,
+    }, self.profiler_handler)
+end
+
+-- Deletes the routes served by `sub`.
+local function delete_handler_routes(self, sub)
+    for n = #self.routes, 1, -1 do
+        if self.routes[n].sub == sub then
+            table.remove(self.routes, n)
+        end
     end
+    for name in pairs(self.iroutes) do
+        self.iroutes[name] = nil
+    end
+    for n, r in ipairs(self.routes) do
+        if r.name then
+            self.iroutes[r.name] = n
+        end
+    end
+end
 
-    local server = self.tcp_server_f(self.host, self.port, {
+local function ssl_ctx_options(options, http2_opts)
+    return {
+        ssl_cert_file = options.ssl_cert_file,
+        ssl_key_file = options.ssl_key_file,
+        ssl_password = options.ssl_password,
+        ssl_password_file = options.ssl_password_file,
+        ssl_ca_file = options.ssl_ca_file,
+        ssl_ciphers = options.ssl_ciphers,
+        ssl_verify_client = options.ssl_verify_client,
+        alpn_h2 = http2_opts ~= nil,
+    }
+end
+
+-- TLS listeners created by tls_tcp_server_f().
+local tls_server_functions = setmetatable({}, { __mode = 'k' })
+
+-- Returns a tcp_server_f for a TLS server. The context is looked up on
+-- every accepted connection, so reconfigure() can replace it without
+-- closing the listener.
+local function tls_tcp_server_f(self)
+    local f = function(host, port, handler, timeout)
+        if self.ssl_ctx == nil then
+            self.ssl_ctx = create_ssl_ctx(host, port,
+                ssl_ctx_options(self.options, self.http2))
+        end
+        return sslsocket.tcp_server(host, port, handler, timeout, function()
+            return self.ssl_ctx
+        end, function()
+            local opts = self.http2 or http2.DEFAULT_OPTIONS
+            return opts.handshake_timeout
+        end)
+    end
+    tls_server_functions[f] = true
+    return f
+end
+
+-- Binds a listener of the server. Returns it and the state shared by its
+-- connections, which are closed after their current request once the
+-- listener is closed.
+local function listen(self, tcp_server_f, host, port)
+    local listener = {
+        draining = false,
+        -- Only the sockets of the socket module can be parked.
+        plain = tcp_server_f == socket.tcp_server,
+    }
+    local server = tcp_server_f(host, port, {
         name = 'http',
-        handler = function(...)
+        handler = function(s, peer)
+            local collector = self.metrics
+            if collector ~= nil then
+                collector:connection_opened()
+            end
             self.internal.preprocess_client_handler()
-            process_client(self, ...)
-            self.internal.postprocess_client_handler()
+            serve_client(self, listener, s, peer, collector, 0, false)
         end,
         http_server = self,
     })
+    if server == nil then
+        return nil
+    end
+    return server, listener
+end
+
+local function httpd_start(self)
+    if type(self) ~= 'table' then
+        error("httpd: usage: httpd:start()")
+    end
 
+    -- Compile the templates before accepting requests, so the first
+    -- requests after a deploy do not pay for it.
+    if self.options.cache_templates then
+        self.cache.tpl:preload(self.options.template_bundle)
+    end
+
+    local server, listener = listen(self, self.tcp_server_f, self.host, self.port)
     if server == nil then
         error(sprintf("Can't create tcp_server: %s", errno.strerror()))
     end
 
+    if self.access_log ~= nil then
+        self.access_log:start()
+    end
+
     rawset(self, 'is_run', true)
     rawset(self, 'tcp_server', server)
+    rawset(self, 'listener', listener)
     rawset(self, 'stop', httpd_stop)
 
     return self
 end
 
+-- Compares option values, tables are compared by content.
+local function option_equals(a, b)
+    if type(a) ~= 'table' or type(b) ~= 'table' then
+        return a == b
+    end
+    for k, v in pairs(a) do
+        if not option_equals(v, b[k]) then
+            return false
+        end
+    end
+    for k in pairs(b) do
+        if a[k] == nil then
+            return false
+        end
+    end
+    return true
+end
+
+-- The module table, new() is used by reconfigure().
+local exports
+
+-- Applies a new address and options to the server in place. The routes,
+-- helpers, hooks and caches are kept and the open connections are served
+-- with the new options. A running server keeps its listener when the
+-- address does not change, a new TLS context is used for the connections
+-- accepted after the call. Otherwise the new address is bound before the
+-- old listener is closed, and the connections accepted by the old one are
+-- closed after their current request.
+local function httpd_reconfigure(self, host, port, options)
+    if type(self) ~= 'table' then
+        error("httpd: usage: httpd:reconfigure(host, port[, options])")
+    end
+    -- Validates the arguments the same way as new().
+    local fresh = exports.new(host, port, options)
+
+    local ssl_ctx
+    if fresh.use_tls then
+        ssl_ctx = create_ssl_ctx(host, port,
+            ssl_ctx_options(fresh.options, fresh.http2))
+    end
+
+    local tcp_server_f = self.tcp_server_f
+    if fresh.use_tls ~= self.use_tls and
+       (tcp_server_f == socket.tcp_server or tls_server_functions[tcp_server_f]) then
+        tcp_server_f = fresh.use_tls and tls_tcp_server_f(self) or socket.tcp_server
+    end
+
+    local server, listener
+    if self.is_run and (host ~= self.host or port ~= self.port or
+                        tcp_server_f ~= self.tcp_server_f) then
+        local old_ctx = self.ssl_ctx
+        self.ssl_ctx = ssl_ctx
+        server, listener = listen(self, tcp_server_f, host, port)
+        if server == nil and host == self.host and port == self.port then
+            -- The address is taken by the listener being replaced.
+            log.warn('httpd: %s:%s is rebound, new connections are refused ' ..
+                     'until it is done', host, port)
+            self.tcp_server:close()
+            self.listener.draining = true
+            self.tcp_server = nil
+            server, listener = listen(self, tcp_server_f, host, port)
+        end
+        if server == nil then
+            local err = errno.strerror()
+            self.ssl_ctx = old_ctx
+            if self.tcp_server == nil then
+                self.is_run = false
+            end
+            error(sprintf("Can't create tcp_server: %s", err))
+        end
+    end
+
+    local old = self.options
+    self.host = host
+    self.port = port
+    self.options = fresh.options
+    self.use_tls = fresh.use_tls
+    self.ssl_ctx = ssl_ctx
+    self.tcp_server_f = tcp_server_f
+    self.disable_keepalive = fresh.disable_keepalive
+    self.idle_timeout = fresh.idle_timeout
+    self.http2 = fresh.http2
+    self.response_cache:set_max_bytes(fresh.response_cache.max_bytes)
+
+    if not option_equals(old.metrics, fresh.options.metrics) then
+        delete_handler_routes(self, metrics_handler)
+        self.metrics = fresh.metrics
+        if self.metrics ~= nil then
+            add_metrics_route(self, metrics.parse_options(fresh.options.metrics))
+        end
+    end
+
+    if not option_equals(old.profiler, fresh.options.profiler) then
+        if self.profiler_handler ~= nil then
+            delete_handler_routes(self, self.profiler_handler)
+            self.profiler_handler = nil
+        end
+        local profiler_opts = profiler.parse_options(fresh.options.profiler)
+        if profiler_opts ~= nil then
+            add_profiler_route(self, profiler_opts)
+        end
+    end
+
+    if not option_equals(old.access_log, fresh.options.access_log) then
+        if self.access_log ~= nil then
+            self.access_log:stop()
+        end
+        self.access_log = fresh.access_log
+        if self.is_run and self.access_log ~= nil then
+            self.access_log:start()
+        end
+    end
+
+    self.deadline = fresh.deadline
+
+    -- The state of the clients is kept unless the limit changes.
+    if not option_equals(old.rate_limit, fresh.options.rate_limit) then
+        self.rate_limit = fresh.rate_limit
+    end
+
+    if old.app_dir ~= fresh.options.app_dir then
+        self.cache.tpl = fresh.cache.tpl
+        self.cache.ctx = {}
+        self.cache.static = {}
+    end
+    if self.is_run and fresh.options.cache_templates then
+        self.cache.tpl:preload(fresh.options.template_bundle)
+    end
+
+    if server ~= nil then
+        if self.tcp_server ~= nil then
+            self.tcp_server:close()
+            self.listener.draining = true
+        end
+        self.tcp_server = server
+        self.listener = listener
+    end
+    return self
+end
+
 local AVAILABLE_SSL_VERIFY_CLIENT_OPTS = {
     off = true,
     optional = true,
@@ -1412,7 +2724,7 @@ local function validate_ssl_opts(opts)
     return is_tls_enabled
 end
 
-local exports = {
+exports = {
     _VERSION = require('http.version'),
     DETACHED = DETACHED,
 
@@ -1433,6 +2745,37 @@ local exports = {
            type(options.idle_timeout) ~= 'number' then
             error('Option idle_timeout must be a number.')
         end
+        local metrics_opts = metrics.parse_options(options.metrics)
+        if options.request_timing ~= nil and
+           type(options.request_timing) ~= 'boolean' then
+            error('Option request_timing must be a boolean.')
+        end
+        if options.server_timing ~= nil and
+           type(options.server_timing) ~= 'boolean' then
+            error('Option server_timing must be a boolean.')
+        end
+        if options.slow_request_threshold ~= nil and
+           (type(options.slow_request_threshold) ~= 'number' or
+            options.slow_request_threshold < 0) then
+            error('Option slow_request_threshold must be a non-negative number.')
+        end
+        local http2_opts = http2.parse_options(options.http2)
+        local access_log_opts = access_log.parse_options(options.access_log)
+        local rate_limit_opts = rate_limit.parse_options(options.rate_limit)
+        local profiler_opts = profiler.parse_options(options.profiler)
+        local deadline_opts = deadline.parse_options(options.deadline)
+        if options.template_bundle ~= nil and
+           type(options.template_bundle) ~= 'string' then
+            error('Option template_bundle must be a string.')
+        end
+        if options.park_idle ~= nil and type(options.park_idle) ~= 'boolean' then
+            error('Option park_idle must be a boolean.')
+        end
+        if options.response_cache_max_bytes ~= nil and
+           (type(options.response_cache_max_bytes) ~= 'number' or
+            options.response_cache_max_bytes <= 0) then
+            error('Option response_cache_max_bytes must be a positive number.')
+        end
 
         local is_tls_enabled = validate_ssl_opts({
             ssl_cert_file = options.ssl_cert_file,
@@ -1458,6 +2801,12 @@ local exports = {
             display_errors      = false,
             disable_keepalive   = {},
             idle_timeout        = 0, -- no timeout, option is disabled
+            metrics             = false,
+            request_timing      = false,
+            server_timing       = false,
+            response_cache_max_bytes = response_cache.DEFAULT_MAX_BYTES,
+            http2               = false,
+            park_idle           = false,
         }
 
         local self = {
@@ -1466,6 +2815,7 @@ local exports = {
             is_run  = false,
             stop    = httpd_stop,
             start   = httpd_start,
+            reconfigure = httpd_reconfigure,
             use_tls = is_tls_enabled,
             options = extend(default, options, false),
 
@@ -1483,19 +2833,29 @@ local exports = {
             helper  = set_helper,
             hook    = set_hook,
             url_for = url_for_httpd,
+            invalidate_cache = invalidate_cache,
+            sse_channel = sse_channel,
 
             -- Exposed to make it replaceable by a user.
             tcp_server_f = socket.tcp_server,
 
             -- caches
             cache   = {
-                tpl         = {},
                 ctx         = {},
                 static      = {},
             },
 
+            response_cache = response_cache.new({
+                max_bytes = options.response_cache_max_bytes,
+            }),
+            single_flight = single_flight.new(),
+            fast_routes = fast_route.new(),
+            sse_channels = {},
+
             disable_keepalive   = tomap(disable_keepalive),
             idle_timeout        = options.idle_timeout,
+            http2               = http2_opts,
+            deadline            = deadline_opts,
 
             internal = {
                 preprocess_client_handler = function() end,
@@ -1503,19 +2863,26 @@ local exports = {
             }
         }
 
+        self.cache.tpl = template.new(
+            catfile(self.options.app_dir, 'templates'),
+            { check_interval = TEMPLATE_CHECK_INTERVAL })
+
         if self.use_tls then
-            self.tcp_server_f = function(host, port, handler, timeout)
-                local ssl_ctx = create_ssl_ctx(host, port, {
-                    ssl_cert_file = self.options.ssl_cert_file,
-                    ssl_key_file = self.options.ssl_key_file,
-                    ssl_password = self.options.ssl_password,
-                    ssl_password_file = self.options.ssl_password_file,
-                    ssl_ca_file = self.options.ssl_ca_file,
-                    ssl_ciphers = self.options.ssl_ciphers,
-                    ssl_verify_client = self.options.ssl_verify_client,
-                })
-                return sslsocket.tcp_server(host, port, handler, timeout, ssl_ctx)
-            end
+            self.tcp_server_f = tls_tcp_server_f(self)
+        end
+
+        if metrics_opts ~= nil then
+            self.metrics = metrics.new(metrics_opts)
+            add_metrics_route(self, metrics_opts)
+        end
+        if access_log_opts ~= nil then
+            self.access_log = access_log.new(access_log_opts)
+        end
+        if rate_limit_opts ~= nil then
+            self.rate_limit = rate_limit.new(rate_limit_opts)
+        end
+        if profiler_opts ~= nil then
+            add_profiler_route(self, profiler_opts)
         end
 
         return self
@@ -1525,6 +2892,7 @@ local exports = {
         response_mt = response_mt,
         request_mt = request_mt,
         extend = extend,
+        option_equals = option_equals,
     }
 }
 
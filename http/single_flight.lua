@@ -0,0 +1,143 @@
+-- http.single_flight
+--
+-- Coalescing of identical concurrent requests: while a handler runs for
+-- a key, other requests with the same key wait for its result instead of
+-- running the handler again.
+
+local clock = require('clock')
+local fiber = require('fiber')
+
+local DEFAULT_TIMEOUT = 10
+
+-- Request headers which identify a user.
+local PRIVATE_HEADERS = { 'authorization', 'cookie' }
+
+local function errorf(fmt, ...)
+    error(string.format(fmt, ...))
+end
+
+-- Checks the `single_flight` option of a route and returns a normalized
+-- table.
+local function parse_route_options(opts)
+    if opts == true then
+        opts = {}
+    end
+    if type(opts) ~= 'table' then
+        error("'single_flight' option should be a boolean or a table")
+    end
+    for k in pairs(opts) do
+        if k ~= 'timeout' and k ~= 'vary' then
+            errorf("Unknown single_flight option '%s'", k)
+        end
+    end
+    if opts.timeout ~= nil and
+       (type(opts.timeout) ~= 'number' or opts.timeout <= 0) then
+        error('single_flight.timeout must be a positive number')
+    end
+    local vary = {}
+    if opts.vary ~= nil then
+        if type(opts.vary) ~= 'table' then
+            error('single_flight.vary must be an array of header names')
+        end
+        for i, name in ipairs(opts.vary) do
+            if type(name) ~= 'string' then
+                errorf('single_flight.vary[%d] must be a string', i)
+            end
+            vary[i] = string.lower(name)
+        end
+    end
+    return {
+        timeout = opts.timeout or DEFAULT_TIMEOUT,
+        vary = vary,
+    }
+end
+
+-- Returns true if a request with `headers` may share a response with
+-- other requests of the route: a request carrying a header that
+-- identifies a user is coalesced only if the route varies on it.
+local function is_shareable(route_opts, headers)
+    for _, name in ipairs(PRIVATE_HEADERS) do
+        if headers[name] ~= nil then
+            local varies = false
+            for _, vary in ipairs(route_opts.vary) do
+                if vary == name then
+                    varies = true
+                    break
+                end
+            end
+            if not varies then
+                return false
+            end
+        end
+    end
+    return true
+end
+
+local group_methods = {}
+
+-- Runs `fn(...)` under `key`. The first caller (the leader) runs `fn` and
+-- gets its results as is. Callers arriving while it runs wait up to
+-- `timeout` seconds and get `share(ok, ...)` of the leader's `pcall` results.
+--
+-- Returns `is_leader, ...`: for the leader the rest are the `pcall` results
+-- of `fn`, for a waiting caller it is the value returned by `share` or nil
+-- and 'timeout' if the leader has not finished in time.
+function group_methods.execute(self, key, timeout, share, fn, ...)
+    local call = self.calls[key]
+    if call ~= nil then
+        self.coalesced = self.coalesced + 1
+        local deadline = clock.monotonic() + timeout
+        while not call.done do
+            local left = deadline - clock.monotonic()
+            if left <= 0 or not call.cond:wait(left) and not call.done then
+                self.timeouts = self.timeouts + 1
+                return false, nil, 'timeout'
+            end
+        end
+        return false, call.shared
+    end
+
+    call = { cond = fiber.cond(), done = false }
+    self.calls[key] = call
+    self.executions = self.executions + 1
+
+    local res = { pcall(fn, ...) }
+    local ok, shared = pcall(share, unpack(res, 1, table.maxn(res)))
+    call.shared = ok and shared or nil
+    call.done = true
+    self.calls[key] = nil
+    call.cond:broadcast()
+
+    return true, unpack(res, 1, table.maxn(res))
+end
+
+function group_methods.stats(self)
+    local in_flight = 0
+    for _ in pairs(self.calls) do
+        in_flight = in_flight + 1
+    end
+    return {
+        in_flight = in_flight,
+        executions = self.executions,
+        coalesced = self.coalesced,
+        timeouts = self.timeouts,
+    }
+end
+
+local group_mt = { __index = group_methods }
+
+local function new()
+    return setmetatable({
+        calls = {},
+        executions = 0,
+        coalesced = 0,
+        timeouts = 0,
+    }, group_mt)
+end
+
+return {
+    new = new,
+    parse_route_options = parse_route_options,
+    is_shareable = is_shareable,
+    DEFAULT_TIMEOUT = DEFAULT_TIMEOUT,
+}
@@ -0,0 +1,303 @@
+-- http.sse
+--
+-- Server-Sent Events channels. A published event is encoded and framed
+-- once, and the same string is queued to every subscriber of the channel.
+-- Each subscriber connection is written by its own fiber from a bounded
+-- queue; a subscriber which falls too far behind is evicted.
+
+local fiber = require('fiber')
+
+local DEFAULT_OPTIONS = {
+    queue_size = 1024,
+    max_queued_bytes = 1024 * 1024,
+    heartbeat = 15,
+    write_timeout = 10,
+}
+
+-- A comment line, ignored by clients.
+local HEARTBEAT = ':\n\n'
+
+local function errorf(fmt, ...)
+    error(string.format(fmt, ...))
+end
+
+-- Checks options of `req:sse()` and returns a table with defaults.
+local function parse_options(opts)
+    if opts == nil then
+        opts = {}
+    end
+    if type(opts) ~= 'table' then
+        error('SSE options must be a table')
+    end
+    for k in pairs(opts) do
+        if DEFAULT_OPTIONS[k] == nil and k ~= 'retry' and k ~= 'headers' then
+            errorf("Unknown sse option '%s'", k)
+        end
+    end
+    for _, name in ipairs({ 'queue_size', 'max_queued_bytes', 'retry' }) do
+        local value = opts[name]
+        if value ~= nil and (type(value) ~= 'number' or value <= 0 or
+                             math.floor(value) ~= value) then
+            errorf('sse.%s must be a positive integer', name)
+        end
+    end
+    for _, name in ipairs({ 'heartbeat', 'write_timeout' }) do
+        local value = opts[name]
+        if value ~= nil and (type(value) ~= 'number' or value <= 0) then
+            errorf('sse.%s must be a positive number', name)
+        end
+    end
+    if opts.headers ~= nil and type(opts.headers) ~= 'table' then
+        error('sse.headers must be a table')
+    end
+    return {
+        queue_size = opts.queue_size or DEFAULT_OPTIONS.queue_size,
+        max_queued_bytes = opts.max_queued_bytes or DEFAULT_OPTIONS.max_queued_bytes,
+        heartbeat = opts.heartbeat or DEFAULT_OPTIONS.heartbeat,
+        write_timeout = opts.write_timeout or DEFAULT_OPTIONS.write_timeout,
+        retry = opts.retry,
+        headers = opts.headers or {},
+    }
+end
+
+local function check_field(name, value)
+    value = tostring(value)
+    if string.find(value, '[\r\n]') then
+        errorf('SSE event %s must not contain line breaks', name)
+    end
+    return value
+end
+
+-- Encodes an event in the text/event-stream format. Returns the event and
+-- the same event as a chunk of the chunked transfer coding.
+local function encode_event(data, opts)
+    local lines = {}
+    if opts ~= nil then
+        if opts.id ~= nil then
+            table.insert(lines, 'id: ' .. check_field('id', opts.id) .. '\n')
+        end
+        if opts.event ~= nil then
+            table.insert(lines, 'event: ' .. check_field('event', opts.event) .. '\n')
+        end
+        if opts.retry ~= nil then
+            table.insert(lines, 'retry: ' .. check_field('retry', opts.retry) .. '\n')
+        end
+    end
+    data = string.gsub(tostring(data), '\r\n?', '\n')
+    for line in string.gmatch(data .. '\n', '([^\n]*)\n') do
+        table.insert(lines, 'data: ' .. line .. '\n')
+    end
+    table.insert(lines, '\n')
+    local event = table.concat(lines)
+    return event, string.format('%x\r\n%s\r\n', #event, event)
+end
+
+local stream_methods = {}
+
+local function clear_queue(self)
+    local queue = self.queue
+    for i = self.first, self.last do
+        queue[i] = nil
+    end
+    self.first, self.last = 1, 0
+    self.queued_bytes = 0
+end
+
+local function unsubscribe(self)
+    for _, channel in ipairs(self.channels) do
+        channel.subscribers[self] = nil
+    end
+end
+
+-- Queues an encoded event, evicts the subscriber if the queue is full.
+local function push(self, event, chunk)
+    if self.closed then
+        return false
+    end
+    local data = self.chunked and chunk or event
+    if self.last - self.first + 1 >= self.opts.queue_size or
+       self.queued_bytes + #data > self.opts.max_queued_bytes then
+        self.evicted = true
+        self.closed = true
+        clear_queue(self)
+        unsubscribe(self)
+        for _, channel in ipairs(self.channels) do
+            channel.evicted = channel.evicted + 1
+        end
+        self.cond:signal()
+        return false
+    end
+    self.last = self.last + 1
+    self.queue[self.last] = data
+    self.queued_bytes = self.queued_bytes + #data
+    self.cond:signal()
+    return true
+end
+
+-- Sends an event to this subscriber only, e.g. a snapshot of the state
+-- before channel updates. Returns false if the stream is closed or evicted.
+function stream_methods.send(self, data, opts)
+    return push(self, encode_event(data, opts))
+end
+
+-- Ends the stream after the queued events are written.
+function stream_methods.close(self)
+    if not self.closed then
+        self.closed = true
+        unsubscribe(self)
+        self.cond:signal()
+    end
+end
+
+-- Writes queued events until the stream is closed, evicted or the client
+-- is gone. Called by the server in the handler fiber.
+local function serve(self)
+    local s = self.s
+    local opts = self.opts
+    local heartbeat = HEARTBEAT
+    if self.chunked then
+        heartbeat = string.format('%x\r\n%s\r\n', #HEARTBEAT, HEARTBEAT)
+    end
+    while true do
+        local data
+        if self.first == self.last then
+            data = self.queue[self.first]
+        elseif self.first < self.last then
+            data = table.concat(self.queue, '', self.first, self.last)
+        end
+        if data ~= nil then
+            clear_queue(self)
+            if not s:write(data, opts.write_timeout) then
+                break
+            end
+        elseif self.closed then
+            if not self.evicted and self.chunked then
+                s:write('0\r\n\r\n', opts.write_timeout)
+            end
+            break
+        elseif not self.cond:wait(opts.heartbeat) and self.first > self.last and
+               not self.closed then
+            -- Detects gone clients and keeps proxies from dropping the
+            -- connection.
+            if not s:write(heartbeat, opts.write_timeout) then
+                break
+            end
+        end
+    end
+    self.closed = true
+    unsubscribe(self)
+end
+
+local stream_mt = { __index = stream_methods }
+
+local channel_methods = {}
+
+-- Publishes an event to all subscribers. Returns the number of
+-- subscribers the event is queued to.
+function channel_methods.publish(self, data, opts)
+    local event, chunk = encode_event(data, opts)
+    self.published = self.published + 1
+    local n = 0
+    for stream in pairs(self.subscribers) do
+        if push(stream, event, chunk) then
+            n = n + 1
+        end
+    end
+    return n
+end
+
+-- Ends the streams of all subscribers.
+function channel_methods.close(self)
+    for stream in pairs(self.subscribers) do
+        stream:close()
+    end
+end
+
+function channel_methods.stats(self)
+    local subscribers = 0
+    for _ in pairs(self.subscribers) do
+        subscribers = subscribers + 1
+    end
+    return {
+        subscribers = subscribers,
+        published = self.published,
+        evicted = self.evicted,
+    }
+end
+
+local channel_mt = { __index = channel_methods }
+
+local function new_channel(name)
+    return setmetatable({
+        name = name,
+        subscribers = {},
+        published = 0,
+        evicted = 0,
+    }, channel_mt)
+end
+
+-- Sends the response headers on the connection of `req` and subscribes it
+-- to `channels`. Returns the stream or nil and an error.
+local function subscribe(req, channels, opts)
+    opts = parse_options(opts)
+    if rawget(req, 'sse_stream') ~= nil then
+        error('The connection is already subscribed')
+    end
+    if req.proto[1] ~= 1 then
+        return nil, 'Server-Sent Events require HTTP/1.x'
+    end
+    local chunked = req.proto[2] >= 1
+    local response = {
+        'HTTP/1.1 200 Ok\r\n',
+        'Content-Type: text/event-stream; charset=utf-8\r\n',
+        'Cache-Control: no-cache\r\n',
+    }
+    if chunked then
+        table.insert(response, 'Transfer-Encoding: chunked\r\n')
+    else
+        table.insert(response, 'Connection: close\r\n')
+    end
+    for k, v in pairs(opts.headers) do
+        table.insert(response, string.format('%s: %s\r\n', k, v))
+    end
+    table.insert(response, '\r\n')
+    if not req.s:write(table.concat(response), opts.write_timeout) then
+        return nil, 'Failed to send the response headers'
+    end
+
+    local stream = setmetatable({
+        s = req.s,
+        opts = opts,
+        chunked = chunked,
+        channels = channels,
+        last_event_id = req.headers['last-event-id'],
+        queue = {},
+        first = 1,
+        last = 0,
+        queued_bytes = 0,
+        cond = fiber.cond(),
+        closed = false,
+        evicted = false,
+    }, stream_mt)
+    for _, channel in ipairs(channels) do
+        channel.subscribers[stream] = true
+    end
+    if opts.retry ~= nil then
+        local event = string.format('retry: %d\n\n', opts.retry)
+        push(stream, event, string.format('%x\r\n%s\r\n', #event, event))
+    end
+    -- The request has no body, the server serves the stream when the
+    -- handler returns.
+    rawset(req, '_remaining', 0)
+    rawset(req, 'sse_stream', stream)
+    return stream
+end
+
+return {
+    new_channel = new_channel,
+    subscribe = subscribe,
+    serve = serve,
+    encode_event = encode_event,
+    parse_options = parse_options,
+    DEFAULT_OPTIONS = DEFAULT_OPTIONS,
+}
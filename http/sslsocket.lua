@@ -1,5 +1,7 @@
 local TIMEOUT_INFINITY = 500 * 365 * 86400
 local LIMIT_INFINITY   = 2147483647
+-- Seconds an accepted connection with ALPN has to complete the handshake.
+local DEFAULT_HANDSHAKE_TIMEOUT = 10
 
 local log = require('log')
 local ffi = require('ffi')
@@ -52,6 +54,17 @@ pcall(ffi.cdef, [[
 
     int SSL_get_error(const SSL *s, int ret_code);
 
+    int SSL_do_handshake(SSL *s);
+
+    typedef int (*SSL_CTX_alpn_select_cb_func)(SSL *ssl,
+        const unsigned char **out, unsigned char *outlen,
+        const unsigned char *in, unsigned int inlen, void *arg);
+    void SSL_CTX_set_alpn_select_cb(SSL_CTX *ctx,
+        SSL_CTX_alpn_select_cb_func cb, void *arg);
+    int SSL_select_next_proto(unsigned char **out, unsigned char *outlen,
+        const unsigned char *server, unsigned int server_len,
+        const unsigned char *client, unsigned int client_len);
+
     void *memmem(const void *haystack, size_t haystacklen,
                  const void *needle, size_t needlelen);
 ]])
@@ -82,6 +95,10 @@ local function tls_server_method()
     return ffi.C.TLS_server_method()
 end
 
+local function tls_client_method()
+    return ffi.C.TLS_client_method()
+end
+
 local function ctx(method)
     ffi.C.ERR_clear_error()
 
@@ -181,6 +198,38 @@ end
 
 local default_ctx = ctx(ffi.C.TLS_server_method())
 
+-- Protocols offered by ALPN in the order of preference, in the wire format.
+local ALPN_H2_PROTOS = '\2h2\8http/1.1'
+
+local OPENSSL_NPN_NEGOTIATED = 1
+local SSL_TLSEXT_ERR_OK = 0
+local SSL_TLSEXT_ERR_NOACK = 3
+
+local alpn_h2_select_cb
+
+-- Contexts with the ALPN callback, their connections are handshaked
+-- before passing them to the handler.
+local alpn_contexts = setmetatable({}, { __mode = 'k' })
+
+-- Makes the server select HTTP/2 if the client supports it. The callback is
+-- created once and never freed.
+local function ctx_set_alpn_h2(ctx)
+    if alpn_h2_select_cb == nil then
+        alpn_h2_select_cb = ffi.cast('SSL_CTX_alpn_select_cb_func',
+            function(_, out, outlen, client, client_len)
+                local rc = ffi.C.SSL_select_next_proto(
+                    ffi.cast('unsigned char **', out), outlen,
+                    ALPN_H2_PROTOS, #ALPN_H2_PROTOS, client, client_len)
+                if rc ~= OPENSSL_NPN_NEGOTIATED then
+                    return SSL_TLSEXT_ERR_NOACK
+                end
+                return SSL_TLSEXT_ERR_OK
+            end)
+    end
+    ffi.C.SSL_CTX_set_alpn_select_cb(ctx, alpn_h2_select_cb, nil)
+    alpn_contexts[ctx] = true
+end
+
 local SSL_ERROR_WANT_READ   = 2
 local SSL_ERROR_WANT_WRITE  = 3
 local SSL_ERROR_SYSCALL     = 5 -- Look at error stack/return value/errno.
@@ -243,6 +292,10 @@ function sslsocket.close(self)
     return self.sock:close()
 end
 
+function sslsocket.shutdown(self, how)
+    return self.sock:shutdown(how)
+end
+
 function sslsocket.error(self)
     local error_string =
         ffi.string(ffi.C.ERR_error_string(ffi.C.ERR_peek_last_error(), nil))
@@ -310,6 +363,12 @@ local function sysread(self, charptr, size, timeout)
     end
 end
 
+-- Reads up to `size` bytes into `charptr` past the read buffer. Returns
+-- the number of bytes, 0 at EOF or nil and an error.
+function sslsocket.read_into(self, charptr, size, timeout)
+    return sysread(self, charptr, size, timeout or TIMEOUT_INFINITY)
+end
+
 local function read(self, limit, timeout, check, ...)
     assert(limit >= 0)
 
@@ -412,12 +471,51 @@ function sslsocket.read(self, opts, timeout)
 end
 
 function sslsocket.readable(self, timeout)
+    -- Decrypted data may be left in the TLS session.
+    if ffi.C.SSL_pending(self.ssl) > 0 then
+        return true
+    end
     return self.sock:readable(timeout)
 end
 
-local function wrap_accepted_socket(sock, sslctx)
-    sslctx = sslctx or default_ctx
+-- Performs the TLS handshake of an accepted connection. LuaJIT does not
+-- allow to call Lua callbacks (ALPN) from compiled code, so the function
+-- is never compiled.
+local function handshake(self, timeout)
+    local start = clock.time()
+    local mode = WAIT_FOR_READ
+    while true do
+        ffi.C.ERR_clear_error()
+        local rc = ffi.C.SSL_do_handshake(self.ssl)
+        if rc == 1 then
+            return true
+        end
+        local ssl_error = ffi.C.SSL_get_error(self.ssl, rc)
+        if ssl_error == SSL_ERROR_WANT_READ then
+            mode = WAIT_FOR_READ
+        elseif ssl_error == SSL_ERROR_WANT_WRITE then
+            mode = WAIT_FOR_WRITE
+        elseif ssl_error == SSL_ERROR_SYSCALL then
+            return nil, self.sock:error()
+        else
+            return nil, ffi.string(ffi.C.ERR_error_string(ssl_error, nil))
+        end
+
+        local ready
+        if mode == WAIT_FOR_READ then
+            ready = self.sock:readable(slice_wait(timeout, start))
+        else
+            ready = self.sock:writable(slice_wait(timeout, start))
+        end
+        if not ready then
+            self.sock._errno = errno.ETIMEDOUT
+            return nil, 'Timeout exceeded'
+        end
+    end
+end
+jit.off(handshake)
 
+local function wrap_socket(sock, sslctx, is_server)
     ffi.C.ERR_clear_error()
     local ssl = ffi.gc(ffi.C.SSL_new(sslctx),
                        ffi.C.SSL_free)
@@ -436,7 +534,11 @@ local function wrap_accepted_socket(sock, sslctx)
     end
 
     ffi.C.ERR_clear_error()
-    ffi.C.SSL_set_accept_state(ssl);
+    if is_server then
+        ffi.C.SSL_set_accept_state(ssl);
+    else
+        ffi.C.SSL_set_connect_state(ssl);
+    end
 
     local self = setmetatable({}, sslsocket)
     rawset(self, 'sock', sock)
@@ -445,13 +547,46 @@ local function wrap_accepted_socket(sock, sslctx)
     return self
 end
 
-local function tcp_server(host, port, handler, timeout, sslctx)
-    sslctx = sslctx or default_ctx
+local function wrap_accepted_socket(sock, sslctx)
+    return wrap_socket(sock, sslctx or default_ctx, true)
+end
+
+-- Wraps a connected client socket, the handshake is performed on the first
+-- read or write. sslctx must be created with tls_client_method().
+local function wrap_connected_socket(sock, sslctx)
+    return wrap_socket(sock, sslctx, false)
+end
+
+-- sslctx is a context or a function returning the context for an
+-- accepted connection, so it can be replaced without closing the listener.
+-- handshake_timeout is the number of seconds or a function returning it:
+-- connections with ALPN are handshaked before the handler is called and
+-- closed if the client does not complete the handshake in time.
+local function tcp_server(host, port, handler, timeout, sslctx, handshake_timeout)
+    local get_ctx = sslctx
+    if type(sslctx) ~= 'function' then
+        sslctx = sslctx or default_ctx
+        get_ctx = function() return sslctx end
+    end
+    local get_handshake_timeout = handshake_timeout
+    if type(handshake_timeout) ~= 'function' then
+        handshake_timeout = handshake_timeout or DEFAULT_HANDSHAKE_TIMEOUT
+        get_handshake_timeout = function() return handshake_timeout end
+    end
 
     local handler_function = handler.handler
 
     local wrapper = function(sock, from)
-        local self, err = wrap_accepted_socket(sock, sslctx)
+        local ctx = get_ctx()
+        local self, err = wrap_accepted_socket(sock, ctx)
+        if self and alpn_contexts[ctx] then
+            local ok
+            ok, err = handshake(self, get_handshake_timeout())
+            if not ok then
+                self = nil
+                sock:close()
+            end
+        end
         if not self then
             log.info('sslsocket.tcp_server error: %s ', err)
         else
@@ -466,6 +601,7 @@ end
 
 return {
     tls_server_method = tls_server_method,
+    tls_client_method = tls_client_method,
 
     ctx = ctx,
     ctx_use_private_key_file = ctx_use_private_key_file,
@@ -473,8 +609,10 @@ return {
     ctx_load_verify_locations = ctx_load_verify_locations,
     ctx_set_cipher_list = ctx_set_cipher_list,
     ctx_set_verify = ctx_set_verify,
+    ctx_set_alpn_h2 = ctx_set_alpn_h2,
 
     tcp_server = tcp_server,
 
     wrap_accepted_socket = wrap_accepted_socket,
+    wrap_connected_socket = wrap_connected_socket,
 }
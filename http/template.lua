@@ -0,0 +1,235 @@
+-- http.template
+--
+-- Compiled templates. A template is compiled once to a Lua chunk and
+-- rendered by lib.template() with the variables as the environment of the
+-- template function. The templates of a directory can be compiled ahead of
+-- time into a bundle of LuaJIT bytecode, which is loaded at server start
+-- instead of compiling the sources.
+
+local lib = require('http.lib')
+local fio = require('fio')
+local fiber = require('fiber')
+local log = require('log')
+local msgpack = require('msgpack')
+
+local BUNDLE_VERSION = 1
+
+-- Compiled inline templates (the `template` route option) by source.
+local MAX_COMPILED_SOURCES = 1024
+
+local TEMPLATE_SUFFIX = '.el'
+
+local function errorf(fmt, ...)
+    error(string.format(fmt, ...))
+end
+
+-- Returns the chunk of a template source.
+local function compile(source, name)
+    return lib.template_compile(source, name ~= nil and '=' .. name or nil)
+end
+
+local compiled_sources = {}
+local compiled_count = 0
+
+-- Returns the chunk of an inline template, compiling each source once.
+local function compile_cached(source)
+    local chunk = compiled_sources[source]
+    if chunk == nil then
+        chunk = compile(source)
+        if compiled_count < MAX_COMPILED_SOURCES then
+            compiled_sources[source] = chunk
+            compiled_count = compiled_count + 1
+        end
+    end
+    return chunk
+end
+
+local function read_file(path)
+    local fh, err = fio.open(path, { 'O_RDONLY' })
+    if fh == nil then
+        return nil, err
+    end
+    local data
+    data, err = fh:read()
+    fh:close()
+    if data == nil then
+        return nil, err
+    end
+    return data
+end
+
+local function write_file(path, data)
+    local tmp = path .. '.tmp'
+    local fh, err = fio.open(tmp, { 'O_WRONLY', 'O_CREAT', 'O_TRUNC' },
+        tonumber('644', 8))
+    if fh == nil then
+        return nil, err
+    end
+    local ok
+    ok, err = fh:write(data)
+    fh:close()
+    if not ok then
+        fio.unlink(tmp)
+        return nil, err
+    end
+    return fio.rename(tmp, path)
+end
+
+-- Returns the template files of `dir` relative to it.
+local function list_templates(dir, prefix, res)
+    res = res or {}
+    for _, name in ipairs(fio.listdir(dir) or {}) do
+        local path = fio.pathjoin(dir, name)
+        local file = prefix ~= nil and prefix .. '/' .. name or name
+        if fio.path.is_dir(path) then
+            list_templates(path, file, res)
+        elseif string.sub(name, -#TEMPLATE_SUFFIX) == TEMPLATE_SUFFIX then
+            table.insert(res, file)
+        end
+    end
+    return res
+end
+
+-- Compiles the template `file` of `dir`. Returns an entry or nil and
+-- an error.
+local function compile_file(dir, file)
+    local path = fio.pathjoin(dir, file)
+    local st, err = fio.stat(path)
+    if st == nil then
+        return nil, err
+    end
+    local source
+    source, err = read_file(path)
+    if source == nil then
+        return nil, err
+    end
+    return {
+        chunk = compile(source, file),
+        mtime = st.mtime,
+        size = st.size,
+        checked = fiber.clock(),
+    }
+end
+
+-- Loads a bundle written by build(). Returns the entries by file or nil
+-- if the bundle is absent or made by another LuaJIT.
+local function load_bundle(path)
+    local data = read_file(path)
+    if data == nil then
+        return nil
+    end
+    local ok, bundle = pcall(msgpack.decode, data)
+    if not ok or type(bundle) ~= 'table' or
+       bundle.version ~= BUNDLE_VERSION or bundle.jit ~= jit.version then
+        log.warn("Template bundle '%s' is outdated, ignored", path)
+        return nil
+    end
+    local entries = {}
+    for file, e in pairs(bundle.templates) do
+        local chunk = loadstring(e.code, '=' .. file)
+        if chunk ~= nil then
+            entries[file] = { chunk = chunk, mtime = e.mtime, size = e.size }
+        end
+    end
+    return entries
+end
+
+-- Compiles the templates of `dir` into a bundle of bytecode at `path`.
+-- Returns the number of the templates.
+local function build(dir, path)
+    if type(dir) ~= 'string' or type(path) ~= 'string' then
+        error('Usage: template.build(dir, path)')
+    end
+    local templates = {}
+    local count = 0
+    for _, file in ipairs(list_templates(dir)) do
+        local e, err = compile_file(dir, file)
+        if e == nil then
+            errorf("Can not load template '%s': %s", file, err)
+        end
+        templates[file] = {
+            code = string.dump(e.chunk),
+            mtime = e.mtime,
+            size = e.size,
+        }
+        count = count + 1
+    end
+    local ok, err = write_file(path, msgpack.encode({
+        version = BUNDLE_VERSION,
+        jit = jit.version,
+        templates = templates,
+    }))
+    if not ok then
+        errorf("Can not write template bundle '%s': %s", path, err)
+    end
+    return count
+end
+
+local cache_methods = {}
+
+-- Compiles all the templates of the directory, taking the ones which
+-- did not change since the bundle was built from the bundle.
+function cache_methods.preload(self, bundle_path)
+    local bundle = bundle_path ~= nil and load_bundle(bundle_path) or {}
+    local now = fiber.clock()
+    for _, file in ipairs(list_templates(self.dir)) do
+        local e = bundle[file]
+        local st = fio.stat(fio.pathjoin(self.dir, file))
+        if e ~= nil and st ~= nil and
+           st.mtime == e.mtime and st.size == e.size then
+            e.checked = now
+        else
+            local ok, res, err = pcall(compile_file, self.dir, file)
+            if not ok or res == nil then
+                log.warn("Can not compile template '%s': %s", file, res or err)
+            end
+            e = ok and res or nil
+        end
+        self.entries[file] = e
+    end
+end
+
+-- Returns the chunk of the template `file`. The file is checked for
+-- changes at most once per `check_interval` seconds and recompiled when
+-- its modification time or size changes.
+function cache_methods.get(self, file)
+    local e = self.entries[file]
+    if e ~= nil then
+        local now = fiber.clock()
+        if now - e.checked < self.check_interval then
+            return e.chunk
+        end
+        local st = fio.stat(fio.pathjoin(self.dir, file))
+        if st ~= nil and st.mtime == e.mtime and st.size == e.size then
+            e.checked = now
+            return e.chunk
+        end
+    end
+    local err
+    e, err = compile_file(self.dir, file)
+    if e == nil then
+        return nil, err
+    end
+    self.entries[file] = e
+    return e.chunk
+end
+
+local cache_mt = { __index = cache_methods }
+
+-- Returns a cache of the compiled templates of `dir`.
+local function new(dir, opts)
+    opts = opts or {}
+    return setmetatable({
+        dir = dir,
+        check_interval = opts.check_interval or 0,
+        entries = {},
+    }, cache_mt)
+end
+
+return {
+    new = new,
+    compile = compile,
+    compile_cached = compile_cached,
+    build = build,
+    BUNDLE_VERSION = BUNDLE_VERSION,
+}
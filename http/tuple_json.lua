@@ -0,0 +1,111 @@
+-- http.tuple_json
+--
+-- JSON responses from box data. Tuples are encoded to MessagePack, which
+-- copies their data as is, and the MessagePack is encoded as JSON in C,
+-- so no Lua tables are created for the rows. Iterators are streamed as
+-- a chunked JSON array in batches.
+
+local lib = require('http.lib')
+local fiber = require('fiber')
+local msgpack = require('msgpack')
+
+local DEFAULT_BATCH_SIZE = 1000
+
+-- Returns an array of field names given the array itself or a space.
+local function field_names(names)
+    if names == nil then
+        return nil
+    end
+    if type(names) ~= 'table' then
+        error("'names' option should be an array of field names or a space")
+    end
+    if type(names.format) == 'function' then
+        local res = {}
+        for i, field in ipairs(names:format()) do
+            res[i] = field.name
+        end
+        return res
+    end
+    return names
+end
+
+-- Encodes an array of tuples as the elements of a JSON array.
+local function encode_batch(batch, names)
+    return lib.msgpack_to_json(msgpack.encode(batch), names, true)
+end
+
+-- Returns an iterator of the body chunks: the rows of `gen, param, state`
+-- encoded by batches. The fiber yields between batches.
+local function stream(gen, param, state, names, batch_size)
+    local batch = {}
+    local size = 0
+    local first = true
+    local done = false
+    return function()
+        if done then
+            return nil
+        end
+        if not first then
+            fiber.yield()
+        end
+        local n = 0
+        while n < batch_size do
+            local tuple
+            state, tuple = gen(param, state)
+            if state == nil then
+                done = true
+                break
+            end
+            n = n + 1
+            batch[n] = tuple
+        end
+        for i = n + 1, size do
+            batch[i] = nil
+        end
+        size = n
+
+        local chunk = n > 0 and encode_batch(batch, names) or ''
+        if first then
+            chunk = '[' .. chunk
+        elseif n > 0 then
+            chunk = ',' .. chunk
+        end
+        first = false
+        if done then
+            chunk = chunk .. ']'
+        end
+        return true, chunk
+    end
+end
+
+-- Returns the body of a response for `render({tuple = ...})` or
+-- `render({tuples = ...})`: a string or an iterator of chunks.
+local function render(opts)
+    local names = field_names(opts.names)
+    if opts.tuple ~= nil then
+        return encode_batch({ opts.tuple }, names)
+    end
+
+    local tuples = opts.tuples
+    if type(tuples) == 'table' and tuples.gen ~= nil then
+        local batch_size = opts.batch_size or DEFAULT_BATCH_SIZE
+        if type(batch_size) ~= 'number' or batch_size < 1 then
+            error("'batch_size' option should be a positive number")
+        end
+        return {
+            gen = stream(tuples.gen, tuples.param, tuples.state, names, batch_size),
+        }
+    end
+    if type(tuples) ~= 'table' then
+        error("'tuples' option should be an array of tuples or an iterator")
+    end
+    if #tuples == 0 then
+        return '[]'
+    end
+    return lib.msgpack_to_json(msgpack.encode(tuples), names)
+end
+
+return {
+    render = render,
+    DEFAULT_BATCH_SIZE = DEFAULT_BATCH_SIZE,
+}
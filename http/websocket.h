@@ -0,0 +1,279 @@
+/*
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef WEBSOCKET_H_INCLUDED
+#define WEBSOCKET_H_INCLUDED
+
+/*
+ * WebSocket (RFC 6455) frame parsing, masking and serialization.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+enum {
+	WS_OP_CONTINUATION = 0x0,
+	WS_OP_TEXT = 0x1,
+	WS_OP_BINARY = 0x2,
+	WS_OP_CLOSE = 0x8,
+	WS_OP_PING = 0x9,
+	WS_OP_PONG = 0xa
+};
+
+/* 2 octets, 8 octets of the extended payload length and a masking key. */
+#define WS_MAX_HEADER_SIZE 14
+
+#define WS_MAX_CONTROL_PAYLOAD 125
+
+struct ws_frame {
+	int fin;
+	int opcode;
+	int masked;
+	unsigned char mask[4];
+	uint64_t payload_len;
+	size_t header_len;
+};
+
+/*
+ * Parses a frame header at the beginning of `data`.
+ *
+ * Returns 1 if the header is parsed, 0 if more data is needed (then
+ * frame->header_len is the length of the header known so far) and -1
+ * on a protocol error (then *error is set).
+ */
+static inline int
+ws_parse_header(const char *data, size_t len, struct ws_frame *frame,
+		const char **error)
+{
+	const unsigned char *p = (const unsigned char *)data;
+
+	frame->header_len = 2;
+	if (len < 2)
+		return 0;
+
+	frame->fin = (p[0] & 0x80) != 0;
+	frame->opcode = p[0] & 0x0f;
+	frame->masked = (p[1] & 0x80) != 0;
+
+	if (p[0] & 0x70) {
+		*error = "reserved bits are set";
+		return -1;
+	}
+	switch (frame->opcode) {
+		case WS_OP_CONTINUATION:
+		case WS_OP_TEXT:
+		case WS_OP_BINARY:
+			break;
+		case WS_OP_CLOSE:
+		case WS_OP_PING:
+		case WS_OP_PONG:
+			if (!frame->fin) {
+				*error = "fragmented control frame";
+				return -1;
+			}
+			if ((p[1] & 0x7f) > WS_MAX_CONTROL_PAYLOAD) {
+				*error = "control frame is too long";
+				return -1;
+			}
+			break;
+		default:
+			*error = "unknown opcode";
+			return -1;
+	}
+
+	size_t ext = 0;
+	uint64_t payload_len = p[1] & 0x7f;
+	if (payload_len == 126)
+		ext = 2;
+	else if (payload_len == 127)
+		ext = 8;
+
+	frame->header_len = 2 + ext + (frame->masked ? 4 : 0);
+	if (len < frame->header_len)
+		return 0;
+
+	if (ext != 0) {
+		payload_len = 0;
+		for (size_t i = 0; i < ext; i++)
+			payload_len = (payload_len << 8) | p[2 + i];
+		if (payload_len >> 63) {
+			*error = "invalid payload length";
+			return -1;
+		}
+	}
+	frame->payload_len = payload_len;
+
+	if (frame->masked)
+		memcpy(frame->mask, p + 2 + ext, 4);
+	return 1;
+}
+
+/*
+ * Writes a frame header to `buf` (at least WS_MAX_HEADER_SIZE octets),
+ * `mask` is NULL for frames sent by a server. Returns the header length.
+ */
+static inline size_t
+ws_encode_header(char *buf, int fin, int opcode, uint64_t payload_len,
+		 const unsigned char *mask)
+{
+	unsigned char *p = (unsigned char *)buf;
+	size_t len = 2;
+
+	p[0] = (fin ? 0x80 : 0) | (opcode & 0x0f);
+	if (payload_len < 126) {
+		p[1] = (unsigned char)payload_len;
+	} else if (payload_len <= 0xffff) {
+		p[1] = 126;
+		p[2] = (unsigned char)(payload_len >> 8);
+		p[3] = (unsigned char)payload_len;
+		len = 4;
+	} else {
+		p[1] = 127;
+		for (int i = 0; i < 8; i++)
+			p[2 + i] = (unsigned char)(payload_len >> (56 - 8 * i));
+		len = 10;
+	}
+	if (mask != NULL) {
+		p[1] |= 0x80;
+		memcpy(p + len, mask, 4);
+		len += 4;
+	}
+	return len;
+}
+
+/*
+ * XORs `len` octets of `src` with the masking key into `dst`, `offset` is
+ * the position of `src` in the payload. `dst` may be equal to `src`.
+ *
+ * The bulk of the payload is processed 16 octets at a time with SSE2 or
+ * NEON and 8 octets at a time elsewhere.
+ */
+static inline void
+ws_mask(char *dst, const char *src, size_t len, const unsigned char mask[4],
+	size_t offset)
+{
+	unsigned char key[4];
+	for (int i = 0; i < 4; i++)
+		key[i] = mask[(offset + i) & 3];
+
+	uint32_t key32;
+	memcpy(&key32, key, 4);
+	uint64_t key64 = ((uint64_t)key32 << 32) | key32;
+
+	size_t i = 0;
+#if defined(__SSE2__)
+	__m128i key128 = _mm_set1_epi32((int)key32);
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(v, key128));
+	}
+#elif defined(__ARM_NEON)
+	uint8x16_t key128 = vreinterpretq_u8_u32(vdupq_n_u32(key32));
+	for (; i + 16 <= len; i += 16) {
+		uint8x16_t v = vld1q_u8((const uint8_t *)(src + i));
+		vst1q_u8((uint8_t *)(dst + i), veorq_u8(v, key128));
+	}
+#endif
+	for (; i + 8 <= len; i += 8) {
+		uint64_t v;
+		memcpy(&v, src + i, 8);
+		v ^= key64;
+		memcpy(dst + i, &v, 8);
+	}
+	for (; i < len; i++)
+		dst[i] = src[i] ^ key[i & 3];
+}
+
+/*
+ * Checks that `data` is a valid UTF-8 string: no overlong forms, no
+ * surrogates and no code points above U+10FFFF.
+ */
+static inline int
+ws_utf8_valid(const char *data, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	const unsigned char *pe = p + len;
+
+	while (p < pe) {
+		/* ASCII runs are skipped 8 octets at a time. */
+		while (pe - p >= 8) {
+			uint64_t v;
+			memcpy(&v, p, 8);
+			if (v & UINT64_C(0x8080808080808080))
+				break;
+			p += 8;
+		}
+		if (p == pe)
+			break;
+
+		unsigned char c = *p;
+		if (c < 0x80) {
+			p++;
+			continue;
+		}
+
+		size_t n;
+		unsigned char lo = 0x80, hi = 0xbf;
+		if (c >= 0xc2 && c <= 0xdf) {
+			n = 1;
+		} else if (c >= 0xe0 && c <= 0xef) {
+			n = 2;
+			if (c == 0xe0)
+				lo = 0xa0;
+			else if (c == 0xed)
+				hi = 0x9f;
+		} else if (c >= 0xf0 && c <= 0xf4) {
+			n = 3;
+			if (c == 0xf0)
+				lo = 0x90;
+			else if (c == 0xf4)
+				hi = 0x8f;
+		} else {
+			return 0;
+		}
+		if ((size_t)(pe - p) <= n)
+			return 0;
+		if (p[1] < lo || p[1] > hi)
+			return 0;
+		for (size_t i = 2; i <= n; i++) {
+			if ((p[i] & 0xc0) != 0x80)
+				return 0;
+		}
+		p += n + 1;
+	}
+	return 1;
+}
+
+#endif /* WEBSOCKET_H_INCLUDED */
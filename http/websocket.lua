@@ -0,0 +1,465 @@
+-- http.websocket
+--
+-- WebSocket (RFC 6455) connections taken over from HTTP/1.1 requests.
+-- Frames are parsed, masked and serialized by http.lib, so a message costs
+-- a few socket reads and one copy of the payload.
+
+local lib = require('http.lib')
+local clock = require('clock')
+local digest = require('digest')
+local fiber = require('fiber')
+
+local GUID = '258EAFA5-E914-47DA-95CA-C5AB0DC85B11'
+
+local OP_CONTINUATION = 0x0
+local OP_TEXT = 0x1
+local OP_BINARY = 0x2
+local OP_CLOSE = 0x8
+local OP_PING = 0x9
+local OP_PONG = 0xa
+
+local OPCODES = {
+    text = OP_TEXT,
+    binary = OP_BINARY,
+}
+
+local OPCODE_NAMES = {
+    [OP_TEXT] = 'text',
+    [OP_BINARY] = 'binary',
+}
+
+-- Close codes, RFC 6455 7.4.1.
+local CLOSE_NORMAL = 1000
+local CLOSE_PROTOCOL_ERROR = 1002
+local CLOSE_NO_STATUS = 1005
+local CLOSE_INVALID_DATA = 1007
+local CLOSE_TOO_BIG = 1009
+
+local DEFAULT_OPTIONS = {
+    max_message_size = 16 * 1024 * 1024,
+    close_timeout = 1,
+}
+
+local TIMEOUT_INFINITY = 500 * 365 * 86400
+
+local function errorf(fmt, ...)
+    error(string.format(fmt, ...))
+end
+
+-- Checks options of `req:websocket()` and returns a table with defaults.
+local function parse_options(opts)
+    if opts == nil then
+        opts = {}
+    end
+    if type(opts) ~= 'table' then
+        error('WebSocket options must be a table')
+    end
+    for k in pairs(opts) do
+        if k ~= 'protocols' and k ~= 'max_message_size' and
+           k ~= 'fragment_size' and k ~= 'close_timeout' then
+            errorf("Unknown websocket option '%s'", k)
+        end
+    end
+    for _, name in ipairs({ 'max_message_size', 'fragment_size' }) do
+        local value = opts[name]
+        if value ~= nil and (type(value) ~= 'number' or value <= 0 or
+                             math.floor(value) ~= value) then
+            errorf('websocket.%s must be a positive integer', name)
+        end
+    end
+    if opts.close_timeout ~= nil and
+       (type(opts.close_timeout) ~= 'number' or opts.close_timeout < 0) then
+        error('websocket.close_timeout must be a non-negative number')
+    end
+    local protocols = {}
+    if opts.protocols ~= nil then
+        if type(opts.protocols) ~= 'table' then
+            error('websocket.protocols must be an array of strings')
+        end
+        for i, name in ipairs(opts.protocols) do
+            if type(name) ~= 'string' then
+                errorf('websocket.protocols[%d] must be a string', i)
+            end
+            protocols[i] = name
+        end
+    end
+    return {
+        protocols = protocols,
+        max_message_size = opts.max_message_size or DEFAULT_OPTIONS.max_message_size,
+        fragment_size = opts.fragment_size,
+        close_timeout = opts.close_timeout or DEFAULT_OPTIONS.close_timeout,
+    }
+end
+
+local function has_token(value, token)
+    if value == nil then
+        return false
+    end
+    for item in string.gmatch(value, '[^,]+') do
+        if string.lower(string.match(item, '^%s*(.-)%s*$')) == token then
+            return true
+        end
+    end
+    return false
+end
+
+-- Picks the first protocol offered by the client which the server supports.
+local function select_protocol(offered, supported)
+    if offered == nil then
+        return nil
+    end
+    for item in string.gmatch(offered, '[^,]+') do
+        item = string.match(item, '^%s*(.-)%s*$')
+        for _, name in ipairs(supported) do
+            if item == name then
+                return name
+            end
+        end
+    end
+    return nil
+end
+
+local function remaining(deadline)
+    return math.max(deadline - clock.monotonic(), 0)
+end
+
+local ws_methods = {}
+
+local function write(self, data)
+    while self.writing do
+        self.write_cond:wait()
+    end
+    self.writing = true
+    local ok, err = self.s:write(data)
+    self.writing = false
+    self.write_cond:signal()
+    if not ok then
+        self.broken = true
+        return nil, err or 'write error'
+    end
+    return true
+end
+
+local function send_close(self, code, reason)
+    if self.close_sent then
+        return true
+    end
+    self.close_sent = true
+    local payload = ''
+    if code ~= nil and code ~= CLOSE_NO_STATUS then
+        payload = string.char(math.floor(code / 256), code % 256) .. (reason or '')
+    end
+    return write(self, lib.ws_encode_frame(OP_CLOSE, payload))
+end
+
+-- Fails the connection, RFC 6455 7.1.7.
+local function fail(self, code, err)
+    send_close(self, code, err)
+    self.broken = true
+    return nil, err
+end
+
+-- Reads `size` bytes. Data of an incomplete read stays in the socket
+-- buffer, so a timeout between frames does not break the connection.
+local function read_exactly(self, size, deadline)
+    local data, err = self.s:read(size, remaining(deadline))
+    if data ~= nil and #data == size then
+        return data
+    end
+    if data ~= nil and #data < size then
+        self.broken = true
+        return nil, 'connection closed'
+    end
+    if clock.monotonic() >= deadline then
+        return nil, 'timeout'
+    end
+    self.broken = true
+    return nil, err or self.s:error() or 'read error'
+end
+
+-- Reads a frame, returns fin, opcode and the unmasked payload.
+local function read_frame(self, deadline)
+    local header, err = read_exactly(self, 2, deadline)
+    if header == nil then
+        return nil, err
+    end
+    local header_len, fin, opcode, payload_len, mask = lib.ws_parse_header(header)
+    if header_len == 0 then
+        local rest
+        rest, err = read_exactly(self, fin - 2, deadline)
+        if rest == nil then
+            -- The frame is partially read, the connection is unusable.
+            self.broken = true
+            return nil, err
+        end
+        header_len, fin, opcode, payload_len, mask =
+            lib.ws_parse_header(header .. rest)
+    end
+    if header_len == nil then
+        return fail(self, CLOSE_PROTOCOL_ERROR, fin)
+    end
+    if mask == nil then
+        return fail(self, CLOSE_PROTOCOL_ERROR, 'unmasked frame')
+    end
+    if payload_len + self.message_size > self.opts.max_message_size then
+        return fail(self, CLOSE_TOO_BIG, 'message is too big')
+    end
+    local payload = ''
+    if payload_len > 0 then
+        payload, err = read_exactly(self, payload_len, deadline)
+        if payload == nil then
+            self.broken = true
+            return nil, err
+        end
+        payload = lib.ws_unmask(payload, mask)
+    end
+    return fin, opcode, payload
+end
+
+local function handle_close(self, payload)
+    self.close_received = true
+    local code = CLOSE_NO_STATUS
+    local reason = ''
+    if #payload == 1 then
+        return fail(self, CLOSE_PROTOCOL_ERROR, 'invalid close frame')
+    elseif #payload >= 2 then
+        code = string.byte(payload, 1) * 256 + string.byte(payload, 2)
+        reason = string.sub(payload, 3)
+        if code < 1000 or code >= 5000 or code == 1004 or code == 1005 or
+           code == 1006 or (code >= 1016 and code < 3000) then
+            return fail(self, CLOSE_PROTOCOL_ERROR, 'invalid close code')
+        end
+        if not lib.ws_utf8_valid(reason) then
+            return fail(self, CLOSE_INVALID_DATA, 'invalid close reason')
+        end
+    end
+    self.close_code = code
+    self.close_reason = reason
+    -- Echo the status code, RFC 6455 5.5.1.
+    send_close(self, code)
+    return nil, 'closed'
+end
+
+local function read_message(self, deadline)
+    while true do
+        local fin, opcode, payload = read_frame(self, deadline)
+        if fin == nil then
+            return nil, opcode
+        end
+        if opcode == OP_CLOSE then
+            return handle_close(self, payload)
+        elseif opcode == OP_PING then
+            if not self.close_sent then
+                write(self, lib.ws_encode_frame(OP_PONG, payload))
+            end
+        elseif opcode == OP_PONG then -- luacheck: ignore 542
+            -- Unsolicited pongs serve as a heartbeat, RFC 6455 5.5.3.
+        elseif opcode == OP_CONTINUATION then
+            if self.message_opcode == nil then
+                return fail(self, CLOSE_PROTOCOL_ERROR, 'unexpected continuation frame')
+            end
+            table.insert(self.fragments, payload)
+            self.message_size = self.message_size + #payload
+            if fin then
+                local message = table.concat(self.fragments)
+                opcode = self.message_opcode
+                self.fragments = {}
+                self.message_opcode = nil
+                self.message_size = 0
+                return message, opcode
+            end
+        else
+            if self.message_opcode ~= nil then
+                return fail(self, CLOSE_PROTOCOL_ERROR, 'unfinished fragmented message')
+            end
+            if fin then
+                return payload, opcode
+            end
+            self.message_opcode = opcode
+            self.fragments = { payload }
+            self.message_size = #payload
+        end
+    end
+end
+
+-- Reads a message. Returns the message and its type (`text` or `binary`)
+-- or nil and an error: `closed` after the close handshake, `timeout` or
+-- a protocol error. Pings are answered and pongs are skipped while waiting.
+function ws_methods.read(self, timeout)
+    if self.close_received or self.broken then
+        return nil, 'closed'
+    end
+    self.reading = true
+    local message, opcode = read_message(self,
+        clock.monotonic() + (timeout or TIMEOUT_INFINITY))
+    self.reading = false
+    if message == nil then
+        return nil, opcode
+    end
+    if opcode == OP_TEXT and not lib.ws_utf8_valid(message) then
+        return fail(self, CLOSE_INVALID_DATA, 'invalid UTF-8 in a text message')
+    end
+    return message, OPCODE_NAMES[opcode]
+end
+
+-- Sends a message, `message_type` is `text` (default) or `binary`.
+-- Messages longer than the `fragment_size` option are fragmented.
+function ws_methods.send(self, data, message_type)
+    local opcode = OPCODES[message_type or 'text']
+    if opcode == nil then
+        errorf("Unknown message type '%s'", message_type)
+    end
+    data = tostring(data)
+    if self.close_sent or self.broken then
+        return nil, 'closed'
+    end
+    local fragment_size = self.opts.fragment_size
+    if fragment_size == nil or #data <= fragment_size then
+        return write(self, lib.ws_encode_frame(opcode, data))
+    end
+    local frames = {}
+    for pos = 1, #data, fragment_size do
+        table.insert(frames, lib.ws_encode_frame(pos == 1 and opcode or OP_CONTINUATION,
+            string.sub(data, pos, pos + fragment_size - 1), pos + fragment_size > #data))
+    end
+    return write(self, table.concat(frames))
+end
+
+function ws_methods.ping(self, payload)
+    payload = payload or ''
+    if #payload > 125 then
+        error('ping payload must not be longer than 125 bytes')
+    end
+    if self.close_sent or self.broken then
+        return nil, 'closed'
+    end
+    return write(self, lib.ws_encode_frame(OP_PING, payload))
+end
+
+-- Starts the close handshake and, unless another fiber reads messages,
+-- waits up to `close_timeout` seconds for the client to confirm it.
+function ws_methods.close(self, code, reason)
+    code = code or CLOSE_NORMAL
+    reason = reason or ''
+    if #reason > 123 then
+        error('close reason must not be longer than 123 bytes')
+    end
+    if self.broken then
+        return true
+    end
+    local ok, err = send_close(self, code, reason)
+    if not ok then
+        return nil, err
+    end
+    if self.close_received or self.reading then
+        return true
+    end
+    local deadline = clock.monotonic() + self.opts.close_timeout
+    while not self.close_received and not self.broken and
+          clock.monotonic() < deadline do
+        local fin, op, payload = read_frame(self, deadline)
+        if fin == nil then
+            break
+        end
+        if op == OP_CLOSE then
+            self.close_received = true
+            if #payload >= 2 then
+                self.close_code = string.byte(payload, 1) * 256 + string.byte(payload, 2)
+                self.close_reason = string.sub(payload, 3)
+            end
+        end
+    end
+    return true
+end
+
+function ws_methods.is_closed(self)
+    return self.close_sent or self.close_received or self.broken
+end
+
+local ws_mt = { __index = ws_methods }
+
+-- Checks the handshake request, RFC 6455 4.2.1. Returns the client key or
+-- nil and an error.
+local function check_request(req)
+    if req.proto[1] ~= 1 or req.proto[2] < 1 then
+        return nil, 'WebSocket requires HTTP/1.1'
+    end
+    if req.method ~= 'GET' then
+        return nil, 'WebSocket handshake must be a GET request'
+    end
+    local headers = req.headers
+    if not has_token(headers['upgrade'], 'websocket') or
+       not has_token(headers['connection'], 'upgrade') then
+        return nil, 'Not a WebSocket upgrade request'
+    end
+    if headers['sec-websocket-version'] ~= '13' then
+        return nil, 'Unsupported WebSocket version'
+    end
+    local key = headers['sec-websocket-key']
+    if key == nil or #digest.base64_decode(key) ~= 16 then
+        return nil, 'Invalid Sec-WebSocket-Key'
+    end
+    return key
+end
+
+-- Performs the opening handshake on the connection of `req` and returns
+-- a WebSocket object. Returns nil and an error if the request is not
+-- a valid handshake; nothing is sent to the client then.
+local function upgrade(req, opts)
+    opts = parse_options(opts)
+    if rawget(req, 'websocket_conn') ~= nil then
+        error('The connection is already upgraded')
+    end
+    local key, err = check_request(req)
+    if key == nil then
+        return nil, err
+    end
+    local protocol = select_protocol(req.headers['sec-websocket-protocol'],
+                                     opts.protocols)
+    local response = {
+        'HTTP/1.1 101 Switching Protocols\r\n',
+        'Upgrade: websocket\r\n',
+        'Connection: Upgrade\r\n',
+        'Sec-WebSocket-Accept: ', digest.base64_encode(digest.sha1(key .. GUID)), '\r\n',
+    }
+    if protocol ~= nil then
+        table.insert(response, 'Sec-WebSocket-Protocol: ' .. protocol .. '\r\n')
+    end
+    table.insert(response, '\r\n')
+    if not req.s:write(table.concat(response)) then
+        return nil, 'Failed to send the handshake response'
+    end
+
+    local ws = setmetatable({
+        s = req.s,
+        peer = req.peer,
+        protocol = protocol,
+        opts = opts,
+        writing = false,
+        write_cond = fiber.cond(),
+        reading = false,
+        close_sent = false,
+        close_received = false,
+        broken = false,
+        fragments = {},
+        message_size = 0,
+    }, ws_mt)
+    -- The request has no body, the server must not read frames as it.
+    rawset(req, '_remaining', 0)
+    rawset(req, 'websocket_conn', ws)
+    return ws
+end
+
+-- Called by the server when the handler of an upgraded request returns.
+local function finish(ws)
+    if not ws.close_sent and not ws.broken then
+        ws:close(CLOSE_NORMAL)
+    end
+end
+
+return {
+    upgrade = upgrade,
+    finish = finish,
+    parse_options = parse_options,
+    DEFAULT_OPTIONS = DEFAULT_OPTIONS,
+}
@@ -0,0 +1,145 @@
+/*
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef XXHASH_H_INCLUDED
+#define XXHASH_H_INCLUDED
+
+/*
+ * XXH64, the 64-bit variant of the xxHash non-cryptographic hash
+ * function by Yann Collet. The results match the reference
+ * implementation.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t
+xxh_rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+/* Reads little-endian words, memcpy() is compiled to a single load. */
+static inline uint64_t
+xxh_read64(const unsigned char *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+}
+
+static inline uint32_t
+xxh_read32(const unsigned char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap32(v);
+#endif
+	return v;
+}
+
+static inline uint64_t
+xxh64_round(uint64_t acc, uint64_t input)
+{
+	acc += input * XXH_PRIME64_2;
+	acc = xxh_rotl64(acc, 31);
+	return acc * XXH_PRIME64_1;
+}
+
+static inline uint64_t
+xxh64_merge_round(uint64_t acc, uint64_t val)
+{
+	acc ^= xxh64_round(0, val);
+	return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+static inline uint64_t
+xxh64(const void *data, size_t len, uint64_t seed)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	const unsigned char *end = p + len;
+	uint64_t h;
+
+	if (len >= 32) {
+		const unsigned char *limit = end - 32;
+		uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+		uint64_t v2 = seed + XXH_PRIME64_2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - XXH_PRIME64_1;
+		do {
+			v1 = xxh64_round(v1, xxh_read64(p));
+			v2 = xxh64_round(v2, xxh_read64(p + 8));
+			v3 = xxh64_round(v3, xxh_read64(p + 16));
+			v4 = xxh64_round(v4, xxh_read64(p + 24));
+			p += 32;
+		} while (p <= limit);
+		h = xxh_rotl64(v1, 1) + xxh_rotl64(v2, 7) +
+		    xxh_rotl64(v3, 12) + xxh_rotl64(v4, 18);
+		h = xxh64_merge_round(h, v1);
+		h = xxh64_merge_round(h, v2);
+		h = xxh64_merge_round(h, v3);
+		h = xxh64_merge_round(h, v4);
+	} else {
+		h = seed + XXH_PRIME64_5;
+	}
+	h += (uint64_t)len;
+
+	for (; p + 8 <= end; p += 8) {
+		h ^= xxh64_round(0, xxh_read64(p));
+		h = xxh_rotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+	}
+	if (p + 4 <= end) {
+		h ^= (uint64_t)xxh_read32(p) * XXH_PRIME64_1;
+		h = xxh_rotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+		p += 4;
+	}
+	for (; p < end; p++) {
+		h ^= (*p) * XXH_PRIME64_5;
+		h = xxh_rotl64(h, 11) * XXH_PRIME64_1;
+	}
+
+	h ^= h >> 33;
+	h *= XXH_PRIME64_2;
+	h ^= h >> 29;
+	h *= XXH_PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+#endif /* XXHASH_H_INCLUDED */
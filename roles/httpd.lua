@@ -105,15 +105,28 @@ local function parse_params(node)
         ssl_ca_file = node.ssl_ca_file,
         ssl_ciphers = node.ssl_ciphers,
         ssl_verify_client = node.ssl_verify_client,
+        metrics = node.metrics,
+        server_timing = node.server_timing,
+        slow_request_threshold = node.slow_request_threshold,
+        response_cache_max_bytes = node.response_cache_max_bytes,
+        http2 = node.http2,
+        access_log = node.access_log,
+        rate_limit = node.rate_limit,
+        profiler = node.profiler,
+        park_idle = node.park_idle,
+        deadline = node.deadline,
     }
 end
 
+-- Compares option values, tables (e.g. `metrics`) are compared by content.
+local option_equals = http_server.internal.option_equals
+
 local function server_has_changed(name, node_params, host, port)
     if servers[name].httpd.host ~= host or servers[name].httpd.port ~= port then
         return true
     end
     for k in pairs(node_params) do
-        if k ~= 'listen' and servers[name].httpd.options[k] ~= node_params[k] then
+        if k ~= 'listen' and not option_equals(servers[name].httpd.options[k], node_params[k]) then
             return true
         end
     end
@@ -137,9 +150,9 @@ local function apply_http(name, node)
             routes = {},
         }
     elseif server_has_changed(name, params, host, port) then
-        servers[name].httpd:stop()
-        servers[name].httpd = http_server.new(host, port, params)
-        servers[name].httpd:start()
+        -- Reconfigured in place to keep the routes, the listener (if the
+        -- address is the same) and the open connections.
+        servers[name].httpd:reconfigure(host, port, params)
     end
 end
 
@@ -119,6 +119,25 @@ helpers.teardown = function(httpd)
     end)
 end
 
+-- Sends an HTTP/1.1 request over the connected socket `s` and returns the
+-- lowercased response head and the body. A body is sent with its
+-- Content-Length, the connection is kept open.
+helpers.request = function(s, method, path, headers, body)
+    local lines = { method .. ' ' .. path .. ' HTTP/1.1', 'Host: localhost' }
+    if body ~= nil then
+        table.insert(lines, 'Content-Length: ' .. #body)
+    end
+    for k, v in pairs(headers or {}) do
+        table.insert(lines, k .. ': ' .. v)
+    end
+    s:write(table.concat(lines, '\r\n') .. '\r\n\r\n' .. (body or ''))
+    local head = s:read('\r\n\r\n', 5)
+    luatest.assert(head ~= nil and head ~= '', 'response received')
+    head = string.lower(head)
+    local length = tonumber(string.match(head, 'content%-length: (%d+)'))
+    return head, s:read(length, 5)
+end
+
 helpers.is_tarantool3 = function()
     local tarantool_version = luatest_utils.get_tarantool_version()
     return luatest_utils.version_ge(tarantool_version, luatest_utils.version(3, 0, 0))
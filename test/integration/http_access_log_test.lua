@@ -0,0 +1,61 @@
+local t = require('luatest')
+local fio = require('fio')
+local socket = require('socket')
+local http_server = require('http.server')
+
+local helpers = require('test.helpers')
+
+local g = t.group()
+
+local function get(path)
+    local s = socket.tcp_connect(helpers.base_host, helpers.base_port)
+    t.assert(s ~= nil, 'connected')
+    s:write('GET ' .. path .. ' HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n')
+    local head = s:read('\r\n\r\n', 5)
+    s:close()
+    return head
+end
+
+g.before_each(function()
+    g.dir = fio.tempdir()
+    g.path = fio.pathjoin(g.dir, 'access.log')
+    g.httpd = http_server.new(helpers.base_host, helpers.base_port, {
+        log_requests = false,
+        log_errors = false,
+        access_log = { file = g.path, flush_interval = 60 },
+    })
+    g.httpd:route({ path = '/hello' }, function(req)
+        return req:render({ text = 'hello' })
+    end)
+    g.httpd:route({ path = '/health', log_requests = false }, function(req)
+        return req:render({ text = 'ok' })
+    end)
+    g.httpd:start()
+end)
+
+g.after_each(function()
+    if g.httpd.is_run then
+        helpers.teardown(g.httpd)
+    end
+    fio.rmtree(g.dir)
+end)
+
+g.test_access_log = function()
+    get('/hello?a=1')
+    get('/health')
+    get('/absent')
+    t.assert_equals(g.httpd.access_log:stats().buffered, 2)
+
+    -- The records are written on stop.
+    g.httpd:stop()
+    local fh = fio.open(g.path, { 'O_RDONLY' })
+    local data = fh:read()
+    fh:close()
+    local lines = {}
+    for line in string.gmatch(data, '([^\n]*)\n') do
+        table.insert(lines, line)
+    end
+    t.assert_equals(#lines, 2)
+    t.assert_str_contains(lines[1], '"GET /hello?a=1 HTTP/1.1" 200 ')
+    t.assert_str_contains(lines[2], '"GET /absent HTTP/1.1" 404 ')
+end
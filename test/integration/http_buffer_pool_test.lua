@@ -0,0 +1,51 @@
+local t = require('luatest')
+local socket = require('socket')
+local buffer_pool = require('http.buffer_pool')
+local http_server = require('http.server')
+
+local helpers = require('test.helpers')
+
+local g = t.group()
+
+g.before_each(function()
+    g.httpd = http_server.new(helpers.base_host, helpers.base_port, {
+        log_requests = false,
+        log_errors = false,
+    })
+    g.httpd:route({ path = '/upload' }, function(req)
+        return { status = 200, body = tostring(#req:read()) }
+    end)
+    g.httpd:start()
+end)
+
+g.after_each(function()
+    helpers.teardown(g.httpd)
+end)
+
+g.test_idle_connection = function()
+    local pool = buffer_pool.shared
+    local before = pool:stats()
+    local s = socket.tcp_connect(helpers.base_host, helpers.base_port)
+    t.assert(s ~= nil, 'connected')
+
+    local _, body = helpers.request(s, 'POST', '/upload', nil, string.rep('x', 1024 * 1024))
+    t.assert_equals(body, tostring(1024 * 1024))
+    -- The idle connection has given its buffer back, the memory grown by
+    -- the upload is freed.
+    t.helpers.retrying({}, function()
+        local stats = pool:stats()
+        t.assert_equals(stats.taken - before.taken, 1)
+        t.assert_equals(stats.returned - before.returned, 1)
+        t.assert_equals(stats.shrunk - before.shrunk, 1)
+    end)
+
+    _, body = helpers.request(s, 'POST', '/upload', nil, 'abc')
+    t.assert_equals(body, '3')
+    t.helpers.retrying({}, function()
+        local stats = pool:stats()
+        t.assert_equals(stats.taken - before.taken, 2)
+        t.assert_equals(stats.returned - before.returned, 2)
+        t.assert_equals(stats.shrunk - before.shrunk, 1)
+    end)
+    s:close()
+end
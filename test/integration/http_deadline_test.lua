@@ -0,0 +1,145 @@
+local t = require('luatest')
+local clock = require('clock')
+local fiber = require('fiber')
+local socket = require('socket')
+local http_server = require('http.server')
+local deadline = require('http.deadline')
+
+local helpers = require('test.helpers')
+
+local g = t.group()
+
+local function slow(req)
+    g.timing = req.timing
+    for i = 1, 40 do
+        fiber.sleep(0.05)
+        g.ticks = i
+    end
+    return req:render({ text = 'done' })
+end
+
+g.before_each(function()
+    g.ticks = 0
+    g.httpd = http_server.new(helpers.base_host, helpers.base_port, {
+        log_requests = false,
+        log_errors = false,
+        request_timing = true,
+        deadline = { timeout = 0.3, header = 'X-Request-Timeout', check_interval = 0.05 },
+    })
+    g.httpd:route({ path = '/slow' }, slow)
+    g.httpd:route({ path = '/unlimited', deadline = false }, function(req)
+        fiber.sleep(0.4)
+        return req:render({ text = 'done' })
+    end)
+    g.httpd:route({ path = '/short', deadline = { timeout = 0.1 } }, slow)
+    g.httpd:route({ path = '/sleep' }, function(req)
+        g.timing = req.timing
+        fiber.sleep(0.01)
+        fiber.sleep(0.01)
+        return req:render({ text = 'done' })
+    end)
+    g.httpd:route({ path = '/remaining' }, function(req)
+        return req:render({ text = string.format('%.3f', req:remaining()) })
+    end)
+    g.httpd:start()
+    g.s = socket.tcp_connect(helpers.base_host, helpers.base_port)
+    t.assert(g.s ~= nil, 'connected')
+end)
+
+g.after_each(function()
+    g.s:close()
+    helpers.teardown(g.httpd)
+end)
+
+g.test_timeout = function()
+    local start = clock.monotonic()
+    local head, body = helpers.request(g.s, 'GET', '/slow')
+    t.assert_str_contains(head, 'http/1.1 504 ')
+    t.assert_str_contains(head, 'connection: close\r\n')
+    t.assert_equals(body, 'Gateway Timeout')
+    t.assert_lt(clock.monotonic() - start, 1)
+    -- The handler is cancelled.
+    local ticks = g.ticks
+    fiber.sleep(0.2)
+    t.assert_equals(g.ticks, ticks)
+end
+
+g.test_route = function()
+    local start = clock.monotonic()
+    local head = helpers.request(g.s, 'GET', '/short')
+    t.assert_str_contains(head, 'http/1.1 504 ')
+    t.assert_lt(clock.monotonic() - start, 0.25)
+
+    g.s:close()
+    g.s = socket.tcp_connect(helpers.base_host, helpers.base_port)
+    local body
+    head, body = helpers.request(g.s, 'GET', '/unlimited')
+    t.assert_str_contains(head, 'http/1.1 200 ')
+    t.assert_equals(body, 'done')
+end
+
+g.test_timing = function()
+    -- The context switches are counted in the handler fiber.
+    local head = helpers.request(g.s, 'GET', '/sleep')
+    t.assert_str_contains(head, 'http/1.1 200 ')
+    if fiber.self().csw ~= nil then
+        t.assert_ge(g.timing.csw, 2)
+        t.assert_lt(g.timing.csw, 5)
+    end
+    -- and are unknown for a cancelled handler.
+    head = helpers.request(g.s, 'GET', '/short')
+    t.assert_str_contains(head, 'http/1.1 504 ')
+    t.assert_equals(g.timing.csw, nil)
+    t.assert_ge(g.timing.handler, 0.1)
+end
+
+g.test_header = function()
+    local _, body = helpers.request(g.s, 'GET', '/remaining')
+    t.assert_almost_equals(tonumber(body), 0.3, 0.05)
+    _, body = helpers.request(g.s, 'GET', '/remaining', { ['X-Request-Timeout'] = '0.1' })
+    t.assert_almost_equals(tonumber(body), 0.1, 0.05)
+    -- The header can not extend the deadline.
+    _, body = helpers.request(g.s, 'GET', '/remaining', { ['X-Request-Timeout'] = '100' })
+    t.assert_almost_equals(tonumber(body), 0.3, 0.05)
+end
+
+g.test_disconnect = function()
+    g.s:write('GET /slow HTTP/1.1\r\nHost: localhost\r\n\r\n')
+    t.helpers.retrying({ timeout = 1 }, function()
+        t.assert_gt(g.ticks, 0)
+    end)
+    g.s:close()
+    fiber.sleep(0.15)
+    local ticks = g.ticks
+    fiber.sleep(0.2)
+    t.assert_equals(g.ticks, ticks)
+    t.assert_lt(ticks, 6)
+end
+
+g.test_request_timeout = function()
+    local opts = deadline.parse_options({ timeout = 5, header = 'X-Request-Timeout' })
+    t.assert_equals(deadline.request_timeout(opts, nil, {}), 5)
+    t.assert_equals(deadline.request_timeout(opts, { timeout = 2 }, {}), 2)
+    t.assert_equals(deadline.request_timeout(opts, false, {}), nil)
+    t.assert_equals(deadline.request_timeout(opts, nil, { ['x-request-timeout'] = '1.5' }), 1.5)
+    t.assert_equals(deadline.request_timeout(opts, nil, { ['x-request-timeout'] = 'soon' }), 5)
+    t.assert_equals(deadline.request_timeout(opts, nil, { ['x-request-timeout'] = '-1' }), 5)
+    opts = deadline.parse_options({ header = 'X-Request-Timeout' })
+    t.assert_equals(deadline.request_timeout(opts, nil, {}), nil)
+    t.assert_equals(deadline.request_timeout(opts, nil, { ['x-request-timeout'] = '10' }), 10)
+    t.assert_equals(deadline.request_timeout(nil, { timeout = 3 }, {}), 3)
+end
+
+g.test_options = function()
+    t.assert_error_msg_contains('Option deadline must be a table.',
+        http_server.new, helpers.base_host, helpers.base_port, { deadline = 5 })
+    t.assert_error_msg_contains('deadline.timeout or deadline.header must be set',
+        http_server.new, helpers.base_host, helpers.base_port, { deadline = {} })
+    t.assert_error_msg_contains('deadline.timeout must be a positive number',
+        http_server.new, helpers.base_host, helpers.base_port,
+        { deadline = { timeout = 0 } })
+    t.assert_error_msg_contains("Unknown deadline option 'header'",
+        g.httpd.route, g.httpd, { path = '/a', deadline = { header = 'x' } }, slow)
+    t.assert_error_msg_contains("'deadline' option should be a table",
+        g.httpd.route, g.httpd, { path = '/a', deadline = 1 }, slow)
+end
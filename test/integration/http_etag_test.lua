@@ -0,0 +1,99 @@
+local t = require('luatest')
+local socket = require('socket')
+local http_server = require('http.server')
+
+local helpers = require('test.helpers')
+
+local g = t.group()
+
+local function get(path, if_none_match)
+    local s = socket.tcp_connect(helpers.base_host, helpers.base_port)
+    t.assert(s ~= nil, 'connected')
+    local request = 'GET ' .. path .. ' HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n'
+    if if_none_match ~= nil then
+        request = request .. 'If-None-Match: ' .. if_none_match .. '\r\n'
+    end
+    s:write(request .. '\r\n')
+    local chunks = {}
+    while true do
+        local data = s:read(65536, 5)
+        if data == nil or data == '' then
+            break
+        end
+        table.insert(chunks, data)
+    end
+    s:close()
+    local head, body = string.match(table.concat(chunks), '^(.-\r\n)\r\n(.*)$')
+    return head, body, string.match(head, '\r\n[Ee][Tt][Aa][Gg]: ([^\r]+)')
+end
+
+g.before_each(function()
+    g.calls = 0
+    g.version = 1
+    g.httpd = http_server.new(helpers.base_host, helpers.base_port, {
+        log_requests = false,
+        log_errors = false,
+    })
+    g.httpd:route({ path = '/data', etag = true }, function(req)
+        g.calls = g.calls + 1
+        return req:render({ json = { version = g.version } })
+    end)
+    g.httpd:route({ path = '/versioned', etag = {
+        validator = function() return g.version end,
+    } }, function(req)
+        g.calls = g.calls + 1
+        return req:render({ json = { version = g.version } })
+    end)
+    g.httpd:route({ path = '/missing', etag = true }, function()
+        return { status = 404, body = 'not found' }
+    end)
+    g.httpd:start()
+end)
+
+g.after_each(function()
+    helpers.teardown(g.httpd)
+end)
+
+g.test_body_hash = function()
+    local head, body, tag = get('/data')
+    t.assert_str_contains(head, 'HTTP/1.1 200 Ok\r\n')
+    t.assert_equals(body, '{"version":1}')
+    t.assert_str_matches(tag, 'W/"%x+"')
+
+    head, body = get('/data', tag)
+    t.assert_str_contains(head, 'HTTP/1.1 304 Not modified\r\n')
+    t.assert_equals(body, '')
+    t.assert_not_str_contains(string.lower(head), 'content-length')
+    t.assert_equals(g.calls, 2)
+
+    g.version = 2
+    local new_tag
+    head, body, new_tag = get('/data', tag)
+    t.assert_str_contains(head, 'HTTP/1.1 200 Ok\r\n')
+    t.assert_equals(body, '{"version":2}')
+    t.assert_not_equals(new_tag, tag)
+end
+
+g.test_validator = function()
+    local head, _, tag = get('/versioned')
+    t.assert_str_contains(head, 'HTTP/1.1 200 Ok\r\n')
+    t.assert_equals(g.calls, 1)
+
+    -- The handler is not called for a matching request.
+    head = get('/versioned', tag)
+    t.assert_str_contains(head, 'HTTP/1.1 304 Not modified\r\n')
+    t.assert_equals(g.calls, 1)
+
+    g.version = 2
+    local new_tag
+    head, _, new_tag = get('/versioned', tag)
+    t.assert_str_contains(head, 'HTTP/1.1 200 Ok\r\n')
+    t.assert_not_equals(new_tag, tag)
+    t.assert_equals(g.calls, 2)
+end
+
+g.test_error_status = function()
+    local head, _, tag = get('/missing')
+    t.assert_str_contains(head, 'HTTP/1.1 404 Not found\r\n')
+    t.assert_equals(tag, nil)
+end
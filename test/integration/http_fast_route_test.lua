@@ -0,0 +1,134 @@
+local t = require('luatest')
+local fio = require('fio')
+local socket = require('socket')
+local http_client = require('http.client')
+local http_server = require('http.server')
+
+local helpers = require('test.helpers')
+
+local g = t.group()
+
+local function read_response(s)
+    local head = s:read({ delimiter = '\r\n\r\n' }, 5)
+    t.assert(head ~= nil and head ~= '', 'response head')
+    local length = tonumber(string.match(head, '\r\nContent%-length: (%d+)'))
+    local body = ''
+    if length ~= nil and length > 0 then
+        body = s:read(length, 5)
+    end
+    return head, body
+end
+
+g.before_each(function()
+    g.dispatched = 0
+    g.httpd = http_server.new(helpers.base_host, helpers.base_port, {
+        -- Requests taking the fast path are not logged.
+        log_requests = function()
+            g.dispatched = g.dispatched + 1
+        end,
+        log_errors = false,
+    })
+    g.httpd:route({ path = '/health', name = 'health', response = {
+        headers = { ['X-State'] = 'up' },
+        body = 'OK',
+    } })
+    g.httpd:start()
+end)
+
+g.after_each(function()
+    if g.httpd.is_run then
+        helpers.teardown(g.httpd)
+    end
+end)
+
+g.test_keepalive = function()
+    local s = socket.tcp_connect(helpers.base_host, helpers.base_port)
+    t.assert(s ~= nil, 'connected')
+    for _ = 1, 3 do
+        s:write('GET /health HTTP/1.1\r\nHost: localhost\r\n\r\n')
+        local head, body = read_response(s)
+        t.assert_str_contains(head, 'HTTP/1.1 200 Ok\r\n')
+        t.assert_str_contains(head, 'X-state: up\r\n')
+        t.assert_str_contains(head, 'Connection: keep-alive\r\n')
+        t.assert_str_contains(head, 'Content-type: text/plain; charset=utf-8\r\n')
+        t.assert_equals(body, 'OK')
+    end
+
+    s:write('HEAD /health HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n')
+    local head = s:read({ delimiter = '\r\n\r\n' }, 5)
+    t.assert_str_contains(head, 'Content-length: 2\r\n')
+    t.assert_str_contains(head, 'Connection: close\r\n')
+    t.assert_equals(s:read(1, 5), '')
+    s:close()
+
+    -- The requests did not reach the dispatcher.
+    t.assert_equals(g.dispatched, 0)
+end
+
+g.test_fallback = function()
+    -- A query string or a body take the usual path.
+    local r = http_client.get(helpers.base_uri .. '/health?full=1')
+    t.assert_equals(r.status, 200)
+    t.assert_equals(r.body, 'OK')
+    t.assert_equals(r.headers['x-state'], 'up')
+    r = http_client.request('POST', helpers.base_uri .. '/health', 'data')
+    t.assert_equals(r.status, 200)
+    t.assert_equals(r.body, 'OK')
+    t.assert_equals(g.dispatched, 2)
+end
+
+g.test_server_options = function()
+    -- Hooks, the rate limit and the access log apply to every request.
+    helpers.teardown(g.httpd)
+    local dir = fio.tempdir()
+    g.httpd = http_server.new(helpers.base_host, helpers.base_port, {
+        log_requests = false,
+        log_errors = false,
+        rate_limit = { rate = 0.01, burst = 2 },
+        access_log = { file = fio.pathjoin(dir, 'access.log'), flush_interval = 60 },
+    })
+    g.httpd:hook('before_dispatch', function()
+        g.dispatched = g.dispatched + 1
+    end)
+    g.httpd:route({ path = '/health', response = { body = 'OK' } })
+    g.httpd:start()
+
+    local s = socket.tcp_connect(helpers.base_host, helpers.base_port)
+    t.assert(s ~= nil, 'connected')
+    for _ = 1, 2 do
+        s:write('GET /health HTTP/1.1\r\nHost: localhost\r\n\r\n')
+        local head, body = read_response(s)
+        t.assert_str_contains(head, 'HTTP/1.1 200 Ok\r\n')
+        t.assert_equals(body, 'OK')
+    end
+    s:write('GET /health HTTP/1.1\r\nHost: localhost\r\n\r\n')
+    t.assert_str_contains(read_response(s), 'HTTP/1.1 429 ')
+    s:close()
+
+    t.assert_equals(g.dispatched, 2)
+    t.assert_equals(g.httpd.rate_limit:stats().rejected, 1)
+    t.assert_equals(g.httpd.access_log:stats().buffered, 3)
+    helpers.teardown(g.httpd)
+    fio.rmtree(dir)
+end
+
+g.test_delete = function()
+    g.httpd:delete('health')
+    local r = http_client.get(helpers.base_uri .. '/health')
+    t.assert_equals(r.status, 404)
+    t.assert_equals(g.dispatched, 1)
+end
+
+g.test_options = function()
+    t.assert_error_msg_contains("Route with the 'response' option can not have a handler",
+        g.httpd.route, g.httpd, { path = '/a', response = {} }, function() end)
+    t.assert_error_msg_contains("Route with the 'response' option can not have stashes",
+        g.httpd.route, g.httpd, { path = '/a/:id', response = {} })
+    t.assert_error_msg_contains("'response' option should be a table",
+        g.httpd.route, g.httpd, { path = '/a', response = 'OK' })
+    for _, name in ipairs({ 'rate_limit', 'etag', 'cache' }) do
+        t.assert_error_msg_contains(
+            "Route with the 'response' option can not have the '" .. name .. "' option",
+            g.httpd.route, g.httpd, { path = '/a', response = {}, [name] = {} })
+    end
+end
@@ -0,0 +1,315 @@
+local t = require('luatest')
+local bit = require('bit')
+local fiber = require('fiber')
+local socket = require('socket')
+local http_client = require('http.client')
+local http_server = require('http.server')
+local hpack = require('http.hpack')
+
+local helpers = require('test.helpers')
+
+local g = t.group()
+
+local PREFACE = 'PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n'
+
+local DATA = 0x0
+local HEADERS = 0x1
+local RST_STREAM = 0x3
+local SETTINGS = 0x4
+local PING = 0x6
+local GOAWAY = 0x7
+local WINDOW_UPDATE = 0x8
+
+local END_STREAM = 0x1
+local END_HEADERS = 0x4
+
+local function uint32(n)
+    return string.char(bit.band(bit.rshift(n, 24), 0xff), bit.band(bit.rshift(n, 16), 0xff),
+                       bit.band(bit.rshift(n, 8), 0xff), bit.band(n, 0xff))
+end
+
+local function read_uint32(data, pos)
+    local b1, b2, b3, b4 = string.byte(data, pos, pos + 3)
+    return ((b1 * 256 + b2) * 256 + b3) * 256 + b4
+end
+
+local function frame(type, flags, stream_id, payload)
+    local len = #payload
+    return string.char(bit.rshift(len, 16), bit.band(bit.rshift(len, 8), 0xff),
+                       bit.band(len, 0xff), type, flags) .. uint32(stream_id) .. payload
+end
+
+-- A minimal HTTP/2 client that sends prepared frames.
+local function connect(settings)
+    local s = socket.tcp_connect(helpers.base_host, helpers.base_port)
+    t.assert(s ~= nil, 'connected')
+    s:write(PREFACE .. frame(SETTINGS, 0, 0, settings or ''))
+    return {
+        s = s,
+        encoder = hpack.new_encoder(),
+        decoder = hpack.new_decoder(),
+    }
+end
+
+local function send_request(conn, stream_id, method, path, body, headers)
+    local fields = {
+        { ':method', method },
+        { ':scheme', 'http' },
+        { ':path', path },
+        { ':authority', 'localhost' },
+    }
+    for _, field in ipairs(headers or {}) do
+        table.insert(fields, field)
+    end
+    local block = conn.encoder:encode(fields)
+    local flags = END_HEADERS
+    if body == nil then
+        flags = flags + END_STREAM
+    end
+    local data = frame(HEADERS, flags, stream_id, block)
+    if body ~= nil then
+        data = data .. frame(DATA, END_STREAM, stream_id, body)
+    end
+    conn.s:write(data)
+end
+
+local function read_frame(conn)
+    local header = conn.s:read(9, 1)
+    if header == nil or #header < 9 then
+        return nil
+    end
+    local b1, b2, b3, type, flags = string.byte(header, 1, 5)
+    local length = (b1 * 256 + b2) * 256 + b3
+    return {
+        type = type,
+        flags = flags,
+        stream_id = bit.band(read_uint32(header, 6), 0x7fffffff),
+        payload = length > 0 and conn.s:read(length, 1) or '',
+    }
+end
+
+-- Reads frames until `n` streams are finished, returns responses by stream
+-- id.
+local function read_responses(conn, n, on_frame)
+    local responses = {}
+    local finished = 0
+    while finished < n do
+        local f = read_frame(conn)
+        t.assert(f ~= nil, 'frame received')
+        if on_frame ~= nil then
+            on_frame(f)
+        end
+        local resp = responses[f.stream_id]
+        if f.type == HEADERS then
+            resp = { headers = {}, body = '' }
+            responses[f.stream_id] = resp
+            for _, field in ipairs(conn.decoder:decode(f.payload)) do
+                resp.headers[field[1]] = field[2]
+            end
+        elseif f.type == DATA then
+            resp.body = resp.body .. f.payload
+        elseif f.type == RST_STREAM then
+            responses[f.stream_id] = { reset = read_uint32(f.payload, 1) }
+            finished = finished + 1
+        end
+        if (f.type == HEADERS or f.type == DATA) and bit.band(f.flags, END_STREAM) ~= 0 then
+            finished = finished + 1
+        end
+    end
+    return responses
+end
+
+g.before_each(function()
+    g.httpd = http_server.new(helpers.base_host, helpers.base_port, {
+        log_requests = false,
+        log_errors = false,
+        http2 = { max_concurrent_streams = 4 },
+    })
+    g.httpd:route({ path = '/hello' }, function(req)
+        return {
+            status = 200,
+            headers = { ['x-proto'] = req.proto[1] .. '.' .. req.proto[2] },
+            body = 'hello ' .. (req:query_param('name') or 'world'),
+        }
+    end)
+    g.httpd:route({ path = '/echo', method = 'POST' }, function(req)
+        return { status = 200, body = req:read() }
+    end)
+    g.httpd:route({ path = '/chunked' }, function()
+        local parts = { 'one', 'two', 'three' }
+        return {
+            status = 200,
+            body = { gen = ipairs(parts), param = parts, state = 0 },
+        }
+    end)
+    g.httpd:route({ path = '/large' }, function()
+        return { status = 200, body = string.rep('x', 1000) }
+    end)
+    g.httpd:route({ path = '/slow' }, function()
+        fiber.sleep(0.2)
+        return { status = 200, body = 'slow' }
+    end)
+    g.httpd:start()
+end)
+
+g.after_each(function()
+    helpers.teardown(g.httpd)
+end)
+
+g.test_prior_knowledge = function()
+    local conn = connect()
+    send_request(conn, 1, 'GET', '/hello?name=h2')
+    local resp = read_responses(conn, 1)[1]
+    t.assert_equals(resp.headers[':status'], '200')
+    t.assert_equals(resp.headers['x-proto'], '2.0')
+    t.assert_equals(resp.headers['content-length'], '8')
+    t.assert_equals(resp.headers['connection'], nil)
+    t.assert_equals(resp.body, 'hello h2')
+    conn.s:close()
+end
+
+g.test_multiplexing = function()
+    local conn = connect()
+    send_request(conn, 1, 'GET', '/slow')
+    send_request(conn, 3, 'POST', '/echo', 'request body')
+    send_request(conn, 5, 'GET', '/chunked')
+    send_request(conn, 7, 'GET', '/not_found')
+    local finished = {}
+    local responses = read_responses(conn, 4, function(f)
+        if bit.band(f.flags, END_STREAM) ~= 0 and f.type ~= SETTINGS then
+            table.insert(finished, f.stream_id)
+        end
+    end)
+    t.assert_equals(responses[1].body, 'slow')
+    t.assert_equals(responses[3].body, 'request body')
+    t.assert_equals(responses[5].body, 'onetwothree')
+    t.assert_equals(responses[7].headers[':status'], '404')
+    -- The slow response does not block the others.
+    t.assert_equals(finished[#finished], 1)
+    conn.s:close()
+end
+
+g.test_flow_control = function()
+    -- SETTINGS_INITIAL_WINDOW_SIZE = 100.
+    local conn = connect(string.char(0, 4) .. uint32(100))
+    send_request(conn, 1, 'GET', '/large')
+    local received = 0
+    while received < 100 do
+        local f = read_frame(conn)
+        if f.type == DATA then
+            received = received + #f.payload
+        end
+    end
+    t.assert_equals(received, 100)
+    -- Nothing is sent until the window is extended.
+    local f = read_frame(conn)
+    while f ~= nil and f.type ~= DATA do
+        f = read_frame(conn)
+    end
+    t.assert_equals(f, nil)
+
+    conn.s:write(frame(WINDOW_UPDATE, 0, 1, uint32(900)))
+    local body = ''
+    repeat
+        f = read_frame(conn)
+        if f.type == DATA then
+            body = body .. f.payload
+        end
+    until f.type == DATA and bit.band(f.flags, END_STREAM) ~= 0
+    t.assert_equals(#body, 900)
+    conn.s:close()
+end
+
+g.test_concurrency_limit = function()
+    local conn = connect()
+    for i = 0, 4 do
+        send_request(conn, 2 * i + 1, 'GET', '/slow')
+    end
+    local responses = read_responses(conn, 5)
+    -- REFUSED_STREAM.
+    t.assert_equals(responses[9], { reset = 0x7 })
+    for i = 0, 3 do
+        t.assert_equals(responses[2 * i + 1].body, 'slow')
+    end
+    conn.s:close()
+end
+
+g.test_ping = function()
+    local conn = connect()
+    conn.s:write(frame(PING, 0, 0, '12345678'))
+    local f = read_frame(conn)
+    while f.type ~= PING do
+        f = read_frame(conn)
+    end
+    t.assert_equals(f.flags, 0x1)
+    t.assert_equals(f.payload, '12345678')
+    conn.s:close()
+end
+
+g.test_ping_flood = function()
+    local conn = connect()
+    -- The client sends PINGs without reading the acknowledgements.
+    local pings = {}
+    for i = 1, 5000 do
+        pings[i] = frame(PING, 0, 0, '12345678')
+    end
+    conn.s:write(table.concat(pings))
+    local f = read_frame(conn)
+    while f ~= nil and f.type ~= GOAWAY do
+        f = read_frame(conn)
+    end
+    t.assert(f ~= nil, 'GOAWAY received')
+    -- ENHANCE_YOUR_CALM.
+    t.assert_equals(read_uint32(f.payload, 5), 0xb)
+    -- The connection is closed.
+    t.assert_equals(read_frame(conn), nil)
+    conn.s:close()
+end
+
+g.test_protocol_error = function()
+    local conn = connect()
+    conn.s:write(frame(DATA, 0, 0, 'data'))
+    local f = read_frame(conn)
+    while f.type ~= GOAWAY do
+        f = read_frame(conn)
+    end
+    -- PROTOCOL_ERROR.
+    t.assert_equals(read_uint32(f.payload, 5), 0x1)
+    conn.s:close()
+end
+
+g.test_content_length_mismatch = function()
+    local conn = connect()
+    local length = { { 'content-length', '4' } }
+    -- More DATA than announced, less and none at all.
+    send_request(conn, 1, 'POST', '/echo', '12345678', length)
+    send_request(conn, 3, 'POST', '/echo', '12', length)
+    send_request(conn, 5, 'POST', '/echo', nil, length)
+    send_request(conn, 7, 'POST', '/echo', '1234', length)
+    local responses = read_responses(conn, 4)
+    for _, id in ipairs({ 1, 3, 5 }) do
+        -- PROTOCOL_ERROR.
+        t.assert_equals(responses[id].reset, 0x1, id)
+    end
+    t.assert_equals(responses[7].headers[':status'], '200')
+    t.assert_equals(responses[7].body, '1234')
+    conn.s:close()
+end
+
+g.test_http1_still_works = function()
+    local r = http_client.get(helpers.base_uri .. '/hello')
+    t.assert_equals(r.status, 200)
+    t.assert_equals(r.body, 'hello world')
+    t.assert_equals(r.headers['x-proto'], '1.1')
+end
+
+g.test_options = function()
+    t.assert_error_msg_contains('Option http2 must be a boolean or a table.',
+        http_server.new, helpers.base_host, helpers.base_port, { http2 = 'yes' })
+    t.assert_error_msg_contains("Unknown http2 option 'foo'",
+        http_server.new, helpers.base_host, helpers.base_port, { http2 = { foo = 1 } })
+    t.assert_error_msg_contains('http2.max_frame_size must be an integer from 16384 to 16777215',
+        http_server.new, helpers.base_host, helpers.base_port, { http2 = { max_frame_size = 100 } })
+    t.assert_error_msg_contains('http2.handshake_timeout must be a positive number',
+        http_server.new, helpers.base_host, helpers.base_port, { http2 = { handshake_timeout = 0 } })
+end
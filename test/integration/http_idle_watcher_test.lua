@@ -0,0 +1,117 @@
+local t = require('luatest')
+local fiber = require('fiber')
+local socket = require('socket')
+local http_server = require('http.server')
+local idle_watcher = require('http.idle_watcher')
+
+local helpers = require('test.helpers')
+
+local g = t.group()
+
+local watcher = idle_watcher.shared
+
+local function start(opts)
+    g.opened = 0
+    g.closed = 0
+    g.httpd = http_server.new(helpers.base_host, helpers.base_port,
+        http_server.internal.extend({
+            log_requests = false,
+            log_errors = false,
+            park_idle = true,
+        }, opts or {}))
+    g.httpd.internal.preprocess_client_handler = function()
+        g.opened = g.opened + 1
+    end
+    g.httpd.internal.postprocess_client_handler = function()
+        g.closed = g.closed + 1
+    end
+    g.httpd:route({ path = '/echo', method = 'POST' }, function(req)
+        return { status = 200, body = req:read() }
+    end)
+    g.httpd:start()
+end
+
+local function request(s, body)
+    local head, res = helpers.request(s, 'POST', '/echo', nil, body)
+    t.assert_str_contains(head, 'http/1.1 200 ok\r\n')
+    return res
+end
+
+local function wait_parked(n)
+    t.helpers.retrying({ timeout = 5 }, function()
+        t.assert_equals(watcher:stats().parked, n)
+    end)
+end
+
+g.before_all(function()
+    t.skip_if(not idle_watcher.supported, 'epoll is not available')
+end)
+
+g.after_each(function()
+    if g.httpd ~= nil then
+        helpers.teardown(g.httpd)
+        g.httpd = nil
+    end
+end)
+
+g.test_keepalive = function()
+    start()
+    local woken = watcher:stats().woken
+    local conns = {}
+    for i = 1, 20 do
+        conns[i] = socket.tcp_connect(helpers.base_host, helpers.base_port)
+        t.assert_equals(request(conns[i], 'first ' .. i), 'first ' .. i)
+    end
+    -- The connections wait for the next request without a fiber each.
+    wait_parked(20)
+    for i = 1, 20 do
+        t.assert_equals(request(conns[i], 'second ' .. i), 'second ' .. i)
+    end
+    wait_parked(20)
+    t.assert_equals(watcher:stats().woken - woken, 20)
+    t.assert_equals(g.opened, 20)
+    t.assert_equals(g.closed, 0)
+
+    for i = 1, 20 do
+        conns[i]:close()
+    end
+    wait_parked(0)
+    t.helpers.retrying({ timeout = 5 }, function()
+        t.assert_equals(g.closed, 20)
+    end)
+end
+
+g.test_idle_timeout = function()
+    start({ idle_timeout = 0.3 })
+    local expired = watcher:stats().expired
+    local s = socket.tcp_connect(helpers.base_host, helpers.base_port)
+    t.assert_equals(request(s, 'data'), 'data')
+    wait_parked(1)
+    fiber.sleep(0.2)
+    t.assert_equals(request(s, 'more'), 'more')
+    wait_parked(1)
+    -- Closed by the server after the idle timeout.
+    t.assert_equals(s:read(1, 5), '')
+    s:close()
+    wait_parked(0)
+    t.assert_equals(watcher:stats().expired - expired, 1)
+    t.assert_equals(g.closed, 1)
+end
+
+g.test_disabled = function()
+    start({ park_idle = false })
+    local s = socket.tcp_connect(helpers.base_host, helpers.base_port)
+    t.assert_equals(request(s, 'data'), 'data')
+    fiber.sleep(0.1)
+    t.assert_equals(watcher:stats().parked, 0)
+    s:close()
+    t.helpers.retrying({ timeout = 5 }, function()
+        t.assert_equals(g.closed, 1)
+    end)
+end
+
+g.test_option = function()
+    t.assert_error_msg_contains('Option park_idle must be a boolean.',
+        http_server.new, helpers.base_host, helpers.base_port,
+        { park_idle = 'yes' })
+end
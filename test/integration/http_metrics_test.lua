@@ -0,0 +1,77 @@
+local t = require('luatest')
+local http_client = require('http.client')
+local http_server = require('http.server')
+
+local helpers = require('test.helpers')
+
+local g = t.group()
+
+g.before_each(function()
+    g.httpd = http_server.new(helpers.base_host, helpers.base_port, {
+        log_requests = false,
+        log_errors = false,
+        metrics = { path = '/metrics' },
+    })
+    g.httpd:route({ path = '/hello', name = 'hello' }, function(req)
+        return req:render({ text = 'hello' })
+    end)
+    g.httpd:route({ path = '/error' }, function()
+        error('Some error...')
+    end)
+    g.httpd:start()
+end)
+
+g.after_each(function()
+    helpers.teardown(g.httpd)
+end)
+
+g.test_requests_are_counted = function()
+    t.assert_equals(http_client.get(helpers.base_uri .. '/hello').status, 200)
+    t.assert_equals(http_client.get(helpers.base_uri .. '/hello').status, 200)
+    t.assert_equals(http_client.get(helpers.base_uri .. '/error').status, 500)
+    t.assert_equals(http_client.get(helpers.base_uri .. '/absent').status, 404)
+
+    local snapshot = g.httpd.metrics:collect()
+    t.assert_equals(snapshot.routes.hello.requests, { GET = { [200] = 2 } })
+    t.assert_equals(snapshot.routes.hello.duration.count, 2)
+    t.assert_gt(snapshot.routes.hello.bytes_in, 0)
+    t.assert_gt(snapshot.routes.hello.bytes_out, 0)
+    t.assert_equals(snapshot.routes['/error'].requests, { GET = { [500] = 1 } })
+    t.assert_equals(snapshot.routes.unmatched.requests, { GET = { [404] = 1 } })
+    t.assert_ge(snapshot.connections_total, 1)
+end
+
+g.test_keepalive_reuse = function()
+    local client = http_client.new()
+    local opts = {
+        keepalive_idle = 3600,
+        keepalive_interval = 3600,
+    }
+    for _ = 1, 3 do
+        local r = client:request('GET', helpers.base_uri .. '/hello', nil, opts)
+        t.assert_equals(r.status, 200)
+    end
+
+    local snapshot = g.httpd.metrics:collect()
+    t.assert_equals(snapshot.connections_total, 1)
+    t.assert_equals(snapshot.keepalive_requests_total, 2)
+    t.assert_equals(snapshot.active_connections, 1)
+end
+
+g.test_metrics_route = function()
+    http_client.get(helpers.base_uri .. '/hello')
+
+    local r = http_client.get(helpers.base_uri .. '/metrics')
+    t.assert_equals(r.status, 200)
+    t.assert_str_contains(r.headers['content-type'], 'text/plain; version=0.0.4')
+    t.assert_str_contains(r.body,
+        'http_server_requests_total{route="hello",method="GET",status="200"} 1')
+    t.assert_str_contains(r.body,
+        'http_server_request_duration_seconds_count{route="hello"} 1')
+end
+
+g.test_metrics_disabled_by_default = function()
+    local httpd = http_server.new(helpers.base_host, helpers.base_port)
+    t.assert_equals(httpd.metrics, nil)
+    t.assert_equals(httpd:match('GET', '/metrics'), nil)
+end
@@ -0,0 +1,93 @@
+local t = require('luatest')
+local json = require('json')
+local msgpack = require('msgpack')
+local socket = require('socket')
+local http_server = require('http.server')
+
+local helpers = require('test.helpers')
+
+local g = t.group()
+
+g.before_each(function()
+    g.httpd = http_server.new(helpers.base_host, helpers.base_port, {
+        log_requests = false,
+        log_errors = false,
+    })
+    g.httpd:route({ path = '/echo' }, function(req)
+        return req:render({ msgpack = req:msgpack() })
+    end)
+    g.httpd:route({ path = '/param' }, function(req)
+        return req:render({ text = req:post_param('name') })
+    end)
+    g.httpd:route({ path = '/object' }, function(req)
+        local object = req:msgpack_object()
+        -- The decoded value is taken from the object.
+        t.assert_equals(req:msgpack(), object:decode())
+        return req:render({ msgpack = object:decode() })
+    end)
+    g.httpd:route({ path = '/negotiate' }, function(req)
+        return req:render({ negotiate = { id = 1, name = 'a' } })
+    end)
+    g.httpd:start()
+    g.s = socket.tcp_connect(helpers.base_host, helpers.base_port)
+    t.assert(g.s ~= nil, 'connected')
+end)
+
+g.after_each(function()
+    g.s:close()
+    helpers.teardown(g.httpd)
+end)
+
+g.test_body = function()
+    local data = { id = 1, tags = { 'a', 'b' } }
+    for _, content_type in ipairs({ 'application/msgpack', 'application/x-msgpack' }) do
+        local head, body = helpers.request(g.s, 'POST', '/echo',
+            { ['Content-Type'] = content_type }, msgpack.encode(data))
+        t.assert_str_contains(head, 'http/1.1 200 ok\r\n')
+        t.assert_str_contains(head, 'content-type: application/msgpack\r\n')
+        t.assert_equals(msgpack.decode(body), data)
+    end
+end
+
+g.test_post_param = function()
+    local head, body = helpers.request(g.s, 'POST', '/param',
+        { ['Content-Type'] = 'application/msgpack; charset=binary' },
+        msgpack.encode({ name = 'value' }))
+    t.assert_str_contains(head, 'http/1.1 200 ok\r\n')
+    t.assert_equals(body, 'value')
+end
+
+g.test_object = function()
+    local data = { 1, 'name', { flag = true } }
+    local head, body = helpers.request(g.s, 'POST', '/object',
+        { ['Content-Type'] = 'application/msgpack' }, msgpack.encode(data))
+    t.assert_str_contains(head, 'http/1.1 200 ok\r\n')
+    t.assert_equals(msgpack.decode(body), data)
+end
+
+g.test_invalid_body = function()
+    local head = helpers.request(g.s, 'POST', '/echo',
+        { ['Content-Type'] = 'application/msgpack' }, '\xc1')
+    t.assert_str_contains(head, 'http/1.1 500 ')
+end
+
+g.test_negotiate = function()
+    local data = { id = 1, name = 'a' }
+    local cases = {
+        { 'application/msgpack', 'application/msgpack' },
+        { 'application/x-msgpack;q=0.9, application/json;q=0.5', 'application/msgpack' },
+        { 'application/json, application/msgpack;q=0.5', 'application/json' },
+        { '*/*', 'application/json' },
+    }
+    for _, case in ipairs(cases) do
+        local head, body = helpers.request(g.s, 'POST', '/negotiate',
+                                           { Accept = case[1] }, '')
+        t.assert_str_contains(head, 'vary: accept\r\n')
+        t.assert_str_contains(head, 'content-type: ' .. case[2])
+        if case[2] == 'application/msgpack' then
+            t.assert_equals(msgpack.decode(body), data)
+        else
+            t.assert_equals(json.decode(body), data)
+        end
+    end
+end
@@ -0,0 +1,84 @@
+local t = require('luatest')
+local json = require('json')
+local http_client = require('http.client')
+local http_server = require('http.server')
+local profiler = require('http.profiler')
+
+local helpers = require('test.helpers')
+
+local g = t.group()
+
+local PATH = helpers.base_uri .. '/admin/profile'
+local AUTH = { headers = { authorization = 'Bearer secret' } }
+
+g.before_each(function()
+    g.httpd = http_server.new(helpers.base_host, helpers.base_port, {
+        log_requests = false,
+        log_errors = false,
+        profiler = { path = '/admin/profile', token = 'secret' },
+    })
+    g.httpd:route({ path = '/busy', name = 'busy' }, function()
+        local deadline = os.clock() + 0.1
+        local x = 0
+        while os.clock() < deadline do
+            x = x + math.sin(x)
+        end
+        return { status = 200, body = tostring(x) }
+    end)
+    g.httpd:start()
+end)
+
+g.after_each(function()
+    profiler.stop()
+    helpers.teardown(g.httpd)
+end)
+
+g.test_unauthorized = function()
+    local r = http_client.get(helpers.base_uri .. '/admin/profile')
+    t.assert_equals(r.status, 401)
+    t.assert_equals(r.headers['www-authenticate'], 'Bearer')
+    r = http_client.request('POST', PATH, nil,
+                            { headers = { authorization = 'Bearer other' } })
+    t.assert_equals(r.status, 401)
+    t.assert_not(profiler.is_running())
+end
+
+g.test_profile = function()
+    local r = http_client.request('POST', PATH .. '?interval=1&duration=30', nil, AUTH)
+    t.assert_equals(r.status, 202)
+    t.assert_equals(json.decode(r.body).running, true)
+    t.assert(profiler.is_running())
+
+    r = http_client.request('POST', PATH, nil, AUTH)
+    t.assert_equals(r.status, 409)
+
+    for _ = 1, 3 do
+        t.assert_equals(http_client.get(helpers.base_uri .. '/busy').status, 200)
+    end
+
+    r = http_client.request('DELETE', PATH, nil, AUTH)
+    t.assert_equals(r.status, 200)
+    t.assert_str_contains(r.body, 'busy;')
+    t.assert_not(profiler.is_running())
+
+    r = http_client.get(PATH .. '?format=json', AUTH)
+    t.assert_equals(r.status, 200)
+    local report = json.decode(r.body)
+    t.assert_equals(report.running, false)
+    t.assert(report.routes.busy > 0)
+end
+
+g.test_bad_options = function()
+    local r = http_client.request('POST', PATH .. '?duration=1000', nil, AUTH)
+    t.assert_equals(r.status, 400)
+    t.assert_str_contains(r.body, 'profiler.duration must be')
+    t.assert_not(profiler.is_running())
+end
+
+g.test_reconfigure = function()
+    g.httpd:reconfigure(helpers.base_host, helpers.base_port, {
+        log_requests = false,
+        log_errors = false,
+    })
+    t.assert_equals(http_client.get(PATH, AUTH).status, 404)
+end
@@ -0,0 +1,271 @@
+local t = require('luatest')
+local fiber = require('fiber')
+local json = require('json')
+local socket = require('socket')
+local http_server = require('http.server')
+
+local helpers = require('test.helpers')
+
+local g = t.group()
+
+local UPSTREAM_PORT = helpers.base_port + 1
+local DOWN_PORT = helpers.base_port + 2
+local RAW_PORT = helpers.base_port + 3
+local UPSTREAM = helpers.base_host .. ':' .. UPSTREAM_PORT
+local RAW = helpers.base_host .. ':' .. RAW_PORT
+
+local LARGE = string.rep('0123456789abcdef', 16384)
+
+local function request(raw)
+    local s = socket.tcp_connect(helpers.base_host, helpers.base_port)
+    t.assert(s ~= nil, 'connected')
+    s:write(raw)
+    local head = s:read('\r\n\r\n', 5)
+    local status = tonumber(string.match(head, '^HTTP/1.1 (%d+)'))
+    local headers = {}
+    for k, v in string.gmatch(head, '\n([%w%-]+): ([^\r]*)') do
+        k = string.lower(k)
+        if headers[k] ~= nil then
+            v = headers[k] .. '\n' .. v
+        end
+        headers[k] = v
+    end
+    local body
+    if headers['content-length'] ~= nil then
+        body = s:read(tonumber(headers['content-length']), 5)
+    else
+        local chunks = {}
+        while true do
+            local size = tonumber(s:read('\r\n', 5), 16)
+            local data = s:read(size + 2, 5)
+            if size == 0 then
+                break
+            end
+            table.insert(chunks, string.sub(data, 1, size))
+        end
+        body = table.concat(chunks)
+    end
+    s:close()
+    return { status = status, headers = headers, body = body }
+end
+
+local function get(path)
+    return request('GET ' .. path .. ' HTTP/1.1\r\nHost: localhost\r\n' ..
+                   'Connection: close\r\n\r\n')
+end
+
+g.before_each(function()
+    g.upstream = http_server.new(helpers.base_host, UPSTREAM_PORT, {
+        log_requests = false,
+        log_errors = false,
+    })
+    g.upstream:route({ path = '/echo/*rest' }, function(req)
+        local resp = req:render({ json = {
+            method = req.method,
+            path = req.path,
+            query = req.query,
+            host = req.headers['host'],
+            forwarded_for = req.headers['x-forwarded-for'],
+            tag = req.headers['x-tag'],
+            timeout = req.headers['x-request-timeout'],
+            body = req:read(),
+        } })
+        resp.headers['set-cookie'] = { 'a=1', 'b=2' }
+        return resp
+    end)
+    g.upstream:route({ path = '/large' }, function()
+        return { status = 200, body = LARGE }
+    end)
+    g.upstream:route({ path = '/chunked' }, function()
+        local i = 0
+        return {
+            status = 201,
+            body = {
+                gen = function()
+                    i = i + 1
+                    if i <= 3 then
+                        return true, 'part' .. i
+                    end
+                end,
+            },
+        }
+    end)
+    g.upstream:start()
+
+    g.httpd = http_server.new(helpers.base_host, helpers.base_port, {
+        log_requests = false,
+        log_errors = false,
+        deadline = { header = 'X-Request-Timeout' },
+    })
+    g.httpd:route({ path = '/api/*rest', name = 'api', proxy = {
+        upstreams = { UPSTREAM },
+        strip_prefix = '/api',
+        headers = { ['X-Tag'] = 'proxied' },
+        buffer_size = 4096,
+    } })
+    g.httpd:route({ path = '/failover/*rest', name = 'failover', proxy = {
+        upstreams = { helpers.base_host .. ':' .. DOWN_PORT, UPSTREAM },
+        strip_prefix = '/failover',
+        max_fails = 1,
+    } })
+    g.httpd:route({ path = '/down', proxy = helpers.base_host .. ':' .. DOWN_PORT })
+    g.httpd:route({ path = '/raw', name = 'raw', proxy = RAW })
+    g.httpd:start()
+end)
+
+g.after_each(function()
+    helpers.teardown(g.httpd)
+    helpers.teardown(g.upstream)
+end)
+
+g.test_forward = function()
+    local r = get('/api/echo/a%20b?x=1')
+    t.assert_equals(r.status, 200)
+    t.assert_str_contains(r.headers['content-type'], 'application/json')
+    t.assert_equals(r.headers['set-cookie'], 'a=1\nb=2')
+    t.assert_equals(json.decode(r.body), {
+        method = 'GET',
+        path = '/echo/a b',
+        query = 'x=1',
+        host = UPSTREAM,
+        forwarded_for = '127.0.0.1',
+        tag = 'proxied',
+        body = '',
+    })
+end
+
+g.test_request_body = function()
+    local body = string.rep('x', 10000)
+    local r = request('POST /api/echo/post HTTP/1.1\r\nHost: localhost\r\n' ..
+                      'Connection: close\r\nContent-Length: ' .. #body .. '\r\n\r\n' .. body)
+    t.assert_equals(r.status, 200)
+    local echo = json.decode(r.body)
+    t.assert_equals(echo.method, 'POST')
+    t.assert_equals(echo.body, body)
+end
+
+g.test_client_abort = function()
+    local proxy = g.httpd.routes[g.httpd.iroutes['api']].proxy
+    -- Larger than the buffer size, the body is streamed and the client
+    -- goes away in the middle of it.
+    local s = socket.tcp_connect(helpers.base_host, helpers.base_port)
+    s:write('POST /api/echo/post HTTP/1.1\r\nHost: localhost\r\n' ..
+            'Content-Length: 10000\r\n\r\n' .. string.rep('x', 5000))
+    t.helpers.retrying({ timeout = 5 }, function()
+        t.assert_equals(proxy:stats()[UPSTREAM].requests, 1)
+    end)
+    s:close()
+    t.helpers.retrying({ timeout = 5 }, function()
+        t.assert_equals(proxy:stats()[UPSTREAM].active, 0)
+    end)
+    -- The upstream is not blamed for the client.
+    t.assert_equals(proxy:stats()[UPSTREAM].fails, 0)
+    t.assert_equals(proxy:stats()[UPSTREAM].available, true)
+end
+
+g.test_deadline = function()
+    -- The upstream gets the time left before the deadline.
+    local r = request('GET /api/echo/x HTTP/1.1\r\nHost: localhost\r\n' ..
+                      'X-Request-Timeout: 5\r\nConnection: close\r\n\r\n')
+    t.assert_equals(r.status, 200)
+    local timeout = tonumber(json.decode(r.body).timeout)
+    t.assert(timeout ~= nil and timeout > 4 and timeout <= 5, 'timeout propagated')
+end
+
+g.test_streamed_response = function()
+    -- Larger than the buffer size, the response is streamed.
+    local r = get('/api/large')
+    t.assert_equals(r.status, 200)
+    t.assert_equals(r.headers['transfer-encoding'], 'chunked')
+    t.assert_equals(r.body, LARGE)
+
+    r = get('/api/chunked')
+    t.assert_equals(r.status, 201)
+    t.assert_equals(r.body, 'part1part2part3')
+end
+
+g.test_head = function()
+    local s = socket.tcp_connect(helpers.base_host, helpers.base_port)
+    s:write('HEAD /api/large HTTP/1.1\r\nHost: localhost\r\n' ..
+            'Connection: close\r\n\r\n')
+    local head = s:read('\r\n\r\n', 5)
+    -- The length of the upstream body is kept, the body is not sent.
+    t.assert_str_contains(string.lower(head), '\r\ncontent-length: ' .. #LARGE .. '\r\n')
+    t.assert_equals(s:read(1, 5), '')
+    s:close()
+end
+
+g.test_invalid_length = function()
+    local server = socket.tcp_server(helpers.base_host, RAW_PORT, function(s)
+        s:read('\r\n\r\n', 5)
+        s:write('HTTP/1.1 200 OK\r\nContent-Length: ten\r\n\r\n0123456789')
+    end)
+    local r = get('/raw')
+    server:close()
+    t.assert_equals(r.status, 502)
+    t.assert_equals(r.body, 'Upstream error: invalid content-length')
+end
+
+g.test_keepalive_pool = function()
+    local proxy = g.httpd.routes[g.httpd.iroutes['failover']].proxy
+    for _ = 1, 3 do
+        t.assert_equals(get('/failover/large').body, LARGE)
+    end
+    local stats = proxy:stats()
+    t.assert_equals(stats[UPSTREAM].requests, 3)
+    t.assert_equals(stats[UPSTREAM].idle, 1)
+end
+
+g.test_failover = function()
+    local proxy = g.httpd.routes[g.httpd.iroutes['failover']].proxy
+    for _ = 1, 4 do
+        local r = get('/failover/echo/x')
+        t.assert_equals(r.status, 200)
+    end
+    local stats = proxy:stats()
+    local down = stats[helpers.base_host .. ':' .. DOWN_PORT]
+    -- The failed upstream is tried once and then skipped.
+    t.assert_equals(down.requests, 1)
+    t.assert_equals(down.available, false)
+    t.assert_equals(stats[UPSTREAM].requests, 4)
+end
+
+g.test_upstream_down = function()
+    local r = get('/down')
+    t.assert_equals(r.status, 502)
+    t.assert_equals(r.body, 'Upstream error: connection failed')
+end
+
+g.test_options = function()
+    t.assert_error_msg_contains("Route with the 'proxy' option can not have a handler",
+        g.httpd.route, g.httpd, { path = '/x', proxy = UPSTREAM }, function() end)
+    t.assert_error_msg_contains("Unknown proxy option 'foo'",
+        g.httpd.route, g.httpd, { path = '/x', proxy = { upstreams = UPSTREAM, foo = 1 } })
+end
+
+g.test_streamed_response_abort = function()
+    local proxy = g.httpd.routes[g.httpd.iroutes['raw']].proxy
+    local closed = false
+    local server = socket.tcp_server(helpers.base_host, RAW_PORT, function(s)
+        s:read('\r\n\r\n', 5)
+        s:write('HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n')
+        -- The response never ends, it is sent until the proxy goes away.
+        while s:write('4\r\npart\r\n') do
+            fiber.sleep(0.01)
+        end
+        closed = true
+    end)
+    local s = socket.tcp_connect(helpers.base_host, helpers.base_port)
+    s:write('GET /raw HTTP/1.1\r\nHost: localhost\r\n\r\n')
+    t.assert_str_contains(s:read('\r\n\r\n', 5), 'chunked')
+    t.assert_equals(s:read('\r\n', 5), '4\r\n')
+    -- The upstream is busy while the body is streamed.
+    t.assert_equals(proxy:stats()[RAW].active, 1)
+    s:close()
+    t.helpers.retrying({ timeout = 5 }, function()
+        t.assert(closed, 'upstream connection is closed')
+    end)
+    server:close()
+    t.assert_equals(proxy:stats()[RAW].active, 0)
+    t.assert_equals(proxy:stats()[RAW].idle, 0)
+end
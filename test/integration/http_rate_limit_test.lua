@@ -0,0 +1,59 @@
+local t = require('luatest')
+local socket = require('socket')
+local http_server = require('http.server')
+
+local helpers = require('test.helpers')
+
+local g = t.group()
+
+local function get(path)
+    local s = socket.tcp_connect(helpers.base_host, helpers.base_port)
+    t.assert(s ~= nil, 'connected')
+    s:write('GET ' .. path .. ' HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n')
+    local head = s:read('\r\n\r\n', 5)
+    s:close()
+    return string.lower(head)
+end
+
+g.before_each(function()
+    g.calls = 0
+    g.httpd = http_server.new(helpers.base_host, helpers.base_port, {
+        log_requests = false,
+        log_errors = false,
+        rate_limit = { rate = 0.01, burst = 3 },
+    })
+    g.httpd:route({ path = '/hello' }, function(req)
+        g.calls = g.calls + 1
+        return req:render({ text = 'hello' })
+    end)
+    g.httpd:route({ path = '/login', rate_limit = { rate = 0.01, key = 'route' } },
+        function(req)
+            g.calls = g.calls + 1
+            return req:render({ text = 'ok' })
+        end)
+    g.httpd:start()
+end)
+
+g.after_each(function()
+    helpers.teardown(g.httpd)
+end)
+
+g.test_server_limit = function()
+    for _ = 1, 3 do
+        t.assert_str_contains(get('/hello'), 'http/1.1 200 ok\r\n')
+    end
+    local head = get('/hello')
+    t.assert_str_contains(head, 'http/1.1 429 too many requests\r\n')
+    t.assert_str_contains(head, 'retry-after: 100\r\n')
+    t.assert_equals(g.calls, 3)
+    t.assert_equals(g.httpd.rate_limit:stats(), { keys = 1, rejected = 1 })
+end
+
+g.test_route_limit = function()
+    t.assert_str_contains(get('/login'), 'http/1.1 200 ok\r\n')
+    local head = get('/login')
+    t.assert_str_contains(head, 'http/1.1 429 too many requests\r\n')
+    t.assert_equals(g.calls, 1)
+    -- Other routes are only limited by the server.
+    t.assert_str_contains(get('/hello'), 'http/1.1 200 ok\r\n')
+end
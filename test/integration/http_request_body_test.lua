@@ -0,0 +1,74 @@
+local t = require('luatest')
+local buffer = require('buffer')
+local ffi = require('ffi')
+local socket = require('socket')
+local http_server = require('http.server')
+
+local helpers = require('test.helpers')
+
+local g = t.group()
+
+local BODY = string.rep('0123456789', 20000)
+
+g.before_each(function()
+    g.httpd = http_server.new(helpers.base_host, helpers.base_port, {
+        log_requests = false,
+        log_errors = false,
+    })
+    g.httpd:route({ path = '/ignore' }, function()
+        return { status = 413, body = 'too large' }
+    end)
+    g.httpd:route({ path = '/partial' }, function(req)
+        return { status = 200, body = req:read(10) }
+    end)
+    g.httpd:route({ path = '/into' }, function(req)
+        local buf = buffer.ibuf()
+        local n = 0
+        while true do
+            local size = req:read_into(buf, 4096)
+            if size == 0 then
+                break
+            end
+            n = n + 1
+        end
+        local body = ffi.string(buf.rpos, buf:size())
+        buf:recycle()
+        return { status = 200, body = string.format('%d %s', n, body == BODY) }
+    end)
+    g.httpd:start()
+end)
+
+g.after_each(function()
+    helpers.teardown(g.httpd)
+end)
+
+g.test_unread_body = function()
+    local s = socket.tcp_connect(helpers.base_host, helpers.base_port)
+    t.assert(s ~= nil, 'connected')
+    -- The unread bodies are skipped and the connection is kept.
+    for _ = 1, 3 do
+        local head, body = helpers.request(s, 'POST', '/ignore', nil, BODY)
+        t.assert_str_contains(head, 'http/1.1 413 ')
+        t.assert_str_contains(head, 'connection: keep-alive\r\n')
+        t.assert_equals(body, 'too large')
+    end
+    local head, body = helpers.request(s, 'POST', '/partial', nil, BODY)
+    t.assert_str_contains(head, 'http/1.1 200 ok\r\n')
+    t.assert_equals(body, '0123456789')
+    head, body = helpers.request(s, 'POST', '/partial', nil, 'abcdefghijkl')
+    t.assert_str_contains(head, 'http/1.1 200 ok\r\n')
+    t.assert_equals(body, 'abcdefghij')
+    s:close()
+end
+
+g.test_read_into = function()
+    local s = socket.tcp_connect(helpers.base_host, helpers.base_port)
+    t.assert(s ~= nil, 'connected')
+    local head, body = helpers.request(s, 'POST', '/into', nil, BODY)
+    t.assert_str_contains(head, 'http/1.1 200 ok\r\n')
+    t.assert_equals(body, string.format('%d true', math.ceil(#BODY / 4096)))
+    head, body = helpers.request(s, 'POST', '/into', nil, '')
+    t.assert_str_contains(head, 'http/1.1 200 ok\r\n')
+    t.assert_equals(body, '0 false')
+    s:close()
+end
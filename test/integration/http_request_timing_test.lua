@@ -0,0 +1,117 @@
+local t = require('luatest')
+local fiber = require('fiber')
+local log = require('log')
+local http_client = require('http.client')
+local http_server = require('http.server')
+
+local helpers = require('test.helpers')
+
+local g = t.group()
+
+local PHASES = { 'read', 'parse', 'route', 'handler', 'serialize', 'write' }
+
+g.after_each(function()
+    helpers.teardown(g.httpd)
+    helpers.clear_log_queue()
+end)
+
+g.test_timing_is_disabled_by_default = function()
+    local timing = false
+    g.httpd = http_server.new(helpers.base_host, helpers.base_port, {
+        log_requests = false,
+    })
+    g.httpd:route({ path = '/' }, function(req)
+        timing = req.timing
+        return { status = 200 }
+    end)
+    g.httpd:start()
+
+    local r = http_client.get(helpers.base_uri)
+    t.assert_equals(r.status, 200)
+    t.assert_equals(r.headers['server-timing'], nil)
+    t.assert_equals(timing, nil)
+end
+
+g.test_timing_is_passed_to_logger = function()
+    local logged
+    local timing_in_handler
+    g.httpd = http_server.new(helpers.base_host, helpers.base_port, {
+        request_timing = true,
+        log_requests = function(fmt, ...)
+            logged = { fmt = fmt, args = { ... } }
+        end,
+    })
+    g.httpd:route({ path = '/sleep' }, function(req)
+        timing_in_handler = req.timing
+        fiber.sleep(0.1)
+        return req:render({ text = 'ok' })
+    end)
+    g.httpd:start()
+
+    local r = http_client.get(helpers.base_uri .. '/sleep?a=1')
+    t.assert_equals(r.status, 200)
+    t.assert_equals(r.headers['server-timing'], nil)
+
+    t.assert_equals(logged.fmt, '%s %s%s')
+    t.assert_equals({ logged.args[1], logged.args[2], logged.args[3] },
+                    { 'GET', '/sleep', '?a=1' })
+    local timing = logged.args[4]
+    t.assert_is(timing, timing_in_handler)
+    for _, phase in ipairs(PHASES) do
+        t.assert_type(timing[phase], 'number', phase)
+        t.assert_ge(timing[phase], 0, phase)
+    end
+    t.assert_ge(timing.handler, 0.1)
+    t.assert_ge(timing.total, timing.handler)
+    if fiber.self().csw ~= nil then
+        t.assert_ge(timing.csw, 1)
+    else
+        t.assert_equals(timing.csw, nil)
+    end
+    t.assert_type(timing.cpu, 'number')
+end
+
+g.test_server_timing_header = function()
+    g.httpd = http_server.new(helpers.base_host, helpers.base_port, {
+        log_requests = false,
+        server_timing = true,
+    })
+    g.httpd:route({ path = '/' }, function(req)
+        return req:render({ text = 'ok' })
+    end)
+    g.httpd:start()
+
+    local r = http_client.get(helpers.base_uri)
+    t.assert_equals(r.status, 200)
+    t.assert_str_matches(r.headers['server-timing'],
+        'parse;dur=[%d.]+, route;dur=[%d.]+, handler;dur=[%d.]+')
+end
+
+g.test_slow_request_is_logged = function()
+    g.httpd = http_server.new(helpers.base_host, helpers.base_port, {
+        log_requests = false,
+        slow_request_threshold = 0.05,
+    })
+    g.httpd:route({ path = '/fast' }, function(req)
+        return req:render({ text = 'ok' })
+    end)
+    g.httpd:route({ path = '/slow' }, function(req)
+        fiber.sleep(0.1)
+        return req:render({ text = 'ok' })
+    end)
+    g.httpd:start()
+
+    local warn = log.warn
+    log.warn = helpers.custom_logger.warn
+    local ok, err = pcall(function()
+        t.assert_equals(http_client.get(helpers.base_uri .. '/fast').status, 200)
+        t.assert_equals(http_client.get(helpers.base_uri .. '/slow').status, 200)
+    end)
+    log.warn = warn
+    t.assert(ok, err)
+
+    t.assert_equals(helpers.find_msg_in_log_queue('slow request GET /fast'), nil)
+    t.assert_equals(helpers.find_msg_in_log_queue(
+        '^slow request GET /slow: total=[%d.]+ms read=[%d.]+ms ' ..
+        'parse=[%d.]+ms route=[%d.]+ms handler=[%d.]+ms').log_lvl, 'warn')
+end
@@ -0,0 +1,86 @@
+local t = require('luatest')
+local http_client = require('http.client')
+local http_server = require('http.server')
+
+local helpers = require('test.helpers')
+
+local g = t.group()
+
+g.before_each(function()
+    g.calls = 0
+    g.httpd = http_server.new(helpers.base_host, helpers.base_port, {
+        log_requests = false,
+        log_errors = false,
+        metrics = true,
+    })
+    g.httpd:route({
+        path = '/dashboard/:id',
+        name = 'dashboard',
+        cache = { ttl = 60, vary = { 'Accept-Language' } },
+    }, function(req)
+        g.calls = g.calls + 1
+        return req:render({ text = req:stash('id') .. ':' .. g.calls })
+    end)
+    g.httpd:route({ path = '/private', cache = { ttl = 60 } }, function(req)
+        g.calls = g.calls + 1
+        local resp = req:render({ text = tostring(g.calls) })
+        resp:setcookie({ name = 'session', value = 'abc' })
+        return resp
+    end)
+    g.httpd:start()
+end)
+
+g.after_each(function()
+    helpers.teardown(g.httpd)
+end)
+
+local function get(path, headers)
+    return http_client.get(helpers.base_uri .. path, { headers = headers })
+end
+
+g.test_cached_response = function()
+    local r = get('/dashboard/1?b=2&a=1')
+    t.assert_equals(r.status, 200)
+    t.assert_equals(r.body, '1:1')
+    t.assert_equals(r.headers['content-type'], 'text/plain; charset=utf-8')
+    t.assert_equals(r.headers['vary'], 'accept-language')
+
+    -- The handler is not called again for the same normalized request.
+    r = get('/dashboard/1?a=1&b=2')
+    t.assert_equals(r.body, '1:1')
+    t.assert_equals(r.headers['content-type'], 'text/plain; charset=utf-8')
+    t.assert_equals(r.headers['vary'], 'accept-language')
+    t.assert_equals(g.calls, 1)
+
+    -- Other stash values and Vary headers are cached separately.
+    t.assert_equals(get('/dashboard/2').body, '2:2')
+    t.assert_equals(get('/dashboard/1?a=1&b=2', { ['Accept-Language'] = 'ru' }).body, '1:3')
+    t.assert_equals(get('/dashboard/1?a=1&b=2', { ['Accept-Language'] = 'ru' }).body, '1:3')
+
+    local routes = g.httpd.metrics:collect().routes
+    t.assert_equals(routes.dashboard.cache_hits, 2)
+    t.assert_equals(routes.dashboard.cache_misses, 3)
+end
+
+g.test_not_cacheable = function()
+    t.assert_equals(get('/private').body, '1')
+    t.assert_equals(get('/private').body, '2')
+    t.assert_equals(get('/private').headers['vary'], nil)
+    t.assert_equals(g.httpd.response_cache:stats().entries, 0)
+end
+
+g.test_invalidate = function()
+    t.assert_equals(get('/dashboard/1').body, '1:1')
+    t.assert_equals(get('/dashboard/2').body, '2:2')
+
+    t.assert_equals(g.httpd:invalidate_cache({ prefix = '/dashboard/1' }), 1)
+    t.assert_equals(get('/dashboard/1').body, '1:3')
+    t.assert_equals(get('/dashboard/2').body, '2:2')
+
+    t.assert_equals(g.httpd:invalidate_cache({ route = 'dashboard' }), 2)
+    t.assert_equals(get('/dashboard/2').body, '2:4')
+
+    t.assert_equals(g.httpd:invalidate_cache(), 1)
+    t.assert_error_msg_contains("Route with name 'absent' does not exist",
+        g.httpd.invalidate_cache, g.httpd, { route = 'absent' })
+end
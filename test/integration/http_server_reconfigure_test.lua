@@ -0,0 +1,87 @@
+local t = require('luatest')
+local socket = require('socket')
+local http_server = require('http.server')
+
+local helpers = require('test.helpers')
+
+local g = t.group()
+
+local OTHER_PORT = helpers.base_port + 1
+
+g.before_each(function()
+    g.httpd = http_server.new(helpers.base_host, helpers.base_port, {
+        log_requests = false,
+        log_errors = false,
+    })
+    g.httpd:route({ path = '/hello' }, function(req)
+        return req:render({ text = 'hello' .. (req:query_param('n') or '') })
+    end)
+    g.httpd:start()
+end)
+
+g.after_each(function()
+    helpers.teardown(g.httpd)
+end)
+
+g.test_same_address = function()
+    local s = socket.tcp_connect(helpers.base_host, helpers.base_port)
+    local head, body = helpers.request(s, 'GET', '/hello?n=1')
+    t.assert_str_contains(head, 'connection: keep-alive')
+    t.assert_equals(body, 'hello1')
+
+    local httpd = g.httpd:reconfigure(helpers.base_host, helpers.base_port, {
+        log_requests = false,
+        log_errors = false,
+        display_errors = true,
+    })
+    t.assert_is(httpd, g.httpd)
+    t.assert_equals(g.httpd.options.display_errors, true)
+
+    -- The listener and the open connection are kept, the routes too.
+    head, body = helpers.request(s, 'GET', '/hello?n=2')
+    t.assert_str_contains(head, 'connection: keep-alive')
+    t.assert_equals(body, 'hello2')
+    s:close()
+
+    s = socket.tcp_connect(helpers.base_host, helpers.base_port)
+    head, body = helpers.request(s, 'GET', '/hello?n=3')
+    t.assert_str_contains(head, 'http/1.1 200')
+    t.assert_equals(body, 'hello3')
+    s:close()
+end
+
+g.test_new_address = function()
+    local s = socket.tcp_connect(helpers.base_host, helpers.base_port)
+    helpers.request(s, 'GET', '/hello')
+
+    g.httpd:reconfigure(helpers.base_host, OTHER_PORT, {
+        log_requests = false,
+        log_errors = false,
+    })
+    t.assert_equals(g.httpd.port, OTHER_PORT)
+
+    -- A connection to the old listener is closed after its next request.
+    local head, body = helpers.request(s, 'GET', '/hello?n=1')
+    t.assert_str_contains(head, 'connection: close')
+    t.assert_equals(body, 'hello1')
+    s:close()
+
+    t.assert_equals(socket.tcp_connect(helpers.base_host, helpers.base_port), nil)
+    s = socket.tcp_connect(helpers.base_host, OTHER_PORT)
+    head, body = helpers.request(s, 'GET', '/hello?n=2')
+    t.assert_str_contains(head, 'connection: keep-alive')
+    t.assert_equals(body, 'hello2')
+    s:close()
+end
+
+g.test_invalid_options = function()
+    t.assert_error_msg_contains('Option idle_timeout must be a number',
+        g.httpd.reconfigure, g.httpd, helpers.base_host, helpers.base_port,
+        { idle_timeout = 'x' })
+    -- The server is left as is.
+    t.assert_equals(g.httpd.options.log_requests, false)
+    local s = socket.tcp_connect(helpers.base_host, helpers.base_port)
+    local _, body = helpers.request(s, 'GET', '/hello')
+    t.assert_equals(body, 'hello')
+    s:close()
+end
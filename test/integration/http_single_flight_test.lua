@@ -0,0 +1,117 @@
+local t = require('luatest')
+local fiber = require('fiber')
+local http_client = require('http.client')
+local http_server = require('http.server')
+
+local helpers = require('test.helpers')
+
+local g = t.group()
+
+g.before_each(function()
+    g.calls = 0
+    g.httpd = http_server.new(helpers.base_host, helpers.base_port, {
+        log_requests = false,
+        log_errors = false,
+    })
+    g.httpd:route({ path = '/report', single_flight = true }, function(req)
+        g.calls = g.calls + 1
+        local n = g.calls
+        fiber.sleep(0.2)
+        if req:query_param('fail') ~= nil then
+            error('backend failure')
+        end
+        return req:render({ json = { n = n } })
+    end)
+    g.httpd:route({ path = '/slow', single_flight = { timeout = 0.05 } }, function(req)
+        fiber.sleep(0.5)
+        return req:render({ text = 'done' })
+    end)
+    g.httpd:route({ path = '/user', single_flight = { vary = { 'Authorization' } } },
+        function(req)
+            g.calls = g.calls + 1
+            fiber.sleep(0.2)
+            return req:render({ text = req.headers['authorization'] or '' })
+        end)
+    g.httpd:start()
+end)
+
+g.after_each(function()
+    helpers.teardown(g.httpd)
+end)
+
+-- Sends `n` concurrent requests, `headers(i)` returns the headers of
+-- the i-th one.
+local function burst(path, n, headers)
+    local responses = {}
+    local fibers = {}
+    for i = 1, n do
+        fibers[i] = fiber.new(function()
+            responses[i] = http_client.get(helpers.base_uri .. path,
+                                           { headers = headers and headers(i) })
+        end)
+        fibers[i]:set_joinable(true)
+    end
+    for i = 1, n do
+        fibers[i]:join()
+    end
+    return responses
+end
+
+g.test_identical_requests_are_coalesced = function()
+    local responses = burst('/report?x=1', 5)
+    t.assert_equals(g.calls, 1)
+    for _, r in ipairs(responses) do
+        t.assert_equals(r.status, 200)
+        t.assert_equals(r.body, '{"n":1}')
+        t.assert_equals(r.headers['content-type'], 'application/json; charset=utf-8')
+    end
+    t.assert_equals(g.httpd.single_flight:stats().coalesced, 4)
+
+    -- Requests with another query are not coalesced with the previous ones.
+    t.assert_equals(http_client.get(helpers.base_uri .. '/report?x=2').body, '{"n":2}')
+end
+
+g.test_error_is_propagated = function()
+    local responses = burst('/report?fail=1', 3)
+    t.assert_equals(g.calls, 1)
+    for _, r in ipairs(responses) do
+        t.assert_equals(r.status, 500)
+    end
+end
+
+g.test_timeout = function()
+    local responses = burst('/slow', 2)
+    local statuses = { responses[1].status, responses[2].status }
+    table.sort(statuses)
+    t.assert_equals(statuses, { 200, 504 })
+end
+
+g.test_private_requests_are_not_coalesced = function()
+    local responses = burst('/report', 3, function(i)
+        return { Authorization = 'Bearer ' .. i }
+    end)
+    t.assert_equals(g.calls, 3)
+    local seen = {}
+    for _, r in ipairs(responses) do
+        t.assert_equals(r.status, 200)
+        seen[r.body] = true
+    end
+    t.assert_equals(seen, { ['{"n":1}'] = true, ['{"n":2}'] = true, ['{"n":3}'] = true })
+
+    g.calls = 0
+    burst('/report', 3, function(i)
+        return { Cookie = 'session=' .. i }
+    end)
+    t.assert_equals(g.calls, 3)
+end
+
+g.test_vary_on_private_header = function()
+    local responses = burst('/user', 4, function(i)
+        return { Authorization = 'Bearer ' .. (i % 2) }
+    end)
+    -- One handler call per user.
+    t.assert_equals(g.calls, 2)
+    for i, r in ipairs(responses) do
+        t.assert_equals(r.body, 'Bearer ' .. (i % 2))
+    end
+end
@@ -0,0 +1,83 @@
+local t = require('luatest')
+local fiber = require('fiber')
+local socket = require('socket')
+local http_server = require('http.server')
+
+local helpers = require('test.helpers')
+
+local g = t.group()
+
+local function subscribe(path)
+    local s = socket.tcp_connect(helpers.base_host, helpers.base_port)
+    t.assert(s ~= nil, 'connected')
+    s:write('GET ' .. path .. ' HTTP/1.1\r\nHost: localhost\r\nLast-Event-ID: 5\r\n\r\n')
+    local headers = s:read('\r\n\r\n', 1)
+    t.assert_str_contains(headers, 'HTTP/1.1 200 Ok\r\n')
+    t.assert_str_contains(headers, 'Content-Type: text/event-stream; charset=utf-8\r\n')
+    t.assert_str_contains(headers, 'Transfer-Encoding: chunked\r\n')
+    return s
+end
+
+local function read_chunk(s)
+    local size = tonumber(s:read('\r\n', 1), 16)
+    local data = s:read(size + 2, 1)
+    return string.sub(data, 1, size)
+end
+
+g.before_each(function()
+    g.httpd = http_server.new(helpers.base_host, helpers.base_port, {
+        log_requests = false,
+        log_errors = false,
+    })
+    g.httpd:route({ path = '/prices' }, function(req)
+        local stream = req:sse('prices', { heartbeat = 0.5 })
+        stream:send('snapshot since ' .. stream.last_event_id)
+    end)
+    g.httpd:route({ path = '/slow' }, function(req)
+        req:sse({ 'prices' }, { queue_size = 2 })
+    end)
+    g.httpd:start()
+end)
+
+g.after_each(function()
+    helpers.teardown(g.httpd)
+end)
+
+g.test_broadcast = function()
+    local s1 = subscribe('/prices')
+    local s2 = subscribe('/prices')
+    t.assert_equals(read_chunk(s1), 'data: snapshot since 5\n\n')
+    t.assert_equals(read_chunk(s2), 'data: snapshot since 5\n\n')
+
+    local channel = g.httpd:sse_channel('prices')
+    t.assert_equals(channel:publish('{"price": 42}', { event = 'price', id = 6 }), 2)
+    t.assert_equals(read_chunk(s1), 'id: 6\nevent: price\ndata: {"price": 42}\n\n')
+    t.assert_equals(read_chunk(s2), 'id: 6\nevent: price\ndata: {"price": 42}\n\n')
+
+    -- Idle streams get heartbeat comments.
+    t.assert_equals(read_chunk(s1), ':\n\n')
+
+    channel:close()
+    -- The stream ends with the last chunk, maybe after a heartbeat.
+    t.assert_str_matches(s2:read('0\r\n\r\n', 1), '.*\r\n0\r\n\r\n')
+    t.assert_equals(channel:stats().subscribers, 0)
+    s1:close()
+    s2:close()
+end
+
+g.test_slow_consumer_is_evicted = function()
+    local s = subscribe('/slow')
+    local channel = g.httpd:sse_channel('prices')
+    t.helpers.retrying({}, function()
+        t.assert_equals(channel:stats().subscribers, 1)
+    end)
+    -- Events published without yielding pile up in the queue.
+    for i = 1, 3 do
+        channel:publish(tostring(i))
+    end
+    t.assert_equals(channel:stats(), { subscribers = 0, published = 3, evicted = 1 })
+    fiber.yield()
+    -- The connection is closed without the last chunk.
+    t.assert_equals(s:read('0\r\n\r\n', 1), '')
+    s:close()
+end
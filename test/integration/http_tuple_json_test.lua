@@ -0,0 +1,84 @@
+local t = require('luatest')
+local fun = require('fun')
+local json = require('json')
+local socket = require('socket')
+local http_server = require('http.server')
+
+local helpers = require('test.helpers')
+
+local g = t.group()
+
+local ROWS = {}
+for i = 1, 2500 do
+    ROWS[i] = box.tuple.new({ i, 'user' .. i })
+end
+
+local function get(path)
+    local s = socket.tcp_connect(helpers.base_host, helpers.base_port)
+    t.assert(s ~= nil, 'connected')
+    s:write('GET ' .. path .. ' HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n')
+    local chunks = {}
+    while true do
+        local data = s:read(65536, 5)
+        if data == nil or data == '' then
+            break
+        end
+        table.insert(chunks, data)
+    end
+    s:close()
+    local response = table.concat(chunks)
+    local head, body = string.match(response, '^(.-\r\n)\r\n(.*)$')
+    return string.lower(head), body
+end
+
+local function dechunk(body)
+    local res = {}
+    local pos = 1
+    while true do
+        local size, data_start = string.match(body, '^(%x+)\r\n()', pos)
+        size = tonumber(size, 16)
+        if size == 0 then
+            break
+        end
+        table.insert(res, string.sub(body, data_start, data_start + size - 1))
+        pos = data_start + size + 2
+    end
+    return table.concat(res), #res
+end
+
+g.before_each(function()
+    g.httpd = http_server.new(helpers.base_host, helpers.base_port, {
+        log_requests = false,
+        log_errors = false,
+    })
+    g.httpd:route({ path = '/users' }, function(req)
+        return req:render({ tuples = fun.iter(ROWS), names = { 'id', 'name' } })
+    end)
+    g.httpd:route({ path = '/users/:id' }, function(req)
+        return req:render({ tuple = ROWS[tonumber(req:stash('id'))] })
+    end)
+    g.httpd:start()
+end)
+
+g.after_each(function()
+    helpers.teardown(g.httpd)
+end)
+
+g.test_tuple = function()
+    local head, body = get('/users/7')
+    t.assert_str_contains(head, 'http/1.1 200 ok\r\n')
+    t.assert_str_contains(head, 'content-type: application/json')
+    t.assert_equals(body, '[7,"user7"]')
+end
+
+g.test_iterator = function()
+    local head, body = get('/users')
+    t.assert_str_contains(head, 'transfer-encoding: chunked\r\n')
+    local data, nchunks = dechunk(body)
+    -- Batches of 1000 rows, the last one ends the array.
+    t.assert_equals(nchunks, 3)
+    local users = json.decode(data)
+    t.assert_equals(#users, 2500)
+    t.assert_equals(users[1], { id = 1, name = 'user1' })
+    t.assert_equals(users[2500], { id = 2500, name = 'user2500' })
+end
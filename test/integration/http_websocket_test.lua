@@ -0,0 +1,134 @@
+local t = require('luatest')
+local socket = require('socket')
+local http_lib = require('http.lib')
+local http_client = require('http.client')
+local http_server = require('http.server')
+
+local helpers = require('test.helpers')
+
+local g = t.group()
+
+local MASK = 0x12345678
+
+local HANDSHAKE = 'GET /echo HTTP/1.1\r\n' ..
+    'Host: localhost\r\n' ..
+    'Upgrade: websocket\r\n' ..
+    'Connection: keep-alive, Upgrade\r\n' ..
+    'Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n' ..
+    'Sec-WebSocket-Version: 13\r\n' ..
+    'Sec-WebSocket-Protocol: v2.chat, chat\r\n' ..
+    '\r\n'
+
+local function connect()
+    local s = socket.tcp_connect(helpers.base_host, helpers.base_port)
+    t.assert(s ~= nil, 'connected')
+    s:write(HANDSHAKE)
+    local response = s:read('\r\n\r\n', 1)
+    t.assert_str_contains(response, 'HTTP/1.1 101 Switching Protocols\r\n')
+    t.assert_str_contains(response, 'Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n')
+    t.assert_str_contains(response, 'Sec-WebSocket-Protocol: chat\r\n')
+    return s
+end
+
+local function send_frame(s, opcode, payload, fin)
+    s:write(http_lib.ws_encode_frame(opcode, payload, fin, MASK))
+end
+
+local function read_frame(s)
+    local header = s:read(2, 1)
+    t.assert_equals(#header, 2, 'frame header received')
+    local header_len, fin, opcode, len = http_lib.ws_parse_header(header)
+    if header_len == 0 then
+        header = header .. s:read(fin - 2, 1)
+        header_len, fin, opcode, len = http_lib.ws_parse_header(header)
+    end
+    return opcode, len > 0 and s:read(len, 1) or '', fin
+end
+
+g.before_each(function()
+    g.httpd = http_server.new(helpers.base_host, helpers.base_port, {
+        log_requests = false,
+        log_errors = false,
+    })
+    g.httpd:route({ path = '/echo' }, function(req)
+        local ws, err = req:websocket({
+            protocols = { 'chat' },
+            max_message_size = 100000,
+        })
+        if ws == nil then
+            return { status = 400, body = err }
+        end
+        g.ws = ws
+        while true do
+            local message, message_type = ws:read()
+            if message == nil then
+                break
+            end
+            ws:send(message, message_type)
+        end
+    end)
+    g.httpd:start()
+end)
+
+g.after_each(function()
+    g.ws = nil
+    helpers.teardown(g.httpd)
+end)
+
+g.test_echo = function()
+    local s = connect()
+    send_frame(s, 0x1, 'Hello')
+    t.assert_equals({ read_frame(s) }, { 0x1, 'Hello', true })
+
+    local payload = string.rep('0123456789', 7000)
+    send_frame(s, 0x2, payload)
+    t.assert_equals({ read_frame(s) }, { 0x2, payload, true })
+    s:close()
+end
+
+g.test_fragmentation_and_ping = function()
+    local s = connect()
+    send_frame(s, 0x1, 'Hel', false)
+    -- A control frame in the middle of a fragmented message.
+    send_frame(s, 0x9, 'ping')
+    send_frame(s, 0x0, 'lo, ', false)
+    send_frame(s, 0x0, 'world')
+    t.assert_equals({ read_frame(s) }, { 0xa, 'ping', true })
+    t.assert_equals({ read_frame(s) }, { 0x1, 'Hello, world', true })
+    s:close()
+end
+
+g.test_close_handshake = function()
+    local s = connect()
+    send_frame(s, 0x8, '\x03\xe8bye')
+    t.assert_equals({ read_frame(s) }, { 0x8, '\x03\xe8', true })
+    -- The server closes the connection.
+    t.assert_equals(s:read(1, 1), '')
+    t.assert_equals(g.ws.close_code, 1000)
+    t.assert_equals(g.ws.close_reason, 'bye')
+    s:close()
+end
+
+g.test_protocol_errors = function()
+    local s = connect()
+    -- Client frames must be masked.
+    s:write(http_lib.ws_encode_frame(0x1, 'Hello'))
+    t.assert_equals({ read_frame(s) }, { 0x8, '\x03\xeaunmasked frame', true })
+    s:close()
+
+    s = connect()
+    send_frame(s, 0x1, '\xff')
+    t.assert_equals({ read_frame(s) }, { 0x8, '\x03\xefinvalid UTF-8 in a text message', true })
+    s:close()
+
+    s = connect()
+    send_frame(s, 0x2, string.rep('x', 100001))
+    t.assert_equals({ read_frame(s) }, { 0x8, '\x03\xf1message is too big', true })
+    s:close()
+end
+
+g.test_not_upgrade = function()
+    local r = http_client.get(helpers.base_uri .. '/echo')
+    t.assert_equals(r.status, 400)
+    t.assert_equals(r.body, 'Not a WebSocket upgrade request')
+end
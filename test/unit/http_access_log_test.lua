@@ -0,0 +1,138 @@
+local t = require('luatest')
+local fio = require('fio')
+local json = require('json')
+local access_log = require('http.access_log')
+
+local g = t.group()
+
+local function request(path, query)
+    return {
+        method = 'GET',
+        path = path,
+        query = query or '',
+        proto = { 1, 1 },
+        peer = { host = '127.0.0.1', port = 5555 },
+    }
+end
+
+local function new_log(opts)
+    return access_log.new(access_log.parse_options(opts))
+end
+
+local function read_lines(path)
+    local fh = fio.open(path, { 'O_RDONLY' })
+    local data = fh:read()
+    fh:close()
+    local lines = {}
+    for line in string.gmatch(data, '([^\n]*)\n') do
+        table.insert(lines, line)
+    end
+    return lines
+end
+
+g.before_each(function()
+    g.dir = fio.tempdir()
+end)
+
+g.after_each(function()
+    fio.rmtree(g.dir)
+end)
+
+g.test_options = function()
+    local opts = access_log.parse_options({ file = 'access.log' })
+    t.assert_equals(opts.format, 'common')
+    t.assert_equals(opts.buffer_size, access_log.DEFAULT_OPTIONS.buffer_size)
+    t.assert_equals(access_log.parse_options(nil), nil)
+
+    t.assert_error_msg_contains('access_log must have either a file or a space',
+        access_log.parse_options, {})
+    t.assert_error_msg_contains('access_log must have either a file or a space',
+        access_log.parse_options, { file = 'a', space = 'b' })
+    t.assert_error_msg_contains("Unknown access_log option 'foo'",
+        access_log.parse_options, { file = 'a', foo = 1 })
+    t.assert_error_msg_contains("access_log.format must be 'common', 'json' or a function",
+        access_log.parse_options, { file = 'a', format = 'xml' })
+    t.assert_error_msg_contains('access_log.format must be a function',
+        access_log.parse_options, { space = 'a', format = 'json' })
+    t.assert_error_msg_contains('access_log.buffer_size must be a positive integer',
+        access_log.parse_options, { file = 'a', buffer_size = 0 })
+    t.assert_error_msg_contains('access_log.sample must be a number between 0 and 1',
+        access_log.parse_options, { file = 'a', sample = 2 })
+end
+
+g.test_file_formats = function()
+    local path = fio.pathjoin(g.dir, 'common.log')
+    local log = new_log({ file = path })
+    log:record(request('/a', 'x=1'), 200, 10, 123, 0.5)
+    log:record(request('/b'), 404, 10, 0, 0.25)
+    t.assert_equals(log:flush(), 2)
+    local lines = read_lines(path)
+    t.assert_equals(#lines, 2)
+    t.assert_str_matches(lines[1],
+        '127%.0%.0%.1 %- %- %[.+ %+0000%] "GET /a%?x=1 HTTP/1%.1" 200 123 0%.500000')
+    t.assert_str_contains(lines[2], '"GET /b HTTP/1.1" 404 0 0.250000')
+
+    path = fio.pathjoin(g.dir, 'json.log')
+    log = new_log({ file = path, format = 'json' })
+    log:record(request('/a'), 200, 10, 123, 0.5)
+    log:flush()
+    local record = json.decode(read_lines(path)[1])
+    t.assert_equals(record.path, '/a')
+    t.assert_equals(record.status, 200)
+    t.assert_equals(record.bytes_out, 123)
+    t.assert_equals(record.peer, '127.0.0.1')
+
+    path = fio.pathjoin(g.dir, 'custom.log')
+    log = new_log({ file = path, format = function(r)
+        return r.method .. ' ' .. r.path .. '\n'
+    end })
+    log:record(request('/a'), 200, 10, 123, 0.5)
+    log:flush()
+    t.assert_equals(read_lines(path), { 'GET /a' })
+end
+
+g.test_overflow = function()
+    local log = new_log({ file = fio.pathjoin(g.dir, 'access.log'), buffer_size = 4 })
+    for i = 1, 6 do
+        log:record(request('/' .. i), 200, 0, 0, 0)
+    end
+    t.assert_equals(log:stats().buffered, 4)
+    t.assert_equals(log:stats().dropped, 2)
+    t.assert_equals(log:flush(), 4)
+    -- The ring wraps around.
+    for i = 1, 3 do
+        log:record(request('/' .. i), 200, 0, 0, 0)
+    end
+    t.assert_equals(log:flush(), 3)
+    t.assert_equals(log:stats().written, 7)
+    local lines = read_lines(fio.pathjoin(g.dir, 'access.log'))
+    t.assert_str_contains(lines[4], '"GET /4 ')
+    t.assert_str_contains(lines[7], '"GET /3 ')
+end
+
+g.test_sample = function()
+    local log = new_log({ file = fio.pathjoin(g.dir, 'access.log'), sample = 0 })
+    log:record(request('/ok'), 200, 0, 0, 0)
+    -- Server errors are always logged.
+    log:record(request('/fail'), 500, 0, 0, 0)
+    t.assert_equals(log:stats().sampled_out, 1)
+    t.assert_equals(log:flush(), 1)
+end
+
+g.test_space = function()
+    local tuples = {}
+    local space = {
+        index = { [0] = { max = function() return { 41 } end } },
+        insert = function(_, tuple) table.insert(tuples, tuple) end,
+    }
+    local log = new_log({ space = space })
+    log:start()
+    log:record(request('/a', 'x=1'), 201, 10, 20, 0.5)
+    log:stop()
+    t.assert_equals(#tuples, 1)
+    local tuple = tuples[1]
+    -- The numbering continues after the last record of the space.
+    t.assert_equals(tuple[1], 42)
+    t.assert_equals({ tuple[3], tuple[4], tuple[5], tuple[6], tuple[7], tuple[8] },
+        { 'GET', '/a', 'x=1', 201, 10, 20 })
+end
@@ -0,0 +1,99 @@
+local t = require('luatest')
+local buffer_pool = require('http.buffer_pool')
+
+local g = t.group()
+
+local function new_pool(opts)
+    return buffer_pool.new(opts or {
+        classes = { 1024, 4096 },
+        max_bytes = 16384,
+        max_buffers = 8,
+    })
+end
+
+-- Returns a buffer of the pool grown to at least `size` bytes.
+local function grown(pool, size)
+    local buf = pool:take()
+    buf:reserve(size)
+    return buf
+end
+
+g.test_take_put = function()
+    local pool = new_pool()
+    local buf = grown(pool, 1000)
+    local capacity = buf:capacity()
+    t.assert_ge(capacity, 1000)
+    pool:put(buf)
+    local stats = pool:stats()
+    t.assert_equals(stats.free, 1)
+    t.assert_equals(stats.free_bytes, capacity)
+    t.assert_equals(stats.created, 1)
+
+    -- The buffer is reused with its memory.
+    local again = pool:take()
+    t.assert(again == buf)
+    t.assert_equals(again:size(), 0)
+    t.assert_equals(again:capacity(), capacity)
+    t.assert_equals(pool:stats().free_bytes, 0)
+end
+
+g.test_smallest_first = function()
+    local pool = new_pool()
+    local empty = pool:take()
+    local large = grown(pool, 3000)
+    local small = grown(pool, 500)
+    pool:put(empty)
+    pool:put(large)
+    pool:put(small)
+    t.assert_equals(pool:stats().classes, {
+        { size = 1024, free = 1 },
+        { size = 4096, free = 1 },
+    })
+    t.assert(pool:take() == small)
+    t.assert(pool:take() == large)
+    t.assert(pool:take() == empty)
+end
+
+g.test_high_water_mark = function()
+    local pool = new_pool()
+    local buf = grown(pool, 10000)
+    pool:put(buf)
+    local stats = pool:stats()
+    t.assert_equals(stats.shrunk, 1)
+    t.assert_equals(stats.free_bytes, 0)
+    t.assert_equals(stats.empty, 1)
+    t.assert_equals(buf:capacity(), 0)
+end
+
+g.test_limits = function()
+    local pool = new_pool()
+    local bufs = {}
+    for i = 1, 10 do
+        bufs[i] = grown(pool, 3000)
+    end
+    for i = 1, 10 do
+        pool:put(bufs[i])
+    end
+    local stats = pool:stats()
+    t.assert_le(stats.free_bytes, 16384)
+    t.assert_gt(stats.shrunk, 0)
+    t.assert_equals(stats.free, 8)
+    t.assert_equals(stats.taken, 10)
+    t.assert_equals(stats.returned, 10)
+end
+
+g.test_attach_detach = function()
+    local pool = new_pool()
+    local s = {}
+    pool:attach(s)
+    t.assert_not_equals(s.rbuf, nil)
+    local rbuf = s.rbuf
+    -- A buffer with unread data is kept.
+    rbuf:alloc(10)
+    pool:detach(s)
+    t.assert(s.rbuf == rbuf)
+    rbuf.rpos = rbuf.rpos + 10
+    pool:detach(s)
+    t.assert_equals(s.rbuf, nil)
+    t.assert_equals(pool:stats().free, 1)
+end
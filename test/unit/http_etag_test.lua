@@ -0,0 +1,46 @@
+local t = require('luatest')
+local etag = require('http.etag')
+
+local g = t.group()
+
+g.test_of = function()
+    -- XXH64 test vectors.
+    t.assert_equals(etag.of(''), 'W/"ef46db3751d8e999"')
+    t.assert_equals(etag.of('abc'), 'W/"44bc2cf5ad770999"')
+    t.assert_equals(etag.of('Nobody inspects the spammish repetition'),
+        'W/"fbcea83c8a378bf1"')
+    t.assert_not_equals(etag.of(string.rep('a', 1000)), etag.of(string.rep('a', 1001)))
+end
+
+g.test_none_match = function()
+    local tag = 'W/"44bc2cf5ad770999"'
+    t.assert(etag.none_match(tag, tag))
+    t.assert(etag.none_match('"44bc2cf5ad770999"', tag))
+    t.assert(etag.none_match('"xyz", W/"44bc2cf5ad770999"', tag))
+    t.assert(etag.none_match('*', tag))
+    t.assert(etag.none_match(tag, '"44bc2cf5ad770999"'))
+    t.assert_not(etag.none_match(nil, tag))
+    t.assert_not(etag.none_match('W/"44bc2cf5ad770998"', tag))
+    t.assert_not(etag.none_match('"xyz"', tag))
+end
+
+g.test_validate = function()
+    local opts = etag.parse_route_options({
+        validator = function(req) return req.version end,
+    })
+    t.assert_equals(etag.validate(opts, { version = 7 }), etag.of('7'))
+    t.assert_equals(etag.validate(opts, {}), nil)
+    opts = etag.parse_route_options({ validator = function() error('boom') end })
+    t.assert_equals(etag.validate(opts, {}), nil)
+    t.assert_equals(etag.validate(etag.parse_route_options(true), {}), nil)
+end
+
+g.test_options = function()
+    t.assert_equals(etag.parse_route_options(true), {})
+    t.assert_error_msg_contains("'etag' option should be a boolean or a table",
+        etag.parse_route_options, 'yes')
+    t.assert_error_msg_contains("Unknown etag option 'weak'",
+        etag.parse_route_options, { weak = true })
+    t.assert_error_msg_contains('etag.validator must be a function',
+        etag.parse_route_options, { validator = 1 })
+end
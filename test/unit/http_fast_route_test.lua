@@ -0,0 +1,102 @@
+local t = require('luatest')
+local lib = require('http.lib')
+local fast_route = require('http.fast_route')
+
+local g = t.group()
+
+g.test_key = function()
+    local key, keepalive = lib.fast_route_key('GET /health HTTP/1.1\r\nHost: a\r\n\r\n')
+    t.assert_equals(key, 'GET /health')
+    t.assert_equals(keepalive, true)
+
+    key, keepalive = lib.fast_route_key('HEAD /health?full=1 HTTP/1.1\n\n')
+    t.assert_equals(key, 'HEAD /health?full=1')
+    t.assert_equals(keepalive, true)
+
+    key, keepalive = lib.fast_route_key(
+        'GET /health HTTP/1.1\r\nCONNECTION:  Close \r\n\r\n')
+    t.assert_equals(key, 'GET /health')
+    t.assert_equals(keepalive, false)
+
+    key, keepalive = lib.fast_route_key('GET /health HTTP/1.0\r\n\r\n')
+    t.assert_equals(key, 'GET /health')
+    t.assert_equals(keepalive, false)
+
+    key, keepalive = lib.fast_route_key(
+        'GET /health HTTP/1.0\r\nConnection: keep-alive\r\n\r\n')
+    t.assert_equals(key, 'GET /health')
+    t.assert_equals(keepalive, true)
+
+    key = lib.fast_route_key('GET /health HTTP/1.1\r\nContent-Length: 0\r\n\r\n')
+    t.assert_equals(key, 'GET /health')
+end
+
+g.test_key_rejected = function()
+    t.assert_equals(lib.fast_route_key(''), nil)
+    t.assert_equals(lib.fast_route_key('GET /health\r\n\r\n'), nil)
+    t.assert_equals(lib.fast_route_key('GET /health HTTP/2.0\r\n\r\n'), nil)
+    t.assert_equals(lib.fast_route_key('GET /health HTTP/1.1'), nil)
+    t.assert_equals(lib.fast_route_key(
+        'POST /health HTTP/1.1\r\nContent-Length: 2\r\n\r\n'), nil)
+    t.assert_equals(lib.fast_route_key(
+        'POST /health HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n'), nil)
+end
+
+g.test_lookup = function()
+    local routes = fast_route.new()
+    local route = {
+        path = 'health',
+        method = 'ANY',
+        response = fast_route.parse_route_options({
+            headers = { ['Content-Length'] = 2 },
+            body = 'OK',
+        }),
+    }
+    routes:add(route)
+    t.assert_equals(routes.size, 2)
+
+    local entry, keepalive = routes:lookup('GET /health HTTP/1.1\r\n\r\n')
+    t.assert_equals(keepalive, true)
+    t.assert_equals(entry.route.endpoint, route)
+    t.assert_str_contains(entry.keepalive, 'HTTP/1.1 200 Ok\r\n')
+    t.assert_str_contains(entry.keepalive, 'Content-length: 2\r\n')
+    t.assert_str_contains(entry.keepalive, 'Connection: keep-alive\r\n\r\nOK')
+    t.assert_str_contains(entry.close, 'Connection: close\r\n\r\nOK')
+
+    entry = routes:lookup('HEAD /health HTTP/1.1\r\n\r\n')
+    t.assert_str_contains(entry.keepalive, 'Content-length: 2\r\n')
+    t.assert(string.endswith(entry.keepalive, '\r\n\r\n'))
+
+    t.assert_equals(routes:lookup('POST /health HTTP/1.1\r\n\r\n'), nil)
+    t.assert_equals(routes:lookup('GET /health/ HTTP/1.1\r\n\r\n'), nil)
+
+    routes:remove(route)
+    t.assert_equals(routes.size, 0)
+    t.assert_equals(routes:lookup('GET /health HTTP/1.1\r\n\r\n'), nil)
+end
+
+g.test_handler = function()
+    local response = fast_route.parse_route_options({
+        status = 503,
+        headers = { ['X-State'] = 'down' },
+    })
+    local res = fast_route.handler(response)()
+    t.assert_equals(res, { status = 503, headers = { ['x-state'] = 'down' }, body = '' })
+    res.headers.extra = true
+    t.assert_equals(response.headers, { ['x-state'] = 'down' })
+end
+
+g.test_options = function()
+    t.assert_equals(fast_route.parse_route_options({}),
+        { status = 200, headers = {}, body = '' })
+    t.assert_error_msg_contains("'response' option should be a table",
+        fast_route.parse_route_options, 'OK')
+    t.assert_error_msg_contains("Unknown response option 'code'",
+        fast_route.parse_route_options, { code = 200 })
+    t.assert_error_msg_contains('response.status must be an integer between 200 and 599',
+        fast_route.parse_route_options, { status = 100 })
+    t.assert_error_msg_contains('response.headers must map names to strings',
+        fast_route.parse_route_options, { headers = { a = true } })
+    t.assert_error_msg_contains('response.body must be a string',
+        fast_route.parse_route_options, { body = {} })
+end
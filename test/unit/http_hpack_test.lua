@@ -0,0 +1,137 @@
+local t = require('luatest')
+local hpack = require('http.hpack')
+
+local g = t.group()
+
+local function unhex(s)
+    s = string.gsub(s, '%s', '')
+    return (string.gsub(s, '..', function(h)
+        return string.char(tonumber(h, 16))
+    end))
+end
+
+g.test_integer = function()
+    -- RFC 7541 C.1.
+    t.assert_equals(hpack.encode_integer(10, 5, 0), unhex('0a'))
+    t.assert_equals(hpack.encode_integer(1337, 5, 0), unhex('1f9a0a'))
+    t.assert_equals(hpack.encode_integer(42, 8, 0), unhex('2a'))
+
+    t.assert_equals({ hpack.decode_integer(unhex('1f9a0a'), 1, 5) }, { 1337, 4 })
+    t.assert_equals({ hpack.decode_integer(unhex('ea'), 1, 5) }, { 10, 2 })
+    t.assert_equals({ hpack.decode_integer(unhex('1f9a'), 1, 5) },
+        { nil, 'truncated integer' })
+    t.assert_equals({ hpack.decode_integer(unhex('1fffffffffff01'), 1, 5) },
+        { nil, 'integer overflow' })
+end
+
+g.test_huffman = function()
+    t.assert_equals(hpack.huffman_decode(unhex('f1e3c2e5f23a6ba0ab90f4ff'), 1, 12),
+        'www.example.com')
+    t.assert_equals(hpack.huffman_decode(unhex('a8eb10649cbf'), 1, 6), 'no-cache')
+    -- Padding longer than 7 bits.
+    t.assert_equals({ hpack.huffman_decode(unhex('a8eb10649cbfff'), 1, 7) },
+        { nil, 'invalid Huffman padding' })
+    -- Padding which is not a prefix of EOS.
+    t.assert_equals({ hpack.huffman_decode(unhex('00'), 1, 1) },
+        { nil, 'invalid Huffman padding' })
+    -- EOS in the string.
+    t.assert_equals({ hpack.huffman_decode(unhex('ffffffff'), 1, 4) },
+        { nil, 'invalid Huffman code' })
+end
+
+-- RFC 7541 C.3 and C.4: requests without and with Huffman coding.
+local requests = {
+    {
+        {
+            { ':method', 'GET' }, { ':scheme', 'http' }, { ':path', '/' },
+            { ':authority', 'www.example.com' },
+        },
+        '828684410f7777772e6578616d706c652e636f6d',
+        '828684418cf1e3c2e5f23a6ba0ab90f4ff',
+    },
+    {
+        {
+            { ':method', 'GET' }, { ':scheme', 'http' }, { ':path', '/' },
+            { ':authority', 'www.example.com' }, { 'cache-control', 'no-cache' },
+        },
+        '828684be58086e6f2d6361636865',
+        '828684be5886a8eb10649cbf',
+    },
+    {
+        {
+            { ':method', 'GET' }, { ':scheme', 'https' }, { ':path', '/index.html' },
+            { ':authority', 'www.example.com' }, { 'custom-key', 'custom-value' },
+        },
+        '828785bf400a637573746f6d2d6b65790c637573746f6d2d76616c7565',
+        '828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf',
+    },
+}
+
+g.test_decode_requests = function()
+    for _, column in ipairs({ 2, 3 }) do
+        local decoder = hpack.new_decoder()
+        for _, case in ipairs(requests) do
+            t.assert_equals(decoder:decode(unhex(case[column])), case[1])
+        end
+        t.assert_equals(decoder.table.size, 164)
+    end
+end
+
+g.test_decode_errors = function()
+    local decoder = hpack.new_decoder()
+    t.assert_equals({ decoder:decode(unhex('80')) }, { nil, 'invalid header index 0' })
+    t.assert_equals({ decoder:decode(unhex('be')) }, { nil, 'invalid header index 62' })
+    t.assert_equals({ decoder:decode(unhex('400a6375')) }, { nil, 'truncated string' })
+    t.assert_equals({ decoder:decode(unhex('823f e11f')) },
+        { nil, 'unexpected dynamic table size update' })
+    t.assert_equals({ decoder:decode(unhex('3fe21f')) },
+        { nil, 'dynamic table size update exceeds the limit' })
+end
+
+g.test_dynamic_table_eviction = function()
+    -- RFC 7541 C.5: responses with a 256 octet dynamic table.
+    local decoder = hpack.new_decoder()
+    t.assert_equals(decoder:decode(unhex('3fe101')), {})
+    t.assert_equals(decoder:decode(unhex(
+        '4803333032580770726976617465611d4d6f6e2c203231204f63742032303133' ..
+        '2032303a31333a323120474d546e1768747470733a2f2f7777772e6578616d70' ..
+        '6c652e636f6d')), {
+        { ':status', '302' },
+        { 'cache-control', 'private' },
+        { 'date', 'Mon, 21 Oct 2013 20:13:21 GMT' },
+        { 'location', 'https://www.example.com' },
+    })
+    t.assert_equals(decoder:decode(unhex('4803333037c1c0bf')), {
+        { ':status', '307' },
+        { 'cache-control', 'private' },
+        { 'date', 'Mon, 21 Oct 2013 20:13:21 GMT' },
+        { 'location', 'https://www.example.com' },
+    })
+    t.assert_equals(decoder.table.size, 222)
+    t.assert_equals(#decoder.table.entries, 4)
+end
+
+g.test_encode_roundtrip = function()
+    local encoder = hpack.new_encoder()
+    local decoder = hpack.new_decoder()
+    local headers = {
+        { ':status', '200' },
+        { 'content-type', 'application/json' },
+        { 'content-length', '13' },
+        { 'set-cookie', 'id=1' },
+        { 'x-custom', 'value' },
+    }
+    local first = encoder:encode(headers)
+    t.assert_equals(decoder:decode(first), headers)
+    local second = encoder:encode(headers)
+    t.assert_equals(decoder:decode(second), headers)
+    -- Indexed fields take one octet on the second response.
+    t.assert_lt(#second, #first)
+    t.assert_equals(string.byte(second, 1), 0x88)
+
+    encoder:set_max_table_size(0)
+    local third = encoder:encode(headers)
+    t.assert_equals(string.byte(third, 1), 0x20)
+    t.assert_equals(decoder:decode(third), headers)
+    t.assert_equals(#decoder.table.entries, 0)
+end
@@ -0,0 +1,94 @@
+local t = require('luatest')
+local metrics = require('http.metrics')
+
+local g = t.group()
+
+local route = { endpoint = { path = '/abc', name = 'abc' } }
+
+g.test_parse_options = function()
+    t.assert_equals(metrics.parse_options(nil), nil)
+    t.assert_equals(metrics.parse_options(false), nil)
+    t.assert_equals(metrics.parse_options(true), {
+        buckets = metrics.DEFAULT_BUCKETS,
+    })
+    t.assert_equals(metrics.parse_options({ path = '/metrics', buckets = { 0.1, 1 } }), {
+        path = '/metrics',
+        buckets = { 0.1, 1 },
+    })
+
+    t.assert_error_msg_contains('must be a boolean or a table',
+        metrics.parse_options, 42)
+    t.assert_error_msg_contains("Unknown metrics option 'foo'",
+        metrics.parse_options, { foo = 1 })
+    t.assert_error_msg_contains("metrics.path must be a string starting with '/'",
+        metrics.parse_options, { path = 'metrics' })
+    t.assert_error_msg_contains('sorted in increasing order',
+        metrics.parse_options, { buckets = { 1, 0.1 } })
+end
+
+g.test_observe = function()
+    local collector = metrics.new({ buckets = { 0.01, 0.1 } })
+    collector:connection_opened()
+    collector:observe(route, 'GET', 200, 0.005, 10, 100, false)
+    collector:observe(route, 'GET', 200, 0.05, 10, 100, true)
+    collector:observe(route, 'POST', 500, 1, 20, 50, true)
+    collector:observe(nil, 'GET', 404, 0.001, 5, 7, false)
+
+    local snapshot = collector:collect()
+    t.assert_equals(snapshot.active_connections, 1)
+    t.assert_equals(snapshot.connections_total, 1)
+    t.assert_equals(snapshot.keepalive_requests_total, 2)
+
+    local abc = snapshot.routes.abc
+    t.assert_equals(abc.requests, { GET = { [200] = 2 }, POST = { [500] = 1 } })
+    t.assert_equals(abc.duration.buckets, {
+        { le = 0.01, count = 1 },
+        { le = 0.1, count = 2 },
+        { le = math.huge, count = 3 },
+    })
+    t.assert_equals(abc.duration.count, 3)
+    t.assert_almost_equals(abc.duration.sum, 1.055, 1e-9)
+    t.assert_equals(abc.bytes_in, 40)
+    t.assert_equals(abc.bytes_out, 250)
+
+    t.assert_equals(snapshot.routes[metrics.UNMATCHED_ROUTE].requests,
+        { GET = { [404] = 1 } })
+
+    collector:connection_closed()
+    t.assert_equals(collector:collect().active_connections, 0)
+end
+
+g.test_render = function()
+    local collector = metrics.new({ buckets = { 0.5 } })
+    collector:connection_opened()
+    collector:observe(route, 'GET', 200, 0.25, 10, 100, false)
+
+    local text = collector:render()
+    t.assert_str_contains(text, '# TYPE http_server_requests_total counter\n')
+    t.assert_str_contains(text,
+        'http_server_requests_total{route="abc",method="GET",status="200"} 1\n')
+    t.assert_str_contains(text,
+        'http_server_request_duration_seconds_bucket{route="abc",le="0.5"} 1\n')
+    t.assert_str_contains(text,
+        'http_server_request_duration_seconds_bucket{route="abc",le="+Inf"} 1\n')
+    t.assert_str_contains(text,
+        'http_server_request_duration_seconds_sum{route="abc"} 0.25\n')
+    t.assert_str_contains(text, 'http_server_request_bytes_total{route="abc"} 10\n')
+    t.assert_str_contains(text, 'http_server_response_bytes_total{route="abc"} 100\n')
+    t.assert_str_contains(text, 'http_server_active_connections 1\n')
+    t.assert_str_contains(text, 'http_server_connections_total 1\n')
+end
+
+g.test_reset = function()
+    local collector = metrics.new()
+    collector:connection_opened()
+    collector:observe(route, 'GET', 200, 0.25, 10, 100, true)
+    collector:reset()
+
+    local snapshot = collector:collect()
+    t.assert_equals(snapshot.routes, {})
+    t.assert_equals(snapshot.connections_total, 0)
+    t.assert_equals(snapshot.keepalive_requests_total, 0)
+    -- The gauge reflects open connections and is not reset.
+    t.assert_equals(snapshot.active_connections, 1)
+end
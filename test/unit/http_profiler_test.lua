@@ -0,0 +1,103 @@
+local t = require('luatest')
+local fiber = require('fiber')
+local profiler = require('http.profiler')
+
+local g = t.group()
+
+-- Runs Lua code for about `seconds`.
+local function busy(seconds)
+    local deadline = os.clock() + seconds
+    local x = 0
+    while os.clock() < deadline do
+        for i = 1, 1000 do
+            x = x + math.sin(i)
+        end
+    end
+    return x
+end
+
+-- Calls `func` in a coroutine, like a fiber of a request.
+local function in_coroutine(func, ...)
+    return select(2, assert(coroutine.resume(coroutine.create(func), ...)))
+end
+
+g.after_each(function()
+    profiler.stop()
+end)
+
+g.test_routes = function()
+    t.assert_equals(profiler.start({ interval = 1 }), true)
+    t.assert(profiler.is_running())
+    in_coroutine(profiler.call, '/busy', busy, 0.2)
+    busy(0.05)
+    local report = profiler.stop()
+    t.assert_not(profiler.is_running())
+    t.assert_not(report.running)
+    t.assert(report.routes['/busy'] > 0)
+    t.assert(report.samples >= report.routes['/busy'])
+    t.assert_equals(report.interval, 1)
+    t.assert_equals(profiler.report(), report)
+
+    local total = 0
+    for line in string.gmatch(profiler.collapsed(), '[^\n]+') do
+        local stack, count = string.match(line, '^(.+) (%d+)$')
+        t.assert(stack ~= nil, line)
+        total = total + tonumber(count)
+    end
+    t.assert_equals(total, report.samples)
+    t.assert_str_contains(profiler.collapsed(), '/busy;')
+    t.assert_equals(profiler.stop(), nil)
+end
+
+g.test_call = function()
+    local function add(a, b)
+        return a + b, 'x'
+    end
+    t.assert_equals({ in_coroutine(profiler.call, 'r', add, 1, 2) }, { 3, 'x' })
+    t.assert_equals({ profiler.call('r', add, 1, 2) }, { 3, 'x' })
+    local err = { code = 1 }
+    local ok, res = coroutine.resume(coroutine.create(profiler.call), 'r', error, err)
+    t.assert_not(ok)
+    t.assert_is(res, err)
+end
+
+g.test_duration = function()
+    t.assert_equals(profiler.start({ duration = 0.1 }), true)
+    local ok, err = profiler.start()
+    t.assert_equals(ok, nil)
+    t.assert_equals(err, 'profiler is already running')
+    fiber.sleep(0.3)
+    t.assert_not(profiler.is_running())
+    t.assert(profiler.report().duration >= 0.1)
+end
+
+g.test_max_stacks = function()
+    profiler.start({ interval = 1, max_stacks = 1 })
+    in_coroutine(profiler.call, 'a', busy, 0.05)
+    in_coroutine(profiler.call, 'b', busy, 0.05)
+    local report = profiler.stop()
+    t.assert_equals(report.stacks, 1)
+    t.assert(report.dropped > 0)
+end
+
+g.test_options = function()
+    t.assert_error_msg_contains("Unknown profiler option 'mode'",
+        profiler.start, { mode = 'l' })
+    t.assert_error_msg_contains('profiler.duration must be a positive number of at most 600 seconds',
+        profiler.start, { duration = 601 })
+    t.assert_error_msg_contains('profiler.interval must be an integer between 1 and 1000',
+        profiler.start, { interval = 0.5 })
+    t.assert_error_msg_contains('profiler.max_stacks must be a positive integer',
+        profiler.start, { max_stacks = 0 })
+    t.assert_not(profiler.is_running())
+
+    t.assert_equals(profiler.parse_options(nil), nil)
+    t.assert_equals(profiler.parse_options({ path = '/p', token = 's' }),
+                    { path = '/p', token = 's' })
+    t.assert_error_msg_contains('Option profiler must be a table.',
+        profiler.parse_options, true)
+    t.assert_error_msg_contains("profiler.path must be a string starting with '/'",
+        profiler.parse_options, { path = 'p', token = 's' })
+    t.assert_error_msg_contains('profiler.token must be a non-empty string',
+        profiler.parse_options, { path = '/p' })
+end
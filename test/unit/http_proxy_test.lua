@@ -0,0 +1,37 @@
+local t = require('luatest')
+local proxy = require('http.proxy')
+
+local g = t.group()
+
+g.test_options = function()
+    local opts = proxy.parse_route_options('localhost:8080')
+    t.assert_equals(#opts.upstreams, 1)
+    t.assert_equals(opts.upstreams[1].host, 'localhost')
+    t.assert_equals(opts.upstreams[1].port, 8080)
+    t.assert_equals(opts.timeout, proxy.DEFAULT_OPTIONS.timeout)
+    t.assert_equals(opts.preserve_host, false)
+
+    opts = proxy.parse_route_options({
+        upstreams = { '10.0.0.1:80', '10.0.0.2:80' },
+        headers = { ['X-Real-IP'] = '' },
+        retries = 0,
+    })
+    t.assert_equals(#opts.upstreams, 2)
+    t.assert_equals(opts.headers, { ['x-real-ip'] = '' })
+    t.assert_equals(opts.retries, 0)
+end
+
+g.test_invalid_options = function()
+    t.assert_error_msg_contains("'proxy' option should be a string or a table",
+        proxy.parse_route_options, 8080)
+    t.assert_error_msg_contains("Unknown proxy option 'foo'",
+        proxy.parse_route_options, { upstreams = 'localhost:80', foo = 1 })
+    t.assert_error_msg_contains('proxy.upstreams must be a non-empty array',
+        proxy.parse_route_options, { upstreams = {} })
+    t.assert_error_msg_contains("proxy.upstreams[1] must be 'host:port', got 'localhost'",
+        proxy.parse_route_options, 'localhost')
+    t.assert_error_msg_contains('proxy.timeout must be a non-negative number',
+        proxy.parse_route_options, { upstreams = 'localhost:80', timeout = -1 })
+    t.assert_error_msg_contains('proxy.pool_size must be an integer',
+        proxy.parse_route_options, { upstreams = 'localhost:80', pool_size = 1.5 })
+end
@@ -0,0 +1,110 @@
+local t = require('luatest')
+local http_lib = require('http.lib')
+local rate_limit = require('http.rate_limit')
+
+local g = t.group()
+
+local function request(host, headers)
+    return {
+        peer = { host = host, port = 5555 },
+        headers = headers or {},
+    }
+end
+
+local function new_limiter(opts, is_route)
+    return rate_limit.new(rate_limit.parse_options(opts, is_route))
+end
+
+g.test_store = function()
+    -- 10 requests per second, bursts of 2.
+    local store = http_lib.rate_limiter(16, 10, 2)
+    t.assert_equals(store:check('a', 0), 0)
+    t.assert_equals(store:check('a', 0), 0)
+    t.assert_almost_equals(store:check('a', 0), 0.1, 1e-9)
+    -- A rejected request is not accounted.
+    t.assert_almost_equals(store:check('a', 0.05), 0.05, 1e-9)
+    t.assert_equals(store:check('a', 0.1), 0)
+    t.assert_equals(store:check('b', 0), 0)
+    t.assert_equals(store:size(), 2)
+    -- The burst is restored after an idle period.
+    t.assert_equals(store:check('a', 10), 0)
+    t.assert_equals(store:check('a', 10), 0)
+    t.assert_not_equals(store:check('a', 10), 0)
+
+    t.assert_error_msg_contains('rate_limiter: invalid max_keys',
+        http_lib.rate_limiter, 2^32, 10, 2)
+end
+
+g.test_store_eviction = function()
+    local store = http_lib.rate_limiter(3, 1, 1)
+    local long = string.rep('x', 100)
+    t.assert_equals(store:check('a', 0), 0)
+    t.assert_equals(store:check(long, 0), 0)
+    t.assert_equals(store:check('c', 0), 0)
+    -- Touch 'a' so that the long key is the least recently used one.
+    t.assert_not_equals(store:check('a', 0), 0)
+    t.assert_equals(store:check('d', 0), 0)
+    t.assert_equals(store:size(), 3)
+    -- The evicted key starts over, the others are still limited.
+    t.assert_equals(store:check(long, 0), 0)
+    t.assert_not_equals(store:check('a', 0), 0)
+    for i = 1, 1000 do
+        store:check('key' .. i, 0)
+    end
+    t.assert_equals(store:size(), 3)
+end
+
+g.test_keys = function()
+    local limiter = new_limiter({ rate = 1 })
+    t.assert_equals(limiter:check(request('10.0.0.1')), nil)
+    t.assert_not_equals(limiter:check(request('10.0.0.1')), nil)
+    t.assert_equals(limiter:check(request('10.0.0.2')), nil)
+    t.assert_equals(limiter:stats(), { keys = 2, rejected = 1 })
+
+    limiter = new_limiter({ rate = 1, key = 'header:X-Api-Key' })
+    t.assert_equals(limiter:check(request('10.0.0.1', { ['x-api-key'] = 'a' })), nil)
+    t.assert_equals(limiter:check(request('10.0.0.1', { ['x-api-key'] = 'b' })), nil)
+    t.assert_not_equals(limiter:check(request('10.0.0.2', { ['x-api-key'] = 'a' })), nil)
+    -- Without the header the address is the key.
+    t.assert_equals(limiter:check(request('10.0.0.1')), nil)
+    t.assert_not_equals(limiter:check(request('10.0.0.1')), nil)
+
+    limiter = new_limiter({ rate = 1, key = 'route' }, true)
+    t.assert_equals(limiter:check(request('10.0.0.1')), nil)
+    t.assert_not_equals(limiter:check(request('10.0.0.2')), nil)
+
+    limiter = new_limiter({ rate = 1, key = function(req) return req.headers.user end })
+    t.assert_equals(limiter:check(request('10.0.0.1', { user = 'u' })), nil)
+    t.assert_not_equals(limiter:check(request('10.0.0.1', { user = 'u' })), nil)
+    -- Requests without a key are not limited.
+    t.assert_equals(limiter:check(request('10.0.0.1')), nil)
+    t.assert_equals(limiter:check(request('10.0.0.1')), nil)
+end
+
+g.test_options = function()
+    t.assert_equals(rate_limit.parse_options(nil), nil)
+    t.assert_equals(rate_limit.parse_options(false), nil)
+    t.assert_equals(rate_limit.parse_options({ rate = 2.5 }), {
+        rate = 2.5, burst = 3, key = 'peer', max_keys = 65536,
+    })
+    t.assert_equals(rate_limit.parse_options({ rate = 0.1, key = 'header:X-Key' }).header,
+        'x-key')
+    t.assert_error_msg_contains('Option rate_limit must be a table',
+        rate_limit.parse_options, 10)
+    t.assert_error_msg_contains("'rate_limit' option should be a table",
+        rate_limit.parse_options, 10, true)
+    t.assert_error_msg_contains("Unknown rate_limit option 'rps'",
+        rate_limit.parse_options, { rps = 1 })
+    t.assert_error_msg_contains('rate_limit.rate must be a positive number',
+        rate_limit.parse_options, { rate = 0 })
+    t.assert_error_msg_contains('rate_limit.burst must be a positive integer',
+        rate_limit.parse_options, { rate = 1, burst = 1.5 })
+    t.assert_error_msg_contains('rate_limit.max_keys must be a positive integer',
+        rate_limit.parse_options, { rate = 1, max_keys = 0 })
+    t.assert_error_msg_contains('rate_limit.max_keys must not exceed 16777216',
+        rate_limit.parse_options, { rate = 1, max_keys = 2^32 })
+    t.assert_error_msg_contains("rate_limit.key must be 'peer', 'header:<name>' or a function",
+        rate_limit.parse_options, { rate = 1, key = 'route' })
+    t.assert_error_msg_contains('rate_limit.key must be a string or a function',
+        rate_limit.parse_options, { rate = 1, key = 1 })
+end
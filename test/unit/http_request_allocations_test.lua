@@ -0,0 +1,122 @@
+local t = require('luatest')
+local ffi = require('ffi')
+local http_server = require('http.server')
+
+local g = t.group()
+
+local REQUEST = 'GET /hello/world?x=1 HTTP/1.1\r\n' ..
+    'Host: localhost\r\n' ..
+    'User-Agent: test\r\n' ..
+    'Accept: */*\r\n' ..
+    '\r\n'
+
+-- A keep-alive connection sending the same request `count` times.
+local function connection(count)
+    local n = 0
+    return {
+        read = function()
+            n = n + 1
+            if n > count then
+                return ''
+            end
+            return REQUEST
+        end,
+        write = function(_, data)
+            return #data
+        end,
+    }
+end
+
+-- A keep-alive connection sending `count` requests with a body that are
+-- answered without reading it.
+local function upload_connection(count, body)
+    local head = 'POST /upload HTTP/1.1\r\n' ..
+        'Host: localhost\r\n' ..
+        'Content-Length: ' .. #body .. '\r\n' ..
+        '\r\n'
+    local n = 0
+    local offset = #body
+    return {
+        read = function()
+            assert(offset == #body, 'the body is read')
+            n = n + 1
+            if n > count then
+                return ''
+            end
+            offset = 0
+            return head
+        end,
+        sysread = function(_, ptr, size)
+            size = math.min(size, #body - offset)
+            ffi.copy(ptr, ffi.cast('const char *', body) + offset, size)
+            offset = offset + size
+            return size
+        end,
+        write = function(_, data)
+            return #data
+        end,
+    }
+end
+
+-- Returns the number of bytes allocated by the server per request.
+local function allocated_per_request(setup, connection_f)
+    connection_f = connection_f or connection
+    local accept
+    local httpd = http_server.new('localhost', 0, {
+        log_requests = false,
+        log_errors = false,
+    })
+    httpd.tcp_server_f = function(_, _, opts)
+        accept = opts.handler
+        return { close = function() end }
+    end
+    setup(httpd)
+    httpd:start()
+    local peer = { host = '127.0.0.1', port = 1, family = 'AF_INET' }
+
+    -- Warm up the caches of the server and the JIT.
+    accept(connection_f(200), peer)
+
+    local count = 1000
+    collectgarbage('collect')
+    collectgarbage('stop')
+    local before = collectgarbage('count')
+    accept(connection_f(count), peer)
+    local allocated = (collectgarbage('count') - before) * 1024
+    collectgarbage('restart')
+    httpd:stop()
+    return allocated / count
+end
+
+g.test_handler = function()
+    local allocated = allocated_per_request(function(httpd)
+        httpd:route({ path = '/hello/:name' }, function(req)
+            return { status = 200, body = 'Hello, ' .. req:stash('name') }
+        end)
+    end)
+    t.assert_lt(allocated, 2048)
+end
+
+g.test_template = function()
+    local allocated = allocated_per_request(function(httpd)
+        httpd:helper('upper', function(_, str) return string.upper(str) end)
+        httpd:helper('lower', function(_, str) return string.lower(str) end)
+        httpd:route({ path = '/hello/:name', template = 'Hello, <%= upper(name) %>' },
+            function(req)
+                return req:render({})
+            end)
+    end)
+    t.assert_lt(allocated, 3072)
+end
+
+g.test_discarded_body = function()
+    local body = string.rep('x', 100000)
+    local allocated = allocated_per_request(function(httpd)
+        httpd:route({ path = '/upload' }, function()
+            return { status = 413 }
+        end)
+    end, function(count)
+        return upload_connection(count, body)
+    end)
+    t.assert_lt(allocated, 2048)
+end
@@ -0,0 +1,150 @@
+local t = require('luatest')
+local response_cache = require('http.response_cache')
+
+local g = t.group()
+
+local function endpoint(cache_opts)
+    return { path = '/abc', cache = response_cache.parse_route_options(cache_opts) }
+end
+
+g.test_parse_route_options = function()
+    t.assert_equals(response_cache.parse_route_options({ ttl = 5 }), {
+        ttl = 5,
+        vary = {},
+    })
+    t.assert_equals(response_cache.parse_route_options({
+        ttl = 1, vary = { 'Accept-Language' }, max_bytes = 1024,
+    }), {
+        ttl = 1,
+        vary = { 'accept-language' },
+        max_bytes = 1024,
+    })
+
+    t.assert_error_msg_contains("'cache' option should be a table",
+        response_cache.parse_route_options, true)
+    t.assert_error_msg_contains('cache.ttl must be a positive number',
+        response_cache.parse_route_options, {})
+    t.assert_error_msg_contains("Unknown cache option 'foo'",
+        response_cache.parse_route_options, { ttl = 1, foo = 1 })
+    t.assert_error_msg_contains('cache.vary[1] must be a string',
+        response_cache.parse_route_options, { ttl = 1, vary = { 1 } })
+    t.assert_error_msg_contains('cache.max_bytes must be a positive number',
+        response_cache.parse_route_options, { ttl = 1, max_bytes = 0 })
+end
+
+g.test_request_key = function()
+    local opts = response_cache.parse_route_options({ ttl = 1, vary = { 'Accept' } })
+    local function key(path, query, headers)
+        return response_cache.request_key(opts, {
+            method = 'GET', path = path, query = query, headers = headers or {},
+        })
+    end
+
+    t.assert_equals(key('/a/b/', 'y=2&x=1'), key('/a//b', 'x=1&y=2'))
+    t.assert_not_equals(key('/a', ''), key('/a', 'x=1'))
+    t.assert_not_equals(key('/a', '', { accept = 'text/html' }),
+                        key('/a', '', { accept = 'application/json' }))
+    t.assert_equals(key('/a', '', { ['user-agent'] = 'curl' }), key('/a', ''))
+    t.assert_equals(select(2, key('/a/b/', '')), '/a/b')
+end
+
+g.test_get_put = function()
+    local cache = response_cache.new()
+    local e = endpoint({ ttl = 60 })
+
+    t.assert_equals(cache:get(e, 'k'), nil)
+    t.assert(cache:put(e, 'k', '/abc', 200, { ['content-type'] = 'text/plain' }, 'body'))
+    local entry = cache:get(e, 'k')
+    t.assert_equals(entry.status, 200)
+    t.assert_equals(entry.body, 'body')
+    t.assert_equals(entry.headers, { ['content-type'] = 'text/plain' })
+
+    -- Responses that must not be shared are not stored.
+    t.assert_not(cache:put(e, 'k1', '/abc', 500, {}, 'body'))
+    t.assert_not(cache:put(e, 'k2', '/abc', 200, { ['set-cookie'] = 'a=1' }, 'body'))
+    t.assert_not(cache:put(e, 'k3', '/abc', 200, { ['cache-control'] = 'no-store' }, 'body'))
+    t.assert_not(cache:put(e, 'k4', '/abc', 200, {}, function() end))
+
+    local stats = cache:stats()
+    t.assert_equals(stats.entries, 1)
+    t.assert_equals(stats.hits, 1)
+    t.assert_equals(stats.misses, 1)
+end
+
+g.test_ttl = function()
+    local cache = response_cache.new()
+    local e = endpoint({ ttl = 0.01 })
+    cache:put(e, 'k', '/abc', 200, {}, 'body')
+    require('fiber').sleep(0.02)
+    t.assert_equals(cache:get(e, 'k'), nil)
+    t.assert_equals(cache:stats().entries, 0)
+    t.assert_equals(cache:stats().bytes, 0)
+end
+
+g.test_budgets = function()
+    local body = string.rep('x', 100)
+    local cache = response_cache.new({ max_bytes = 2000 })
+    local small = endpoint({ ttl = 60, max_bytes = 800 })
+    local other = endpoint({ ttl = 60 })
+
+    for i = 1, 5 do
+        cache:put(small, 's' .. i, '/s', 200, {}, body)
+    end
+    -- The route budget fits only a couple of entries, the oldest ones
+    -- are evicted.
+    t.assert_le(cache:stats().bytes, 800)
+    t.assert_equals(cache:get(small, 's1'), nil)
+    t.assert_not_equals(cache:get(small, 's5'), nil)
+
+    for i = 1, 20 do
+        cache:put(other, 'o' .. i, '/o', 200, {}, body)
+    end
+    t.assert_le(cache:stats().bytes, 2000)
+    t.assert_gt(cache:stats().evictions, 0)
+    t.assert_not_equals(cache:get(other, 'o20'), nil)
+
+    -- An entry larger than the budget is never stored.
+    t.assert_not(cache:put(other, 'big', '/o', 200, {}, string.rep('x', 4096)))
+end
+
+g.test_add_vary = function()
+    local opts = response_cache.parse_route_options({ ttl = 1, vary = { 'Accept', 'Cookie' } })
+    t.assert_equals(response_cache.add_vary(opts, {}), { vary = 'accept, cookie' })
+    t.assert_equals(response_cache.add_vary(opts, { vary = 'Accept-Encoding, Accept' }),
+                    { vary = 'Accept-Encoding, Accept, cookie' })
+    opts = response_cache.parse_route_options({ ttl = 1 })
+    t.assert_equals(response_cache.add_vary(opts, {}), {})
+end
+
+g.test_set_max_bytes = function()
+    local cache = response_cache.new({ max_bytes = 4000 })
+    local e = endpoint({ ttl = 60 })
+    for i = 1, 10 do
+        cache:put(e, 'k' .. i, '/k', 200, {}, string.rep('x', 100))
+    end
+    local bytes = cache:stats().bytes
+    t.assert_gt(bytes, 1000)
+    cache:set_max_bytes(1000)
+    t.assert_le(cache:stats().bytes, 1000)
+    t.assert_equals(cache:stats().max_bytes, 1000)
+    -- The most recently used entries are kept.
+    t.assert_not_equals(cache:get(e, 'k10'), nil)
+    t.assert_equals(cache:get(e, 'k1'), nil)
+end
+
+g.test_invalidate = function()
+    local cache = response_cache.new()
+    local a = endpoint({ ttl = 60 })
+    local b = endpoint({ ttl = 60 })
+    cache:put(a, 'a1', '/a/1', 200, {}, 'a1')
+    cache:put(a, 'a2', '/a/2', 200, {}, 'a2')
+    cache:put(b, 'b1', '/b/1', 200, {}, 'b1')
+
+    t.assert_equals(cache:invalidate(nil, '/a/1'), 1)
+    t.assert_equals(cache:get(a, 'a1'), nil)
+    t.assert_equals(cache:invalidate(a), 1)
+    t.assert_not_equals(cache:get(b, 'b1'), nil)
+    t.assert_equals(cache:invalidate(), 1)
+    t.assert_equals(cache:stats().entries, 0)
+    t.assert_equals(cache:stats().bytes, 0)
+end
@@ -0,0 +1,120 @@
+local t = require('luatest')
+local fiber = require('fiber')
+local single_flight = require('http.single_flight')
+
+local g = t.group()
+
+local function share(ok, value)
+    return { ok = ok, value = value }
+end
+
+g.test_parse_route_options = function()
+    t.assert_equals(single_flight.parse_route_options(true), {
+        timeout = single_flight.DEFAULT_TIMEOUT,
+        vary = {},
+    })
+    t.assert_equals(single_flight.parse_route_options({ timeout = 1, vary = { 'Accept' } }), {
+        timeout = 1,
+        vary = { 'accept' },
+    })
+
+    t.assert_error_msg_contains("'single_flight' option should be a boolean or a table",
+        single_flight.parse_route_options, 1)
+    t.assert_error_msg_contains("Unknown single_flight option 'foo'",
+        single_flight.parse_route_options, { foo = 1 })
+    t.assert_error_msg_contains('single_flight.timeout must be a positive number',
+        single_flight.parse_route_options, { timeout = -1 })
+    t.assert_error_msg_contains('single_flight.vary[1] must be a string',
+        single_flight.parse_route_options, { vary = { true } })
+end
+
+g.test_is_shareable = function()
+    local opts = single_flight.parse_route_options(true)
+    t.assert(single_flight.is_shareable(opts, { accept = '*/*' }))
+    t.assert_not(single_flight.is_shareable(opts, { authorization = 'Bearer x' }))
+    t.assert_not(single_flight.is_shareable(opts, { cookie = 'a=1' }))
+    opts = single_flight.parse_route_options({ vary = { 'Cookie' } })
+    t.assert(single_flight.is_shareable(opts, { cookie = 'a=1' }))
+    t.assert_not(single_flight.is_shareable(opts, { cookie = 'a=1', authorization = 'x' }))
+end
+
+local function run_concurrently(n, fn)
+    local results = {}
+    local fibers = {}
+    for i = 1, n do
+        fibers[i] = fiber.new(function() results[i] = { fn() } end)
+        fibers[i]:set_joinable(true)
+    end
+    for i = 1, n do
+        fibers[i]:join()
+    end
+    return results
+end
+
+g.test_coalesced = function()
+    local group = single_flight.new()
+    local calls = 0
+    local results = run_concurrently(5, function()
+        return group:execute('key', 1, share, function()
+            calls = calls + 1
+            fiber.sleep(0.05)
+            return 'value'
+        end)
+    end)
+
+    t.assert_equals(calls, 1)
+    t.assert_equals(results[1], { true, true, 'value' })
+    for i = 2, 5 do
+        t.assert_equals(results[i], { false, { ok = true, value = 'value' } })
+    end
+    t.assert_equals(group:stats(), {
+        in_flight = 0,
+        executions = 1,
+        coalesced = 4,
+        timeouts = 0,
+    })
+
+    -- The next call runs the function again.
+    t.assert_equals({ group:execute('key', 1, share, function() return 'new' end) },
+                    { true, true, 'new' })
+end
+
+g.test_error_is_propagated = function()
+    local group = single_flight.new()
+    local results = run_concurrently(3, function()
+        return group:execute('key', 1, share, function()
+            fiber.sleep(0.05)
+            error('boom', 0)
+        end)
+    end)
+
+    t.assert_equals(results[1], { true, false, 'boom' })
+    t.assert_equals(results[2], { false, { ok = false, value = 'boom' } })
+    t.assert_equals(results[3], { false, { ok = false, value = 'boom' } })
+end
+
+g.test_timeout = function()
+    local group = single_flight.new()
+    local results = run_concurrently(2, function()
+        return group:execute('key', 0.01, share, function()
+            fiber.sleep(0.1)
+            return 'late'
+        end)
+    end)
+
+    t.assert_equals(results[1], { true, true, 'late' })
+    t.assert_equals(results[2], { false, nil, 'timeout' })
+    t.assert_equals(group:stats().timeouts, 1)
+end
+
+g.test_different_keys = function()
+    local group = single_flight.new()
+    local calls = 0
+    run_concurrently(3, function()
+        calls = calls + 1
+        local key = 'key' .. calls
+        return group:execute(key, 1, share, function() fiber.sleep(0.01) end)
+    end)
+    t.assert_equals(calls, 3)
+    t.assert_equals(group:stats().executions, 3)
+end
@@ -0,0 +1,80 @@
+local t = require('luatest')
+local sse = require('http.sse')
+
+local g = t.group()
+
+local function fake_request(proto)
+    local written = {}
+    return {
+        proto = proto or { 1, 1 },
+        headers = {},
+        s = {
+            write = function(_, data)
+                table.insert(written, data)
+                return #data
+            end,
+        },
+    }, written
+end
+
+g.test_encode_event = function()
+    t.assert_equals({ sse.encode_event('hello') },
+        { 'data: hello\n\n', 'd\r\ndata: hello\n\n\r\n' })
+    t.assert_equals(sse.encode_event('a\nb\r\nc\rd', { id = 7, event = 'price' }),
+        'id: 7\nevent: price\ndata: a\ndata: b\ndata: c\ndata: d\n\n')
+    t.assert_equals(sse.encode_event(''), 'data: \n\n')
+    t.assert_error_msg_contains('SSE event id must not contain line breaks',
+        sse.encode_event, 'x', { id = '1\n2' })
+end
+
+g.test_options = function()
+    t.assert_equals(sse.parse_options(nil), {
+        queue_size = sse.DEFAULT_OPTIONS.queue_size,
+        max_queued_bytes = sse.DEFAULT_OPTIONS.max_queued_bytes,
+        heartbeat = sse.DEFAULT_OPTIONS.heartbeat,
+        write_timeout = sse.DEFAULT_OPTIONS.write_timeout,
+        headers = {},
+    })
+    t.assert_error_msg_contains("Unknown sse option 'foo'", sse.parse_options, { foo = 1 })
+    t.assert_error_msg_contains('sse.queue_size must be a positive integer',
+        sse.parse_options, { queue_size = 0.5 })
+    t.assert_error_msg_contains('sse.heartbeat must be a positive number',
+        sse.parse_options, { heartbeat = 0 })
+end
+
+g.test_publish_shares_encoded_event = function()
+    local channel = sse.new_channel('prices')
+    local req1, written = fake_request()
+    local req2 = fake_request({ 1, 0 })
+    local s1 = sse.subscribe(req1, { channel })
+    local s2 = sse.subscribe(req2, { channel })
+    t.assert_str_contains(written[1], 'Transfer-Encoding: chunked\r\n')
+
+    t.assert_equals(channel:publish('42', { event = 'price' }), 2)
+    -- HTTP/1.1 subscribers get the event framed as a chunk.
+    t.assert_equals(s1.queue[1], '17\r\nevent: price\ndata: 42\n\n\r\n')
+    t.assert_equals(s2.queue[1], 'event: price\ndata: 42\n\n')
+    t.assert_equals(channel:stats(), { subscribers = 2, published = 1, evicted = 0 })
+
+    s2:close()
+    t.assert_equals(channel:publish('43'), 1)
+    t.assert_equals(channel:stats().subscribers, 1)
+end
+
+g.test_slow_consumer_eviction = function()
+    local channel = sse.new_channel('prices')
+    local fast = sse.subscribe(fake_request(), { channel })
+    local slow = sse.subscribe(fake_request(), { channel }, { queue_size = 2 })
+    t.assert_equals(channel:publish('1'), 2)
+    t.assert_equals(channel:publish('2'), 2)
+    t.assert_equals(channel:publish('3'), 1)
+    t.assert(slow.evicted)
+    t.assert_equals(slow.last - slow.first + 1, 0)
+    t.assert_not(fast.evicted)
+    t.assert_equals(channel:stats(), { subscribers = 1, published = 3, evicted = 1 })
+    t.assert_not(slow:send('x'))
+
+    local bytes = sse.subscribe(fake_request(), { channel }, { max_queued_bytes = 30 })
+    channel:publish(string.rep('x', 20))
+    t.assert(bytes.evicted)
+end
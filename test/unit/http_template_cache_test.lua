@@ -0,0 +1,84 @@
+local t = require('luatest')
+local fio = require('fio')
+local http_lib = require('http.lib')
+local template = require('http.template')
+
+local g = t.group()
+
+g.before_each(function()
+    g.dir = fio.tempdir()
+    fio.mkdir(fio.pathjoin(g.dir, 'user'))
+end)
+
+g.after_each(function()
+    fio.rmtree(g.dir)
+end)
+
+local function write(file, data)
+    local fh = fio.open(fio.pathjoin(g.dir, file),
+        { 'O_WRONLY', 'O_CREAT', 'O_TRUNC' }, tonumber('644', 8))
+    fh:write(data)
+    fh:close()
+end
+
+local function render(cache, file, vars)
+    local chunk = cache:get(file)
+    return http_lib.template(chunk, vars or {})
+end
+
+g.test_reload = function()
+    write('index.html.el', 'v1 <%= name %>')
+    local cache = template.new(g.dir)
+    t.assert_equals(render(cache, 'index.html.el', { name = 'a' }), 'v1 a')
+
+    write('index.html.el', 'v22 <%= name %>')
+    t.assert_equals(render(cache, 'index.html.el', { name = 'b' }), 'v22 b')
+
+    -- The file is not checked again within the interval.
+    cache.check_interval = 3600
+    write('index.html.el', 'v333 <%= name %>')
+    t.assert_equals(render(cache, 'index.html.el', { name = 'c' }), 'v22 c')
+
+    local chunk, err = cache:get('absent.html.el')
+    t.assert_equals(chunk, nil)
+    t.assert_not_equals(err, nil)
+end
+
+g.test_bundle = function()
+    write('index.html.el', 'index <%= name %>')
+    write('user/show.html.el', 'user <%= name %>')
+    write('README.md', 'not a template')
+    local bundle = fio.pathjoin(g.dir, 'templates.bundle')
+    t.assert_equals(template.build(g.dir, bundle), 2)
+
+    -- A template with the same size and mtime is taken from the bundle,
+    -- its source is not compiled.
+    local path = fio.pathjoin(g.dir, 'index.html.el')
+    local mtime = fio.stat(path).mtime
+    write('index.html.el', 'INDEX <%= name %>')
+    fio.utime(path, mtime, mtime)
+    -- A changed one is compiled from the source.
+    write('user/show.html.el', 'user: <%= name %>')
+
+    local cache = template.new(g.dir, { check_interval = 3600 })
+    cache:preload(bundle)
+    t.assert_equals(render(cache, 'index.html.el', { name = 'a' }), 'index a')
+    t.assert_equals(render(cache, 'user/show.html.el', { name = 'b' }), 'user: b')
+end
+
+g.test_preload_broken = function()
+    write('broken.html.el', '<% if %>')
+    write('index.html.el', 'index')
+    local cache = template.new(g.dir)
+    cache:preload()
+    t.assert_equals(cache.entries['broken.html.el'], nil)
+    t.assert_equals(render(cache, 'index.html.el'), 'index')
+    t.assert_error_msg_contains("unexpected symbol", cache.get, cache, 'broken.html.el')
+end
+
+g.test_compile_cached = function()
+    local source = 'inline <%= name %>'
+    t.assert_is(template.compile_cached(source), template.compile_cached(source))
+    t.assert_equals(http_lib.template(template.compile_cached(source), { name = 'a' }),
+        'inline a')
+end
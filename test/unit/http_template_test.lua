@@ -55,3 +55,40 @@ g.test_incorrect_arguments_escaping_leads_to_segfault_gh_51 = function()
     local result = http_lib.template(template, {continue = '/'})
     t.assert(result:find('\"') ~= nil)
 end
+
+g.test_compiled_template = function()
+    local chunk = http_lib.template_compile('<%= a %> <%== b %> <% c = 1 %><%= string.upper(d) %>')
+    t.assert_equals(http_lib.template(chunk, { a = '<a>', b = '<b>', d = 'x' }),
+        '&lt;a&gt; <b> X')
+    -- An assignment does not leak to the globals.
+    t.assert_equals(rawget(_G, 'c'), nil)
+    -- The chunk can be dumped and rendered with other variables.
+    chunk = loadstring(string.dump(chunk))
+    t.assert_equals(http_lib.template(chunk, { a = 1, b = 2, d = 'y' }), '1 2 Y')
+
+    chunk = http_lib.template_compile('\n<% ab() %>', 'test.html.el')
+    t.assert_error_msg_contains('users template:2:', http_lib.template, chunk, {})
+    t.assert_error_msg_contains("'=' expected", http_lib.template_compile, '<% a b %>')
+end
+
+g.test_text_runs = function()
+    local template = 'a\n"b"\r\n\n% x = 1\nc <%= "<" %> d\ne\n'
+    local rendered, code = http_lib.template(template, {})
+    t.assert_equals(rendered, 'a\n"b"\r\n\n\nc &lt; d\ne\n', 'rendered')
+    -- Adjacent lines of text are one constant.
+    local _, calls = string.gsub(code, '_i%(', '')
+    t.assert_equals(calls, 3, 'text constants')
+    -- The lines of the code match the lines of the template.
+    local chunk = http_lib.template_compile(template .. '<% error("boom") %>')
+    t.assert_error_msg_contains('users template:7:', http_lib.template, chunk, {})
+end
+
+g.test_large_output = function()
+    local chunk = http_lib.template_compile(
+        '% for i = 1, n do\n<li><%= i %> <%== s %></li>\n% end\n')
+    local rendered = http_lib.template(chunk, { n = 20000, s = string.rep('x', 100) })
+    local _, items = string.gsub(rendered, '<li>%d+ x+</li>\n', '')
+    t.assert_equals(items, 20000)
+    t.assert_error_msg_contains('attempt to concatenate a table value',
+        http_lib.template, http_lib.template_compile('<%== t %>'), { t = {} })
+end
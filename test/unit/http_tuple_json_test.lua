@@ -0,0 +1,118 @@
+local t = require('luatest')
+local http_lib = require('http.lib')
+local tuple_json = require('http.tuple_json')
+
+local g = t.group()
+
+local function mp_to_json(data, ...)
+    return http_lib.msgpack_to_json(data, ...)
+end
+
+g.test_scalars = function()
+    t.assert_equals(mp_to_json('\xc0'), 'null')
+    t.assert_equals(mp_to_json('\xc2'), 'false')
+    t.assert_equals(mp_to_json('\xc3'), 'true')
+    t.assert_equals(mp_to_json('\x7f'), '127')
+    t.assert_equals(mp_to_json('\xff'), '-1')
+    t.assert_equals(mp_to_json('\xcd\x01\x00'), '256')
+    t.assert_equals(mp_to_json('\xcf\xff\xff\xff\xff\xff\xff\xff\xff'), '18446744073709551615')
+    t.assert_equals(mp_to_json('\xd1\xff\x00'), '-256')
+    t.assert_equals(mp_to_json('\xd3\x80\x00\x00\x00\x00\x00\x00\x00'), '-9223372036854775808')
+    t.assert_equals(mp_to_json('\xcb\x3f\xf8\x00\x00\x00\x00\x00\x00'), '1.5')
+    t.assert_equals(mp_to_json('\xca\x3f\xc0\x00\x00'), '1.5')
+    -- NaN is not valid JSON.
+    t.assert_equals(mp_to_json('\xcb\x7f\xf8\x00\x00\x00\x00\x00\x00'), 'null')
+end
+
+g.test_strings = function()
+    t.assert_equals(mp_to_json('\xa5hello'), '"hello"')
+    t.assert_equals(mp_to_json('\xa0'), '""')
+    t.assert_equals(mp_to_json('\xa8a"b\\c\n\x01/'), '"a\\"b\\\\c\\n\\u0001/"')
+    t.assert_equals(mp_to_json('\xa6κόσ'), '"κόσ"')
+    local long = string.rep('x', 300)
+    t.assert_equals(mp_to_json('\xda\x01\x2c' .. long), '"' .. long .. '"')
+    t.assert_equals(mp_to_json('\xc4\x03abc'), '"abc"')
+end
+
+g.test_containers = function()
+    t.assert_equals(mp_to_json('\x93\x01\xa1a\x90'), '[1,"a",[]]')
+    t.assert_equals(mp_to_json('\x82\xa1a\x01\x02\xc3'), '{"a":1,"2":true}')
+    t.assert_equals(mp_to_json('\xdc\x00\x02\xc0\x80'), '[null,{}]')
+    t.assert_equals(mp_to_json('\x92\x01\x02', nil, true), '1,2')
+end
+
+g.test_names = function()
+    -- Two tuples, the second one has more fields than names.
+    local data = '\x92\x92\x01\xa3Ann\x93\x02\xa3Bob\xc3'
+    t.assert_equals(mp_to_json(data, { 'id', 'name' }),
+        '[{"id":1,"name":"Ann"},{"id":2,"name":"Bob","3":true}]')
+    t.assert_equals(mp_to_json(data, { 'id', 'name' }, true),
+        '{"id":1,"name":"Ann"},{"id":2,"name":"Bob","3":true}')
+end
+
+g.test_extensions = function()
+    -- Decimals.
+    t.assert_equals(mp_to_json('\xd6\x01\x02\x01\x23\x4c'), '"12.34"')
+    t.assert_equals(mp_to_json('\xd5\x01\x03\x5d'), '"-0.005"')
+    t.assert_equals(mp_to_json('\xd5\x01\xfe\x1c'), '"100"')
+    -- UUID.
+    t.assert_equals(mp_to_json('\xd8\x02' ..
+        '\x12\x3e\x45\x67\xe8\x9b\x12\xd3\xa4\x56\x42\x66\x14\x17\x40\x00'),
+        '"123e4567-e89b-12d3-a456-426614174000"')
+    -- Datetime without and with nanoseconds and a timezone offset.
+    t.assert_equals(mp_to_json('\xd7\x04\x00\x53\x0d\x63\x00\x00\x00\x00'),
+        '"2022-08-30T00:00:00Z"')
+    t.assert_equals(mp_to_json('\xd8\x04\x00\x53\x0d\x63\x00\x00\x00\x00' ..
+                               '\x40\x42\x0f\x00\xb4\x00\x00\x00'),
+        '"2022-08-30T03:00:00.001+0300"')
+    t.assert_error_msg_contains('unsupported MessagePack extension type 3',
+        mp_to_json, '\xd4\x03\x00')
+end
+
+g.test_errors = function()
+    t.assert_error_msg_contains('truncated MessagePack data', mp_to_json, '\x92\x01')
+    t.assert_error_msg_contains('truncated MessagePack data', mp_to_json, '\xa5abc')
+    t.assert_error_msg_contains('trailing data', mp_to_json, '\x01\x02')
+    t.assert_error_msg_contains('invalid MessagePack data', mp_to_json, '\xc1')
+    t.assert_error_msg_contains('an array is expected', mp_to_json, '\x01', nil, true)
+    t.assert_error_msg_contains('map key must be a string or a number',
+        mp_to_json, '\x81\x90\x01')
+    t.assert_error_msg_contains('too deep nesting', mp_to_json, string.rep('\x91', 200) .. '\x01')
+end
+
+g.test_render = function()
+    local rows = {
+        box.tuple.new({ 1, 'Ann', { tags = { 'a' } } }),
+        box.tuple.new({ 2, 'Bob', box.NULL }),
+    }
+    t.assert_equals(tuple_json.render({ tuples = rows }),
+        '[[1,"Ann",{"tags":["a"]}],[2,"Bob",null]]')
+    t.assert_equals(tuple_json.render({ tuples = {} }), '[]')
+    t.assert_equals(tuple_json.render({ tuple = rows[1], names = { 'id', 'name' } }),
+        '{"id":1,"name":"Ann","3":{"tags":["a"]}}')
+    -- A space is accepted in place of the names.
+    local space = { format = function() return { { name = 'id' }, { name = 'name' } } end }
+    t.assert_equals(tuple_json.render({ tuple = rows[2], names = space }),
+        '{"id":2,"name":"Bob","3":null}')
+    t.assert_error_msg_contains("'tuples' option should be an array of tuples or an iterator",
+        tuple_json.render, { tuples = 1 })
+end
+
+g.test_render_iterator = function()
+    local rows = {}
+    for i = 1, 5 do
+        rows[i] = box.tuple.new({ i })
+    end
+    local function body(tuples, batch_size)
+        local iter = tuple_json.render({ tuples = { gen = ipairs(tuples), param = tuples, state = 0 },
+                                         batch_size = batch_size })
+        local chunks = {}
+        for _, chunk in iter.gen do
+            table.insert(chunks, chunk)
+        end
+        return chunks
+    end
+    t.assert_equals(body(rows, 2), { '[[1],[2]', ',[3],[4]', ',[5]]' })
+    t.assert_equals(body(rows, 5), { '[[1],[2],[3],[4],[5]', ']' })
+    t.assert_equals(body({}, 2), { '[]' })
+end
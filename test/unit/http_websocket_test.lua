@@ -0,0 +1,116 @@
+local t = require('luatest')
+local http_lib = require('http.lib')
+local websocket = require('http.websocket')
+
+local g = t.group()
+
+local MASK = 0x37fa213d
+
+-- Reference implementation of RFC 6455 5.3.
+local function xor_mask(data, mask, offset)
+    local key = {
+        math.floor(mask / 0x1000000) % 256, math.floor(mask / 0x10000) % 256,
+        math.floor(mask / 0x100) % 256, mask % 256,
+    }
+    local res = {}
+    for i = 1, #data do
+        res[i] = string.char(bit.bxor(string.byte(data, i), key[(i - 1 + offset) % 4 + 1]))
+    end
+    return table.concat(res)
+end
+
+g.test_parse_header = function()
+    -- RFC 6455 5.7: a single-frame masked text message "Hello".
+    local frame = '\x81\x85\x37\xfa\x21\x3d\x7f\x9f\x4d\x51\x58'
+    t.assert_equals({ http_lib.ws_parse_header(frame) }, { 6, true, 0x1, 5, MASK })
+    t.assert_equals(http_lib.ws_unmask(string.sub(frame, 7), MASK), 'Hello')
+
+    -- A fragmented unmasked message.
+    t.assert_equals({ http_lib.ws_parse_header('\x01\x03Hel') }, { 2, false, 0x1, 3, nil })
+    t.assert_equals({ http_lib.ws_parse_header('\x80\x02lo') }, { 2, true, 0x0, 2, nil })
+
+    -- 16-bit and 64-bit payload lengths.
+    t.assert_equals({ http_lib.ws_parse_header('\x82\x7e\x01\x00') },
+        { 4, true, 0x2, 256, nil })
+    t.assert_equals({ http_lib.ws_parse_header('\x82\xff\0\0\0\0\0\1\0\0\1\2\3\4') },
+        { 14, true, 0x2, 65536, 0x01020304 })
+end
+
+g.test_parse_incomplete_header = function()
+    t.assert_equals({ http_lib.ws_parse_header('\x81') }, { 0, 2 })
+    t.assert_equals({ http_lib.ws_parse_header('\x81\x85') }, { 0, 6 })
+    t.assert_equals({ http_lib.ws_parse_header('\x82\x7e\x01') }, { 0, 4 })
+    t.assert_equals({ http_lib.ws_parse_header('\x82\xff\0\0') }, { 0, 14 })
+end
+
+g.test_parse_errors = function()
+    t.assert_equals({ http_lib.ws_parse_header('\xc1\x00') }, { nil, 'reserved bits are set' })
+    t.assert_equals({ http_lib.ws_parse_header('\x83\x00') }, { nil, 'unknown opcode' })
+    t.assert_equals({ http_lib.ws_parse_header('\x09\x00') }, { nil, 'fragmented control frame' })
+    t.assert_equals({ http_lib.ws_parse_header('\x89\x7e\x00\x7e') },
+        { nil, 'control frame is too long' })
+    t.assert_equals({ http_lib.ws_parse_header('\x82\x7f\x80\0\0\0\0\0\0\0') },
+        { nil, 'invalid payload length' })
+end
+
+g.test_unmask = function()
+    local data = {}
+    for i = 1, 1000 do
+        data[i] = string.char(i % 256)
+    end
+    data = table.concat(data)
+    -- Lengths around the vector widths and offsets into the key.
+    for _, len in ipairs({ 0, 1, 3, 7, 8, 15, 16, 17, 31, 33, 100, 1000 }) do
+        for offset = 0, 3 do
+            local chunk = string.sub(data, 1, len)
+            t.assert_equals(http_lib.ws_unmask(chunk, MASK, offset),
+                            xor_mask(chunk, MASK, offset), ('len %d'):format(len))
+        end
+    end
+    -- Larger than the stack buffer.
+    local large = string.rep(data, 10)
+    t.assert_equals(http_lib.ws_unmask(http_lib.ws_unmask(large, MASK), MASK), large)
+end
+
+g.test_encode_frame = function()
+    t.assert_equals(http_lib.ws_encode_frame(0x1, 'Hello'), '\x81\x05Hello')
+    t.assert_equals(http_lib.ws_encode_frame(0x1, 'Hel', false), '\x01\x03Hel')
+    t.assert_equals(http_lib.ws_encode_frame(0x1, 'Hello', true, MASK),
+                    '\x81\x85\x37\xfa\x21\x3d\x7f\x9f\x4d\x51\x58')
+    t.assert_equals(http_lib.ws_encode_frame(0x9), '\x89\x00')
+
+    local payload = string.rep('x', 256)
+    t.assert_equals(http_lib.ws_encode_frame(0x2, payload), '\x82\x7e\x01\x00' .. payload)
+    payload = string.rep('x', 65536)
+    t.assert_equals(http_lib.ws_encode_frame(0x2, payload),
+                    '\x82\x7f\0\0\0\0\0\1\0\0' .. payload)
+end
+
+g.test_utf8_valid = function()
+    t.assert(http_lib.ws_utf8_valid(''))
+    t.assert(http_lib.ws_utf8_valid('plain ascii text longer than eight bytes'))
+    t.assert(http_lib.ws_utf8_valid('κόσμε'))
+    t.assert(http_lib.ws_utf8_valid('\xf4\x8f\xbf\xbf'))
+    -- Overlong forms, surrogates, code points above U+10FFFF and truncated
+    -- sequences.
+    t.assert_not(http_lib.ws_utf8_valid('\xc0\xaf'))
+    t.assert_not(http_lib.ws_utf8_valid('\xe0\x80\xaf'))
+    t.assert_not(http_lib.ws_utf8_valid('\xed\xa0\x80'))
+    t.assert_not(http_lib.ws_utf8_valid('\xf4\x90\x80\x80'))
+    t.assert_not(http_lib.ws_utf8_valid('abcdefgh\xce'))
+    t.assert_not(http_lib.ws_utf8_valid('\xce\xba\xe1\xbd'))
+end
+
+g.test_options = function()
+    t.assert_equals(websocket.parse_options(nil), {
+        protocols = {},
+        max_message_size = websocket.DEFAULT_OPTIONS.max_message_size,
+        close_timeout = websocket.DEFAULT_OPTIONS.close_timeout,
+    })
+    t.assert_error_msg_contains("Unknown websocket option 'foo'",
+        websocket.parse_options, { foo = 1 })
+    t.assert_error_msg_contains('websocket.fragment_size must be a positive integer',
+        websocket.parse_options, { fragment_size = 0 })
+    t.assert_error_msg_contains('websocket.protocols[1] must be a string',
+        websocket.parse_options, { protocols = { 1 } })
+end
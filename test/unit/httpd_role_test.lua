@@ -244,7 +244,52 @@ local validation_cases = {
             }
         },
         err = '"unknown" option not exists. Available options: "on", "off", "optional"',
-    }
+    },
+    ["slow_request_threshold_invalid_type"] = {
+        cfg = {
+            server = {
+                listen = "localhost:123",
+                slow_request_threshold = "1s",
+            }
+        },
+        err = "Option slow_request_threshold must be a non-negative number.",
+    },
+    ["server_timing_invalid_type"] = {
+        cfg = {
+            server = {
+                listen = "localhost:123",
+                server_timing = "yes",
+            }
+        },
+        err = "Option server_timing must be a boolean.",
+    },
+    ["response_cache_max_bytes_invalid_value"] = {
+        cfg = {
+            server = {
+                listen = "localhost:123",
+                response_cache_max_bytes = 0,
+            }
+        },
+        err = "Option response_cache_max_bytes must be a positive number.",
+    },
+    ["http2_invalid_type"] = {
+        cfg = {
+            server = {
+                listen = "localhost:123",
+                http2 = "yes",
+            }
+        },
+        err = "Option http2 must be a boolean or a table.",
+    },
+    ["slow_request_threshold"] = {
+        cfg = {
+            server = {
+                listen = "localhost:123",
+                slow_request_threshold = 0.5,
+                server_timing = true,
+            }
+        },
+    },
 }
 
 for name, case in pairs(validation_cases) do
@@ -351,6 +396,30 @@ g.test_edit_server_address = function()
     t.assert_equals(result.port, cfg[httpd_role.DEFAULT_SERVER_NAME].listen)
 end
 
+g.test_reconfigure_in_place = function()
+    local cfg = {
+        [httpd_role.DEFAULT_SERVER_NAME] = {
+            listen = 13001,
+        },
+    }
+
+    httpd_role.apply(cfg)
+    local httpd = httpd_role.get_server()
+    httpd:route({ path = '/ping', name = 'ping' }, function() end)
+
+    cfg[httpd_role.DEFAULT_SERVER_NAME].log_requests = 'verbose'
+    httpd_role.apply(cfg)
+    t.assert_is(httpd_role.get_server(), httpd)
+    t.assert_type(httpd.options.log_requests, 'function')
+    t.assert(httpd.is_run)
+
+    cfg[httpd_role.DEFAULT_SERVER_NAME].listen = 13002
+    httpd_role.apply(cfg)
+    t.assert_is(httpd_role.get_server(), httpd)
+    t.assert_equals(httpd.port, 13002)
+    t.assert_not_equals(httpd.iroutes.ping, nil)
+end
+
 g.test_log_requests = function()
     local cfg = {
         server1 = {